@@ -0,0 +1,90 @@
+#include "RunCommon.h"
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+namespace {
+
+bool parseButton(const std::string &name, Joypad::Button &button) {
+  static const char *names[] = {"right", "left", "up",     "down",
+                                "a",     "b",    "select", "start"};
+  for (int i = 0; i < 8; i++) {
+    if (name == names[i]) {
+      button = static_cast<Joypad::Button>(i);
+      return true;
+    }
+  }
+  return false;
+}
+
+} // namespace
+
+bool loadInputScript(const std::string &path, std::vector<InputEvent> &events) {
+  std::ifstream file(path);
+  if (!file.is_open())
+    return false;
+
+  std::string line;
+  int number = 0;
+  while (std::getline(file, line)) {
+    number++;
+    line = line.substr(0, line.find('#'));
+    std::istringstream fields(line);
+    uint64_t frame;
+    std::string action;
+    if (!(fields >> frame))
+      continue; // Blank or comment
+    InputEvent event{frame, Joypad::A, true};
+    if (!(fields >> action) || action.size() < 2 ||
+        (action[0] != '+' && action[0] != '-') ||
+        !parseButton(action.substr(1), event.button)) {
+      std::cerr << path << ":" << number << ": bad input event" << std::endl;
+      return false;
+    }
+    event.press = action[0] == '+';
+    events.push_back(event);
+  }
+  std::stable_sort(events.begin(), events.end(),
+                   [](const InputEvent &a, const InputEvent &b) {
+                     return a.frame < b.frame;
+                   });
+  return true;
+}
+
+void applyInput(const std::vector<InputEvent> &events, size_t &next,
+                uint64_t frame, Joypad &joypad) {
+  for (; next < events.size() && events[next].frame <= frame; next++) {
+    if (events[next].press)
+      joypad.pressButton(events[next].button);
+    else
+      joypad.releaseButton(events[next].button);
+  }
+}
+
+uint64_t hashFrame(const std::array<uint8_t, 160 * 144> &frame) {
+  uint64_t hash = 0xCBF29CE484222325ull;
+  for (uint8_t pixel : frame) {
+    hash ^= pixel;
+    hash *= 0x100000001B3ull;
+  }
+  return hash;
+}
+
+std::string jsonString(const std::string &value) {
+  std::string out = "\"";
+  for (char c : value) {
+    if (c == '"' || c == '\\') {
+      out += '\\';
+      out += c;
+    } else if (static_cast<unsigned char>(c) < 0x20) {
+      char escaped[8];
+      std::snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+      out += escaped;
+    } else {
+      out += c;
+    }
+  }
+  return out + "\"";
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include "core/Joypad.h"
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Pieces shared by the headless runners (ShellBoyBench, ShellBoyBatch).
+//
+// Input scripts hold one "FRAME +BUTTON" / "FRAME -BUTTON" per line
+// (press/release before that frame runs), '#' starts a comment. Buttons:
+// up down left right a b select start.
+
+struct InputEvent {
+  uint64_t frame;
+  Joypad::Button button;
+  bool press;
+};
+
+// Sorted by frame. Prints the offending line and returns false on a bad one.
+bool loadInputScript(const std::string &path, std::vector<InputEvent> &events);
+
+// Apply every event due before `frame` runs, starting at `next`.
+void applyInput(const std::vector<InputEvent> &events, size_t &next,
+                uint64_t frame, Joypad &joypad);
+
+// FNV-1a
+uint64_t hashFrame(const std::array<uint8_t, 160 * 144> &frame);
+
+std::string jsonString(const std::string &value);
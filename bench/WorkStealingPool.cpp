@@ -0,0 +1,144 @@
+#include "WorkStealingPool.h"
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace {
+
+// A mutex per queue is plenty: a quantum is a whole emulated frame, so
+// queues are touched a few thousand times a second per worker.
+struct Queue {
+  std::mutex lock;
+  std::deque<size_t> jobs;
+
+  // The owner goes round its jobs oldest first...
+  bool popOldest(size_t &job) {
+    std::lock_guard<std::mutex> guard(lock);
+    if (jobs.empty())
+      return false;
+    job = jobs.front();
+    jobs.pop_front();
+    return true;
+  }
+  // ...and thieves take the one it would get back to last
+  bool stealNewest(size_t &job) {
+    std::lock_guard<std::mutex> guard(lock);
+    if (jobs.empty())
+      return false;
+    job = jobs.back();
+    jobs.pop_back();
+    return true;
+  }
+  // Returns the number of jobs queued, this one included
+  size_t push(size_t job) {
+    std::lock_guard<std::mutex> guard(lock);
+    jobs.push_back(job);
+    return jobs.size();
+  }
+};
+
+// Pins the calling thread
+bool pinToCpu(int index) {
+#ifdef __linux__
+  cpu_set_t available;
+  if (sched_getaffinity(0, sizeof(available), &available) != 0)
+    return false;
+  int count = CPU_COUNT(&available);
+  if (count == 0)
+    return false;
+  // The index-th CPU this process may run on
+  int wanted = index % count;
+  for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+    if (!CPU_ISSET(cpu, &available) || wanted--)
+      continue;
+    cpu_set_t one;
+    CPU_ZERO(&one);
+    CPU_SET(cpu, &one);
+    return pthread_setaffinity_np(pthread_self(), sizeof(one), &one) == 0;
+  }
+  return false;
+#else
+  (void)index;
+  return false;
+#endif
+}
+
+} // namespace
+
+WorkStealingPool::WorkStealingPool(int threads, bool pin) : pin(pin) {
+  if (threads <= 0)
+    threads = static_cast<int>(std::thread::hardware_concurrency());
+  threadCount = threads > 0 ? threads : 1;
+}
+
+void WorkStealingPool::run(std::vector<Job> &jobs) {
+  std::vector<Queue> queues(threadCount);
+  for (size_t i = 0; i < jobs.size(); i++)
+    queues[i % threadCount].jobs.push_back(i);
+  workerStats.assign(threadCount, {});
+  std::atomic<size_t> remaining{jobs.size()};
+  std::atomic<size_t> queued{jobs.size()}; // Waiting in a queue, not running
+  std::atomic<bool> pinFailed{false};
+
+  // Workers with nothing to run or steal sleep here
+  std::mutex idleLock;
+  std::condition_variable wake;
+  std::atomic<int> sleeping{0};
+  auto notify = [&](bool all) {
+    std::lock_guard<std::mutex> guard(idleLock);
+    if (all)
+      wake.notify_all();
+    else
+      wake.notify_one();
+  };
+
+  auto work = [&](int self) {
+    if (pin && !pinToCpu(self))
+      pinFailed = true;
+    WorkerStats &stats = workerStats[self];
+    while (remaining) {
+      size_t job;
+      bool found = queues[self].popOldest(job);
+      for (int i = 1; !found && i < threadCount; i++) {
+        found = queues[(self + i) % threadCount].stealNewest(job);
+        stats.steals += found;
+      }
+      if (!found) {
+        // Everything left is running on other workers: wait for one of them
+        // to have a job to spare, or for the last job to finish
+        std::unique_lock<std::mutex> guard(idleLock);
+        sleeping++;
+        wake.wait(guard, [&] { return queued || !remaining; });
+        sleeping--;
+        continue;
+      }
+      queued--;
+      stats.quanta++;
+      if (jobs[job]()) {
+        // A job on its own is this worker's next, not one to spare
+        size_t waiting = queues[self].push(job);
+        queued++;
+        if (waiting > 1 && sleeping)
+          notify(false);
+      } else if (--remaining == 0) {
+        notify(true);
+      }
+    }
+  };
+
+  std::vector<std::thread> workers;
+  workers.reserve(threadCount);
+  for (int i = 0; i < threadCount; i++)
+    workers.emplace_back(work, i);
+  for (std::thread &worker : workers)
+    worker.join();
+  if (pinFailed)
+    std::cerr << "Could not pin every worker to a CPU" << std::endl;
+}
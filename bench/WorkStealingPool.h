@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+// Runs a set of resumable jobs across worker threads. A job does one
+// quantum of work per call and returns true while it has more. Jobs start
+// spread round-robin over the workers; a worker goes round its own queue a
+// quantum at a time, putting unfinished jobs back at the end, so they tend
+// to stay on one core. Only once its own queue is empty does it take the
+// newest job of another worker, and with nothing to take it sleeps until
+// there is.
+class WorkStealingPool {
+public:
+  using Job = std::function<bool()>;
+
+  // A cache line each: every worker updates its own as it goes
+  struct alignas(64) WorkerStats {
+    uint64_t quanta = 0;
+    uint64_t steals = 0;
+  };
+
+  // threads <= 0: one per hardware thread. With pin, worker i is bound to
+  // CPU i modulo the CPUs available (Linux only; elsewhere ignored).
+  WorkStealingPool(int threads, bool pin);
+
+  // Blocks until every job has returned false.
+  void run(std::vector<Job> &jobs);
+
+  int threads() const { return threadCount; }
+  bool pinned() const { return pin; }
+  // Of the last run()
+  const std::vector<WorkerStats> &stats() const { return workerStats; }
+
+private:
+  int threadCount;
+  bool pin;
+  std::vector<WorkerStats> workerStats;
+};
@@ -0,0 +1,231 @@
+#include "bench/RunCommon.h"
+#include "bench/WorkStealingPool.h"
+#include "core/GameBoy.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Plays many ROM/input pairs in one process, each on its own emulator
+// instance, spread over a work-stealing thread pool a few frames at a time.
+// Prints per-instance results and the aggregate speed as JSON.
+//
+// The manifest has one job per line: a ROM path, optionally followed by an
+// input script (see RunCommon.h); '#' starts a comment. Paths are relative
+// to the manifest. --copies N runs every job N times, e.g. to measure
+// throughput with a short manifest.
+
+namespace {
+
+struct Job {
+  std::string rom;
+  std::string input;
+};
+
+bool loadManifest(const std::string &path, std::vector<Job> &jobs) {
+  std::ifstream file(path);
+  if (!file.is_open())
+    return false;
+  std::string base = path.substr(0, path.find_last_of('/') + 1);
+  auto resolve = [&](const std::string &name) {
+    return name.empty() || name[0] == '/' ? name : base + name;
+  };
+
+  std::string line;
+  while (std::getline(file, line)) {
+    line = line.substr(0, line.find('#'));
+    std::istringstream fields(line);
+    Job job;
+    if (!(fields >> job.rom))
+      continue; // Blank or comment
+    fields >> job.input;
+    jobs.push_back({resolve(job.rom), resolve(job.input)});
+  }
+  return true;
+}
+
+// One emulator, and its progress through its job
+struct Instance {
+  GameBoy gameBoy;
+  const Job &job;
+  std::vector<InputEvent> input;
+  size_t nextInput = 0;
+  uint64_t frames = 0;
+  uint64_t frameLimit;
+  double seconds = 0; // Wall time spent running this instance
+
+  Instance(const Job &job, uint64_t frameLimit)
+      : job(job), frameLimit(frameLimit) {}
+
+  bool load(bool idleSkip, bool jit) {
+    if (!gameBoy.loadRom(job.rom)) {
+      std::cerr << "Failed to load ROM: " << job.rom << ": "
+                << gameBoy.loadError() << std::endl;
+      return false;
+    }
+    if (!job.input.empty() && !loadInputScript(job.input, input)) {
+      std::cerr << "Failed to load input script: " << job.input << std::endl;
+      return false;
+    }
+    gameBoy.scheduler.setIdleLoopSkipping(idleSkip);
+    gameBoy.cpu.setJitEnabled(jit);
+    return true;
+  }
+
+  // Returns true while frames remain
+  bool runQuantum(uint64_t quantum) {
+    auto start = std::chrono::steady_clock::now();
+    for (uint64_t i = 0; i < quantum && frames < frameLimit; i++) {
+      applyInput(input, nextInput, frames, gameBoy.joypad);
+      gameBoy.runFrame();
+      gameBoy.ppu.frameReady = false;
+      frames++;
+    }
+    seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                             start)
+                   .count();
+    return frames < frameLimit;
+  }
+};
+
+void usage() {
+  std::cerr << "Usage: ShellBoyBatch <manifest> [--frames N] [--copies N]\n"
+               "       [--threads N] [--pin] [--quantum frames]\n"
+               "       [--jit] [--no-idle-skip]"
+            << std::endl;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    usage();
+    return 1;
+  }
+  const char *manifestPath = argv[1];
+  uint64_t frameLimit = 3600; // One emulated minute
+  int copies = 1;
+  int threads = 0;
+  bool pin = false;
+  uint64_t quantum = 1;
+  bool jit = false;
+  bool idleSkip = true;
+  for (int i = 2; i < argc; i++) {
+    bool hasValue = i + 1 < argc;
+    if (!std::strcmp(argv[i], "--frames") && hasValue) {
+      frameLimit = std::strtoull(argv[++i], nullptr, 10);
+    } else if (!std::strcmp(argv[i], "--copies") && hasValue) {
+      copies = std::atoi(argv[++i]);
+    } else if (!std::strcmp(argv[i], "--threads") && hasValue) {
+      threads = std::atoi(argv[++i]);
+    } else if (!std::strcmp(argv[i], "--pin")) {
+      pin = true;
+    } else if (!std::strcmp(argv[i], "--quantum") && hasValue) {
+      quantum = std::strtoull(argv[++i], nullptr, 10);
+    } else if (!std::strcmp(argv[i], "--jit")) {
+      jit = true;
+    } else if (!std::strcmp(argv[i], "--no-idle-skip")) {
+      idleSkip = false;
+    } else {
+      usage();
+      return 1;
+    }
+  }
+  if (quantum == 0)
+    quantum = 1;
+
+  std::vector<Job> manifest;
+  if (!loadManifest(manifestPath, manifest)) {
+    std::cerr << "Failed to read manifest: " << manifestPath << std::endl;
+    return 1;
+  }
+  if (manifest.empty() || copies < 1) {
+    std::cerr << "Nothing to run in " << manifestPath << std::endl;
+    return 1;
+  }
+
+  // Instances of the same ROM share it (see RomImage)
+  std::vector<std::unique_ptr<Instance>> instances;
+  for (int copy = 0; copy < copies; copy++) {
+    for (const Job &job : manifest) {
+      instances.push_back(std::make_unique<Instance>(job, frameLimit));
+      if (!instances.back()->load(idleSkip, jit))
+        return 1;
+    }
+  }
+
+  WorkStealingPool pool(threads, pin);
+  std::vector<WorkStealingPool::Job> work;
+  work.reserve(instances.size());
+  for (auto &instance : instances) {
+    Instance *target = instance.get();
+    work.push_back([target, quantum] { return target->runQuantum(quantum); });
+  }
+
+  using Clock = std::chrono::steady_clock;
+  auto start = Clock::now();
+  pool.run(work);
+  double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+  uint64_t frames = 0;
+  uint64_t steals = 0;
+  size_t instanceBytes = 0;
+  std::set<const RomImage *> roms;
+  size_t romBytes = 0;
+  for (auto &instance : instances) {
+    frames += instance->frames;
+    instanceBytes += instance->gameBoy.footprint();
+    const RomImage *rom = instance->gameBoy.cartridge.romImage().get();
+    if (roms.insert(rom).second)
+      romBytes += rom->size();
+  }
+  for (const auto &stats : pool.stats())
+    steals += stats.steals;
+
+  std::printf("{\n");
+  std::printf("  \"instances\": %zu,\n", instances.size());
+  std::printf("  \"threads\": %d,\n", pool.threads());
+  std::printf("  \"pinned\": %s,\n", pool.pinned() ? "true" : "false");
+  std::printf("  \"quantum_frames\": %llu,\n",
+              static_cast<unsigned long long>(quantum));
+  std::printf("  \"frames\": %llu,\n", static_cast<unsigned long long>(frames));
+  std::printf("  \"seconds\": %.6f,\n", seconds);
+  std::printf("  \"fps\": %.2f,\n", frames / seconds);
+  std::printf("  \"fps_per_thread\": %.2f,\n",
+              frames / seconds / pool.threads());
+  std::printf("  \"steals\": %llu,\n", static_cast<unsigned long long>(steals));
+  std::printf("  \"bytes_per_instance\": %zu,\n",
+              instanceBytes / instances.size());
+  // Each distinct ROM once, however many instances play it
+  std::printf("  \"rom_bytes\": %zu,\n", romBytes);
+  std::printf("  \"results\": [\n");
+  for (size_t i = 0; i < instances.size(); i++) {
+    const Instance &instance = *instances[i];
+    const GameBoy &gameBoy = instance.gameBoy;
+    std::printf("    {\"rom\": %s, \"input\": %s, \"frames\": %llu, "
+                "\"cycles\": %llu, \"instructions\": %llu, "
+                "\"fps\": %.2f, \"framebuffer_hash\": \"%016llx\"}%s\n",
+                jsonString(instance.job.rom).c_str(),
+                jsonString(instance.job.input).c_str(),
+                static_cast<unsigned long long>(instance.frames),
+                static_cast<unsigned long long>(gameBoy.scheduler.now()),
+                static_cast<unsigned long long>(
+                    gameBoy.cpu.instructionsRetired()),
+                instance.seconds > 0 ? instance.frames / instance.seconds
+                                     : 0.0,
+                static_cast<unsigned long long>(
+                    hashFrame(gameBoy.ppu.frameBuffer)),
+                i + 1 < instances.size() ? "," : "");
+  }
+  std::printf("  ]\n");
+  std::printf("}\n");
+  return 0;
+}
@@ -0,0 +1,283 @@
+#include "core/Bus.h"
+#include "core/CPU.h"
+#include "core/Lockstep.h"
+#include "tests/TestRom.h"
+#include <array>
+#include <benchmark/benchmark.h>
+#include <cstdio>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+// Per-opcode throughput of CPU::tick(). Each benchmark fills WRAM with a run
+// of the same instruction and executes it in batches of BATCH instructions.
+// The opcode group benchmarks instead run a random mix drawn from one group,
+// through both tick() and runBlock().
+//
+// BM_Lockstep runs Lockstep::LANES copies of a small ROM loop through
+// Lockstep, and BM_LockstepCpus through as many separate CPUs, both counting
+// instructions over all copies.
+
+namespace {
+
+constexpr uint16_t PROGRAM_START = 0xC000;
+constexpr uint16_t DATA_ADDR = 0xD000;  // (HL), (nn) and n16 operands
+constexpr uint16_t STACK_TOP = 0xE000;  // PUSH grows down towards 0xD800
+constexpr uint8_t IMM8 = 0x80;          // LDH targets HRAM
+constexpr int BATCH = 1024;
+
+bool isStraightLine(uint8_t opcode) {
+  switch (opcode) {
+  case 0x10: // STOP
+  case 0x18: case 0x20: case 0x28: case 0x30: case 0x38: // JR
+  case 0x76: // HALT
+  case 0xC0: case 0xC8: case 0xD0: case 0xD8: case 0xC9: case 0xD9: // RET
+  case 0xC2: case 0xC3: case 0xCA: case 0xD2: case 0xDA: case 0xE9: // JP
+  case 0xC4: case 0xCC: case 0xCD: case 0xD4: case 0xDC: // CALL
+  case 0xC7: case 0xCF: case 0xD7: case 0xDF: // RST
+  case 0xE7: case 0xEF: case 0xF7: case 0xFF:
+  case 0xCB: // Prefix, benchmarked separately
+  case 0xD3: case 0xDB: case 0xDD: case 0xE3: case 0xE4: case 0xEB: // Illegal
+  case 0xEC: case 0xED: case 0xF4: case 0xFC: case 0xFD:
+    return false;
+  default:
+    return true;
+  }
+}
+
+void loadProgram(Bus &bus, uint8_t opcode, bool cb) {
+  uint16_t addr = PROGRAM_START;
+  for (int i = 0; i < BATCH; i++) {
+    if (cb) {
+      bus.write(addr++, 0xCB);
+      bus.write(addr++, opcode);
+      continue;
+    }
+    bus.write(addr++, opcode);
+    int length = CPU::instructionLength(opcode);
+    if (length == 2) {
+      bus.write(addr++, IMM8);
+    } else if (length == 3) {
+      bus.write(addr++, DATA_ADDR & 0xFF);
+      bus.write(addr++, DATA_ADDR >> 8);
+    }
+  }
+}
+
+void BM_Opcode(benchmark::State &state, uint8_t opcode, bool cb) {
+  Bus bus;
+  CPU cpu(bus);
+  loadProgram(bus, opcode, cb);
+
+  int64_t cycles = 0;
+  for (auto _ : state) {
+    cpu.PC = PROGRAM_START;
+    cpu.SP = STACK_TOP;
+    cpu.HL.reg16 = DATA_ADDR;
+    for (int i = 0; i < BATCH; i++) {
+      cycles += cpu.tick();
+    }
+  }
+  benchmark::DoNotOptimize(cycles);
+  state.SetItemsProcessed(state.iterations() * BATCH);
+  state.counters["cycles/instr"] =
+      static_cast<double>(cycles) / (state.iterations() * BATCH);
+}
+
+struct OpcodeGroup {
+  const char *name;
+  bool cb;
+  std::vector<uint8_t> opcodes;
+};
+
+// Opcodes sharing a handler shape. Memory operands stay in the data area:
+// BC, DE and HL all point at DATA_ADDR and (HL+)/(HL-) are left out.
+std::vector<OpcodeGroup> opcodeGroups() {
+  std::vector<OpcodeGroup> groups = {
+      {"LD_r_r", false, {}},   {"ALU_r", false, {}},  {"ALU_n", false, {}},
+      {"IncDec", false, {}},   {"Memory", false, {}}, {"CB_Shift", true, {}},
+      {"CB_Bit", true, {}},    {"CB_ResSet", true, {}},
+  };
+  for (int op = 0x40; op < 0x80; op++) {
+    if (op != 0x76 && (op & 0x07) != 6 && (op & 0x38) != 0x30)
+      groups[0].opcodes.push_back(op);
+  }
+  for (int op = 0x80; op < 0xC0; op++) {
+    if ((op & 0x07) != 6)
+      groups[1].opcodes.push_back(op);
+  }
+  for (int op = 0xC6; op <= 0xFE; op += 8)
+    groups[2].opcodes.push_back(op);
+  for (int op = 0x03; op < 0x40; op += 8) {
+    groups[3].opcodes.push_back(op); // INC/DEC rr
+    if (op != 0x33) {
+      groups[3].opcodes.push_back(op + 1); // INC r
+      groups[3].opcodes.push_back(op + 2); // DEC r
+    }
+  }
+  groups[4].opcodes = {0x02, 0x0A, 0x12, 0x1A, 0x34, 0x35, 0x36, 0x46, 0x4E,
+                       0x56, 0x5E, 0x66, 0x6E, 0x7E, 0x70, 0x71, 0x72, 0x73,
+                       0x77, 0x86, 0x96, 0xA6, 0xBE, 0xEA, 0xFA};
+  for (int op = 0; op < 0x100; op++) {
+    if ((op & 0x07) == 6)
+      continue; // (HL) forms
+    groups[op < 0x40 ? 5 : op < 0x80 ? 6 : 7].opcodes.push_back(op);
+  }
+  return groups;
+}
+
+// Writes BATCH random instructions from `group`, returns the end address.
+uint16_t loadGroupProgram(Bus &bus, const OpcodeGroup &group) {
+  std::mt19937 rng(1234);
+  uint16_t addr = PROGRAM_START;
+  for (int i = 0; i < BATCH; i++) {
+    uint8_t opcode = group.opcodes[rng() % group.opcodes.size()];
+    if (group.cb) {
+      bus.write(addr++, 0xCB);
+      bus.write(addr++, opcode);
+      continue;
+    }
+    bus.write(addr++, opcode);
+    int length = CPU::instructionLength(opcode);
+    if (length == 2) {
+      bus.write(addr++, rng());
+    } else if (length == 3) {
+      bus.write(addr++, DATA_ADDR & 0xFF);
+      bus.write(addr++, DATA_ADDR >> 8);
+    }
+  }
+  return addr;
+}
+
+void BM_OpcodeGroup(benchmark::State &state, OpcodeGroup group, bool blocks) {
+  Bus bus;
+  CPU cpu(bus);
+  uint16_t end = loadGroupProgram(bus, group);
+
+  int64_t cycles = 0;
+  for (auto _ : state) {
+    cpu.PC = PROGRAM_START;
+    cpu.SP = STACK_TOP;
+    cpu.BC.reg16 = DATA_ADDR;
+    cpu.DE.reg16 = DATA_ADDR;
+    cpu.HL.reg16 = DATA_ADDR;
+    if (blocks) {
+      while (cpu.PC < end)
+        cycles += cpu.runBlock();
+    } else {
+      for (int i = 0; i < BATCH; i++)
+        cycles += cpu.tick();
+    }
+  }
+  benchmark::DoNotOptimize(cycles);
+  state.SetItemsProcessed(state.iterations() * BATCH);
+}
+
+int registerOpcodeBenchmarks() {
+  for (const OpcodeGroup &group : opcodeGroups()) {
+    std::string name = std::string("BM_OpcodeGroup/") + group.name;
+    benchmark::RegisterBenchmark((name + "/tick").c_str(), BM_OpcodeGroup,
+                                 group, false);
+    benchmark::RegisterBenchmark((name + "/block").c_str(), BM_OpcodeGroup,
+                                 group, true);
+  }
+
+  char name[32];
+  for (int op = 0; op < 256; op++) {
+    if (!isStraightLine(static_cast<uint8_t>(op)))
+      continue;
+    snprintf(name, sizeof(name), "BM_Opcode/%02X", op);
+    benchmark::RegisterBenchmark(name, BM_Opcode, static_cast<uint8_t>(op),
+                                 false);
+  }
+  for (int op = 0; op < 256; op++) {
+    snprintf(name, sizeof(name), "BM_OpcodeCB/%02X", op);
+    benchmark::RegisterBenchmark(name, BM_Opcode, static_cast<uint8_t>(op),
+                                 true);
+  }
+  return 0;
+}
+
+const int registered = registerOpcodeBenchmarks();
+
+} // namespace
+
+namespace {
+
+// Folds a 64-byte table in WRAM, which differs per copy, into B and C with
+// a branch on each byte: copies split and rejoin every iteration.
+std::shared_ptr<const RomImage> lockstepRom() {
+  const TestRom rom({
+      0x21, 0x00, 0xC0, //       LD HL, C000
+      0x2A,             // loop: LD A, (HL+)
+      0xA8,             //       XOR B
+      0x07,             //       RLCA
+      0x47,             //       LD B, A
+      0xCB, 0x47,       //       BIT 0, A
+      0x28, 0x02,       //       JR Z, skip
+      0x0C,             //       INC C
+      0x0C,             //       INC C
+      0x81,             // skip: ADD A, C
+      0x4F,             //       LD C, A
+      0x7D,             //       LD A, L
+      0xE6, 0x3F,       //       AND 3F
+      0x20, 0xEF,       //       JR NZ, loop
+      0x2E, 0x00,       //       LD L, 00
+      0x18, 0xEB,       //       JR loop
+  });
+  return rom.image();
+}
+
+void fillTable(Bus &bus, std::mt19937 &rng) {
+  for (uint16_t addr = 0xC000; addr < 0xC040; addr++)
+    bus.write(addr, static_cast<uint8_t>(rng()));
+}
+
+void BM_Lockstep(benchmark::State &state) {
+  Lockstep lockstep(lockstepRom());
+  if (!lockstep.setSimdEnabled(state.range(0) != 0)) {
+    state.SkipWithError("no AVX2 on this host");
+    return;
+  }
+  std::mt19937 rng(42);
+  for (int lane = 0; lane < Lockstep::LANES; lane++)
+    fillTable(lockstep.bus(lane), rng);
+
+  for (auto _ : state) {
+    lockstep.run(BATCH);
+  }
+  state.SetItemsProcessed(lockstep.instructionsRetired());
+  state.counters["lanes/group"] =
+      static_cast<double>(lockstep.instructionsRetired()) /
+      static_cast<double>(lockstep.groupSteps());
+}
+BENCHMARK(BM_Lockstep)->ArgName("simd")->Arg(0)->Arg(1);
+
+void BM_LockstepCpus(benchmark::State &state) {
+  struct Copy {
+    Bus bus;
+    Cartridge cartridge;
+    CPU cpu{bus};
+  };
+  auto rom = lockstepRom();
+  std::mt19937 rng(42);
+  std::array<std::unique_ptr<Copy>, Lockstep::LANES> copies;
+  for (auto &copy : copies) {
+    copy = std::make_unique<Copy>();
+    copy->cartridge.loadRom(rom);
+    copy->bus.setCartridge(&copy->cartridge);
+    fillTable(copy->bus, rng);
+  }
+
+  for (auto _ : state) {
+    for (auto &copy : copies) {
+      for (int i = 0; i < BATCH; i++)
+        copy->cpu.tick();
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * BATCH * Lockstep::LANES);
+}
+BENCHMARK(BM_LockstepCpus);
+
+} // namespace
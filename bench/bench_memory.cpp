@@ -0,0 +1,160 @@
+#include "core/Bus.h"
+#include "core/PPU.h"
+#include "core/Timer.h"
+#include "mmu/Cartridge.h"
+#include <benchmark/benchmark.h>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+// Bus::read()/write() per memory region and Cartridge::read() per MBC.
+// Each iteration touches up to BATCH consecutive addresses of one region.
+
+namespace {
+
+constexpr int BATCH = 256;
+
+struct Region {
+  const char *name;
+  uint16_t start;
+  int size;
+};
+
+const Region regions[] = {
+    {"ROM0", 0x0100, BATCH}, {"ROMX", 0x4100, BATCH}, {"VRAM", 0x8000, BATCH},
+    {"SRAM", 0xA000, BATCH}, {"WRAM", 0xC000, BATCH}, {"Echo", 0xE000, BATCH},
+    {"OAM", 0xFE00, 0xA0},   {"IO", 0xFF00, 0x80},    {"HRAM", 0xFF80, 0x7F},
+};
+
+struct Mbc {
+  const char *name;
+  uint8_t type; // Header byte 0x147
+  size_t romSize;
+};
+
+const Mbc mbcs[] = {
+    {"None", 0x00, 32 << 10},
+    {"MBC1", 0x03, 1 << 20},
+    {"MBC3", 0x13, 1 << 20},
+    {"MBC5", 0x1B, 2 << 20},
+};
+
+// Image of `size` bytes with the given header type and RAM size bytes.
+std::string writeRom(uint8_t type, size_t size, uint8_t ramSize) {
+  std::vector<uint8_t> rom(size);
+  for (size_t i = 0; i < size; i++)
+    rom[i] = static_cast<uint8_t>(i * 7 + (i >> 14));
+  rom[0x147] = type;
+  rom[0x148] = 0;
+  while ((size_t(0x8000) << rom[0x148]) < size)
+    rom[0x148]++;
+  rom[0x149] = ramSize;
+
+  char name[48];
+  snprintf(name, sizeof(name), "shellboy_bench_%02X.gb", type);
+  std::string path = (std::filesystem::temp_directory_path() / name).string();
+  std::ofstream(path, std::ios::binary)
+      .write(reinterpret_cast<const char *>(rom.data()), rom.size());
+  return path;
+}
+
+struct Machine {
+  Bus bus;
+  Cartridge cart;
+  PPU ppu{bus};
+  Timer timer{bus};
+
+  Machine() {
+    cart.loadRom(writeRom(0x1B, 2 << 20, 3));
+    bus.setCartridge(&cart);
+    bus.setPPU(&ppu);
+    bus.setTimer(&timer);
+    bus.write(0x0000, 0x0A); // Enable cartridge RAM
+    bus.write(0x2000, 0x05); // ROM bank 5
+  }
+};
+
+void BM_BusRead(benchmark::State &state, Region region) {
+  Machine m;
+  uint32_t sum = 0;
+  for (auto _ : state) {
+    for (int i = 0; i < region.size; i++)
+      sum += m.bus.read(region.start + i);
+    benchmark::DoNotOptimize(sum);
+  }
+  state.SetItemsProcessed(state.iterations() * region.size);
+}
+
+void BM_BusWrite(benchmark::State &state, Region region) {
+  Machine m;
+  for (auto _ : state) {
+    for (int i = 0; i < region.size; i++)
+      m.bus.write(region.start + i, static_cast<uint8_t>(i));
+    benchmark::ClobberMemory();
+  }
+  state.SetItemsProcessed(state.iterations() * region.size);
+}
+
+void BM_CartridgeRead(benchmark::State &state, Mbc mbc) {
+  Cartridge cart;
+  cart.loadRom(writeRom(mbc.type, mbc.romSize, mbc.type ? 3 : 0));
+  cart.write(0x0000, 0x0A);
+  cart.write(0x2000, 0x05);
+
+  // ROM0, ROMX and cartridge RAM in turn
+  static constexpr uint16_t starts[] = {0x0100, 0x4100, 0xA000};
+  uint32_t sum = 0;
+  for (auto _ : state) {
+    for (uint16_t start : starts) {
+      for (int i = 0; i < BATCH; i++)
+        sum += cart.read(start + i);
+    }
+    benchmark::DoNotOptimize(sum);
+  }
+  state.SetItemsProcessed(state.iterations() * 3 * BATCH);
+}
+
+// Bank switch followed by a run of reads, as a game streaming level data out
+// of a large MBC5 image does.
+void BM_CartridgeBankedRead(benchmark::State &state) {
+  Cartridge cart;
+  cart.loadRom(writeRom(0x19, 2 << 20, 0));
+  uint32_t sum = 0;
+  int bank = 0;
+  for (auto _ : state) {
+    cart.write(0x2000, static_cast<uint8_t>(bank));
+    bank = (bank + 37) & 0x7F;
+    for (int i = 0; i < BATCH; i++)
+      sum += cart.read(0x4000 + i * 61);
+    benchmark::DoNotOptimize(sum);
+  }
+  state.SetItemsProcessed(state.iterations() * BATCH);
+}
+
+int registerMemoryBenchmarks() {
+  for (const Region &region : regions) {
+    benchmark::RegisterBenchmark(
+        (std::string("BM_BusRead/") + region.name).c_str(), BM_BusRead,
+        region);
+    // ROM writes are MBC commands, not stores
+    if (region.start >= 0x8000) {
+      benchmark::RegisterBenchmark(
+          (std::string("BM_BusWrite/") + region.name).c_str(), BM_BusWrite,
+          region);
+    }
+  }
+  for (const Mbc &mbc : mbcs) {
+    benchmark::RegisterBenchmark(
+        (std::string("BM_CartridgeRead/") + mbc.name).c_str(),
+        BM_CartridgeRead, mbc);
+  }
+  benchmark::RegisterBenchmark("BM_CartridgeBankedRead/MBC5",
+                               BM_CartridgeBankedRead);
+  return 0;
+}
+
+const int registered = registerMemoryBenchmarks();
+
+} // namespace
@@ -0,0 +1,71 @@
+#include "core/Bus.h"
+#include "core/PPU.h"
+#include <benchmark/benchmark.h>
+#include <random>
+
+// Cost of one 70224-cycle frame through PPU::tick() versus PPU::advance(),
+// with background, window and sprites enabled over random VRAM, and the
+// per-scanline rendering cost of each layer.
+
+namespace {
+
+constexpr int CYCLES_PER_FRAME = 70224;
+
+void buildScene(Bus &bus, uint8_t lcdc = 0xF3) {
+  std::mt19937 rng(42);
+  for (uint16_t address = 0x8000; address < 0xA000; address++)
+    bus.write(address, rng());
+  for (uint16_t address = 0xFE00; address < 0xFEA0; address++)
+    bus.write(address, rng() % 176);
+  bus.write(0xFF47, 0xE4); // BGP
+  bus.write(0xFF48, 0xE4); // OBP0
+  bus.write(0xFF4A, 72);   // WY
+  bus.write(0xFF4B, 87);   // WX
+  bus.write(0xFF40, lcdc); // Default: LCD, BG, window, sprites
+}
+
+void BM_PPUFrameTick(benchmark::State &state) {
+  Bus bus;
+  PPU ppu(bus);
+  bus.setPPU(&ppu);
+  buildScene(bus);
+  for (auto _ : state) {
+    for (int i = 0; i < CYCLES_PER_FRAME; i++)
+      ppu.tick();
+  }
+  benchmark::DoNotOptimize(ppu.frameBuffer);
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_PPUFrameTick);
+
+void BM_PPUFrameAdvance(benchmark::State &state) {
+  Bus bus;
+  PPU ppu(bus);
+  bus.setPPU(&ppu);
+  buildScene(bus);
+  for (auto _ : state) {
+    ppu.advance(CYCLES_PER_FRAME);
+  }
+  benchmark::DoNotOptimize(ppu.frameBuffer);
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_PPUFrameAdvance);
+
+// Frames are dominated by renderScanline(); items are visible scanlines.
+void BM_PPUScanlines(benchmark::State &state, uint8_t lcdc) {
+  Bus bus;
+  PPU ppu(bus);
+  bus.setPPU(&ppu);
+  buildScene(bus, lcdc);
+  for (auto _ : state) {
+    ppu.advance(CYCLES_PER_FRAME);
+  }
+  benchmark::DoNotOptimize(ppu.frameBuffer);
+  state.SetItemsProcessed(state.iterations() * 144);
+}
+BENCHMARK_CAPTURE(BM_PPUScanlines, BG, uint8_t{0x91});
+BENCHMARK_CAPTURE(BM_PPUScanlines, Window, uint8_t{0xB1});
+BENCHMARK_CAPTURE(BM_PPUScanlines, Sprites, uint8_t{0x93});
+BENCHMARK_CAPTURE(BM_PPUScanlines, All, uint8_t{0xF3});
+
+} // namespace
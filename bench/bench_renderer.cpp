@@ -0,0 +1,27 @@
+#include "frontend/BrailleRenderer.h"
+#include <benchmark/benchmark.h>
+#include <random>
+
+// BrailleRenderer::render() over a blank and a noisy frame.
+
+namespace {
+
+void BM_BrailleRender(benchmark::State &state, bool noise) {
+  std::array<uint8_t, 160 * 144> frame{};
+  std::mt19937 rng(42);
+  if (noise) {
+    for (uint8_t &pixel : frame)
+      pixel = rng() & 0x03;
+  }
+
+  BrailleRenderer renderer;
+  for (auto _ : state) {
+    std::string text = renderer.render(frame);
+    benchmark::DoNotOptimize(text);
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK_CAPTURE(BM_BrailleRender, Blank, false);
+BENCHMARK_CAPTURE(BM_BrailleRender, Noise, true);
+
+} // namespace
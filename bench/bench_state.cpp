@@ -0,0 +1,116 @@
+#include "core/Bus.h"
+#include "core/CPU.h"
+#include "core/Fork.h"
+#include "core/Joypad.h"
+#include "core/PPU.h"
+#include "core/Rewind.h"
+#include "core/SaveState.h"
+#include "core/Scheduler.h"
+#include "core/Timer.h"
+#include "mmu/Cartridge.h"
+#include <benchmark/benchmark.h>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+// Save state cost for a 2MB MBC5 cartridge with 32KB of RAM, the largest
+// state a DMG game can have short of 128KB MBC5 RAM, and the cost of a
+// rewind capture when a frame changed a few hundred bytes, and of spawning
+// a fork of that machine.
+
+namespace {
+
+std::string writeRom() {
+  std::vector<uint8_t> rom(2 << 20, 0x00);
+  rom[0x147] = 0x1B;
+  rom[0x148] = 0x06; // 2MB
+  rom[0x149] = 0x03;
+  std::string path =
+      (std::filesystem::temp_directory_path() / "shellboy_bench_state.gb")
+          .string();
+  std::ofstream(path, std::ios::binary)
+      .write(reinterpret_cast<const char *>(rom.data()), rom.size());
+  return path;
+}
+
+struct Machine {
+  Cartridge cart;
+  Bus bus;
+  CPU cpu{bus};
+  PPU ppu{bus};
+  Timer timer{bus};
+  Joypad joypad{bus};
+  Scheduler scheduler{bus, cpu, ppu, timer};
+  SaveState::Machine parts{bus, cpu, ppu, timer, joypad, cart, scheduler};
+
+  Machine() {
+    cart.loadRom(writeRom());
+    bus.setCartridge(&cart);
+    bus.setPPU(&ppu);
+    bus.setTimer(&timer);
+    bus.setJoypad(&joypad);
+    bus.setScheduler(&scheduler);
+  }
+};
+
+void BM_SaveState(benchmark::State &state) {
+  Machine m;
+  std::vector<uint8_t> buffer;
+  for (auto _ : state) {
+    SaveState::save(m.parts, buffer);
+    benchmark::DoNotOptimize(buffer.data());
+  }
+  state.SetBytesProcessed(state.iterations() * buffer.size());
+  state.counters["bytes"] = static_cast<double>(buffer.size());
+}
+BENCHMARK(BM_SaveState);
+
+void BM_LoadState(benchmark::State &state) {
+  Machine m;
+  std::vector<uint8_t> buffer;
+  SaveState::save(m.parts, buffer);
+  for (auto _ : state) {
+    bool ok = SaveState::load(m.parts, buffer.data(), buffer.size());
+    benchmark::DoNotOptimize(ok);
+  }
+  state.SetBytesProcessed(state.iterations() * buffer.size());
+}
+BENCHMARK(BM_LoadState);
+
+// Items are captures; one in `keyframes` is a keyframe.
+void BM_RewindCapture(benchmark::State &state) {
+  Machine m;
+  Rewind rewind(m.parts, 1, static_cast<int>(state.range(0)), SIZE_MAX);
+  uint16_t address = 0xC000;
+  for (auto _ : state) {
+    state.PauseTiming();
+    for (int i = 0; i < 300; i++) {
+      m.bus.write(address, m.bus.read(address) + 1);
+      address = 0xC000 + (address * 37 + 11) % 0x2000;
+    }
+    state.ResumeTiming();
+    rewind.frameDone();
+  }
+  state.SetItemsProcessed(state.iterations());
+  state.counters["bytes_per_capture"] = benchmark::Counter(
+      static_cast<double>(rewind.bytesHeld()) / rewind.captures());
+}
+BENCHMARK(BM_RewindCapture)->Arg(1)->Arg(60)->ArgName("keyframes");
+
+// Spawn into an already-wired child, which drops the pages it copied
+// last time; the cost is the state load minus all of the RAM.
+void BM_ForkSpawn(benchmark::State &state) {
+  Machine parent, child;
+  ForkPoint fork(parent.parts);
+  for (auto _ : state) {
+    bool ok = fork.spawn(child.parts);
+    benchmark::DoNotOptimize(ok);
+    child.bus.write(0xC000, 1); // Copy one page
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_ForkSpawn);
+
+} // namespace
@@ -0,0 +1,97 @@
+#!/usr/bin/env python3
+"""Compare a ShellBoyMicrobench run against a stored baseline.
+
+    ShellBoyMicrobench --benchmark_out=run.json --benchmark_out_format=json
+    bench/compare.py bench/baseline.json run.json [--threshold 0.10]
+
+Prints every benchmark whose CPU time moved by more than the threshold and
+exits with status 1 if any got slower. Benchmarks missing from either file
+are listed but not treated as failures. With --update, the baseline is
+rewritten from the run instead.
+
+Baselines are only meaningful on the machine (and build type) that recorded
+them: re-record after changing either.
+"""
+
+import argparse
+import json
+import sys
+
+UNITS = {"ns": 1.0, "us": 1e3, "ms": 1e6, "s": 1e9}
+
+
+def load_times(path):
+    """Map benchmark name -> CPU time in ns. Google Benchmark JSON output and
+    baseline files are both accepted; with repetitions the median is used."""
+    with open(path) as f:
+        data = json.load(f)
+    times = {}
+    for bench in data["benchmarks"]:
+        if bench.get("run_type") == "aggregate":
+            if bench.get("aggregate_name") != "median":
+                continue
+            name = bench["run_name"]
+        elif bench.get("run_type") == "iteration" and "run_name" in bench:
+            name = bench["run_name"]
+            if name in times:
+                continue  # Keep the median if there is one, else the first
+        else:
+            name = bench["name"]
+        times[name] = bench["cpu_time"] * UNITS[bench.get("time_unit", "ns")]
+    return times
+
+
+def save_baseline(path, times):
+    benchmarks = [
+        {"name": name, "cpu_time": round(time, 3), "time_unit": "ns"}
+        for name, time in sorted(times.items())
+    ]
+    with open(path, "w") as f:
+        json.dump({"benchmarks": benchmarks}, f, indent=1)
+        f.write("\n")
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("baseline")
+    parser.add_argument("run")
+    parser.add_argument("--threshold", type=float, default=0.10,
+                        help="relative change to report (default 0.10)")
+    parser.add_argument("--update", action="store_true",
+                        help="overwrite the baseline with the run")
+    args = parser.parse_args()
+
+    run = load_times(args.run)
+    if args.update:
+        save_baseline(args.baseline, run)
+        print(f"Wrote {len(run)} benchmarks to {args.baseline}")
+        return 0
+
+    baseline = load_times(args.baseline)
+    regressions = 0
+    improvements = 0
+    for name in sorted(baseline.keys() & run.keys()):
+        old, new = baseline[name], run[name]
+        change = (new - old) / old if old else 0.0
+        if change > args.threshold:
+            regressions += 1
+            print(f"REGRESSION  {name:<44} {old:12.1f} -> {new:12.1f} ns "
+                  f"({change:+.1%})")
+        elif change < -args.threshold:
+            improvements += 1
+            print(f"improvement {name:<44} {old:12.1f} -> {new:12.1f} ns "
+                  f"({change:+.1%})")
+
+    for name in sorted(baseline.keys() - run.keys()):
+        print(f"missing     {name}")
+    for name in sorted(run.keys() - baseline.keys()):
+        print(f"new         {name}")
+
+    compared = len(baseline.keys() & run.keys())
+    print(f"{compared} compared, {regressions} regressed, "
+          f"{improvements} improved (threshold {args.threshold:.0%})")
+    return 1 if regressions else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,278 @@
+#include "bench/RunCommon.h"
+#include "core/Fork.h"
+#include "core/GameBoy.h"
+#include "core/Profiler.h"
+#include "core/Rewind.h"
+#include "core/RunAhead.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Headless, uncapped runner: plays a ROM for a number of frames (or
+// seconds of wall time) and prints the emulation speed as JSON. --input
+// takes an input script, see RunCommon.h.
+//
+// --profile samples the guest PC (see Profiler) and writes collapsed stacks,
+// symbolized with the ROM's .sym file when there is one.
+//
+// --rewind keeps an unbounded rewind history (see Rewind) while playing and
+// reports its size per minute of history and its capture cost per frame.
+// --run-ahead N plays every frame through RunAhead; "frames" still counts
+// real frames only.
+//
+// --fork N then forks the machine into N children (see ForkPoint), all kept
+// alive, and runs each for --fork-frames frames (default 60) holding a
+// different button, reporting the spawn cost, the children's combined speed
+// and the RAM each ended up not sharing.
+
+namespace {
+
+void usage() {
+  std::cerr << "Usage: ShellBoyBench <rom_path> [--frames N | --seconds S]\n"
+               "       [--input script] [--jit] [--no-idle-skip]\n"
+               "       [--profile out.folded [--profile-interval cycles]]\n"
+               "       [--rewind] [--run-ahead frames]\n"
+               "       [--fork children [--fork-frames N]]"
+#ifdef SHELLBOY_OPCODE_STATS
+               " [--opcode-csv path]"
+#endif
+            << std::endl;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    usage();
+    return 1;
+  }
+  const char *romPath = argv[1];
+  uint64_t frameLimit = 0;
+  double secondLimit = 0;
+  const char *inputPath = nullptr;
+  bool jit = false;
+  bool idleSkip = true;
+  const char *profilePath = nullptr;
+  uint32_t profileInterval = 1024;
+  bool keepRewind = false;
+  int runAheadFrames = 0;
+  int forkChildren = 0;
+  int forkFrames = 60;
+#ifdef SHELLBOY_OPCODE_STATS
+  const char *opcodeCsv = nullptr;
+#endif
+  for (int i = 2; i < argc; i++) {
+    bool hasValue = i + 1 < argc;
+    if (!std::strcmp(argv[i], "--frames") && hasValue) {
+      frameLimit = std::strtoull(argv[++i], nullptr, 10);
+    } else if (!std::strcmp(argv[i], "--seconds") && hasValue) {
+      secondLimit = std::strtod(argv[++i], nullptr);
+    } else if (!std::strcmp(argv[i], "--input") && hasValue) {
+      inputPath = argv[++i];
+    } else if (!std::strcmp(argv[i], "--jit")) {
+      jit = true;
+    } else if (!std::strcmp(argv[i], "--no-idle-skip")) {
+      idleSkip = false;
+    } else if (!std::strcmp(argv[i], "--profile") && hasValue) {
+      profilePath = argv[++i];
+    } else if (!std::strcmp(argv[i], "--profile-interval") && hasValue) {
+      profileInterval = std::strtoul(argv[++i], nullptr, 10);
+    } else if (!std::strcmp(argv[i], "--rewind")) {
+      keepRewind = true;
+    } else if (!std::strcmp(argv[i], "--run-ahead") && hasValue) {
+      runAheadFrames = std::atoi(argv[++i]);
+    } else if (!std::strcmp(argv[i], "--fork") && hasValue) {
+      forkChildren = std::atoi(argv[++i]);
+    } else if (!std::strcmp(argv[i], "--fork-frames") && hasValue) {
+      forkFrames = std::atoi(argv[++i]);
+#ifdef SHELLBOY_OPCODE_STATS
+    } else if (!std::strcmp(argv[i], "--opcode-csv") && hasValue) {
+      opcodeCsv = argv[++i];
+#endif
+    } else {
+      usage();
+      return 1;
+    }
+  }
+  if (frameLimit == 0 && secondLimit <= 0)
+    frameLimit = 3600; // One emulated minute
+
+  std::vector<InputEvent> input;
+  if (inputPath && !loadInputScript(inputPath, input)) {
+    std::cerr << "Failed to load input script: " << inputPath << std::endl;
+    return 1;
+  }
+
+  auto gameBoy = std::make_unique<GameBoy>();
+  if (!gameBoy->loadRom(romPath)) {
+    std::cerr << "Failed to load ROM: " << romPath << ": "
+              << gameBoy->loadError() << std::endl;
+    return 1;
+  }
+  CPU &cpu = gameBoy->cpu;
+  PPU &ppu = gameBoy->ppu;
+  Joypad &joypad = gameBoy->joypad;
+  Cartridge &cart = gameBoy->cartridge;
+  Scheduler &scheduler = gameBoy->scheduler;
+  scheduler.setIdleLoopSkipping(idleSkip);
+  if (jit && !cpu.setJitEnabled(true)) {
+    std::cerr << "JIT not available on this host" << std::endl;
+    return 1;
+  }
+  std::unique_ptr<Profiler> profiler;
+  if (profilePath) {
+    profiler = std::make_unique<Profiler>(profileInterval);
+    scheduler.setProfiler(profiler.get());
+  }
+  RunAhead runAhead(gameBoy->machine(), runAheadFrames);
+  std::unique_ptr<Rewind> rewind;
+  if (keepRewind) {
+    rewind = std::make_unique<Rewind>(gameBoy->machine(), 2, 60, SIZE_MAX);
+  }
+
+  using Clock = std::chrono::steady_clock;
+  auto start = Clock::now();
+  auto deadline = start + std::chrono::duration_cast<Clock::duration>(
+                              std::chrono::duration<double>(secondLimit));
+  uint64_t frames = 0;
+  size_t nextInput = 0;
+  while (frameLimit ? frames < frameLimit : Clock::now() < deadline) {
+    applyInput(input, nextInput, frames, joypad);
+    runAhead.runFrame();
+    ppu.frameReady = false;
+    frames++;
+    if (rewind)
+      rewind->frameDone();
+    if (profiler)
+      profiler->drain();
+  }
+  double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+  double spawnSeconds = 0;
+  double childSeconds = 0;
+  size_t sharedBytes = 0;
+  size_t privateBytes = 0;
+  size_t childBytes = 0;
+  if (forkChildren > 0) {
+    std::vector<std::unique_ptr<GameBoy>> children;
+    children.reserve(forkChildren);
+    for (int i = 0; i < forkChildren; i++) {
+      children.push_back(std::make_unique<GameBoy>());
+      children.back()->scheduler.setIdleLoopSkipping(idleSkip);
+      children.back()->cpu.setJitEnabled(jit);
+    }
+
+    auto forkStart = Clock::now();
+    ForkPoint fork(gameBoy->machine());
+    for (auto &child : children) {
+      if (!fork.spawn(child->machine())) {
+        std::cerr << "Failed to fork" << std::endl;
+        return 1;
+      }
+    }
+    auto runStart = Clock::now();
+    for (int i = 0; i < forkChildren; i++) {
+      GameBoy &child = *children[i];
+      child.joypad.pressButton(static_cast<Joypad::Button>(i % 8));
+      for (int frame = 0; frame < forkFrames; frame++) {
+        child.runFrame();
+        child.ppu.frameReady = false;
+      }
+    }
+    auto runEnd = Clock::now();
+    spawnSeconds = std::chrono::duration<double>(runStart - forkStart).count();
+    childSeconds = std::chrono::duration<double>(runEnd - runStart).count();
+    sharedBytes = fork.sharedBytes();
+    for (auto &child : children) {
+      privateBytes += ForkPoint::privateBytes(child->machine());
+      childBytes += child->footprint();
+    }
+  }
+
+  uint64_t cycles = scheduler.now();
+  uint64_t instructions = cpu.instructionsRetired();
+  char hash[24];
+  std::snprintf(hash, sizeof(hash), "%016llx",
+                static_cast<unsigned long long>(hashFrame(ppu.frameBuffer)));
+
+  std::printf("{\n");
+  std::printf("  \"rom\": %s,\n", jsonString(romPath).c_str());
+  std::printf("  \"title\": %s,\n", jsonString(cart.title()).c_str());
+  std::printf("  \"jit\": %s,\n", cpu.jitEnabled() ? "true" : "false");
+  std::printf("  \"idle_skip\": %s,\n", idleSkip ? "true" : "false");
+  std::printf("  \"run_ahead\": %d,\n", runAhead.frames());
+  std::printf("  \"frames\": %llu,\n", static_cast<unsigned long long>(frames));
+  std::printf("  \"cycles\": %llu,\n", static_cast<unsigned long long>(cycles));
+  std::printf("  \"instructions\": %llu,\n",
+              static_cast<unsigned long long>(instructions));
+  std::printf("  \"halted_cycles\": %llu,\n",
+              static_cast<unsigned long long>(scheduler.haltedCycles()));
+  std::printf("  \"idle_cycles\": %llu,\n",
+              static_cast<unsigned long long>(scheduler.idleCycles()));
+  std::printf("  \"seconds\": %.6f,\n", seconds);
+  std::printf("  \"emulated_mhz\": %.3f,\n", cycles / seconds / 1e6);
+  std::printf("  \"fps\": %.2f,\n", frames / seconds);
+  std::printf("  \"instructions_per_sec\": %.0f,\n", instructions / seconds);
+  std::printf("  \"bytes_per_instance\": %zu,\n", gameBoy->footprint());
+  if (rewind) {
+    // 59.73 frames per emulated second
+    double minutes = rewind->framesHeld() / (60.0 * 4194304.0 / 70224.0);
+    std::printf("  \"rewind_snapshots\": %zu,\n", rewind->snapshots());
+    std::printf("  \"rewind_bytes\": %zu,\n", rewind->bytesHeld());
+    std::printf("  \"rewind_bytes_per_minute\": %.0f,\n",
+                minutes > 0 ? rewind->bytesHeld() / minutes : 0.0);
+    std::printf("  \"rewind_capture_us_per_frame\": %.3f,\n",
+                frames ? rewind->captureNanos() / 1e3 / frames : 0.0);
+    std::printf("  \"rewind_us_per_capture\": %.3f,\n",
+                rewind->captures()
+                    ? rewind->captureNanos() / 1e3 / rewind->captures()
+                    : 0.0);
+  }
+  if (forkChildren > 0) {
+    std::printf("  \"fork_children\": %d,\n", forkChildren);
+    std::printf("  \"fork_frames_per_child\": %d,\n", forkFrames);
+    std::printf("  \"fork_us_per_child\": %.3f,\n",
+                spawnSeconds * 1e6 / forkChildren);
+    std::printf("  \"fork_child_fps\": %.2f,\n",
+                childSeconds > 0
+                    ? double(forkChildren) * forkFrames / childSeconds
+                    : 0.0);
+    std::printf("  \"fork_shared_bytes\": %zu,\n", sharedBytes);
+    std::printf("  \"fork_private_bytes_per_child\": %zu,\n",
+                privateBytes / forkChildren);
+    std::printf("  \"fork_bytes_per_child\": %zu,\n",
+                childBytes / forkChildren);
+  }
+  std::printf("  \"framebuffer_hash\": \"%s\"\n", hash);
+  std::printf("}\n");
+
+  if (profiler) {
+    FILE *out = std::fopen(profilePath, "w");
+    if (!out) {
+      std::cerr << "Failed to write " << profilePath << std::endl;
+      return 1;
+    }
+    profiler->writeCollapsed(out, cart.symbols());
+    std::fclose(out);
+    std::cerr << "Profile: " << profiler->samples() << " samples ("
+              << profiler->dropped() << " dropped), "
+              << cart.symbols().size() << " symbols -> " << profilePath
+              << std::endl;
+  }
+
+#ifdef SHELLBOY_OPCODE_STATS
+  // Keep stdout pure JSON
+  cpu.opcodeStats().printTable(stderr, 40);
+  if (opcodeCsv && !cpu.opcodeStats().writeCsv(opcodeCsv)) {
+    std::cerr << "Failed to write " << opcodeCsv << std::endl;
+    return 1;
+  }
+#endif
+  return 0;
+}
@@ -0,0 +1,140 @@
+#include "shellboy.h"
+#include "core/GameBoy.h"
+#include "mmu/RomImage.h"
+#include <cstring>
+#include <memory>
+#include <new>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Each ROM load builds a new GameBoy and swaps it in only once the ROM has
+// loaded. Exceptions (only std::bad_alloc can come out of the core) are
+// caught here, never let through to C callers.
+struct shellboy {
+  std::unique_ptr<GameBoy> gameBoy;
+  std::string error;
+  std::vector<uint8_t> state; // Reused by every save
+};
+
+namespace {
+
+int fail(shellboy *gb, const std::string &message) {
+  gb->error = message;
+  return -1;
+}
+
+int succeed(shellboy *gb) {
+  gb->error.clear();
+  return 0;
+}
+
+int needsRom(shellboy *gb) { return fail(gb, "no ROM loaded"); }
+
+} // namespace
+
+extern "C" {
+
+uint32_t shellboy_abi_version(void) { return SHELLBOY_ABI_VERSION; }
+
+shellboy *shellboy_create(void) { return new (std::nothrow) shellboy; }
+
+void shellboy_destroy(shellboy *gb) { delete gb; }
+
+int shellboy_load_rom_file(shellboy *gb, const char *path) {
+  if (!path)
+    return fail(gb, "no path given");
+  try {
+    auto next = std::make_unique<GameBoy>();
+    if (!next->loadRom(path))
+      return fail(gb, std::string(path) + ": " + next->loadError());
+    gb->gameBoy = std::move(next);
+  } catch (const std::bad_alloc &) {
+    return fail(gb, "out of memory");
+  }
+  return succeed(gb);
+}
+
+int shellboy_load_rom_memory(shellboy *gb, const void *data, size_t size) {
+  if (!data)
+    return fail(gb, "no ROM data given");
+  try {
+    std::string error;
+    auto rom = RomImage::fromMemory(static_cast<const uint8_t *>(data), size,
+                                    error);
+    if (!rom)
+      return fail(gb, error);
+    auto next = std::make_unique<GameBoy>();
+    next->loadRom(std::move(rom));
+    gb->gameBoy = std::move(next);
+  } catch (const std::bad_alloc &) {
+    return fail(gb, "out of memory");
+  }
+  return succeed(gb);
+}
+
+const char *shellboy_error(const shellboy *gb) { return gb->error.c_str(); }
+
+int shellboy_run_frames(shellboy *gb, uint32_t frames) {
+  if (!gb->gameBoy)
+    return needsRom(gb);
+  GameBoy &gameBoy = *gb->gameBoy;
+  for (uint32_t i = 0; i < frames; i++) {
+    gameBoy.runFrame();
+    gameBoy.ppu.frameReady = false;
+  }
+  return succeed(gb);
+}
+
+void shellboy_set_buttons(shellboy *gb, uint8_t buttons) {
+  if (!gb->gameBoy)
+    return;
+  // Bit i is Joypad::Button i; the Joypad only acts on changes
+  Joypad &joypad = gb->gameBoy->joypad;
+  for (int i = 0; i < 8; i++) {
+    auto button = static_cast<Joypad::Button>(i);
+    if ((buttons >> i) & 1)
+      joypad.pressButton(button);
+    else
+      joypad.releaseButton(button);
+  }
+}
+
+size_t shellboy_save_state(shellboy *gb, void *buffer, size_t capacity) {
+  if (!gb->gameBoy) {
+    needsRom(gb);
+    return 0;
+  }
+  try {
+    SaveState::save(gb->gameBoy->machine(), gb->state);
+  } catch (const std::bad_alloc &) {
+    fail(gb, "out of memory");
+    return 0;
+  }
+  if (buffer && capacity >= gb->state.size())
+    std::memcpy(buffer, gb->state.data(), gb->state.size());
+  succeed(gb);
+  return gb->state.size();
+}
+
+int shellboy_load_state(shellboy *gb, const void *data, size_t size) {
+  if (!gb->gameBoy)
+    return needsRom(gb);
+  if (!data ||
+      !SaveState::load(gb->gameBoy->machine(),
+                       static_cast<const uint8_t *>(data), size))
+    return fail(gb, "not a snapshot of this ROM from this library version");
+  return succeed(gb);
+}
+
+const uint8_t *shellboy_frame_buffer(const shellboy *gb) {
+  return gb->gameBoy ? gb->gameBoy->ppu.frameBuffer.data() : nullptr;
+}
+
+const uint8_t *shellboy_wram(const shellboy *gb) {
+  // Never forked here, so WRAM has never borrowed a page and is still the
+  // one block it was allocated as
+  return gb->gameBoy ? gb->gameBoy->bus.workRam().data() : nullptr;
+}
+
+} // extern "C"
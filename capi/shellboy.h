@@ -0,0 +1,99 @@
+#ifndef SHELLBOY_H
+#define SHELLBOY_H
+
+/* libshellboy: one Game Boy per handle behind a plain C ABI, for harnesses
+ * in other languages (ctypes, cffi, Rust FFI, ...).
+ *
+ * A handle is not thread-safe, but separate handles can run on separate
+ * threads. The frame buffer and WRAM are handed out as pointers into the
+ * running machine: read them after shellboy_run_frames() returns, with no
+ * copying. They stay valid until the next ROM load or shellboy_destroy().
+ *
+ * Functions returning int return 0 on success and -1 on failure, with
+ * shellboy_error() saying why.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#if defined(_WIN32)
+#ifdef SHELLBOY_BUILD
+#define SHELLBOY_API __declspec(dllexport)
+#else
+#define SHELLBOY_API __declspec(dllimport)
+#endif
+#else
+#define SHELLBOY_API __attribute__((visibility("default")))
+#endif
+
+/* Bumped whenever a signature or the meaning of a call changes */
+#define SHELLBOY_ABI_VERSION 1
+
+#define SHELLBOY_SCREEN_WIDTH 160
+#define SHELLBOY_SCREEN_HEIGHT 144
+#define SHELLBOY_WRAM_SIZE 0x2000
+
+/* Bits of shellboy_set_buttons(); set means held */
+#define SHELLBOY_BUTTON_RIGHT 0x01
+#define SHELLBOY_BUTTON_LEFT 0x02
+#define SHELLBOY_BUTTON_UP 0x04
+#define SHELLBOY_BUTTON_DOWN 0x08
+#define SHELLBOY_BUTTON_A 0x10
+#define SHELLBOY_BUTTON_B 0x20
+#define SHELLBOY_BUTTON_SELECT 0x40
+#define SHELLBOY_BUTTON_START 0x80
+
+typedef struct shellboy shellboy;
+
+/* SHELLBOY_ABI_VERSION of the library actually loaded */
+SHELLBOY_API uint32_t shellboy_abi_version(void);
+
+/* NULL if out of memory. Nothing runs until a ROM is loaded. */
+SHELLBOY_API shellboy *shellboy_create(void);
+SHELLBOY_API void shellboy_destroy(shellboy *gb);
+
+/* Loading a ROM powers on a fresh machine; on failure the previous one, if
+ * any, is kept. The memory version copies `data`. */
+SHELLBOY_API int shellboy_load_rom_file(shellboy *gb, const char *path);
+SHELLBOY_API int shellboy_load_rom_memory(shellboy *gb, const void *data,
+                                          size_t size);
+
+/* Why the last call on `gb` failed; empty if it didn't. Owned by the
+ * handle, valid until its next call. */
+SHELLBOY_API const char *shellboy_error(const shellboy *gb);
+
+/* Runs `frames` whole frames. */
+SHELLBOY_API int shellboy_run_frames(shellboy *gb, uint32_t frames);
+
+/* Replaces the buttons held with `buttons` (SHELLBOY_BUTTON_* bits). */
+SHELLBOY_API void shellboy_set_buttons(shellboy *gb, uint8_t buttons);
+
+/* Snapshots of the whole machine. Saving writes the snapshot to `buffer` if
+ * it fits in `capacity` bytes and returns its size either way, so a call
+ * with capacity 0 sizes the buffer; 0 means there is no ROM loaded. The size
+ * only changes with the ROM. Loading reads `size` bytes from `data`, which
+ * must come from the same ROM and library version; if it fails, the machine
+ * is left exactly as it was. */
+SHELLBOY_API size_t shellboy_save_state(shellboy *gb, void *buffer,
+                                        size_t capacity);
+SHELLBOY_API int shellboy_load_state(shellboy *gb, const void *data,
+                                     size_t size);
+
+/* SHELLBOY_SCREEN_WIDTH x SHELLBOY_SCREEN_HEIGHT bytes, row by row, one
+ * shade per pixel: 0 white, 1 light gray, 2 dark gray, 3 black. NULL
+ * without a ROM. */
+SHELLBOY_API const uint8_t *shellboy_frame_buffer(const shellboy *gb);
+
+/* The SHELLBOY_WRAM_SIZE bytes at 0xC000-0xDFFF, where games keep their
+ * state. NULL without a ROM. */
+SHELLBOY_API const uint8_t *shellboy_wram(const shellboy *gb);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SHELLBOY_H */
@@ -1,17 +1,28 @@
 #include "Bus.h"
 #include "core/Joypad.h"
 #include "core/PPU.h"
+#include "core/SaveState.h"
+#include "core/Scheduler.h"
 #include "core/Timer.h"
 #include "mmu/Cartridge.h"
 
+namespace {
+
+// Backs the pages of components a bare Bus (tests) doesn't have
+const std::array<uint8_t, 0x100> ZERO_PAGE{};
+
+} // namespace
+
 Bus::Bus() {
-  // Initialize memory to 0
-  memory.fill(0);
+  remapWorkRam();
+  remapCartridge();
+  remapVideo();
 }
 
 Bus::~Bus() {}
 
-uint8_t Bus::read(uint16_t address) const {
+uint8_t Bus::readSlow(uint16_t address) const {
+  // HRAM and IE never get here, see read()
   if (address == 0xFF00) {
     if (joypad)
       return joypad->read();
@@ -27,8 +38,8 @@ uint8_t Bus::read(uint16_t address) const {
   } else if (address >= SRAM_START && address <= SRAM_END) {
     if (cartridge)
       return cartridge->read(address);
-  } else if (address >= ECHO_START && address <= ECHO_END) {
-    return memory[address - 0x2000];
+  } else if (address >= WRAM_START && address <= ECHO_END) {
+    return wram.read((address - WRAM_START) & 0x1FFF);
   } else if (address >= OAM_START && address <= OAM_END) {
     if (ppu)
       return ppu->readOAM(address);
@@ -36,60 +47,97 @@ uint8_t Bus::read(uint16_t address) const {
     if (timer)
       return timer->read(address);
   } else if (address == 0xFF46) {
-    return memory[0xFF46];
+    return io[0xFF46 - IO_START];
   } else if (address >= 0xFF40 && address <= 0xFF4B) {
     if (ppu)
       return ppu->readReg(address);
   }
-  return memory[address];
+  // Other I/O registers are plain storage; the rest is unmapped (or has no
+  // component behind it)
+  return address >= IO_START ? io[address - IO_START] : 0x00;
 }
 
-void Bus::write(uint16_t address, uint8_t value) {
-  if (address == 0xFF00) {
+void Bus::writeSlow(uint16_t address, uint8_t value) {
+  if (codePages[address >> 8] &&
+      (address < IO_START || address >= HRAM_START)) {
+    invalidateCodePage(address >> 8);
+  }
+
+  if (address >= HRAM_START) {
+    io[address - IO_START] = value; // HRAM and IE
+    return;
+  } else if (address == 0xFF00) {
     if (joypad)
       joypad->write(value);
     return;
-  } else if (address >= ROM0_START && address <= ROM0_END) {
-    if (cartridge)
-      cartridge->write(address, value);
-    return;
-  } else if (address >= ROMX_START && address <= ROMX_END) {
-    if (cartridge)
+  } else if (address >= ROM0_START && address <= ROMX_END) {
+    // MBC control registers: banking may have changed
+    if (cartridge) {
       cartridge->write(address, value);
+      remapCartridge();
+    }
+    romWrites++;
     return;
   } else if (address >= VRAM_START && address <= VRAM_END) {
-    if (ppu)
+    if (ppu) {
       ppu->write(address, value);
+      // Unless locked, the page was shared and has just been copied
+      if (ppu->getMode() != PPU::Mode::PixelTransfer) {
+        uint8_t *page = ppu->videoRam().ownedPage((address - VRAM_START) >> 8);
+        readPages[address >> 8] = page;
+        writePages[address >> 8] = page;
+      }
+    }
     return;
   } else if (address >= SRAM_START && address <= SRAM_END) {
-    if (cartridge)
+    if (cartridge) {
       cartridge->write(address, value);
+      // The page may have just been copied on write
+      if (uint8_t *page = cartridge->ramWritePage(address)) {
+        readPages[address >> 8] = page;
+        writePages[address >> 8] = page;
+      }
+    }
     return;
-  } else if (address >= ECHO_START && address <= ECHO_END) {
-    memory[address - 0x2000] = value;
+  } else if (address >= WRAM_START && address <= ECHO_END) {
+    // Watched for code, or still shared with another machine
+    uint16_t offset = (address - WRAM_START) & 0x1FFF;
+    wram.write(offset, value);
+    remapWorkRamPage(offset >> 8);
     return;
   } else if (address >= OAM_START && address <= OAM_END) {
     if (ppu)
       ppu->writeOAM(address, value);
     return;
   } else if (address >= 0xFF04 && address <= 0xFF07) {
-    if (timer)
+    if (timer) {
       timer->write(address, value);
+      if (scheduler)
+        scheduler->scheduleTimer();
+    }
     return;
   } else if (address == 0xFF46) {
     // OAM DMA Transfer
-    uint16_t source = static_cast<uint16_t>(value) << 8;
-    for (uint16_t i = 0; i < 0xA0; i++) {
-      write(0xFE00 + i, read(source + i));
+    io[0xFF46 - IO_START] = value;
+    if (scheduler) {
+      scheduler->schedule(Scheduler::Event::Dma,
+                          scheduler->now() + Scheduler::DMA_CYCLES);
+    } else {
+      transferOam();
     }
-    memory[0xFF46] = value;
     return;
   } else if (address >= 0xFF40 && address <= 0xFF4B) {
-    if (ppu)
+    if (ppu) {
+      if (scheduler)
+        scheduler->syncVideo();
       ppu->writeReg(address, value);
+      if (scheduler)
+        scheduler->syncVideo();
+    }
     return;
   }
-  memory[address] = value;
+  if (address >= IO_START)
+    io[address - IO_START] = value;
 }
 
 uint16_t Bus::read16(uint16_t address) const {
@@ -103,14 +151,128 @@ void Bus::write16(uint16_t address, uint16_t value) {
   write(address + 1, value >> 8);
 }
 
-void Bus::setCartridge(Cartridge *cart) { cartridge = cart; }
+void Bus::setCartridge(Cartridge *cart) {
+  cartridge = cart;
+  remapCartridge();
+}
 
-void Bus::setPPU(PPU *pixel_unit) { ppu = pixel_unit; }
+void Bus::setPPU(PPU *pixel_unit) {
+  ppu = pixel_unit;
+  remapVideo();
+}
 
 void Bus::setTimer(Timer *t) { timer = t; }
 void Bus::setJoypad(Joypad *j) { joypad = j; }
+void Bus::setScheduler(Scheduler *s) { scheduler = s; }
+
+void Bus::transferOam() {
+  uint16_t source = static_cast<uint16_t>(io[0xFF46 - IO_START]) << 8;
+  for (uint16_t i = 0; i < 0xA0; i++) {
+    write(0xFE00 + i, read(source + i));
+  }
+}
 
 void Bus::requestInterrupt(uint8_t interrupt) {
   uint8_t if_reg = read(0xFF0F);
   write(0xFF0F, if_reg | interrupt);
 }
+
+void Bus::remapCartridge() {
+  // Without a cartridge, reads see zeros and writes are dropped, matching
+  // the behaviour of the slow path.
+  for (int page = ROM0_START >> 8; page <= (ROMX_END >> 8); page++) {
+    readPages[page] = cartridge ? cartridge->romPage(page << 8)
+                                : ZERO_PAGE.data();
+    writePages[page] = nullptr;
+  }
+  for (int page = SRAM_START >> 8; page <= (SRAM_END >> 8); page++) {
+    if (cartridge) {
+      readPages[page] = cartridge->ramReadPage(page << 8);
+      writePages[page] = cartridge->ramWritePage(page << 8);
+    } else {
+      readPages[page] = ZERO_PAGE.data();
+      writePages[page] = nullptr;
+    }
+  }
+}
+
+void Bus::remapVideo() {
+  // VRAM is locked while the PPU is drawing; leave those pages to the slow
+  // path so PPU::read/PPU::write can return 0xFF and drop writes. Pages
+  // still shared with another machine take writes through the slow path too.
+  for (int page = VRAM_START >> 8; page <= (VRAM_END >> 8); page++) {
+    if (!ppu) {
+      readPages[page] = ZERO_PAGE.data();
+      writePages[page] = nullptr;
+    } else if (ppu->getMode() == PPU::Mode::PixelTransfer) {
+      readPages[page] = nullptr;
+      writePages[page] = nullptr;
+    } else {
+      int index = page - (VRAM_START >> 8);
+      readPages[page] = ppu->videoRam().readPage(index);
+      writePages[page] = ppu->videoRam().ownedPage(index);
+    }
+  }
+}
+
+void Bus::remapWorkRam() {
+  for (int index = 0; index < (WRAM_END - WRAM_START + 1) >> 8; index++)
+    remapWorkRamPage(index);
+}
+
+void Bus::remapWorkRamPage(int index) {
+  // Borrowed pages and pages watched for code take writes through the slow
+  // path
+  for (int page : {(WRAM_START >> 8) + index, (ECHO_START >> 8) + index}) {
+    if (page > (ECHO_END >> 8))
+      continue;
+    readPages[page] = wram.readPage(index);
+    writePages[page] = codePages[page] ? nullptr : wram.ownedPage(index);
+  }
+}
+
+int Bus::romBank() const { return cartridge ? cartridge->currentRomBank() : 0; }
+
+void Bus::watchCodePage(uint8_t page) {
+  // WRAM pages are also reachable through their echo
+  codePages[page] = true;
+  writePages[page] = nullptr;
+  if (page >= (WRAM_START >> 8) && page + 0x20 <= (ECHO_END >> 8)) {
+    codePages[page + 0x20] = true;
+    writePages[page + 0x20] = nullptr;
+  }
+}
+
+void Bus::invalidateCodePage(uint8_t page) {
+  if (page >= (ECHO_START >> 8) && page <= (ECHO_END >> 8))
+    page -= 0x20;
+
+  pageEpochs[page]++;
+  codePages[page] = false;
+  if (page >= (WRAM_START >> 8) && page <= (WRAM_END >> 8)) {
+    if (page + 0x20 <= (ECHO_END >> 8))
+      codePages[page + 0x20] = false;
+    remapWorkRamPage(page - (WRAM_START >> 8));
+  }
+}
+
+void Bus::saveState(StateWriter &out) const {
+  wram.saveState(out);
+  out.put(io);
+}
+
+bool Bus::loadState(StateReader &in) {
+  wram.loadState(in);
+  in.get(io);
+
+  // RAM under the CPU's cached blocks was replaced wholesale: bump the
+  // epoch of every page holding code
+  for (int page = 0; page < 0x100; page++) {
+    if (codePages[page])
+      invalidateCodePage(page);
+  }
+  remapWorkRam();
+  remapCartridge();
+  remapVideo();
+  return in.ok();
+}
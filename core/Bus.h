@@ -1,5 +1,6 @@
 #pragma once
 
+#include "mmu/PagedRam.h"
 #include <array>
 #include <cstdint>
 
@@ -7,14 +8,47 @@ class Cartridge;
 class PPU;
 class Timer;
 class Joypad;
+class Scheduler;
+class StateWriter;
+class StateReader;
 
 class Bus {
 public:
   Bus();
   ~Bus();
 
-  uint8_t read(uint16_t address) const;
-  void write(uint16_t address, uint8_t value);
+  // Fast path: pages backed by plain host memory (ROM, WRAM, echo, mapped
+  // VRAM/SRAM) are a single indexed load, and so is HRAM at the top of the
+  // I/O page. Everything else goes through the MMIO handlers in
+  // readSlow()/writeSlow().
+  uint8_t read(uint16_t address) const {
+    const uint8_t *page = readPages[address >> 8];
+    if (page)
+      return page[address & 0xFF];
+    if (address >= HRAM_START)
+      return io[address - IO_START]; // HRAM and IE
+    return readSlow(address);
+  }
+
+  void write(uint16_t address, uint8_t value) {
+    uint8_t *page = writePages[address >> 8];
+    if (page) {
+      page[address & 0xFF] = value;
+      return;
+    }
+    // Unless code is running from HRAM
+    if (address >= HRAM_START && !codePages[HRAM_START >> 8]) {
+      io[address - IO_START] = value;
+      return;
+    }
+    writeSlow(address, value);
+  }
+
+  // 0xFF00-0xFF7F: registers backed by devices that must be caught up with
+  // the clock before they are accessed
+  static bool isIO(uint16_t address) {
+    return address >= IO_START && address <= IO_END;
+  }
 
   uint16_t read16(uint16_t address) const;
   void write16(uint16_t address, uint16_t value);
@@ -23,6 +57,13 @@ public:
   void setPPU(PPU *pixel_unit);
   void setTimer(Timer *t);
   void setJoypad(Joypad *j);
+  // With a scheduler, OAM DMA completes after Scheduler::DMA_CYCLES, LCD
+  // register writes resynchronise the PPU's events and timer register writes
+  // reschedule the TIMA overflow.
+  void setScheduler(Scheduler *s);
+
+  // Copy 0xA0 bytes from the last page written to 0xFF46 into OAM.
+  void transferOam();
 
   // Interrupt Bit Constants
   static constexpr uint8_t INTERRUPT_VBLANK = 0x01;
@@ -33,6 +74,36 @@ public:
 
   void requestInterrupt(uint8_t interrupt);
 
+  // Rebuild the page table entries served by the cartridge (ROM0, ROMX and
+  // SRAM). Must be called whenever the MBC banking state may have changed.
+  void remapCartridge();
+  // Rebuild the VRAM page table entries. VRAM is only directly accessible
+  // while the PPU is not in pixel transfer.
+  void remapVideo();
+  // Rebuild the WRAM and echo page table entries, after the pages behind
+  // workRam() were swapped (PagedRam::borrow()).
+  void remapWorkRam();
+
+  // 0xC000-0xDFFF, also seen through the echo at 0xE000-0xFDFF
+  PagedRam &workRam() { return wram; }
+  const PagedRam &workRam() const { return wram; }
+
+  // ROM bank mapped at 0x4000-0x7FFF (0 without a cartridge).
+  int romBank() const;
+
+  // Self-modifying code detection for the CPU block cache. Watching a RAM
+  // page routes its writes through the slow path; the first write bumps
+  // the page's epoch and stops watching it until the next watchCodePage().
+  void watchCodePage(uint8_t page);
+  uint32_t pageEpoch(uint8_t page) const { return pageEpochs[page]; }
+  // Number of writes to the MBC control registers so far.
+  uint32_t romWriteCount() const { return romWrites; }
+
+  // Snapshot support, see SaveState.h. Saves WRAM and 0xFF00-0xFFFF; the
+  // rest of the map belongs to other components.
+  void saveState(StateWriter &out) const;
+  bool loadState(StateReader &in);
+
 private:
   static constexpr uint16_t ROM0_START = 0x0000;
   static constexpr uint16_t ROM0_END = 0x3FFF;
@@ -56,10 +127,32 @@ private:
   static constexpr uint16_t HRAM_END = 0xFFFE;
   static constexpr uint16_t IE_REG = 0xFFFF;
 
-  std::array<uint8_t, 0x10000> memory{}; // Simple 64KB memory map for now
+  // Hot state first: the page tables every access goes through, then what
+  // the slow path needs, then the memory the Bus itself holds.
+
+  // One entry per 256-byte page. A non-null entry points at the host memory
+  // backing that page; a null entry routes the access to the slow path.
+  std::array<const uint8_t *, 0x100> readPages{};
+  std::array<uint8_t *, 0x100> writePages{};
 
+  uint8_t readSlow(uint16_t address) const;
+  void writeSlow(uint16_t address, uint8_t value);
+
+  // Null on a Bus used on its own (tests, Lockstep lanes); a GameBoy wires
+  // all of them, but the slow path still checks
   Cartridge *cartridge = nullptr;
   PPU *ppu = nullptr;
   Timer *timer = nullptr;
   Joypad *joypad = nullptr;
+  Scheduler *scheduler = nullptr;
+
+  std::array<bool, 0x100> codePages{};
+  std::array<uint32_t, 0x100> pageEpochs{};
+  uint32_t romWrites = 0;
+  void invalidateCodePage(uint8_t page);
+  void remapWorkRamPage(int index);
+
+  // Everything else is served by the other components
+  PagedRam wram{WRAM_END - WRAM_START + 1};
+  std::array<uint8_t, 0x100> io{}; // 0xFF00-0xFFFF: I/O, HRAM and IE
 };
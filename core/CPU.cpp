@@ -1,7 +1,11 @@
 #include "CPU.h"
+#include "SaveState.h"
+#include <algorithm>
 #include <cstdio>
 #include <cstdlib>
 
+static int cbCycles(uint8_t opcode);
+
 CPU::CPU(Bus &b) : bus(b) { reset(); }
 
 CPU::~CPU() {}
@@ -16,9 +20,11 @@ void CPU::reset() {
   SP = 0xFFFE;
   PC = 0x0100;
   IME = false;
+  flagOp = FlagOp::None;
 }
 
 void CPU::setFlag(uint8_t flag, bool value) {
+  syncFlags();
   if (value) {
     AF.lo |= flag;
   } else {
@@ -26,7 +32,58 @@ void CPU::setFlag(uint8_t flag, bool value) {
   }
 }
 
-bool CPU::getFlag(uint8_t flag) const { return (AF.lo & flag) != 0; }
+bool CPU::getFlag(uint8_t flag) const {
+  if (flagOp == FlagOp::None)
+    return (AF.lo & flag) != 0;
+  if (flag == FLAG_Z) // Every recorded op sets Z from its result
+    return flagResult == 0;
+  return (computeFlags() & flag) != 0;
+}
+
+void CPU::syncFlags() {
+  if (flagOp != FlagOp::None) {
+    AF.lo = computeFlags();
+    flagOp = FlagOp::None;
+  }
+}
+
+uint8_t CPU::computeFlags() const {
+  uint8_t flags = flagResult == 0 ? FLAG_Z : 0;
+  switch (flagOp) {
+  case FlagOp::Add:
+    if ((flagA & 0x0F) + (flagB & 0x0F) + flagCarry > 0x0F)
+      flags |= FLAG_H;
+    if (flagA + flagB + flagCarry > 0xFF)
+      flags |= FLAG_C;
+    break;
+  case FlagOp::Sub:
+    flags |= FLAG_N;
+    if ((flagA & 0x0F) < (flagB & 0x0F) + flagCarry)
+      flags |= FLAG_H;
+    if (flagA < flagB + flagCarry)
+      flags |= FLAG_C;
+    break;
+  case FlagOp::And:
+    flags |= FLAG_H;
+    break;
+  case FlagOp::Or:
+    break;
+  case FlagOp::Inc: // C is untouched and still valid in AF.lo
+    if ((flagResult & 0x0F) == 0)
+      flags |= FLAG_H;
+    flags |= AF.lo & FLAG_C;
+    break;
+  case FlagOp::Dec:
+    flags |= FLAG_N;
+    if ((flagResult & 0x0F) == 0x0F)
+      flags |= FLAG_H;
+    flags |= AF.lo & FLAG_C;
+    break;
+  case FlagOp::None:
+    return AF.lo;
+  }
+  return flags;
+}
 
 void CPU::pushStack(uint16_t value) {
   SP -= 2;
@@ -64,6 +121,10 @@ void CPU::handleInterrupts() {
   }
 }
 
+bool CPU::interruptPending() const {
+  return (bus.read(0xFFFF) & bus.read(0xFF0F)) != 0;
+}
+
 uint8_t CPU::fetch() {
   uint8_t val = bus.read(PC);
   PC++;
@@ -83,1558 +144,1030 @@ int CPU::tick() {
     return 4; // CPU in HALT still consumes cycles (mostly)
   }
 
+  retired++;
   uint8_t opcode = fetch();
   return execute(opcode);
 }
 
-int CPU::execute(uint8_t opcode) {
-  // Handle 8-bit INC, DEC, and LD r, n8 generically if they are non-(HL)
-  if (opcode <= 0x3F) {
-    uint8_t op_type = opcode & 0x07;
-    uint8_t r = (opcode >> 3) & 0x07;
-    if (r != 6) {
-      if (op_type == 0x04) { // INC r
-        uint8_t val = 0;
-        switch (r) {
-        case 0:
-          val = ++BC.hi;
-          break;
-        case 1:
-          val = ++BC.lo;
-          break;
-        case 2:
-          val = ++DE.hi;
-          break;
-        case 3:
-          val = ++DE.lo;
-          break;
-        case 4:
-          val = ++HL.hi;
-          break;
-        case 5:
-          val = ++HL.lo;
-          break;
-        case 7:
-          val = ++AF.hi;
-          break;
-        }
-        setFlag(FLAG_Z, val == 0);
-        setFlag(FLAG_N, false);
-        setFlag(FLAG_H,
-                (val & 0x0F) == 0); // h happens when lower nibble cascades,
-                                    // value after inc has lowest nibble 0
-        return 4;
-      } else if (op_type == 0x05) { // DEC r
-        uint8_t val = 0;
-        switch (r) {
-        case 0:
-          val = --BC.hi;
-          break;
-        case 1:
-          val = --BC.lo;
-          break;
-        case 2:
-          val = --DE.hi;
-          break;
-        case 3:
-          val = --DE.lo;
-          break;
-        case 4:
-          val = --HL.hi;
-          break;
-        case 5:
-          val = --HL.lo;
-          break;
-        case 7:
-          val = --AF.hi;
-          break;
-        }
-        setFlag(FLAG_Z, val == 0);
-        setFlag(FLAG_N, true);
-        setFlag(FLAG_H,
-                (val & 0x0F) == 0x0F); // h happens when borrowing from bit 4,
-                                       // so lower nibble becomes 0xF
-        return 4;
-      } else if (op_type == 0x06) { // LD r, n8
-        uint8_t val = fetch();
-        switch (r) {
-        case 0:
-          BC.hi = val;
-          break;
-        case 1:
-          BC.lo = val;
-          break;
-        case 2:
-          DE.hi = val;
-          break;
-        case 3:
-          DE.lo = val;
-          break;
-        case 4:
-          HL.hi = val;
-          break;
-        case 5:
-          HL.lo = val;
-          break;
-        case 7:
-          AF.hi = val;
-          break;
-        }
-        return 8;
-      }
-    }
+int CPU::runBlock() {
+  handleInterrupts();
+  idle = false;
+
+  if (halted) {
+    return 4;
   }
 
-  // Handle LD r, r' generically (0x40 - 0x7F) omitting (HL)
-  if (opcode >= 0x40 && opcode <= 0x7F && opcode != 0x76) {
-    uint8_t r = (opcode >> 3) & 0x07;
-    uint8_t r_prime = opcode & 0x07;
-
-    // If neither is (HL), it's a register-to-register load
-    if (r != 6 && r_prime != 6) {
-      uint8_t val = 0;
-      switch (r_prime) {
-      case 0:
-        val = BC.hi;
-        break;
-      case 1:
-        val = BC.lo;
-        break;
-      case 2:
-        val = DE.hi;
-        break;
-      case 3:
-        val = DE.lo;
-        break;
-      case 4:
-        val = HL.hi;
-        break;
-      case 5:
-        val = HL.lo;
-        break;
-      case 7:
-        val = AF.hi;
-        break;
-      }
+  Block *block = lookupBlock();
+  if (!block) {
+    retired++;
+    return execute(fetch());
+  }
+  if (!block->idleLoop) {
+    return runDecodedBlock(*block);
+  }
 
-      switch (r) {
-      case 0:
-        BC.hi = val;
-        break;
-      case 1:
-        BC.lo = val;
-        break;
-      case 2:
-        DE.hi = val;
-        break;
-      case 3:
-        DE.lo = val;
-        break;
-      case 4:
-        HL.hi = val;
-        break;
-      case 5:
-        HL.lo = val;
-        break;
-      case 7:
-        AF.hi = val;
-        break;
+  // Idle if a full iteration left every register as it found it
+  uint16_t start = PC;
+  syncFlags();
+  std::array<uint16_t, 5> before{AF.reg16, BC.reg16, DE.reg16, HL.reg16, SP};
+  int cycles = runDecodedBlock(*block);
+  syncFlags();
+  std::array<uint16_t, 5> after{AF.reg16, BC.reg16, DE.reg16, HL.reg16, SP};
+  idle = PC == start && before == after;
+  idlePollsDiv = block->pollsDiv;
+  idleOps = block->ops.size();
+  return cycles;
+}
+
+int CPU::runDecodedBlock(Block &block) {
+  size_t start = 0;
+  int cycles = 0;
+  if (useJit && !block.ram) {
+    if (!block.native && ++block.runs == JIT_THRESHOLD) {
+      translateBlock(block);
+    }
+    if (block.native) {
+      start = runNative(block, cycles);
+      if (start < block.nativeOps && block.checked) {
+        retired += start;
+        return cycles; // Switched ROM banks under a ROMX block
       }
-      return 4;
     }
   }
-
-  // Initial switch statement for execution.
-  // 0x00 is NOP, which takes 4 T-cycles.
-  switch (opcode) {
-  case 0x00: // NOP
-    return 4;
-  case 0x17: { // RLA
-    bool old_c = getFlag(FLAG_C);
-    bool c = (AF.hi & 0x80) != 0;
-    AF.hi = (AF.hi << 1) | (old_c ? 1 : 0);
-    setFlag(FLAG_Z, false);
-    setFlag(FLAG_N, false);
-    setFlag(FLAG_H, false);
-    setFlag(FLAG_C, c);
-    return 4;
-  }
-  case 0x1F: { // RRA
-    bool old_c = getFlag(FLAG_C);
-    bool c = (AF.hi & 0x01) != 0;
-    AF.hi = (AF.hi >> 1) | (old_c ? 0x80 : 0);
-    setFlag(FLAG_Z, false);
-    setFlag(FLAG_N, false);
-    setFlag(FLAG_H, false);
-    setFlag(FLAG_C, c);
-    return 4;
+  if (block.checked) {
+    return runCheckedBlock(block, start, cycles);
   }
-  case 0x27: { // DAA
-    uint16_t a = AF.hi;
-    if (getFlag(FLAG_N)) {
-      if (getFlag(FLAG_H))
-        a = (a - 0x6) & 0xFF;
-      if (getFlag(FLAG_C))
-        a -= 0x60;
-    } else {
-      if (getFlag(FLAG_H) || (a & 0xF) > 9)
-        a += 0x6;
-      if (getFlag(FLAG_C) || a > 0x9F)
-        a += 0x60;
+
+  const DecodedOp *first = block.ops.data();
+  const DecodedOp *op = first + start;
+  const DecodedOp *last = first + block.ops.size() - 1;
+  for (; op != last; ++op) {
+    if (block.pointers && op != first && reachesIO(*op)) {
+      return stopBefore(block, op - first);
     }
-    setFlag(FLAG_H, false);
-    if (a & 0x100)
-      setFlag(FLAG_C, true);
-    a &= 0xFF;
-    AF.hi = static_cast<uint8_t>(a);
-    setFlag(FLAG_Z, AF.hi == 0);
-    return 4;
-  }
-  case 0x37: // SCF
-    setFlag(FLAG_N, false);
-    setFlag(FLAG_H, false);
-    setFlag(FLAG_C, true);
-    return 4;
-  case 0x3F: // CCF
-    setFlag(FLAG_N, false);
-    setFlag(FLAG_H, false);
-    setFlag(FLAG_C, !getFlag(FLAG_C));
-    return 4;
-  case 0x01: // LD BC, n16
-    BC.reg16 = fetch16();
-    return 12;
-  case 0x02: // LD (BC), A
-    bus.write(BC.reg16, AF.hi);
-    return 8;
-  case 0x03: // INC BC
-    BC.reg16++;
-    return 8;
+    PC += op->length;
+#ifdef SHELLBOY_OPCODE_STATS
+    stats.record(op->opcode, op->operand, (this->*op->handler)(op->operand));
+#else
+    (this->*op->handler)(op->operand);
+#endif
+  }
+  if (block.pointers && last != first && reachesIO(*last)) {
+    return stopBefore(block, last - first);
+  }
+  retired += block.ops.size();
+  PC += last->length;
+  int lastCycles = (this->*last->handler)(last->operand);
+#ifdef SHELLBOY_OPCODE_STATS
+  stats.record(last->opcode, last->operand, lastCycles);
+#endif
+  return block.cycles + lastCycles;
+}
 
-  case 0x08: // LD (nn), SP
-    bus.write(fetch16(), SP & 0xFF);
-    bus.write(PC - 1 + 1, SP >> 8); // Wait, fetch16 already advanced PC by 2.
-    // Let's rewrite this correctly:
-    {
-      uint16_t addr = fetch16();
-      bus.write(addr, SP & 0xFF);
-      bus.write(addr + 1, SP >> 8);
-      return 20;
+// Stops early if the block rewrote its own page or switched ROM banks, and
+// before an op past the first that would reach I/O through a register pair.
+// The next block then starts at that op.
+int CPU::runCheckedBlock(const Block &block, size_t start, int cycles) {
+  uint32_t romWrites = bus.romWriteCount();
+  retired += start;
+  for (size_t i = start; i < block.ops.size(); i++) {
+    const DecodedOp &op = block.ops[i];
+    if (block.pointers && i > 0 && reachesIO(op)) {
+      break;
+    }
+    PC += op.length;
+    int elapsed = (this->*op.handler)(op.operand);
+#ifdef SHELLBOY_OPCODE_STATS
+    stats.record(op.opcode, op.operand, elapsed);
+#endif
+    cycles += elapsed;
+    retired++;
+    if (block.ram ? bus.pageEpoch(block.page) != block.epoch
+                  : bus.romWriteCount() != romWrites) {
+      break;
     }
-  case 0x09: { // ADD HL, BC
-    uint32_t res = HL.reg16 + BC.reg16;
-    setFlag(FLAG_N, false);
-    setFlag(FLAG_H, (HL.reg16 & 0x0FFF) + (BC.reg16 & 0x0FFF) > 0x0FFF);
-    setFlag(FLAG_C, res > 0xFFFF);
-    HL.reg16 = res & 0xFFFF;
-    return 8;
   }
-  case 0x0A: // LD A, (BC)
-    AF.hi = bus.read(BC.reg16);
-    return 8;
-  case 0x0B: // DEC BC
-    BC.reg16--;
-    return 8;
+  return cycles;
+}
 
-  case 0x04: { // INC B
-    bool h = (BC.hi & 0x0F) == 0x0F;
-    BC.hi++;
-    setFlag(FLAG_Z, BC.hi == 0);
-    setFlag(FLAG_N, false);
-    setFlag(FLAG_H, h);
-    return 4;
+// Ends a block before ops[index], which hasn't run. Only the last op can
+// branch, so the ones before it took their usual cycles.
+int CPU::stopBefore(const Block &block, size_t index) {
+  int cycles = 0;
+  for (size_t i = 0; i < index; i++) {
+    const DecodedOp &op = block.ops[i];
+    cycles += op.opcode == 0xCB ? cbCycles(op.operand) : opCycles[op.opcode];
+  }
+  retired += index;
+  return cycles;
+}
+
+bool CPU::reachesIO(const DecodedOp &op) const {
+  switch (op.pointer) {
+  case 0:
+    return Bus::isIO(BC.reg16);
+  case 1:
+    return Bus::isIO(DE.reg16);
+  case 2:
+    return Bus::isIO(HL.reg16);
+  default:
+    return false;
   }
-  case 0x05: { // DEC B
-    bool h = (BC.hi & 0x0F) == 0;
-    BC.hi--;
-    setFlag(FLAG_Z, BC.hi == 0);
-    setFlag(FLAG_N, true);
-    setFlag(FLAG_H, h);
-    return 4;
+}
+
+size_t CPU::runNative(const Block &block, int &cycles) {
+  syncFlags();
+  Jit::Registers regs{AF.reg16, BC.reg16, DE.reg16, HL.reg16, SP};
+  int done = block.native(&regs, &bus);
+  AF.reg16 = regs.af;
+  BC.reg16 = regs.bc;
+  DE.reg16 = regs.de;
+  HL.reg16 = regs.hl;
+  SP = regs.sp;
+
+  if (done == block.nativeOps) {
+    PC += block.nativeLength;
+    cycles = block.nativeCycles;
+    return done;
   }
-  case 0x06: // LD B, n8
-    BC.hi = fetch();
-    return 8;
-  case 0x07: { // RLCA
-    bool c = (AF.hi & 0x80) != 0;
-    AF.hi = (AF.hi << 1) | (c ? 1 : 0);
-    setFlag(FLAG_Z, false);
-    setFlag(FLAG_N, false);
-    setFlag(FLAG_H, false);
-    setFlag(FLAG_C, c);
-    return 4;
+  for (int i = 0; i < done; i++) {
+    PC += block.ops[i].length;
+    cycles += opCycles[block.ops[i].opcode];
   }
-  case 0x0C: { // INC C
-    bool h = (BC.lo & 0x0F) == 0x0F;
-    BC.lo++;
-    setFlag(FLAG_Z, BC.lo == 0);
-    setFlag(FLAG_N, false);
-    setFlag(FLAG_H, h);
-    return 4;
+  return done;
+}
+
+void CPU::translateBlock(Block &block) {
+  // The last op may branch and is always left to the interpreter
+  std::vector<Jit::Instruction> code;
+  for (size_t i = 0; i + 1 < block.ops.size(); i++) {
+    code.push_back({block.ops[i].opcode, block.ops[i].operand});
   }
-  case 0x0D: { // DEC C
-    bool h = (BC.lo & 0x0F) == 0;
-    BC.lo--;
-    setFlag(FLAG_Z, BC.lo == 0);
-    setFlag(FLAG_N, true);
-    setFlag(FLAG_H, h);
-    return 4;
+
+  size_t translated = 0;
+  block.native = jit.compile(code.data(), code.size(), translated);
+  if (!block.native && jit.full()) {
+    // Out of code space: drop every translation and let them warm up again
+    jit.reset();
+    for (auto &[key, other] : blocks) {
+      other.native = nullptr;
+      other.runs = 0;
+    }
+    block.native = jit.compile(code.data(), code.size(), translated);
   }
-  case 0x0E: // LD C, n8
-    BC.lo = fetch();
-    return 8;
-  case 0x0F: { // RRCA
-    bool c = (AF.hi & 0x01) != 0;
-    AF.hi = (AF.hi >> 1) | (c ? 0x80 : 0);
-    setFlag(FLAG_Z, false);
-    setFlag(FLAG_N, false);
-    setFlag(FLAG_H, false);
-    setFlag(FLAG_C, c);
-    return 4;
+  if (!block.native) {
+    return;
   }
 
-  case 0x11: // LD DE, n16
-    DE.reg16 = fetch16();
-    return 12;
-  case 0x12: // LD (DE), A
-    bus.write(DE.reg16, AF.hi);
-    return 8;
-  case 0x13: // INC DE
-    DE.reg16++;
-    return 8;
-
-  case 0x19: { // ADD HL, DE
-    uint32_t res = HL.reg16 + DE.reg16;
-    setFlag(FLAG_N, false);
-    setFlag(FLAG_H, (HL.reg16 & 0x0FFF) + (DE.reg16 & 0x0FFF) > 0x0FFF);
-    setFlag(FLAG_C, res > 0xFFFF);
-    HL.reg16 = res & 0xFFFF;
-    return 8;
+  block.nativeOps = static_cast<uint8_t>(translated);
+  block.nativeLength = 0;
+  block.nativeCycles = 0;
+  for (size_t i = 0; i < translated; i++) {
+    block.nativeLength += block.ops[i].length;
+    block.nativeCycles += opCycles[block.ops[i].opcode];
   }
-  case 0x1A: // LD A, (DE)
-    AF.hi = bus.read(DE.reg16);
-    return 8;
-  case 0x1B: // DEC DE
-    DE.reg16--;
-    return 8;
+}
+
+bool CPU::setJitEnabled(bool enabled) {
+#ifdef SHELLBOY_OPCODE_STATS
+  enabled = false;
+#endif
+  useJit = enabled && jit.init();
+  return useJit;
+}
 
-  case 0x18: { // JR n8
-    int8_t offset = static_cast<int8_t>(fetch());
-    PC += offset;
-    return 12;
+CPU::Block *CPU::lookupBlock() {
+  bool rom = PC < 0x8000;
+  bool ram = (PC >= 0xC000 && PC < 0xE000) || (PC >= 0xFF80 && PC < 0xFFFF);
+  if (!rom && !ram) {
+    return nullptr;
   }
-  case 0x20: { // JR NZ, n8
-    int8_t offset = static_cast<int8_t>(fetch());
-    if (!getFlag(FLAG_Z)) {
-      PC += offset;
-      return 12;
-    }
-    return 8;
+
+  uint32_t key = PC;
+  if (PC >= 0x4000 && rom) {
+    key |= static_cast<uint32_t>(bus.romBank()) << 16;
   }
-  case 0x21: // LD HL, n16
-    HL.reg16 = fetch16();
-    return 12;
-  case 0x22: // LDI (HL+), A
-    bus.write(HL.reg16, AF.hi);
-    HL.reg16++;
-    return 8;
-  case 0x23: // INC HL
-    HL.reg16++;
-    return 8;
 
-  case 0x29: { // ADD HL, HL
-    uint32_t res = HL.reg16 + HL.reg16;
-    setFlag(FLAG_N, false);
-    setFlag(FLAG_H, (HL.reg16 & 0x0FFF) + (HL.reg16 & 0x0FFF) > 0x0FFF);
-    setFlag(FLAG_C, res > 0xFFFF);
-    HL.reg16 = res & 0xFFFF;
-    return 8;
+  auto [it, inserted] = blocks.try_emplace(key);
+  Block &block = it->second;
+  uint8_t page = PC >> 8;
+  if (!inserted && (!block.ram || bus.pageEpoch(page) == block.epoch)) {
+    return &block;
   }
-  case 0x2A: // LDI A, (HL+)
-    AF.hi = bus.read(HL.reg16);
-    HL.reg16++;
-    return 8;
-  case 0x2B: // DEC HL
-    HL.reg16--;
-    return 8;
 
-  case 0x28: { // JR Z, n8
-    int8_t offset = static_cast<int8_t>(fetch());
-    if (getFlag(FLAG_Z)) {
-      PC += offset;
-      return 12;
+  if (ram) {
+    bus.watchCodePage(page);
+  }
+  block.checked = ram || PC >= 0x4000;
+  block.ram = ram;
+  block.page = page;
+  block.epoch = bus.pageEpoch(page);
+  decodeBlock(block);
+  if (block.ops.empty()) { // First instruction straddles a page boundary
+    blocks.erase(it);
+    return nullptr;
+  }
+  return &block;
+}
+
+void CPU::flushBlockCache() {
+  blocks.clear();
+  jit.reset();
+}
+
+size_t CPU::blockCacheBytes() const {
+  // A node per block (key, block, next pointer) plus the bucket array
+  size_t bytes = blocks.bucket_count() * sizeof(void *);
+  for (const auto &[key, block] : blocks) {
+    bytes += sizeof(key) + sizeof(block) + sizeof(void *);
+    bytes += block.ops.capacity() * sizeof(DecodedOp);
+  }
+  return bytes + jit.codeBytes();
+}
+
+static bool endsBlock(uint8_t opcode);
+static bool accessesIO(uint8_t opcode, uint16_t operand);
+static int pointerPair(uint8_t opcode, uint16_t operand);
+static int branchTarget(uint8_t opcode, uint16_t operand, uint16_t next);
+static bool registerOnly(uint8_t opcode, uint16_t operand);
+static int polledRegister(uint8_t opcode, uint16_t operand);
+
+void CPU::decodeBlock(Block &block) {
+  static constexpr size_t MAX_BLOCK_OPS = 32;
+
+  block.ops.clear();
+  block.cycles = 0;
+  block.pointers = false;
+  int lastCycles = 0;
+  uint16_t pc = PC;
+  while (block.ops.size() < MAX_BLOCK_OPS) {
+    uint8_t opcode = bus.read(pc);
+    int length = opLength[opcode];
+    if (((pc + length - 1) >> 8) != block.page) {
+      break;
     }
-    return 8;
-  }
-  case 0x30: { // JR NC, n8
-    int8_t offset = static_cast<int8_t>(fetch());
-    if (!getFlag(FLAG_C)) {
-      PC += offset;
-      return 12;
+
+    uint16_t operand = 0;
+    if (length == 2) {
+      operand = bus.read(pc + 1);
+    } else if (length == 3) {
+      operand = bus.read16(pc + 1);
     }
-    return 8;
-  }
-  case 0x31: // LD SP, n16
-    SP = fetch16();
-    return 12;
-  case 0x32: // LDD (HL-), A
-    bus.write(HL.reg16, AF.hi);
-    HL.reg16--;
-    return 8;
-  case 0x33: // INC SP
-    SP++;
-    return 8;
-  case 0x38: { // JR C, n8
-    int8_t offset = static_cast<int8_t>(fetch());
-    if (getFlag(FLAG_C)) {
-      PC += offset;
-      return 12;
+    if (!block.ops.empty() && accessesIO(opcode, operand)) {
+      break;
     }
-    return 8;
-  }
-  case 0x10: { // STOP
-    fetch();   // Discard the next byte (0x00)
-    // Actually stopping is more complex, just treat as NOP/HALT for now
-    return 4;
-  }
-  case 0x34: { // INC (HL)
-    uint8_t val = bus.read(HL.reg16);
-    bool h = (val & 0x0F) == 0x0F;
-    val++;
-    bus.write(HL.reg16, val);
-    setFlag(FLAG_Z, val == 0);
-    setFlag(FLAG_N, false);
-    setFlag(FLAG_H, h);
-    return 12;
-  }
-  case 0x35: { // DEC (HL)
-    uint8_t val = bus.read(HL.reg16);
-    bool h = (val & 0x0F) == 0;
-    val--;
-    bus.write(HL.reg16, val);
-    setFlag(FLAG_Z, val == 0);
-    setFlag(FLAG_N, true);
-    setFlag(FLAG_H, h);
-    return 12;
-  }
 
-  case 0x39: { // ADD HL, SP
-    uint32_t res = HL.reg16 + SP;
-    setFlag(FLAG_N, false);
-    setFlag(FLAG_H, (HL.reg16 & 0x0FFF) + (SP & 0x0FFF) > 0x0FFF);
-    setFlag(FLAG_C, res > 0xFFFF);
-    HL.reg16 = res & 0xFFFF;
-    return 8;
-  }
-  case 0x3A: // LDD A, (HL-)
-    AF.hi = bus.read(HL.reg16);
-    HL.reg16--;
-    return 8;
-  case 0x3B: // DEC SP
-    SP--;
-    return 8;
-  case 0x36: // LD (HL), n8
-    bus.write(HL.reg16, fetch());
-    return 12;
-  case 0x3E: // LD A, n8
-    AF.hi = fetch();
-    return 8;
-  case 0x46: // LD B, (HL)
-    BC.hi = bus.read(HL.reg16);
-    return 8;
-  case 0x4E: // LD C, (HL)
-    BC.lo = bus.read(HL.reg16);
-    return 8;
-  case 0x56: // LD D, (HL)
-    DE.hi = bus.read(HL.reg16);
-    return 8;
-  case 0x5E: // LD E, (HL)
-    DE.lo = bus.read(HL.reg16);
-    return 8;
-  case 0x66: // LD H, (HL)
-    HL.hi = bus.read(HL.reg16);
-    return 8;
-  case 0x6E: // LD L, (HL)
-    HL.lo = bus.read(HL.reg16);
-    return 8;
-  case 0x7E: // LD A, (HL)
-    AF.hi = bus.read(HL.reg16);
-    return 8;
-  case 0x70: // LD (HL), B
-    bus.write(HL.reg16, BC.hi);
-    return 8;
-  case 0x71: // LD (HL), C
-    bus.write(HL.reg16, BC.lo);
-    return 8;
-  case 0x72: // LD (HL), D
-    bus.write(HL.reg16, DE.hi);
-    return 8;
-  case 0x73: // LD (HL), E
-    bus.write(HL.reg16, DE.lo);
-    return 8;
-  case 0x74: // LD (HL), H
-    bus.write(HL.reg16, HL.hi);
-    return 8;
-  case 0x75: // LD (HL), L
-    bus.write(HL.reg16, HL.lo);
-    return 8;
-  case 0x76: // HALT
-    halted = true;
-    return 4;
-  case 0x77: // LD (HL), A
-    bus.write(HL.reg16, AF.hi);
-    return 8;
-  case 0x2F: // CPL
-    AF.hi = ~AF.hi;
-    setFlag(FLAG_N, true);
-    setFlag(FLAG_H, true);
-    return 4;
-  case 0xEA: // LD (nn), A
-    bus.write(fetch16(), AF.hi);
-    return 16;
-  case 0xFA: // LD A, (nn)
-    AF.hi = bus.read(fetch16());
-    return 16;
-  case 0x80: { // ADD A, B
-    uint8_t val = BC.hi;
-    uint16_t res = AF.hi + val;
-    setFlag(FLAG_H, (AF.hi & 0x0F) + (val & 0x0F) > 0x0F);
-    AF.hi = res & 0xFF;
-    setFlag(FLAG_Z, AF.hi == 0);
-    setFlag(FLAG_N, false);
-    setFlag(FLAG_C, res > 0xFF);
-    return 4;
-  }
-  case 0x81: { // ADD A, C
-    uint8_t val = BC.lo;
-    uint16_t res = AF.hi + val;
-    setFlag(FLAG_H, (AF.hi & 0x0F) + (val & 0x0F) > 0x0F);
-    AF.hi = res & 0xFF;
-    setFlag(FLAG_Z, AF.hi == 0);
-    setFlag(FLAG_N, false);
-    setFlag(FLAG_C, res > 0xFF);
-    return 4;
-  }
-  case 0x82: { // ADD A, D
-    uint8_t val = DE.hi;
-    uint16_t res = AF.hi + val;
-    setFlag(FLAG_H, (AF.hi & 0x0F) + (val & 0x0F) > 0x0F);
-    AF.hi = res & 0xFF;
-    setFlag(FLAG_Z, AF.hi == 0);
-    setFlag(FLAG_N, false);
-    setFlag(FLAG_C, res > 0xFF);
-    return 4;
-  }
-  case 0x83: { // ADD A, E
-    uint8_t val = DE.lo;
-    uint16_t res = AF.hi + val;
-    setFlag(FLAG_H, (AF.hi & 0x0F) + (val & 0x0F) > 0x0F);
-    AF.hi = res & 0xFF;
-    setFlag(FLAG_Z, AF.hi == 0);
-    setFlag(FLAG_N, false);
-    setFlag(FLAG_C, res > 0xFF);
-    return 4;
-  }
-  case 0x84: { // ADD A, H
-    uint8_t val = HL.hi;
-    uint16_t res = AF.hi + val;
-    setFlag(FLAG_H, (AF.hi & 0x0F) + (val & 0x0F) > 0x0F);
-    AF.hi = res & 0xFF;
-    setFlag(FLAG_Z, AF.hi == 0);
-    setFlag(FLAG_N, false);
-    setFlag(FLAG_C, res > 0xFF);
-    return 4;
-  }
-  case 0x85: { // ADD A, L
-    uint8_t val = HL.lo;
-    uint16_t res = AF.hi + val;
-    setFlag(FLAG_H, (AF.hi & 0x0F) + (val & 0x0F) > 0x0F);
-    AF.hi = res & 0xFF;
-    setFlag(FLAG_Z, AF.hi == 0);
-    setFlag(FLAG_N, false);
-    setFlag(FLAG_C, res > 0xFF);
-    return 4;
-  }
-  case 0x86: { // ADD A, (HL)
-    uint8_t val = bus.read(HL.reg16);
-    uint16_t res = AF.hi + val;
-    setFlag(FLAG_H, (AF.hi & 0x0F) + (val & 0x0F) > 0x0F);
-    AF.hi = res & 0xFF;
-    setFlag(FLAG_Z, AF.hi == 0);
-    setFlag(FLAG_N, false);
-    setFlag(FLAG_C, res > 0xFF);
-    return 8;
-  }
-  case 0x87: { // ADD A, A
-    uint16_t res = AF.hi + AF.hi;
-    setFlag(FLAG_H, (AF.hi & 0x0F) + (AF.hi & 0x0F) > 0x0F);
-    AF.hi = res & 0xFF;
-    setFlag(FLAG_Z, AF.hi == 0);
-    setFlag(FLAG_N, false);
-    setFlag(FLAG_C, res > 0xFF);
-    return 4;
-  }
-  case 0x88: { // ADC A, B
-    uint8_t val = BC.hi;
-    uint8_t c = getFlag(FLAG_C) ? 1 : 0;
-    uint16_t res = AF.hi + val + c;
-    setFlag(FLAG_H, (AF.hi & 0x0F) + (val & 0x0F) + c > 0x0F);
-    AF.hi = res & 0xFF;
-    setFlag(FLAG_Z, AF.hi == 0);
-    setFlag(FLAG_N, false);
-    setFlag(FLAG_C, res > 0xFF);
-    return 4;
-  }
-  case 0x89: { // ADC A, C
-    uint8_t val = BC.lo;
-    uint8_t c = getFlag(FLAG_C) ? 1 : 0;
-    uint16_t res = AF.hi + val + c;
-    setFlag(FLAG_H, (AF.hi & 0x0F) + (val & 0x0F) + c > 0x0F);
-    AF.hi = res & 0xFF;
-    setFlag(FLAG_Z, AF.hi == 0);
-    setFlag(FLAG_N, false);
-    setFlag(FLAG_C, res > 0xFF);
-    return 4;
-  }
-  case 0x8A: { // ADC A, D
-    uint8_t val = DE.hi;
-    uint8_t c = getFlag(FLAG_C) ? 1 : 0;
-    uint16_t res = AF.hi + val + c;
-    setFlag(FLAG_H, (AF.hi & 0x0F) + (val & 0x0F) + c > 0x0F);
-    AF.hi = res & 0xFF;
-    setFlag(FLAG_Z, AF.hi == 0);
-    setFlag(FLAG_N, false);
-    setFlag(FLAG_C, res > 0xFF);
-    return 4;
-  }
-  case 0x8B: { // ADC A, E
-    uint8_t val = DE.lo;
-    uint8_t c = getFlag(FLAG_C) ? 1 : 0;
-    uint16_t res = AF.hi + val + c;
-    setFlag(FLAG_H, (AF.hi & 0x0F) + (val & 0x0F) + c > 0x0F);
-    AF.hi = res & 0xFF;
-    setFlag(FLAG_Z, AF.hi == 0);
-    setFlag(FLAG_N, false);
-    setFlag(FLAG_C, res > 0xFF);
-    return 4;
-  }
-  case 0x8C: { // ADC A, H
-    uint8_t val = HL.hi;
-    uint8_t c = getFlag(FLAG_C) ? 1 : 0;
-    uint16_t res = AF.hi + val + c;
-    setFlag(FLAG_H, (AF.hi & 0x0F) + (val & 0x0F) + c > 0x0F);
-    AF.hi = res & 0xFF;
-    setFlag(FLAG_Z, AF.hi == 0);
-    setFlag(FLAG_N, false);
-    setFlag(FLAG_C, res > 0xFF);
-    return 4;
-  }
-  case 0x8D: { // ADC A, L
-    uint8_t val = HL.lo;
-    uint8_t c = getFlag(FLAG_C) ? 1 : 0;
-    uint16_t res = AF.hi + val + c;
-    setFlag(FLAG_H, (AF.hi & 0x0F) + (val & 0x0F) + c > 0x0F);
-    AF.hi = res & 0xFF;
-    setFlag(FLAG_Z, AF.hi == 0);
-    setFlag(FLAG_N, false);
-    setFlag(FLAG_C, res > 0xFF);
-    return 4;
-  }
-  case 0x8E: { // ADC A, (HL)
-    uint8_t val = bus.read(HL.reg16);
-    uint8_t c = getFlag(FLAG_C) ? 1 : 0;
-    uint16_t res = AF.hi + val + c;
-    setFlag(FLAG_H, (AF.hi & 0x0F) + (val & 0x0F) + c > 0x0F);
-    AF.hi = res & 0xFF;
-    setFlag(FLAG_Z, AF.hi == 0);
-    setFlag(FLAG_N, false);
-    setFlag(FLAG_C, res > 0xFF);
-    return 8;
-  }
-  case 0x8F: { // ADC A, A
-    uint8_t val = AF.hi;
-    uint8_t c = getFlag(FLAG_C) ? 1 : 0;
-    uint16_t res = AF.hi + val + c;
-    setFlag(FLAG_H, (AF.hi & 0x0F) + (val & 0x0F) + c > 0x0F);
-    AF.hi = res & 0xFF;
-    setFlag(FLAG_Z, AF.hi == 0);
-    setFlag(FLAG_N, false);
-    setFlag(FLAG_C, res > 0xFF);
-    return 4;
+    int pointer = pointerPair(opcode, operand);
+    block.pointers |= pointer >= 0 && !block.ops.empty();
+    block.ops.push_back({opTable[opcode], operand, static_cast<uint8_t>(length),
+                         opcode, static_cast<int8_t>(pointer)});
+    lastCycles = opcode == 0xCB ? cbCycles(operand) : opCycles[opcode];
+    block.cycles += lastCycles;
+    pc += length;
+    if (endsBlock(opcode)) {
+      break;
+    }
   }
+  // The last op's cycles come from its handler
+  block.cycles -= lastCycles;
 
-  case 0x90: { // SUB A, B
-    uint8_t val = BC.hi;
-    uint16_t res = AF.hi - val;
-    setFlag(FLAG_H, (AF.hi & 0x0F) < (val & 0x0F));
-    AF.hi = res & 0xFF;
-    setFlag(FLAG_Z, AF.hi == 0);
-    setFlag(FLAG_N, true);
-    setFlag(FLAG_C, res > 0xFF);
-    return 4;
-  }
-  case 0x91: { // SUB A, C
-    uint8_t val = BC.lo;
-    uint16_t res = AF.hi - val;
-    setFlag(FLAG_H, (AF.hi & 0x0F) < (val & 0x0F));
-    AF.hi = res & 0xFF;
-    setFlag(FLAG_Z, AF.hi == 0);
-    setFlag(FLAG_N, true);
-    setFlag(FLAG_C, res > 0xFF);
-    return 4;
-  }
-  case 0x92: { // SUB A, D
-    uint8_t val = DE.hi;
-    uint16_t res = AF.hi - val;
-    setFlag(FLAG_H, (AF.hi & 0x0F) < (val & 0x0F));
-    AF.hi = res & 0xFF;
-    setFlag(FLAG_Z, AF.hi == 0);
-    setFlag(FLAG_N, true);
-    setFlag(FLAG_C, res > 0xFF);
-    return 4;
-  }
-  case 0x93: { // SUB A, E
-    uint8_t val = DE.lo;
-    uint16_t res = AF.hi - val;
-    setFlag(FLAG_H, (AF.hi & 0x0F) < (val & 0x0F));
-    AF.hi = res & 0xFF;
-    setFlag(FLAG_Z, AF.hi == 0);
-    setFlag(FLAG_N, true);
-    setFlag(FLAG_C, res > 0xFF);
-    return 4;
-  }
-  case 0x94: { // SUB A, H
-    uint8_t val = HL.hi;
-    uint16_t res = AF.hi - val;
-    setFlag(FLAG_H, (AF.hi & 0x0F) < (val & 0x0F));
-    AF.hi = res & 0xFF;
-    setFlag(FLAG_Z, AF.hi == 0);
-    setFlag(FLAG_N, true);
-    setFlag(FLAG_C, res > 0xFF);
-    return 4;
-  }
-  case 0x95: { // SUB A, L
-    uint8_t val = HL.lo;
-    uint16_t res = AF.hi - val;
-    setFlag(FLAG_H, (AF.hi & 0x0F) < (val & 0x0F));
-    AF.hi = res & 0xFF;
-    setFlag(FLAG_Z, AF.hi == 0);
-    setFlag(FLAG_N, true);
-    setFlag(FLAG_C, res > 0xFF);
-    return 4;
-  }
-  case 0x96: { // SUB A, (HL)
-    uint8_t val = bus.read(HL.reg16);
-    uint16_t res = AF.hi - val;
-    setFlag(FLAG_H, (AF.hi & 0x0F) < (val & 0x0F));
-    AF.hi = res & 0xFF;
-    setFlag(FLAG_Z, AF.hi == 0);
-    setFlag(FLAG_N, true);
-    setFlag(FLAG_C, res > 0xFF);
-    return 8;
-  }
-  case 0x97: { // SUB A, A
-    AF.hi = 0;
-    setFlag(FLAG_Z, true);
-    setFlag(FLAG_N, true);
-    setFlag(FLAG_H, false);
-    setFlag(FLAG_C, false);
-    return 4;
-  }
-  case 0x98: { // SBC A, B
-    uint8_t val = BC.hi;
-    uint8_t c = getFlag(FLAG_C) ? 1 : 0;
-    uint16_t res = AF.hi - val - c;
-    setFlag(FLAG_H, (AF.hi & 0x0F) < (val & 0x0F) + c);
-    AF.hi = res & 0xFF;
-    setFlag(FLAG_Z, AF.hi == 0);
-    setFlag(FLAG_N, true);
-    setFlag(FLAG_C, res > 0xFF);
-    return 4;
-  }
-  case 0x99: { // SBC A, C
-    uint8_t val = BC.lo;
-    uint8_t c = getFlag(FLAG_C) ? 1 : 0;
-    uint16_t res = AF.hi - val - c;
-    setFlag(FLAG_H, (AF.hi & 0x0F) < (val & 0x0F) + c);
-    AF.hi = res & 0xFF;
-    setFlag(FLAG_Z, AF.hi == 0);
-    setFlag(FLAG_N, true);
-    setFlag(FLAG_C, res > 0xFF);
-    return 4;
-  }
-  case 0x9A: { // SBC A, D
-    uint8_t val = DE.hi;
-    uint8_t c = getFlag(FLAG_C) ? 1 : 0;
-    uint16_t res = AF.hi - val - c;
-    setFlag(FLAG_H, (AF.hi & 0x0F) < (val & 0x0F) + c);
-    AF.hi = res & 0xFF;
-    setFlag(FLAG_Z, AF.hi == 0);
-    setFlag(FLAG_N, true);
-    setFlag(FLAG_C, res > 0xFF);
-    return 4;
-  }
-  case 0x9B: { // SBC A, E
-    uint8_t val = DE.lo;
-    uint8_t c = getFlag(FLAG_C) ? 1 : 0;
-    uint16_t res = AF.hi - val - c;
-    setFlag(FLAG_H, (AF.hi & 0x0F) < (val & 0x0F) + c);
-    AF.hi = res & 0xFF;
-    setFlag(FLAG_Z, AF.hi == 0);
-    setFlag(FLAG_N, true);
-    setFlag(FLAG_C, res > 0xFF);
-    return 4;
-  }
-  case 0x9C: { // SBC A, H
-    uint8_t val = HL.hi;
-    uint8_t c = getFlag(FLAG_C) ? 1 : 0;
-    uint16_t res = AF.hi - val - c;
-    setFlag(FLAG_H, (AF.hi & 0x0F) < (val & 0x0F) + c);
-    AF.hi = res & 0xFF;
-    setFlag(FLAG_Z, AF.hi == 0);
-    setFlag(FLAG_N, true);
-    setFlag(FLAG_C, res > 0xFF);
-    return 4;
-  }
-  case 0x9D: { // SBC A, L
-    uint8_t val = HL.lo;
-    uint8_t c = getFlag(FLAG_C) ? 1 : 0;
-    uint16_t res = AF.hi - val - c;
-    setFlag(FLAG_H, (AF.hi & 0x0F) < (val & 0x0F) + c);
-    AF.hi = res & 0xFF;
-    setFlag(FLAG_Z, AF.hi == 0);
-    setFlag(FLAG_N, true);
-    setFlag(FLAG_C, res > 0xFF);
-    return 4;
+  // Polling loop candidate: branches back to its own start and only touches
+  // registers, apart from reading LY, STAT, IF or DIV.
+  block.idleLoop = false;
+  block.pollsDiv = false;
+  if (block.ops.empty()) {
+    return;
   }
-  case 0x9E: { // SBC A, (HL)
-    uint8_t val = bus.read(HL.reg16);
-    uint8_t c = getFlag(FLAG_C) ? 1 : 0;
-    uint16_t res = AF.hi - val - c;
-    setFlag(FLAG_H, (AF.hi & 0x0F) < (val & 0x0F) + c);
-    AF.hi = res & 0xFF;
-    setFlag(FLAG_Z, AF.hi == 0);
-    setFlag(FLAG_N, true);
-    setFlag(FLAG_C, res > 0xFF);
-    return 8;
+  const DecodedOp &last = block.ops.back();
+  if (branchTarget(last.opcode, last.operand, pc) != PC) {
+    return;
   }
-  case 0x9F: { // SBC A, A
-    uint8_t val = AF.hi;
-    uint8_t c = getFlag(FLAG_C) ? 1 : 0;
-    uint16_t res = AF.hi - val - c;
-    setFlag(FLAG_H, (AF.hi & 0x0F) < (val & 0x0F) + c);
-    AF.hi = res & 0xFF;
-    setFlag(FLAG_Z, AF.hi == 0);
-    setFlag(FLAG_N, true);
-    setFlag(FLAG_C, res > 0xFF);
-    return 4;
+  for (size_t i = 0; i + 1 < block.ops.size(); i++) {
+    const DecodedOp &op = block.ops[i];
+    int polled = polledRegister(op.opcode, op.operand);
+    if (polled < 0 && !registerOnly(op.opcode, op.operand)) {
+      return;
+    }
+    block.pollsDiv |= polled == 0xFF04;
   }
+  block.idleLoop = true;
+}
 
-  case 0xA0: // AND A, B
-    AF.hi &= BC.hi;
-    setFlag(FLAG_Z, AF.hi == 0);
-    setFlag(FLAG_N, false);
-    setFlag(FLAG_H, true);
-    setFlag(FLAG_C, false);
-    return 4;
-  case 0xA1: // AND A, C
-    AF.hi &= BC.lo;
-    setFlag(FLAG_Z, AF.hi == 0);
-    setFlag(FLAG_N, false);
-    setFlag(FLAG_H, true);
-    setFlag(FLAG_C, false);
-    return 4;
-  case 0xA2: // AND A, D
-    AF.hi &= DE.hi;
-    setFlag(FLAG_Z, AF.hi == 0);
-    setFlag(FLAG_N, false);
-    setFlag(FLAG_H, true);
-    setFlag(FLAG_C, false);
-    return 4;
-  case 0xA3: // AND A, E
-    AF.hi &= DE.lo;
-    setFlag(FLAG_Z, AF.hi == 0);
-    setFlag(FLAG_N, false);
-    setFlag(FLAG_H, true);
-    setFlag(FLAG_C, false);
-    return 4;
-  case 0xA4: // AND A, H
-    AF.hi &= HL.hi;
-    setFlag(FLAG_Z, AF.hi == 0);
-    setFlag(FLAG_N, false);
-    setFlag(FLAG_H, true);
-    setFlag(FLAG_C, false);
-    return 4;
-  case 0xA5: // AND A, L
-    AF.hi &= HL.lo;
-    setFlag(FLAG_Z, AF.hi == 0);
-    setFlag(FLAG_N, false);
-    setFlag(FLAG_H, true);
-    setFlag(FLAG_C, false);
-    return 4;
-  case 0xA6: // AND A, (HL)
-    AF.hi &= bus.read(HL.reg16);
-    setFlag(FLAG_Z, AF.hi == 0);
-    setFlag(FLAG_N, false);
-    setFlag(FLAG_H, true);
-    setFlag(FLAG_C, false);
-    return 8;
-  case 0xA7: // AND A, A
-    setFlag(FLAG_Z, AF.hi == 0);
-    setFlag(FLAG_N, false);
-    setFlag(FLAG_H, true);
-    setFlag(FLAG_C, false);
-    return 4;
+int CPU::execute(uint8_t opcode) {
+  uint16_t operand = 0;
+  switch (opLength[opcode]) {
+  case 2:
+    operand = fetch();
+    break;
+  case 3:
+    operand = fetch16();
+    break;
+  }
+  int cycles = (this->*opTable[opcode])(operand);
+#ifdef SHELLBOY_OPCODE_STATS
+  stats.record(opcode, operand, cycles);
+#endif
+  return cycles;
+}
 
-  case 0xA8: // XOR A, B
-    AF.hi ^= BC.hi;
-    setFlag(FLAG_Z, AF.hi == 0);
-    setFlag(FLAG_N, false);
-    setFlag(FLAG_H, false);
-    setFlag(FLAG_C, false);
-    return 4;
-  case 0xA9: // XOR A, C
-    AF.hi ^= BC.lo;
-    setFlag(FLAG_Z, AF.hi == 0);
-    setFlag(FLAG_N, false);
-    setFlag(FLAG_H, false);
-    setFlag(FLAG_C, false);
-    return 4;
-  case 0xAA: // XOR A, D
-    AF.hi ^= DE.hi;
-    setFlag(FLAG_Z, AF.hi == 0);
-    setFlag(FLAG_N, false);
-    setFlag(FLAG_H, false);
-    setFlag(FLAG_C, false);
-    return 4;
-  case 0xAB: // XOR A, E
-    AF.hi ^= DE.lo;
-    setFlag(FLAG_Z, AF.hi == 0);
-    setFlag(FLAG_N, false);
-    setFlag(FLAG_H, false);
-    setFlag(FLAG_C, false);
-    return 4;
-  case 0xAC: // XOR A, H
-    AF.hi ^= HL.hi;
-    setFlag(FLAG_Z, AF.hi == 0);
-    setFlag(FLAG_N, false);
-    setFlag(FLAG_H, false);
-    setFlag(FLAG_C, false);
-    return 4;
-  case 0xAD: // XOR A, L
-    AF.hi ^= HL.lo;
-    setFlag(FLAG_Z, AF.hi == 0);
-    setFlag(FLAG_N, false);
-    setFlag(FLAG_H, false);
-    setFlag(FLAG_C, false);
-    return 4;
-  case 0xAE: // XOR A, (HL)
-    AF.hi ^= bus.read(HL.reg16);
-    setFlag(FLAG_Z, AF.hi == 0);
-    setFlag(FLAG_N, false);
-    setFlag(FLAG_H, false);
-    setFlag(FLAG_C, false);
-    return 8;
-  case 0xAF: // XOR A
-    AF.hi = 0;
-    setFlag(FLAG_Z, true);
-    setFlag(FLAG_N, false);
-    setFlag(FLAG_H, false);
-    setFlag(FLAG_C, false);
-    return 4;
+int CPU::executeCB(uint8_t opcode) { return (this->*cbTable[opcode])(); }
 
-  case 0xB0: // OR A, B
-    AF.hi |= BC.hi;
-    setFlag(FLAG_Z, AF.hi == 0);
-    setFlag(FLAG_N, false);
-    setFlag(FLAG_H, false);
-    setFlag(FLAG_C, false);
-    return 4;
-  case 0xB1: // OR A, C
-    AF.hi |= BC.lo;
-    setFlag(FLAG_Z, AF.hi == 0);
-    setFlag(FLAG_N, false);
-    setFlag(FLAG_H, false);
-    setFlag(FLAG_C, false);
-    return 4;
-  case 0xB2: // OR A, D
-    AF.hi |= DE.hi;
-    setFlag(FLAG_Z, AF.hi == 0);
-    setFlag(FLAG_N, false);
-    setFlag(FLAG_H, false);
-    setFlag(FLAG_C, false);
-    return 4;
-  case 0xB3: // OR A, E
-    AF.hi |= DE.lo;
-    setFlag(FLAG_Z, AF.hi == 0);
-    setFlag(FLAG_N, false);
-    setFlag(FLAG_H, false);
-    setFlag(FLAG_C, false);
-    return 4;
-  case 0xB4: // OR A, H
-    AF.hi |= HL.hi;
-    setFlag(FLAG_Z, AF.hi == 0);
-    setFlag(FLAG_N, false);
-    setFlag(FLAG_H, false);
-    setFlag(FLAG_C, false);
-    return 4;
-  case 0xB5: // OR A, L
-    AF.hi |= HL.lo;
-    setFlag(FLAG_Z, AF.hi == 0);
-    setFlag(FLAG_N, false);
-    setFlag(FLAG_H, false);
-    setFlag(FLAG_C, false);
-    return 4;
-  case 0xB6: // OR A, (HL)
-    AF.hi |= bus.read(HL.reg16);
-    setFlag(FLAG_Z, AF.hi == 0);
-    setFlag(FLAG_N, false);
-    setFlag(FLAG_H, false);
-    setFlag(FLAG_C, false);
-    return 8;
-  case 0xB7: // OR A, A
-    setFlag(FLAG_Z, AF.hi == 0);
-    setFlag(FLAG_N, false);
-    setFlag(FLAG_H, false);
-    setFlag(FLAG_C, false);
-    return 4;
+int CPU::illegal(uint8_t opcode) {
+  fprintf(stderr, "Unimplemented opcode: %02X at PC: %04X\n", opcode, PC - 1);
+  exit(1);
+  return 0;
+}
 
-  case 0xB8: { // CP A, B
-    uint8_t val = BC.hi;
-    uint16_t res = AF.hi - val;
-    setFlag(FLAG_Z, (res & 0xFF) == 0);
-    setFlag(FLAG_N, true);
-    setFlag(FLAG_H, (AF.hi & 0x0F) < (val & 0x0F));
-    setFlag(FLAG_C, res > 0xFF);
-    return 4;
-  }
-  case 0xB9: { // CP A, C
-    uint8_t val = BC.lo;
-    uint16_t res = AF.hi - val;
-    setFlag(FLAG_Z, (res & 0xFF) == 0);
-    setFlag(FLAG_N, true);
-    setFlag(FLAG_H, (AF.hi & 0x0F) < (val & 0x0F));
-    setFlag(FLAG_C, res > 0xFF);
-    return 4;
-  }
-  case 0xBA: { // CP A, D
-    uint8_t val = DE.hi;
-    uint16_t res = AF.hi - val;
-    setFlag(FLAG_Z, (res & 0xFF) == 0);
-    setFlag(FLAG_N, true);
-    setFlag(FLAG_H, (AF.hi & 0x0F) < (val & 0x0F));
-    setFlag(FLAG_C, res > 0xFF);
-    return 4;
-  }
-  case 0xBB: { // CP A, E
-    uint8_t val = DE.lo;
-    uint16_t res = AF.hi - val;
-    setFlag(FLAG_Z, (res & 0xFF) == 0);
-    setFlag(FLAG_N, true);
-    setFlag(FLAG_H, (AF.hi & 0x0F) < (val & 0x0F));
-    setFlag(FLAG_C, res > 0xFF);
-    return 4;
-  }
-  case 0xBC: { // CP A, H
-    uint8_t val = HL.hi;
-    uint16_t res = AF.hi - val;
-    setFlag(FLAG_Z, (res & 0xFF) == 0);
-    setFlag(FLAG_N, true);
-    setFlag(FLAG_H, (AF.hi & 0x0F) < (val & 0x0F));
-    setFlag(FLAG_C, res > 0xFF);
-    return 4;
-  }
-  case 0xBD: { // CP A, L
-    uint8_t val = HL.lo;
-    uint16_t res = AF.hi - val;
-    setFlag(FLAG_Z, (res & 0xFF) == 0);
-    setFlag(FLAG_N, true);
-    setFlag(FLAG_H, (AF.hi & 0x0F) < (val & 0x0F));
-    setFlag(FLAG_C, res > 0xFF);
-    return 4;
-  }
-  case 0xBE: { // CP A, (HL)
-    uint8_t val = bus.read(HL.reg16);
-    uint16_t res = AF.hi - val;
-    setFlag(FLAG_Z, (res & 0xFF) == 0);
-    setFlag(FLAG_N, true);
-    setFlag(FLAG_H, (AF.hi & 0x0F) < (val & 0x0F));
-    setFlag(FLAG_C, res > 0xFF);
-    return 8;
-  }
-  case 0xBF: { // CP A, A
-    setFlag(FLAG_Z, true);
-    setFlag(FLAG_N, true);
-    setFlag(FLAG_H, false);
-    setFlag(FLAG_C, false);
-    return 4;
-  }
-  case 0xC6: { // ADD A, n8
-    uint8_t val = fetch();
-    uint16_t res = AF.hi + val;
-    setFlag(FLAG_H, (AF.hi & 0x0F) + (val & 0x0F) > 0x0F);
-    AF.hi = res & 0xFF;
-    setFlag(FLAG_Z, AF.hi == 0);
-    setFlag(FLAG_N, false);
-    setFlag(FLAG_C, res > 0xFF);
-    return 8;
-  }
-  case 0xCE: { // ADC A, n8
-    uint8_t val = fetch();
-    uint8_t c = getFlag(FLAG_C) ? 1 : 0;
-    uint16_t res = AF.hi + val + c;
-    setFlag(FLAG_H, (AF.hi & 0x0F) + (val & 0x0F) + c > 0x0F);
-    AF.hi = res & 0xFF;
-    setFlag(FLAG_Z, AF.hi == 0);
-    setFlag(FLAG_N, false);
-    setFlag(FLAG_C, res > 0xFF);
-    return 8;
-  }
-  case 0xD6: { // SUB A, n8
-    uint8_t val = fetch();
-    uint16_t res = AF.hi - val;
-    setFlag(FLAG_H, (AF.hi & 0x0F) < (val & 0x0F));
-    AF.hi = res & 0xFF;
-    setFlag(FLAG_Z, AF.hi == 0);
-    setFlag(FLAG_N, true);
-    setFlag(FLAG_C, res > 0xFF); // Borrow occurred
-    return 8;
-  }
-  case 0xDE: { // SBC A, n8
-    uint8_t val = fetch();
-    uint8_t c = getFlag(FLAG_C) ? 1 : 0;
-    uint16_t res = AF.hi - val - c;
-    setFlag(FLAG_H, (AF.hi & 0x0F) < (val & 0x0F) + c);
-    AF.hi = res & 0xFF;
-    setFlag(FLAG_Z, AF.hi == 0);
-    setFlag(FLAG_N, true);
-    setFlag(FLAG_C, res > 0xFF);
-    return 8;
-  }
-  case 0xE6: { // AND A, n8
-    AF.hi &= fetch();
-    setFlag(FLAG_Z, AF.hi == 0);
-    setFlag(FLAG_N, false);
-    setFlag(FLAG_H, true);
-    setFlag(FLAG_C, false);
-    return 8;
-  }
-  case 0xEE: { // XOR A, n8
-    AF.hi ^= fetch();
-    setFlag(FLAG_Z, AF.hi == 0);
-    setFlag(FLAG_N, false);
-    setFlag(FLAG_H, false);
-    setFlag(FLAG_C, false);
-    return 8;
-  }
-  case 0xF6: { // OR A, n8
-    AF.hi |= fetch();
-    setFlag(FLAG_Z, AF.hi == 0);
-    setFlag(FLAG_N, false);
-    setFlag(FLAG_H, false);
-    setFlag(FLAG_C, false);
-    return 8;
-  }
-  case 0xFE: { // CP A, n8
-    uint8_t val = fetch();
-    uint16_t res = AF.hi - val;
-    setFlag(FLAG_Z, (res & 0xFF) == 0);
-    setFlag(FLAG_N, true);
-    setFlag(FLAG_H, (AF.hi & 0x0F) < (val & 0x0F));
-    setFlag(FLAG_C, res > 0xFF);
-    return 8;
-  }
-  case 0xC2: { // JP NZ, nn
-    uint16_t addr = fetch16();
-    if (!getFlag(FLAG_Z)) {
-      PC = addr;
-      return 16;
-    }
-    return 12;
-  }
-  case 0xC3: // JP nn
-    PC = fetch16();
-    return 16;
-  case 0xC4: { // CALL NZ, nn
-    uint16_t addr = fetch16();
-    if (!getFlag(FLAG_Z)) {
-      pushStack(PC);
-      PC = addr;
-      return 24;
-    }
-    return 12;
+// --- Operand helpers ---
+
+template <int R> uint8_t CPU::readR8() {
+  if constexpr (R == 0)
+    return BC.hi;
+  else if constexpr (R == 1)
+    return BC.lo;
+  else if constexpr (R == 2)
+    return DE.hi;
+  else if constexpr (R == 3)
+    return DE.lo;
+  else if constexpr (R == 4)
+    return HL.hi;
+  else if constexpr (R == 5)
+    return HL.lo;
+  else if constexpr (R == 6)
+    return bus.read(HL.reg16);
+  else
+    return AF.hi;
+}
+
+template <int R> void CPU::writeR8(uint8_t value) {
+  if constexpr (R == 0)
+    BC.hi = value;
+  else if constexpr (R == 1)
+    BC.lo = value;
+  else if constexpr (R == 2)
+    DE.hi = value;
+  else if constexpr (R == 3)
+    DE.lo = value;
+  else if constexpr (R == 4)
+    HL.hi = value;
+  else if constexpr (R == 5)
+    HL.lo = value;
+  else if constexpr (R == 6)
+    bus.write(HL.reg16, value);
+  else
+    AF.hi = value;
+}
+
+template <int P> uint16_t &CPU::reg16() {
+  if constexpr (P == 0)
+    return BC.reg16;
+  else if constexpr (P == 1)
+    return DE.reg16;
+  else if constexpr (P == 2)
+    return HL.reg16;
+  else
+    return SP;
+}
+
+template <int CC> bool CPU::condition() const {
+  if constexpr (CC == 0)
+    return !getFlag(FLAG_Z);
+  else if constexpr (CC == 1)
+    return getFlag(FLAG_Z);
+  else if constexpr (CC == 2)
+    return !getFlag(FLAG_C);
+  else
+    return getFlag(FLAG_C);
+}
+
+// ADD, ADC, SUB, SBC, AND, XOR, OR, CP
+template <int Y> void CPU::alu(uint8_t val) {
+  if constexpr (Y == 0 || Y == 1) {
+    flagCarry = (Y == 1 && getFlag(FLAG_C)) ? 1 : 0;
+    flagOp = FlagOp::Add;
+    flagA = AF.hi;
+    flagB = val;
+    AF.hi = flagA + val + flagCarry;
+    flagResult = AF.hi;
+  } else if constexpr (Y == 2 || Y == 3 || Y == 7) {
+    flagCarry = (Y == 3 && getFlag(FLAG_C)) ? 1 : 0;
+    flagOp = FlagOp::Sub;
+    flagA = AF.hi;
+    flagB = val;
+    flagResult = flagA - val - flagCarry;
+    if constexpr (Y != 7)
+      AF.hi = flagResult;
+  } else {
+    if constexpr (Y == 4)
+      AF.hi &= val;
+    else if constexpr (Y == 5)
+      AF.hi ^= val;
+    else
+      AF.hi |= val;
+    flagOp = Y == 4 ? FlagOp::And : FlagOp::Or;
+    flagResult = AF.hi;
   }
-  case 0xCA: { // JP Z, nn
-    uint16_t addr = fetch16();
-    if (getFlag(FLAG_Z)) {
-      PC = addr;
-      return 16;
-    }
-    return 12;
+}
+
+// RLC, RRC, RL, RR, SLA, SRA, SWAP, SRL
+template <int Y> uint8_t CPU::rotate(uint8_t val) {
+  bool c = false;
+  if constexpr (Y == 0) {
+    c = (val & 0x80) != 0;
+    val = (val << 1) | (c ? 1 : 0);
+  } else if constexpr (Y == 1) {
+    c = (val & 0x01) != 0;
+    val = (val >> 1) | (c ? 0x80 : 0);
+  } else if constexpr (Y == 2) {
+    bool old_c = getFlag(FLAG_C);
+    c = (val & 0x80) != 0;
+    val = (val << 1) | (old_c ? 1 : 0);
+  } else if constexpr (Y == 3) {
+    bool old_c = getFlag(FLAG_C);
+    c = (val & 0x01) != 0;
+    val = (val >> 1) | (old_c ? 0x80 : 0);
+  } else if constexpr (Y == 4) {
+    c = (val & 0x80) != 0;
+    val = val << 1;
+  } else if constexpr (Y == 5) {
+    c = (val & 0x01) != 0;
+    val = (val >> 1) | (val & 0x80);
+  } else if constexpr (Y == 6) {
+    val = (val << 4) | (val >> 4);
+  } else {
+    c = (val & 0x01) != 0;
+    val = val >> 1;
   }
-  case 0xCC: { // CALL Z, nn
-    uint16_t addr = fetch16();
-    if (getFlag(FLAG_Z)) {
-      pushStack(PC);
-      PC = addr;
-      return 24;
+  setFlags((val == 0 ? FLAG_Z : 0) | (c ? FLAG_C : 0));
+  return val;
+}
+
+void CPU::addHL(uint16_t value) {
+  uint32_t res = HL.reg16 + value;
+  uint8_t flags = getFlag(FLAG_Z) ? FLAG_Z : 0;
+  if ((HL.reg16 & 0x0FFF) + (value & 0x0FFF) > 0x0FFF)
+    flags |= FLAG_H;
+  if (res > 0xFFFF)
+    flags |= FLAG_C;
+  setFlags(flags);
+  HL.reg16 = res & 0xFFFF;
+}
+
+// --- Base opcodes ---
+// Decoded as x = bits 7-6, y = bits 5-3, z = bits 2-0, p = y >> 1, q = y & 1.
+
+template <uint8_t Op> int CPU::op(uint16_t operand) {
+  constexpr int x = Op >> 6;
+  constexpr int y = (Op >> 3) & 0x07;
+  constexpr int z = Op & 0x07;
+  constexpr int p = y >> 1;
+  constexpr int q = y & 0x01;
+
+  if constexpr (x == 1) {
+    if constexpr (Op == 0x76) { // HALT
+      halted = true;
+      return 4;
+    } else { // LD r, r'
+      writeR8<y>(readR8<z>());
+      return (y == 6 || z == 6) ? 8 : 4;
     }
-    return 12;
-  }
-  case 0xCD: { // CALL nn
-    uint16_t addr = fetch16();
-    pushStack(PC);
-    PC = addr;
-    return 24;
-  }
-  case 0xD2: { // JP NC, nn
-    uint16_t addr = fetch16();
-    if (!getFlag(FLAG_C)) {
-      PC = addr;
-      return 16;
+  } else if constexpr (x == 2) { // ALU A, r
+    alu<y>(readR8<z>());
+    return z == 6 ? 8 : 4;
+  } else if constexpr (x == 0) {
+    if constexpr (z == 0) {
+      if constexpr (y == 0) { // NOP
+        return 4;
+      } else if constexpr (y == 1) { // LD (nn), SP
+        bus.write(operand, SP & 0xFF);
+        bus.write(operand + 1, SP >> 8);
+        return 20;
+      } else if constexpr (y == 2) { // STOP
+        // Actually stopping is more complex, just treat as NOP for now
+        return 4;
+      } else if constexpr (y == 3) { // JR n8
+        PC += static_cast<int8_t>(operand);
+        return 12;
+      } else { // JR cc, n8
+        if (condition<y - 4>()) {
+          PC += static_cast<int8_t>(operand);
+          return 12;
+        }
+        return 8;
+      }
+    } else if constexpr (z == 1) {
+      if constexpr (q == 0) { // LD rp, n16
+        reg16<p>() = operand;
+        return 12;
+      } else { // ADD HL, rp
+        addHL(reg16<p>());
+        return 8;
+      }
+    } else if constexpr (z == 2) {
+      // LD (BC)/(DE)/(HL+)/(HL-), A and the reverse loads
+      uint16_t addr = p == 0 ? BC.reg16 : (p == 1 ? DE.reg16 : HL.reg16);
+      if constexpr (q == 0)
+        bus.write(addr, AF.hi);
+      else
+        AF.hi = bus.read(addr);
+      if constexpr (p == 2)
+        HL.reg16++;
+      else if constexpr (p == 3)
+        HL.reg16--;
+      return 8;
+    } else if constexpr (z == 3) { // INC rp / DEC rp
+      if constexpr (q == 0)
+        reg16<p>()++;
+      else
+        reg16<p>()--;
+      return 8;
+    } else if constexpr (z == 4 || z == 5) { // INC r / DEC r
+      // C is preserved, so anything that may have changed it must be
+      // folded into AF.lo before this op replaces the record.
+      if (flagOp != FlagOp::Inc && flagOp != FlagOp::Dec)
+        syncFlags();
+      uint8_t val = readR8<y>();
+      if constexpr (z == 4) {
+        val++;
+        flagOp = FlagOp::Inc;
+      } else {
+        val--;
+        flagOp = FlagOp::Dec;
+      }
+      writeR8<y>(val);
+      flagResult = val;
+      return y == 6 ? 12 : 4;
+    } else if constexpr (z == 6) { // LD r, n8
+      writeR8<y>(static_cast<uint8_t>(operand));
+      return y == 6 ? 12 : 8;
+    } else {
+      if constexpr (y <= 3) { // RLCA, RRCA, RLA, RRA
+        AF.hi = rotate<y>(AF.hi);
+        AF.lo &= ~FLAG_Z;
+      } else if constexpr (y == 4) { // DAA
+        syncFlags();
+        uint16_t a = AF.hi;
+        if (getFlag(FLAG_N)) {
+          if (getFlag(FLAG_H))
+            a = (a - 0x6) & 0xFF;
+          if (getFlag(FLAG_C))
+            a -= 0x60;
+        } else {
+          if (getFlag(FLAG_H) || (a & 0xF) > 9)
+            a += 0x6;
+          if (getFlag(FLAG_C) || a > 0x9F)
+            a += 0x60;
+        }
+        setFlag(FLAG_H, false);
+        if (a & 0x100)
+          setFlag(FLAG_C, true);
+        a &= 0xFF;
+        AF.hi = static_cast<uint8_t>(a);
+        setFlag(FLAG_Z, AF.hi == 0);
+      } else if constexpr (y == 5) { // CPL
+        AF.hi = ~AF.hi;
+        setFlag(FLAG_N, true);
+        setFlag(FLAG_H, true);
+      } else { // SCF / CCF
+        setFlag(FLAG_N, false);
+        setFlag(FLAG_H, false);
+        setFlag(FLAG_C, y == 6 ? true : !getFlag(FLAG_C));
+      }
+      return 4;
     }
-    return 12;
-  }
-  case 0xD4: { // CALL NC, nn
-    uint16_t addr = fetch16();
-    if (!getFlag(FLAG_C)) {
+  } else {
+    if constexpr (z == 0) {
+      if constexpr (y <= 3) { // RET cc
+        if (condition<y>()) {
+          PC = popStack();
+          return 20;
+        }
+        return 8;
+      } else if constexpr (y == 4) { // LDH (n8), A
+        bus.write(0xFF00 | operand, AF.hi);
+        return 12;
+      } else if constexpr (y == 6) { // LDH A, (n8)
+        AF.hi = bus.read(0xFF00 | operand);
+        return 12;
+      } else { // ADD SP, r8 / LD HL, SP+r8
+        int8_t offset = static_cast<int8_t>(operand);
+        uint16_t result = SP + offset;
+        uint8_t flags = 0;
+        if (((SP & 0x0F) + (offset & 0x0F)) > 0x0F)
+          flags |= FLAG_H;
+        if (((SP & 0xFF) + (offset & 0xFF)) > 0xFF)
+          flags |= FLAG_C;
+        setFlags(flags);
+        if constexpr (y == 5) {
+          SP = result;
+          return 16;
+        } else {
+          HL.reg16 = result;
+          return 12;
+        }
+      }
+    } else if constexpr (z == 1) {
+      if constexpr (q == 0) { // POP rp2
+        if constexpr (p == 3) {
+          AF.reg16 = popStack() & 0xFFF0; // Low 4 bits of F are always 0
+          flagOp = FlagOp::None;
+        } else
+          reg16<p>() = popStack();
+        return 12;
+      } else if constexpr (p == 0) { // RET
+        PC = popStack();
+        return 16;
+      } else if constexpr (p == 1) { // RETI
+        PC = popStack();
+        IME = true;
+        return 16;
+      } else if constexpr (p == 2) { // JP (HL)
+        PC = HL.reg16;
+        return 4;
+      } else { // LD SP, HL
+        SP = HL.reg16;
+        return 8;
+      }
+    } else if constexpr (z == 2) {
+      if constexpr (y <= 3) { // JP cc, nn
+        if (condition<y>()) {
+          PC = operand;
+          return 16;
+        }
+        return 12;
+      } else if constexpr (y == 4) { // LD (C), A
+        bus.write(0xFF00 | BC.lo, AF.hi);
+        return 8;
+      } else if constexpr (y == 5) { // LD (nn), A
+        bus.write(operand, AF.hi);
+        return 16;
+      } else if constexpr (y == 6) { // LD A, (C)
+        AF.hi = bus.read(0xFF00 | BC.lo);
+        return 8;
+      } else { // LD A, (nn)
+        AF.hi = bus.read(operand);
+        return 16;
+      }
+    } else if constexpr (z == 3) {
+      if constexpr (y == 0) { // JP nn
+        PC = operand;
+        return 16;
+      } else if constexpr (y == 1) { // Prefix CB
+        return executeCB(static_cast<uint8_t>(operand));
+      } else if constexpr (y == 6) { // DI
+        IME = false;
+        return 4;
+      } else if constexpr (y == 7) { // EI
+        IME = true;
+        return 4;
+      } else {
+        return illegal(Op);
+      }
+    } else if constexpr (z == 4) {
+      if constexpr (y <= 3) { // CALL cc, nn
+        if (condition<y>()) {
+          pushStack(PC);
+          PC = operand;
+          return 24;
+        }
+        return 12;
+      } else {
+        return illegal(Op);
+      }
+    } else if constexpr (z == 5) {
+      if constexpr (q == 0) { // PUSH rp2
+        if constexpr (p == 3) {
+          syncFlags();
+          pushStack(AF.reg16);
+        } else {
+          pushStack(reg16<p>());
+        }
+        return 16;
+      } else if constexpr (p == 0) { // CALL nn
+        pushStack(PC);
+        PC = operand;
+        return 24;
+      } else {
+        return illegal(Op);
+      }
+    } else if constexpr (z == 6) { // ALU A, n8
+      alu<y>(static_cast<uint8_t>(operand));
+      return 8;
+    } else { // RST
       pushStack(PC);
-      PC = addr;
-      return 24;
-    }
-    return 12;
-  }
-  case 0xDA: { // JP C, nn
-    uint16_t addr = fetch16();
-    if (getFlag(FLAG_C)) {
-      PC = addr;
+      PC = y * 0x08;
       return 16;
     }
-    return 12;
-  }
-  case 0xDC: { // CALL C, nn
-    uint16_t addr = fetch16();
-    if (getFlag(FLAG_C)) {
-      pushStack(PC);
-      PC = addr;
-      return 24;
-    }
-    return 12;
-  }
-  case 0xC0: { // RET NZ
-    if (!getFlag(FLAG_Z)) {
-      PC = popStack();
-      return 20;
-    }
-    return 8;
   }
-  case 0xC8: { // RET Z
-    if (getFlag(FLAG_Z)) {
-      PC = popStack();
-      return 20;
-    }
-    return 8;
+}
+
+// --- CB-prefixed opcodes ---
+
+template <uint8_t Op> int CPU::opCB() {
+  constexpr int x = Op >> 6;
+  constexpr int y = (Op >> 3) & 0x07;
+  constexpr int z = Op & 0x07;
+
+  uint8_t val = readR8<z>();
+  if constexpr (x == 1) { // BIT y, r
+    // Carry flag is not affected
+    uint8_t flags = FLAG_H | (getFlag(FLAG_C) ? FLAG_C : 0);
+    if ((val & (1 << y)) == 0)
+      flags |= FLAG_Z;
+    setFlags(flags);
+    return z == 6 ? 12 : 8;
+  } else {
+    if constexpr (x == 0) // Rotates and shifts
+      val = rotate<y>(val);
+    else if constexpr (x == 2) // RES y, r
+      val &= ~(1 << y);
+    else // SET y, r
+      val |= (1 << y);
+    writeR8<z>(val);
+    return z == 6 ? 16 : 8;
   }
-  case 0xD0: { // RET NC
-    if (!getFlag(FLAG_C)) {
-      PC = popStack();
-      return 20;
-    }
-    return 8;
+}
+
+// --- Dispatch tables ---
+
+// Instruction length in bytes, opcode included. For 0xCB the second byte is
+// the CB opcode.
+static constexpr uint8_t decodeLength(uint8_t opcode) {
+  int x = opcode >> 6;
+  int y = (opcode >> 3) & 0x07;
+  int z = opcode & 0x07;
+  if (x == 0) {
+    if (z == 0)
+      return y == 0 ? 1 : (y == 1 ? 3 : 2);
+    if (z == 1)
+      return (y & 0x01) == 0 ? 3 : 1;
+    return z == 6 ? 2 : 1;
   }
-  case 0xD8: { // RET C
-    if (getFlag(FLAG_C)) {
-      PC = popStack();
-      return 20;
+  if (x == 3) {
+    switch (z) {
+    case 0:
+      return y >= 4 ? 2 : 1;
+    case 2:
+      return (y <= 3 || y == 5 || y == 7) ? 3 : 1;
+    case 3:
+      return y == 0 ? 3 : (y == 1 ? 2 : 1);
+    case 4:
+      return y <= 3 ? 3 : 1;
+    case 5:
+      return y == 1 ? 3 : 1;
+    case 6:
+      return 2;
     }
-    return 8;
   }
-  case 0xD9: // RETI
-    PC = popStack();
-    IME = true;
-    return 16;
-  case 0xC9: // RET
-    PC = popStack();
-    return 16;
-  case 0xC1: // POP BC
-    BC.reg16 = popStack();
-    return 12;
-  case 0xC5: // PUSH BC
-    pushStack(BC.reg16);
-    return 16;
-  case 0xD1: // POP DE
-    DE.reg16 = popStack();
-    return 12;
-  case 0xD5: // PUSH DE
-    pushStack(DE.reg16);
-    return 16;
-  case 0xE1: // POP HL
-    HL.reg16 = popStack();
-    return 12;
-  case 0xE5: // PUSH HL
-    pushStack(HL.reg16);
-    return 16;
-  case 0xF1:                        // POP AF
-    AF.reg16 = popStack() & 0xFFF0; // Low 4 bits of F are always 0
-    return 12;
-  case 0xF5: // PUSH AF
-    pushStack(AF.reg16);
-    return 16;
+  return 1;
+}
 
-  case 0xE0: // LDH (n8), A
-    bus.write(0xFF00 | fetch(), AF.hi);
-    return 12;
-  case 0xF0: // LDH A, (n8)
-    AF.hi = bus.read(0xFF00 | fetch());
-    return 12;
-  case 0xE2: // LD (C), A
-    bus.write(0xFF00 | BC.lo, AF.hi);
-    return 8;
-  case 0xF2: // LD A, (C)
-    AF.hi = bus.read(0xFF00 | BC.lo);
-    return 8;
-  case 0xE8: { // ADD SP, r8
-    int8_t offset = static_cast<int8_t>(fetch());
-    uint16_t result = SP + offset;
-    setFlag(FLAG_Z, false);
-    setFlag(FLAG_N, false);
-    setFlag(FLAG_H, ((SP & 0x0F) + (offset & 0x0F)) > 0x0F);
-    setFlag(FLAG_C, ((SP & 0xFF) + (offset & 0xFF)) > 0xFF);
-    SP = result;
-    return 16;
-  }
-  case 0xE9: // JP (HL)
-    PC = HL.reg16;
-    return 4;
-  case 0xF8: { // LD HL, SP+r8
-    int8_t offset = static_cast<int8_t>(fetch());
-    uint16_t result = SP + offset;
-    setFlag(FLAG_Z, false);
-    setFlag(FLAG_N, false);
-    setFlag(FLAG_H, ((SP & 0x0F) + (offset & 0x0F)) > 0x0F);
-    setFlag(FLAG_C, ((SP & 0xFF) + (offset & 0xFF)) > 0xFF);
-    HL.reg16 = result;
-    return 12;
+// Cycles for base opcodes; conditional branches count as not taken.
+// 0xCB and illegal opcodes are 0.
+static constexpr uint8_t decodeCycles(uint8_t opcode) {
+  int x = opcode >> 6;
+  int y = (opcode >> 3) & 0x07;
+  int z = opcode & 0x07;
+  int q = y & 0x01;
+  if (x == 0) {
+    switch (z) {
+    case 0:
+      return y == 1 ? 20 : (y == 3 ? 12 : (y >= 4 ? 8 : 4));
+    case 1:
+      return q == 0 ? 12 : 8;
+    case 2:
+    case 3:
+      return 8;
+    case 4:
+    case 5:
+      return y == 6 ? 12 : 4;
+    case 6:
+      return y == 6 ? 12 : 8;
+    default:
+      return 4;
+    }
   }
-  case 0xF9: // LD SP, HL
-    SP = HL.reg16;
+  if (x == 1)
+    return (y == 6 || z == 6) && opcode != 0x76 ? 8 : 4;
+  if (x == 2)
+    return z == 6 ? 8 : 4;
+  switch (z) {
+  case 0:
+    return y <= 3 ? 8 : (y == 5 ? 16 : 12);
+  case 1:
+    return q == 0 ? 12 : (y == 5 ? 4 : (y == 7 ? 8 : 16));
+  case 2:
+    return (y <= 3) ? 12 : ((y & 0x01) ? 16 : 8);
+  case 3:
+    return y == 0 ? 16 : (y >= 6 ? 4 : 0);
+  case 4:
+    return y <= 3 ? 12 : 0;
+  case 5:
+    return q == 0 ? 16 : (y == 1 ? 24 : 0);
+  case 6:
     return 8;
-
-  case 0xF3: // DI
-    IME = false;
-    return 4;
-  case 0xFB: // EI
-    IME = true;
-    return 4;
-  case 0xC7:
-    pushStack(PC);
-    PC = 0x00;
-    return 16;
-  case 0xCF:
-    pushStack(PC);
-    PC = 0x08;
-    return 16;
-  case 0xD7:
-    pushStack(PC);
-    PC = 0x10;
-    return 16;
-  case 0xDF:
-    pushStack(PC);
-    PC = 0x18;
-    return 16;
-  case 0xE7:
-    pushStack(PC);
-    PC = 0x20;
-    return 16;
-  case 0xEF:
-    pushStack(PC);
-    PC = 0x28;
-    return 16;
-  case 0xF7:
-    pushStack(PC);
-    PC = 0x30;
-    return 16;
-  case 0xFF:
-    pushStack(PC);
-    PC = 0x38;
-    return 16;
-
-  case 0xCB: // Prefix CB
-    return executeCB(fetch());
-
   default:
-    fprintf(stderr, "Unimplemented opcode: %02X at PC: %04X\n", opcode, PC - 1);
-    exit(1);
-    return 0;
+    return 16;
   }
 }
 
-int CPU::executeCB(uint8_t opcode) {
-  // Decode CB opcode
-  uint8_t x = opcode >> 6;
-  uint8_t y = (opcode >> 3) & 0x07;
-  uint8_t z = opcode & 0x07;
+static int cbCycles(uint8_t opcode) {
+  if ((opcode & 0x07) != 6)
+    return 8;
+  return (opcode >> 6) == 1 ? 12 : 16;
+}
 
-  // 1. Fetch value
-  uint8_t val = 0;
+static bool endsBlock(uint8_t opcode) {
+  int x = opcode >> 6;
+  int y = (opcode >> 3) & 0x07;
+  int z = opcode & 0x07;
+  if (x == 0)
+    return z == 0 && y >= 2; // STOP, JR
+  if (x == 1)
+    return opcode == 0x76; // HALT
+  if (x == 2)
+    return false;
   switch (z) {
   case 0:
-    val = BC.hi;
-    break; // B
+    return y <= 3; // RET cc
   case 1:
-    val = BC.lo;
-    break; // C
+    return (y & 0x01) && y != 7; // RET, RETI, JP (HL)
   case 2:
-    val = DE.hi;
-    break; // D
+    return y <= 3; // JP cc
   case 3:
-    val = DE.lo;
-    break; // E
+    return y != 1; // JP, DI, EI, illegal
   case 4:
-    val = HL.hi;
-    break; // H
   case 5:
-    val = HL.lo;
-    break; // L
+    return z == 4 || (y & 0x01); // CALL, illegal
   case 6:
-    val = bus.read(HL.reg16);
-    break; // (HL)
-  case 7:
-    val = AF.hi;
-    break; // A
+    return false;
+  default:
+    return true; // RST
   }
+}
 
-  // 2. Perform operation
-  if (x == 0) {
-    // Rotates and Shifts
-    switch (y) {
-    case 0: { // RLC
-      bool c = (val & 0x80) != 0;
-      val = (val << 1) | (c ? 1 : 0);
-      setFlag(FLAG_Z, val == 0);
-      setFlag(FLAG_N, false);
-      setFlag(FLAG_H, false);
-      setFlag(FLAG_C, c);
-      break;
-    }
-    case 1: { // RRC
-      bool c = (val & 0x01) != 0;
-      val = (val >> 1) | (c ? 0x80 : 0);
-      setFlag(FLAG_Z, val == 0);
-      setFlag(FLAG_N, false);
-      setFlag(FLAG_H, false);
-      setFlag(FLAG_C, c);
-      break;
-    }
-    case 2: { // RL
-      bool old_c = getFlag(FLAG_C);
-      bool c = (val & 0x80) != 0;
-      val = (val << 1) | (old_c ? 1 : 0);
-      setFlag(FLAG_Z, val == 0);
-      setFlag(FLAG_N, false);
-      setFlag(FLAG_H, false);
-      setFlag(FLAG_C, c);
-      break;
-    }
-    case 3: { // RR
-      bool old_c = getFlag(FLAG_C);
-      bool c = (val & 0x01) != 0;
-      val = (val >> 1) | (old_c ? 0x80 : 0);
-      setFlag(FLAG_Z, val == 0);
-      setFlag(FLAG_N, false);
-      setFlag(FLAG_H, false);
-      setFlag(FLAG_C, c);
-      break;
-    }
-    case 4: { // SLA
-      bool c = (val & 0x80) != 0;
-      val = val << 1;
-      setFlag(FLAG_Z, val == 0);
-      setFlag(FLAG_N, false);
-      setFlag(FLAG_H, false);
-      setFlag(FLAG_C, c);
-      break;
-    }
-    case 5: { // SRA
-      bool c = (val & 0x01) != 0;
-      uint8_t msb = val & 0x80;
-      val = (val >> 1) | msb;
-      setFlag(FLAG_Z, val == 0);
-      setFlag(FLAG_N, false);
-      setFlag(FLAG_H, false);
-      setFlag(FLAG_C, c);
-      break;
-    }
-    case 6: { // SWAP
-      val = (val << 4) | (val >> 4);
-      setFlag(FLAG_Z, val == 0);
-      setFlag(FLAG_N, false);
-      setFlag(FLAG_H, false);
-      setFlag(FLAG_C, false);
-      break;
-    }
-    case 7: { // SRL
-      bool c = (val & 0x01) != 0;
-      val = val >> 1;
-      setFlag(FLAG_Z, val == 0);
-      setFlag(FLAG_N, false);
-      setFlag(FLAG_H, false);
-      setFlag(FLAG_C, c);
-      break;
-    }
-    }
-  } else if (x == 1) {
-    // BIT y, z
-    bool bit = (val & (1 << y)) != 0;
-    setFlag(FLAG_Z, !bit);
-    setFlag(FLAG_N, false);
-    setFlag(FLAG_H, true);
-    // Carry flag is not affected
-  } else if (x == 2) {
-    // RES y, z
-    val &= ~(1 << y);
-  } else if (x == 3) {
-    // SET y, z
-    val |= (1 << y);
+// Destination of a JR/JP (taken or not), -1 for anything else
+static int branchTarget(uint8_t opcode, uint16_t operand, uint16_t next) {
+  switch (opcode) {
+  case 0x18: // JR
+  case 0x20:
+  case 0x28:
+  case 0x30:
+  case 0x38:
+    return static_cast<uint16_t>(next + static_cast<int8_t>(operand));
+  case 0xC3: // JP
+  case 0xC2:
+  case 0xCA:
+  case 0xD2:
+  case 0xDA:
+    return operand;
+  default:
+    return -1;
   }
+}
 
-  // 3. Write value back (if not BIT)
-  if (x != 1) {
-    switch (z) {
-    case 0:
-      BC.hi = val;
-      break;
-    case 1:
-      BC.lo = val;
-      break;
-    case 2:
-      DE.hi = val;
-      break;
-    case 3:
-      DE.lo = val;
-      break;
-    case 4:
-      HL.hi = val;
-      break;
-    case 5:
-      HL.lo = val;
-      break;
-    case 6:
-      bus.write(HL.reg16, val);
-      break;
-    case 7:
-      AF.hi = val;
-      break;
-    }
+// No memory, stack, I/O or control flow side effects
+static bool registerOnly(uint8_t opcode, uint16_t operand) {
+  int x = opcode >> 6;
+  int y = (opcode >> 3) & 0x07;
+  int z = opcode & 0x07;
+  switch (x) {
+  case 0:
+    if (z == 0)
+      return y == 0; // NOP
+    if (z == 2)
+      return false; // LD (rr), A / LD A, (rr)
+    if (z >= 4 && z <= 6)
+      return y != 6; // INC/DEC/LD (HL)
+    return true;
+  case 1:
+    return y != 6 && z != 6;
+  case 2:
+    return z != 6;
+  default:
+    if (opcode == 0xCB)
+      return (operand & 0x07) != 6;
+    return z == 6 || opcode == 0xF9; // ALU A, n8 / LD SP, HL
   }
+}
 
-  // 4. Return cycles
-  if (z == 6) {
-    if (x == 1) {
-      return 12; // BIT (HL) takes 12 cycles
-    } else {
-      return 16; // RES, SET, Rotates on (HL) take 16 cycles
-    }
+// The I/O register an idle loop may poll, -1 if the op reads anything else
+static int polledRegister(uint8_t opcode, uint16_t operand) {
+  uint16_t address;
+  if (opcode == 0xF0) { // LDH A, (n8)
+    address = 0xFF00 | operand;
+  } else if (opcode == 0xFA) { // LD A, (nn)
+    address = operand;
   } else {
-    return 8; // Register operations take 8 cycles
+    return -1;
+  }
+  switch (address) {
+  case 0xFF04: // DIV
+  case 0xFF0F: // IF
+  case 0xFF41: // STAT
+  case 0xFF44: // LY
+    return address;
+  default:
+    return -1;
+  }
+}
+
+static bool accessesIO(uint8_t opcode, uint16_t operand) {
+  switch (opcode) {
+  case 0xE0: // LDH (n8), A
+  case 0xF0: // LDH A, (n8)
+  case 0xE2: // LD (C), A
+  case 0xF2: // LD A, (C)
+    return true;
+  case 0xEA: // LD (nn), A
+  case 0xFA: // LD A, (nn)
+    return operand >= 0xFF00;
+  default:
+    return false;
+  }
+}
+
+// The pair an op addresses memory through (0 BC, 1 DE, 2 HL), -1 for none.
+// Stack ops are left out: SP doesn't point at I/O in practice.
+static int pointerPair(uint8_t opcode, uint16_t operand) {
+  int x = opcode >> 6;
+  int y = (opcode >> 3) & 0x07;
+  int z = opcode & 0x07;
+  switch (x) {
+  case 0:
+    if (z == 2) // LD (BC)/(DE)/(HL+)/(HL-) and back
+      return std::min(y >> 1, 2);
+    return (z >= 4 && z <= 6 && y == 6) ? 2 : -1; // INC/DEC/LD (HL)
+  case 1:
+    return (opcode != 0x76 && (y == 6 || z == 6)) ? 2 : -1;
+  case 2:
+    return z == 6 ? 2 : -1;
+  default:
+    if (opcode == 0xCB)
+      return (operand & 0x07) == 6 ? 2 : -1;
+    return -1;
   }
 }
+
+template <std::size_t... Op>
+constexpr std::array<CPU::OpHandler, 256>
+CPU::makeOpTable(std::index_sequence<Op...>) {
+  return {&CPU::op<static_cast<uint8_t>(Op)>...};
+}
+
+template <std::size_t... Op>
+constexpr std::array<CPU::CBHandler, 256>
+CPU::makeCBTable(std::index_sequence<Op...>) {
+  return {&CPU::opCB<static_cast<uint8_t>(Op)>...};
+}
+
+const std::array<CPU::OpHandler, 256> CPU::opTable =
+    CPU::makeOpTable(std::make_index_sequence<256>{});
+const std::array<CPU::CBHandler, 256> CPU::cbTable =
+    CPU::makeCBTable(std::make_index_sequence<256>{});
+const std::array<uint8_t, 256> CPU::opLength = [] {
+  std::array<uint8_t, 256> table{};
+  for (int i = 0; i < 256; i++)
+    table[i] = decodeLength(static_cast<uint8_t>(i));
+  return table;
+}();
+const std::array<uint8_t, 256> CPU::opCycles = [] {
+  std::array<uint8_t, 256> table{};
+  for (int i = 0; i < 256; i++)
+    table[i] = decodeCycles(static_cast<uint8_t>(i));
+  return table;
+}();
+
+void CPU::saveState(StateWriter &out) const {
+  // Flags are saved folded into F, so the lazy flag state isn't part of the
+  // format
+  uint8_t f = flagOp == FlagOp::None ? AF.lo : computeFlags();
+  out.put(AF.hi);
+  out.put(f);
+  out.put(BC.reg16);
+  out.put(DE.reg16);
+  out.put(HL.reg16);
+  out.put(SP);
+  out.put(PC);
+  out.put(IME);
+  out.put(halted);
+  out.put(retired);
+}
+
+bool CPU::loadState(StateReader &in) {
+  in.get(AF.hi);
+  in.get(AF.lo);
+  flagOp = FlagOp::None;
+  in.get(BC.reg16);
+  in.get(DE.reg16);
+  in.get(HL.reg16);
+  in.get(SP);
+  in.get(PC);
+  in.get(IME);
+  in.get(halted);
+  in.get(retired);
+  idle = false;
+  // Cached blocks stay valid: ROM can't change under them and
+  // Bus::loadState() bumps the epoch of every RAM page holding code
+  return in.ok();
+}
@@ -1,7 +1,18 @@
 #pragma once
 
 #include "Bus.h"
+#include "Jit.h"
+#ifdef SHELLBOY_OPCODE_STATS
+#include "OpcodeStats.h"
+#endif
+#include <array>
 #include <cstdint>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+class StateWriter;
+class StateReader;
 
 // The Game Boy CPU (LR35902) uses 8-bit registers that can be combined
 // into 16-bit registers (AF, BC, DE, HL). It is little-endian.
@@ -22,6 +33,21 @@ public:
   void reset();
   int tick(); // Execute one instruction, return T-cycles elapsed
 
+  // Execute one cached basic block, return T-cycles elapsed. Interrupts are
+  // only checked on entry. Code outside ROM/WRAM/HRAM runs one instruction
+  // at a time, as in tick().
+  int runBlock();
+  // Drop every decoded block, e.g. after memory was replaced wholesale.
+  void flushBlockCache();
+  // Heap held by decoded blocks and their native translations, roughly
+  size_t blockCacheBytes() const;
+
+  // Translate hot ROM blocks to native code (see Jit). Returns whether the
+  // JIT is now in use; false on hosts without a backend and in
+  // SHELLBOY_OPCODE_STATS builds. Safe to toggle between blocks.
+  bool setJitEnabled(bool enabled);
+  bool jitEnabled() const { return useJit; }
+
   // CPU Flags (stored in register F)
   static constexpr uint8_t FLAG_Z = 0x80; // Zero
   static constexpr uint8_t FLAG_N = 0x40; // Subtraction
@@ -31,11 +57,15 @@ public:
   void setFlag(uint8_t flag, bool value);
   bool getFlag(uint8_t flag) const;
 
+  // Flags are evaluated lazily: ALU ops record their operands and F is only
+  // computed when read. Call syncFlags() before touching AF.lo directly.
+  void syncFlags();
+
   void pushStack(uint16_t value);
   uint16_t popStack();
 
   // Registers
-  Register AF; // A = hi, F = lo
+  Register AF; // A = hi, F = lo (may be stale, see syncFlags())
   Register BC; // B = hi, C = lo
   Register DE; // D = hi, E = lo
   Register HL; // H = hi, L = lo
@@ -47,12 +77,148 @@ public:
 
   void handleInterrupts();
 
+  // HALTed and no enabled interrupt pending: only a new interrupt request
+  // can change anything.
+  bool isHalted() const { return halted; }
+  bool interruptPending() const;
+
+  // The last runBlock() was one iteration of a loop that only reads
+  // registers and LY/STAT/IF/DIV, and it left every register unchanged. The
+  // following iterations will do exactly the same until one of those I/O
+  // registers changes (or an interrupt is requested).
+  bool inIdleLoop() const { return idle; }
+  bool idleLoopPollsDiv() const { return idlePollsDiv; }
+  // Count `passes` more iterations of the idle loop as retired without
+  // running them.
+  void skipIdleIterations(uint64_t passes) { retired += passes * idleOps; }
+
+  // Instructions executed since power on
+  uint64_t instructionsRetired() const { return retired; }
+
+#ifdef SHELLBOY_OPCODE_STATS
+  // Per-opcode counts. Native blocks can't be counted, so the JIT stays off
+  // in these builds.
+  OpcodeStats &opcodeStats() { return stats; }
+#endif
+
+  // Instruction length in bytes, opcode included (0xCB counts its suffix).
+  static int instructionLength(uint8_t opcode) { return opLength[opcode]; }
+
+  // Snapshot support, see SaveState.h.
+  void saveState(StateWriter &out) const;
+  bool loadState(StateReader &in);
+
 private:
   Bus &bus;
   bool halted = false;
+  bool idle = false;
+  bool idlePollsDiv = false;
+  uint64_t idleOps = 0;
+  uint64_t retired = 0;
+#ifdef SHELLBOY_OPCODE_STATS
+  OpcodeStats stats;
+#endif
+
+  // The last flag-setting operation not yet folded into AF.lo.
+  enum class FlagOp : uint8_t { None, Add, Sub, And, Or, Inc, Dec };
+  FlagOp flagOp = FlagOp::None;
+  uint8_t flagA = 0;      // Left operand
+  uint8_t flagB = 0;      // Right operand
+  uint8_t flagCarry = 0;  // Carry in (ADC/SBC)
+  uint8_t flagResult = 0; // 8-bit result
+
+  uint8_t computeFlags() const;
+  void setFlags(uint8_t flags) {
+    flagOp = FlagOp::None;
+    AF.lo = flags;
+  }
 
   uint8_t fetch();
   uint16_t fetch16();
   int execute(uint8_t opcode);
   int executeCB(uint8_t opcode);
+
+  // Every opcode gets its own handler, instantiated from the opcode's x/y/z
+  // bit fields at compile time, so dispatch is a single indirect call with
+  // no runtime register decode. Immediate operands are fetched by execute()
+  // (see opLength) and passed in.
+  using OpHandler = int (CPU::*)(uint16_t operand);
+  using CBHandler = int (CPU::*)();
+
+  static const std::array<OpHandler, 256> opTable;
+  static const std::array<CBHandler, 256> cbTable;
+  static const std::array<uint8_t, 256> opLength;
+
+  template <std::size_t... Op>
+  static constexpr std::array<OpHandler, 256>
+  makeOpTable(std::index_sequence<Op...>);
+  template <std::size_t... Op>
+  static constexpr std::array<CBHandler, 256>
+  makeCBTable(std::index_sequence<Op...>);
+
+  static const std::array<uint8_t, 256> opCycles;
+
+  template <uint8_t Op> int op(uint16_t operand);
+  template <uint8_t Op> int opCB();
+  int illegal(uint8_t opcode);
+
+  // Operand helpers indexed like the opcode fields:
+  // r: B, C, D, E, H, L, (HL), A   rp: BC, DE, HL, SP   cc: NZ, Z, NC, C
+  template <int R> uint8_t readR8();
+  template <int R> void writeR8(uint8_t value);
+  template <int P> uint16_t &reg16();
+  template <int CC> bool condition() const;
+  template <int Y> void alu(uint8_t value);
+  template <int Y> uint8_t rotate(uint8_t value);
+  void addHL(uint16_t value);
+
+  // A straight run of pre-decoded instructions ending at the first branch,
+  // HALT/STOP/EI/DI, page boundary or (except as the first instruction) an
+  // access to 0xFFxx through an immediate address. The clock only moves once
+  // a block has run, so I/O must be accessed at the start of one to see
+  // up-to-date devices: a block also stops before any later op whose BC, DE
+  // or HL pointer reaches I/O when it runs (see reachesIO()).
+  struct DecodedOp {
+    OpHandler handler;
+    uint16_t operand;
+    uint8_t length;
+    uint8_t opcode;
+    int8_t pointer; // Pair addressing memory (0 BC, 1 DE, 2 HL), -1 if none
+  };
+  struct Block {
+    std::vector<DecodedOp> ops;
+    int cycles = 0;       // Every op but the last, which may branch
+    bool checked = false; // Code that can change under us (RAM or ROMX)
+    bool ram = false;     // Validated against the page epoch on every use
+    uint8_t page = 0;
+    uint32_t epoch = 0;
+    bool idleLoop = false; // Candidate polling loop, see inIdleLoop()
+    bool pollsDiv = false;
+    // An op past the first addresses memory through BC, DE or HL
+    bool pointers = false;
+
+    // Native translation of the first nativeOps ops (never the last one)
+    uint32_t runs = 0;
+    Jit::Entry native = nullptr;
+    uint8_t nativeOps = 0;
+    uint16_t nativeLength = 0;
+    int nativeCycles = 0;
+  };
+  // Keyed by PC | (ROM bank << 16); the bank is only set for ROMX
+  std::unordered_map<uint32_t, Block> blocks;
+
+  Block *lookupBlock();
+  void decodeBlock(Block &block);
+  int runDecodedBlock(Block &block);
+  int runCheckedBlock(const Block &block, size_t start, int cycles);
+  bool reachesIO(const DecodedOp &op) const;
+  int stopBefore(const Block &block, size_t index);
+
+  static constexpr uint32_t JIT_THRESHOLD = 16; // Runs before translating
+  Jit jit;
+  bool useJit = false;
+  void translateBlock(Block &block);
+  // Returns how many ops ran natively, with PC and `cycles` advanced past
+  // them. Fewer than nativeOps means an MBC write cut the translation short.
+  size_t runNative(const Block &block, int &cycles);
 };
@@ -0,0 +1,131 @@
+#include "DeltaCodec.h"
+#include <bit>
+#include <cstring>
+
+namespace {
+
+// Runs shorter than this are cheaper to store as literals
+constexpr size_t MIN_RUN = 4;
+constexpr uint64_t LOW7 = 0x7F7F7F7F7F7F7F7Full;
+
+void putVarint(std::vector<uint8_t> &out, size_t value) {
+  while (value >= 0x80) {
+    out.push_back(static_cast<uint8_t>(value | 0x80));
+    value >>= 7;
+  }
+  out.push_back(static_cast<uint8_t>(value));
+}
+
+bool getVarint(const uint8_t *&in, const uint8_t *end, size_t &value) {
+  value = 0;
+  for (int shift = 0; in < end && shift < 64; shift += 7) {
+    uint8_t byte = *in++;
+    value |= static_cast<size_t>(byte & 0x7F) << shift;
+    if (!(byte & 0x80))
+      return true;
+  }
+  return false;
+}
+
+// Length of the run of data[at] starting at `at`, compared a word at a time.
+size_t runLength(const uint8_t *data, size_t at, size_t size) {
+  uint64_t pattern = 0x0101010101010101ull * data[at];
+  size_t end = at + 1;
+  while (end + 8 <= size) {
+    uint64_t word;
+    std::memcpy(&word, data + end, 8);
+    if (word != pattern)
+      break;
+    end += 8;
+  }
+  while (end < size && data[end] == data[at])
+    end++;
+  return end - at;
+}
+
+} // namespace
+
+namespace DeltaCodec {
+
+void compress(const uint8_t *data, size_t size, std::vector<uint8_t> &out) {
+  out.clear();
+  size_t literalStart = 0;
+  size_t i = 0;
+  auto flushLiterals = [&](size_t end) {
+    if (end == literalStart)
+      return;
+    putVarint(out, (end - literalStart) << 1);
+    out.insert(out.end(), data + literalStart, data + end);
+  };
+
+  while (i < size) {
+    if (i + 8 <= size) {
+      // Find the first run of MIN_RUN equal bytes starting in i..i+4 a word
+      // at a time; byte k of `equal` is 0x80 when bytes k and k+1 match
+      uint64_t word;
+      std::memcpy(&word, data + i, 8);
+      uint64_t pairs = word ^ (word >> 8);
+      uint64_t equal = ~(((pairs & LOW7) + LOW7) | pairs | LOW7);
+      uint64_t starts = equal & (equal >> 8) & (equal >> 16) & 0x8080808080ull;
+      if (!starts) {
+        i += 5;
+        continue;
+      }
+      i += std::countr_zero(starts) >> 3;
+    } else if (i + MIN_RUN > size || data[i] != data[i + 1] ||
+               data[i] != data[i + 2] || data[i] != data[i + 3]) {
+      i++;
+      continue;
+    }
+
+    size_t run = runLength(data, i, size);
+    flushLiterals(i);
+    putVarint(out, (run << 1) | 1);
+    out.push_back(data[i]);
+    i += run;
+    literalStart = i;
+  }
+  flushLiterals(size);
+}
+
+bool decompress(const uint8_t *data, size_t size, uint8_t *out,
+                size_t outSize) {
+  const uint8_t *in = data;
+  const uint8_t *end = data + size;
+  size_t written = 0;
+  while (in < end) {
+    size_t header;
+    if (!getVarint(in, end, header))
+      return false;
+    size_t count = header >> 1;
+    if (count > outSize - written)
+      return false;
+    if (header & 1) {
+      if (in == end)
+        return false;
+      std::memset(out + written, *in++, count);
+    } else {
+      if (count > static_cast<size_t>(end - in))
+        return false;
+      std::memcpy(out + written, in, count);
+      in += count;
+    }
+    written += count;
+  }
+  return written == outSize;
+}
+
+void xorBytes(const uint8_t *a, const uint8_t *b, uint8_t *out, size_t size) {
+  size_t i = 0;
+  for (; i + 8 <= size; i += 8) {
+    uint64_t x, y;
+    std::memcpy(&x, a + i, 8);
+    std::memcpy(&y, b + i, 8);
+    x ^= y;
+    std::memcpy(out + i, &x, 8);
+  }
+  for (; i < size; i++)
+    out[i] = a[i] ^ b[i];
+}
+
+} // namespace DeltaCodec
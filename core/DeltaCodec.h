@@ -0,0 +1,28 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Byte-run compression for save state deltas (see Rewind). An XOR of two
+// snapshots a few frames apart is almost all zeros, and raw snapshots are
+// mostly long fills, so run-length coding gets most of what a general
+// purpose compressor would at a fraction of the cost.
+//
+// Stream: a sequence of tokens, each a LEB128 header n followed by
+//   n odd:  one byte, repeated n >> 1 times
+//   n even: n >> 1 literal bytes
+namespace DeltaCodec {
+
+// Replaces `out` with the compressed form of `size` bytes at `data`.
+void compress(const uint8_t *data, size_t size, std::vector<uint8_t> &out);
+
+// Decodes exactly `size` bytes into `out`. Returns false if the stream is
+// malformed or doesn't decode to exactly that many bytes.
+bool decompress(const uint8_t *data, size_t size, uint8_t *out,
+                size_t outSize);
+
+// out[i] = a[i] ^ b[i]
+void xorBytes(const uint8_t *a, const uint8_t *b, uint8_t *out, size_t size);
+
+} // namespace DeltaCodec
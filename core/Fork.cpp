@@ -0,0 +1,39 @@
+#include "Fork.h"
+#include "Bus.h"
+#include "CPU.h"
+#include "PPU.h"
+#include "mmu/Cartridge.h"
+
+ForkPoint::ForkPoint(const SaveState::Machine &parent)
+    : rom(parent.cartridge.romImage()),
+      wram(parent.bus.workRam().freeze()),
+      vram(parent.ppu.videoRam().freeze()),
+      sram(parent.cartridge.ramPages().freeze()) {
+  SaveState::save(parent, state, false);
+}
+
+bool ForkPoint::spawn(const SaveState::Machine &child) const {
+  if (!rom)
+    return false;
+  if (child.cartridge.romImage() != rom) {
+    child.cartridge.loadRom(rom);
+    child.cpu.flushBlockCache(); // Blocks decoded from another game
+  }
+  child.bus.workRam().borrow(wram);
+  child.ppu.videoRam().borrow(vram);
+  child.cartridge.ramPages().borrow(sram);
+  // Loading remaps every page onto the borrowed RAM
+  return SaveState::load(child, state.data(), state.size(), false);
+}
+
+size_t ForkPoint::sharedBytes() const {
+  return (rom ? rom->size() : 0) + wram->bytes.size() + vram->bytes.size() +
+         sram->bytes.size();
+}
+
+size_t ForkPoint::privateBytes(const SaveState::Machine &child) {
+  size_t pages = child.bus.workRam().ownedPages() +
+                 child.ppu.videoRam().ownedPages() +
+                 child.cartridge.ramPages().ownedPages();
+  return pages * PagedRam::PAGE_SIZE;
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include "SaveState.h"
+#include "mmu/PagedRam.h"
+#include "mmu/RomImage.h"
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// A running machine frozen so any number of children can be started from
+// it. Children share the ROM and the fork point's copy of WRAM, VRAM and
+// cartridge RAM, copying a 256-byte page only when they first write to it,
+// so spawning costs a small save state load and each child's memory grows
+// with what it dirties. The parent keeps running on its own private RAM.
+class ForkPoint {
+public:
+  explicit ForkPoint(const SaveState::Machine &parent);
+
+  // `child` must be wired like any other Machine; whatever it held before
+  // is replaced. Fails only if the child cannot take the snapshot.
+  bool spawn(const SaveState::Machine &child) const;
+
+  // ROM and RAM every child shares
+  size_t sharedBytes() const;
+  // RAM a child has written since it was spawned, i.e. all it does not share
+  static size_t privateBytes(const SaveState::Machine &child);
+
+private:
+  std::shared_ptr<const RomImage> rom;
+  std::shared_ptr<const PagedRam::Image> wram;
+  std::shared_ptr<const PagedRam::Image> vram;
+  std::shared_ptr<const PagedRam::Image> sram;
+  std::vector<uint8_t> state; // Everything but the RAM above
+};
@@ -0,0 +1,28 @@
+#include "GameBoy.h"
+#include <utility>
+
+GameBoy::GameBoy() {
+  bus.setCartridge(&cartridge);
+  bus.setPPU(&ppu);
+  bus.setTimer(&timer);
+  bus.setJoypad(&joypad);
+  bus.setScheduler(&scheduler);
+}
+
+bool GameBoy::loadRom(const std::string &path) {
+  if (!cartridge.loadRom(path))
+    return false;
+  bus.remapCartridge();
+  return true;
+}
+
+void GameBoy::loadRom(std::shared_ptr<const RomImage> rom) {
+  cartridge.loadRom(std::move(rom));
+  bus.remapCartridge();
+}
+
+size_t GameBoy::footprint() const {
+  size_t pages = bus.workRam().ownedPages() + ppu.videoRam().ownedPages() +
+                 cartridge.ramPages().ownedPages();
+  return sizeof(*this) + pages * PagedRam::PAGE_SIZE + cpu.blockCacheBytes();
+}
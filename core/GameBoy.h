@@ -0,0 +1,63 @@
+#pragma once
+
+#include "Bus.h"
+#include "CPU.h"
+#include "Joypad.h"
+#include "PPU.h"
+#include "SaveState.h"
+#include "Scheduler.h"
+#include "Timer.h"
+#include "mmu/Cartridge.h"
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+// A whole Game Boy in one object: every component by value, wired together
+// once at construction, and the machine is a single allocation. The Bus
+// still null-checks components on its I/O slow path, for the bare Buses of
+// tests and Lockstep lanes; the fast path never looks. Members are laid out
+// so the state touched on every instruction (page tables, PPU registers,
+// CPU, timer, scheduler) sits close together; the bulk memory arrays sit at
+// the ends.
+//
+// The components stay public for frontends and tools that need one (the
+// joypad, the frame buffer, profiling...), but the wiring between them is
+// fixed. About 30KB (see footprint() for the heap on top), so allocate it
+// with new/make_unique rather than on a small stack.
+class GameBoy {
+public:
+  GameBoy();
+  GameBoy(const GameBoy &) = delete;
+  GameBoy &operator=(const GameBoy &) = delete;
+
+  // See Cartridge::loadRom(); meant for a machine that has not run yet. On
+  // failure, loadError() says why.
+  bool loadRom(const std::string &path);
+  void loadRom(std::shared_ptr<const RomImage> rom);
+  const std::string &loadError() const { return cartridge.loadError(); }
+
+  // Run until the end of the current frame, return T-cycles elapsed.
+  uint64_t runFrame() { return scheduler.runFrame(); }
+  // Run for at least `cycles` T-cycles, return T-cycles elapsed.
+  uint64_t runCycles(uint64_t cycles) { return scheduler.runCycles(cycles); }
+
+  // Bytes this instance holds on its own: the object, its RAM (WRAM, VRAM,
+  // and cartridge RAM only if the header declares some; pages still shared
+  // with a ForkPoint don't count), decoded blocks and translated code. The
+  // ROM is shared by every instance playing the same file (see RomImage).
+  size_t footprint() const;
+
+  // For SaveState, Rewind, RunAhead and ForkPoint
+  SaveState::Machine machine() {
+    return {bus, cpu, ppu, timer, joypad, cartridge, scheduler};
+  }
+
+  Bus bus;
+  PPU ppu{bus};
+  CPU cpu{bus};
+  Timer timer{bus};
+  Joypad joypad{bus};
+  Cartridge cartridge;
+  Scheduler scheduler{bus, cpu, ppu, timer};
+};
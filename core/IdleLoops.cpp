@@ -0,0 +1,47 @@
+#include "IdleLoops.h"
+#include <cstdlib>
+#include <fstream>
+
+bool IdleLoopOverrides::load(const std::string &path) {
+  std::ifstream file(path);
+  if (!file.is_open())
+    return false;
+
+  std::string line;
+  while (std::getline(file, line)) {
+    line = line.substr(0, line.find('#'));
+    size_t first = line.find(',');
+    size_t second = line.find(',', first + 1);
+    if (first == std::string::npos || second == std::string::npos)
+      continue;
+
+    std::string title = line.substr(0, first);
+    std::string checksum = line.substr(first + 1, second - first - 1);
+    std::string mode = line.substr(second + 1);
+    mode.erase(mode.find_last_not_of(" \t\r") + 1);
+    if (mode != "on" && mode != "off")
+      continue;
+
+    char *end = nullptr;
+    unsigned long value = std::strtoul(checksum.c_str(), &end, 16);
+    if (end == checksum.c_str() || value > 0xFF)
+      continue;
+    add(title, static_cast<uint8_t>(value), mode == "on");
+  }
+  return true;
+}
+
+void IdleLoopOverrides::add(const std::string &title, uint8_t checksum,
+                            bool skip) {
+  entries.push_back({title, checksum, skip});
+}
+
+bool IdleLoopOverrides::allowsSkipping(const std::string &title,
+                                       uint8_t checksum, bool fallback) const {
+  // Later entries win
+  for (auto it = entries.rbegin(); it != entries.rend(); ++it) {
+    if (it->title == title && it->checksum == checksum)
+      return it->skip;
+  }
+  return fallback;
+}
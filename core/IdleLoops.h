@@ -0,0 +1,30 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Per-ROM switch for idle-loop skipping (Scheduler::setIdleLoopSkipping),
+// keyed by the cartridge header title and header checksum. ROMs not listed
+// keep the default.
+//
+// File format, one entry per line, '#' starts a comment:
+//   TITLE,CHECKSUM,on|off
+// e.g. "MYGAME,3C,off". CHECKSUM is the header checksum byte (0x14D) in hex.
+class IdleLoopOverrides {
+public:
+  // Returns false if the file can't be opened. Malformed lines are skipped.
+  bool load(const std::string &path);
+  void add(const std::string &title, uint8_t checksum, bool skip);
+
+  bool allowsSkipping(const std::string &title, uint8_t checksum,
+                      bool fallback = true) const;
+
+private:
+  struct Entry {
+    std::string title;
+    uint8_t checksum;
+    bool skip;
+  };
+  std::vector<Entry> entries;
+};
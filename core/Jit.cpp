@@ -0,0 +1,565 @@
+#include "Jit.h"
+#include "Bus.h"
+#include <cstring>
+#include <initializer_list>
+#include <utility>
+#include <vector>
+
+#if defined(__x86_64__) && !defined(_WIN32)
+#define SHELLBOY_JIT 1
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+bool Jit::translatable(uint8_t opcode, uint16_t operand) {
+  int x = opcode >> 6;
+  int y = (opcode >> 3) & 0x07;
+  int z = opcode & 0x07;
+  switch (x) {
+  case 0:
+    if (z == 0)
+      return y == 0; // NOP
+    if (z == 7)
+      return y >= 5; // CPL, SCF, CCF
+    return true;
+  case 1:
+    return opcode != 0x76; // HALT
+  case 2:
+    return true;
+  default:
+    if (z == 6 || opcode == 0xF9) // ALU A, n8 / LD SP, HL
+      return true;
+    if (opcode == 0xEA || opcode == 0xFA)
+      return operand < 0xFF00;
+    return false;
+  }
+}
+
+#ifdef SHELLBOY_JIT
+
+namespace {
+
+enum HostReg : uint8_t {
+  RAX = 0,
+  RCX = 1,
+  RDX = 2,
+  RBX = 3,
+  RBP = 5,
+  RSI = 6,
+  R12 = 12,
+  R13 = 13,
+  R14 = 14,
+  R15 = 15,
+};
+
+// Guest register allocation. All callee-saved, so Bus callbacks keep them.
+// 8-bit values are kept zero-extended, 16-bit pairs masked to 16 bits.
+constexpr uint8_t REG_A = RBX;
+constexpr uint8_t REG_F = RBP;
+constexpr uint8_t REG_BC = R12;
+constexpr uint8_t REG_DE = R13;
+constexpr uint8_t REG_HL = R14;
+constexpr uint8_t REG_SP = R15;
+
+// 32-bit ALU opcodes (r/m32, r32) and their 0x81 /ext immediate forms
+constexpr uint8_t OP_ADD = 0x01, EXT_ADD = 0;
+constexpr uint8_t OP_OR = 0x09, EXT_OR = 1;
+constexpr uint8_t OP_AND = 0x21, EXT_AND = 4;
+constexpr uint8_t OP_SUB = 0x29, EXT_SUB = 5;
+constexpr uint8_t OP_XOR = 0x31, EXT_XOR = 6;
+constexpr uint8_t EXT_CMP = 7;
+constexpr uint8_t OP_TEST = 0x85;
+constexpr uint8_t OP_MOV = 0x89;
+constexpr uint8_t EXT_SHL = 4, EXT_SHR = 5;
+constexpr uint8_t CC_B = 0x2, CC_E = 0x4;
+
+uint32_t jitRead(Bus *bus, uint32_t address) { return bus->read(address); }
+
+uint32_t jitWrite(Bus *bus, uint32_t address, uint32_t value) {
+  uint32_t romWrites = bus->romWriteCount();
+  bus->write(address, value);
+  return bus->romWriteCount() != romWrites;
+}
+
+class Translator {
+public:
+  std::vector<uint8_t> out;
+
+  void prologue() {
+    emit({0x53, 0x55, 0x41, 0x54, 0x41, 0x55, 0x41, 0x56, 0x41, 0x57}); // push
+    emit({0x57, 0x56});             // push rdi (regs), push rsi (bus)
+    emit({0x48, 0x83, 0xEC, 0x08}); // sub rsp, 8
+    emit({0x0F, 0xB6, 0x5F, 0x01}); // movzx ebx, byte [rdi + 1]
+    emit({0x0F, 0xB6, 0x6F, 0x00}); // movzx ebp, byte [rdi]
+    emit({0x44, 0x0F, 0xB7, 0x67, 0x02}); // movzx r12d, word [rdi + 2]
+    emit({0x44, 0x0F, 0xB7, 0x6F, 0x04}); // movzx r13d, word [rdi + 4]
+    emit({0x44, 0x0F, 0xB7, 0x77, 0x06}); // movzx r14d, word [rdi + 6]
+    emit({0x44, 0x0F, 0xB7, 0x7F, 0x08}); // movzx r15d, word [rdi + 8]
+  }
+
+  // Returns `completed` from the normal path and the instruction count at
+  // each early exit.
+  void epilogue(int completed) {
+    movImm(RAX, completed);
+    size_t done = out.size();
+    emit({0x48, 0x8B, 0x7C, 0x24, 0x10}); // mov rdi, [rsp + 16]
+    emit({0x88, 0x5F, 0x01});             // mov [rdi + 1], bl
+    emit({0x40, 0x88, 0x6F, 0x00});       // mov [rdi], bpl
+    emit({0x66, 0x44, 0x89, 0x67, 0x02}); // mov [rdi + 2], r12w
+    emit({0x66, 0x44, 0x89, 0x6F, 0x04}); // mov [rdi + 4], r13w
+    emit({0x66, 0x44, 0x89, 0x77, 0x06}); // mov [rdi + 6], r14w
+    emit({0x66, 0x44, 0x89, 0x7F, 0x08}); // mov [rdi + 8], r15w
+    emit({0x48, 0x83, 0xC4, 0x08});       // add rsp, 8
+    emit({0x5E, 0x5F});                   // pop rsi, pop rdi
+    emit({0x41, 0x5F, 0x41, 0x5E, 0x41, 0x5D, 0x41, 0x5C, 0x5D, 0x5B}); // pop
+    emit({0xC3});                                                       // ret
+
+    for (auto [fixup, count] : exits) {
+      patch(fixup, out.size());
+      movImm(RAX, count);
+      out.push_back(0xE9); // jmp rel32
+      size_t jump = out.size();
+      imm32(0);
+      patch(jump, done);
+    }
+  }
+
+  void instruction(uint8_t opcode, uint16_t operand, int index) {
+    int x = opcode >> 6;
+    int y = (opcode >> 3) & 0x07;
+    int z = opcode & 0x07;
+    int p = y >> 1;
+    int q = y & 0x01;
+
+    // Past the first instruction the clock is behind, so leave I/O to the
+    // interpreter, which starts a new block there
+    if (index > 0) {
+      int pointer = pointerOf(opcode);
+      if (pointer >= 0)
+        exitIfIO(static_cast<uint8_t>(pointer), index);
+    }
+
+    if (x == 1) { // LD r, r'
+      if (z == 6) {
+        readFrom(REG_HL);
+        store8(y, RAX);
+      } else if (y == 6) {
+        load8(RDX, z);
+        writeTo(REG_HL);
+        exitIfBanked(index);
+      } else {
+        load8(RCX, z);
+        store8(y, RCX);
+      }
+      return;
+    }
+    if (x == 2) { // ALU A, r
+      load8(RCX, z);
+      alu(y);
+      return;
+    }
+    if (x == 3) {
+      switch (opcode) {
+      case 0xEA: // LD (nn), A
+        mov(RDX, REG_A);
+        movImm(RSI, operand);
+        callWrite();
+        exitIfBanked(index);
+        return;
+      case 0xFA: // LD A, (nn)
+        movImm(RSI, operand);
+        callRead();
+        mov(REG_A, RAX);
+        return;
+      case 0xF9: // LD SP, HL
+        mov(REG_SP, REG_HL);
+        return;
+      default: // ALU A, n8
+        movImm(RCX, operand);
+        alu(y);
+        return;
+      }
+    }
+
+    switch (z) {
+    case 1:
+      if (q == 0) { // LD rr, nn
+        movImm(pair16(p), operand);
+      } else { // ADD HL, rr
+        addHL(pair16(p));
+      }
+      return;
+    case 2:
+      indirect(p, q, index);
+      return;
+    case 3: // INC rr / DEC rr
+      aluImm(q ? EXT_SUB : EXT_ADD, pair16(p), 1);
+      aluImm(EXT_AND, pair16(p), 0xFFFF);
+      return;
+    case 4:
+    case 5: // INC r / DEC r
+      load8(RAX, y);
+      incDec(z == 5);
+      if (y == 6) {
+        mov(RDX, RAX);
+        writeTo(REG_HL);
+        exitIfBanked(index);
+      } else {
+        store8(y, RAX);
+      }
+      return;
+    case 6: // LD r, n8
+      if (y == 6) {
+        movImm(RDX, operand);
+        writeTo(REG_HL);
+        exitIfBanked(index);
+      } else {
+        movImm(RCX, operand);
+        store8(y, RCX);
+      }
+      return;
+    case 7:
+      if (y == 5) { // CPL
+        aluImm(EXT_XOR, REG_A, 0xFF);
+        aluImm(EXT_OR, REG_F, 0x60);
+      } else if (y == 6) { // SCF
+        aluImm(EXT_AND, REG_F, 0x80);
+        aluImm(EXT_OR, REG_F, 0x10);
+      } else { // CCF
+        aluImm(EXT_AND, REG_F, 0x90);
+        aluImm(EXT_XOR, REG_F, 0x10);
+      }
+      return;
+    default: // NOP
+      return;
+    }
+  }
+
+private:
+  std::vector<std::pair<size_t, int>> exits;
+
+  void emit(std::initializer_list<uint8_t> bytes) {
+    out.insert(out.end(), bytes);
+  }
+  void imm32(uint32_t value) {
+    for (int i = 0; i < 4; i++)
+      out.push_back(value >> (i * 8));
+  }
+  void patch(size_t at, size_t target) {
+    int32_t rel = static_cast<int32_t>(target - (at + 4));
+    std::memcpy(&out[at], &rel, sizeof(rel));
+  }
+  void rex(uint8_t reg, uint8_t rm) {
+    if (reg >= 8 || rm >= 8)
+      out.push_back(0x40 | ((reg >> 3) << 2) | (rm >> 3));
+  }
+  void modrm(uint8_t reg, uint8_t rm) {
+    out.push_back(0xC0 | ((reg & 7) << 3) | (rm & 7));
+  }
+
+  void aluReg(uint8_t op, uint8_t dst, uint8_t src) {
+    rex(src, dst);
+    out.push_back(op);
+    modrm(src, dst);
+  }
+  void mov(uint8_t dst, uint8_t src) { aluReg(OP_MOV, dst, src); }
+  void aluImm(uint8_t ext, uint8_t dst, uint32_t value) {
+    rex(0, dst);
+    out.push_back(0x81);
+    modrm(ext, dst);
+    imm32(value);
+  }
+  void movImm(uint8_t dst, uint32_t value) {
+    rex(0, dst);
+    out.push_back(0xB8 + (dst & 7));
+    imm32(value);
+  }
+  void shift(uint8_t ext, uint8_t dst, uint8_t count) {
+    rex(0, dst);
+    out.push_back(0xC1);
+    modrm(ext, dst);
+    out.push_back(count);
+  }
+
+  // ORs FLAG_Z into F if the host ZF is set. Leaves host flags alone until
+  // the setcc, so it can follow the instruction producing the result.
+  void zeroFlag() {
+    movImm(RDX, 0);
+    emit({0x0F, static_cast<uint8_t>(0x90 | CC_E)});
+    modrm(0, RDX);
+    shift(EXT_SHL, RDX, 7);
+    aluReg(OP_OR, REG_F, RDX);
+  }
+
+  void callRead() {
+    emit({0x48, 0x8B, 0x7C, 0x24, 0x08}); // mov rdi, [rsp + 8]
+    call(reinterpret_cast<const void *>(&jitRead));
+  }
+  // Value in edx, address in esi
+  void callWrite() {
+    emit({0x48, 0x8B, 0x7C, 0x24, 0x08}); // mov rdi, [rsp + 8]
+    call(reinterpret_cast<const void *>(&jitWrite));
+  }
+  void call(const void *fn) {
+    uint64_t target = reinterpret_cast<uint64_t>(fn);
+    emit({0x48, 0xB8}); // mov rax, imm64
+    for (int i = 0; i < 8; i++)
+      out.push_back(target >> (i * 8));
+    emit({0xFF, 0xD0}); // call rax
+  }
+  void readFrom(uint8_t addressReg) {
+    mov(RSI, addressReg);
+    callRead();
+  }
+  void writeTo(uint8_t addressReg) {
+    mov(RSI, addressReg);
+    callWrite();
+  }
+  // Expects jitWrite's result in eax
+  void exitIfBanked(int index) {
+    aluReg(OP_TEST, RAX, RAX);
+    emit({0x0F, 0x85}); // jnz rel32
+    exits.emplace_back(out.size(), index + 1);
+    imm32(0);
+  }
+
+  // Host register holding the address an op accesses memory through, -1
+  // for none
+  static int pointerOf(uint8_t opcode) {
+    int x = opcode >> 6;
+    int y = (opcode >> 3) & 0x07;
+    int z = opcode & 0x07;
+    if (x == 0 && z == 2)
+      return y < 4 ? pair16(y >> 1) : REG_HL;
+    if ((x == 0 && y == 6 && z >= 4 && z <= 6) ||
+        (x == 1 && (y == 6 || z == 6)) || (x == 2 && z == 6))
+      return REG_HL;
+    return -1;
+  }
+  // Leaves with the `index` instructions before this one done if the
+  // address is in 0xFF00-0xFF7F
+  void exitIfIO(uint8_t addressReg, int index) {
+    mov(RAX, addressReg);
+    aluImm(EXT_SUB, RAX, 0xFF00);
+    aluImm(EXT_CMP, RAX, 0x80);
+    emit({0x0F, static_cast<uint8_t>(0x80 | CC_B)}); // jb rel32
+    exits.emplace_back(out.size(), index);
+    imm32(0);
+  }
+
+  static uint8_t pair16(int p) {
+    static constexpr uint8_t regs[] = {REG_BC, REG_DE, REG_HL, REG_SP};
+    return regs[p];
+  }
+  static uint8_t pair8(int r) {
+    static constexpr uint8_t regs[] = {REG_BC, REG_DE, REG_HL};
+    return regs[r >> 1];
+  }
+
+  // r: B, C, D, E, H, L, (HL), A
+  void load8(uint8_t dst, int r) {
+    if (r == 7) {
+      mov(dst, REG_A);
+    } else if (r == 6) {
+      readFrom(REG_HL);
+      if (dst != RAX)
+        mov(dst, RAX);
+    } else {
+      mov(dst, pair8(r));
+      if (r & 1)
+        aluImm(EXT_AND, dst, 0xFF);
+      else
+        shift(EXT_SHR, dst, 8);
+    }
+  }
+  // Clobbers `src`. (HL) is handled by the callers.
+  void store8(int r, uint8_t src) {
+    if (r == 7) {
+      mov(REG_A, src);
+    } else if (r & 1) {
+      aluImm(EXT_AND, pair8(r), 0xFF00);
+      aluReg(OP_OR, pair8(r), src);
+    } else {
+      aluImm(EXT_AND, pair8(r), 0x00FF);
+      shift(EXT_SHL, src, 8);
+      aluReg(OP_OR, pair8(r), src);
+    }
+  }
+
+  // y: ADD, ADC, SUB, SBC, AND, XOR, OR, CP with the operand in ecx
+  void alu(int y) {
+    if (y >= 4 && y <= 6) {
+      static constexpr uint8_t ops[] = {OP_AND, OP_XOR, OP_OR};
+      aluReg(ops[y - 4], REG_A, RCX);
+      movImm(REG_F, y == 4 ? 0x20 : 0x00);
+      zeroFlag();
+      return;
+    }
+
+    bool sub = y >= 2;
+    bool carry = y == 1 || y == 3;
+    mov(RAX, REG_A);
+    if (carry) {
+      mov(RDX, REG_F);
+      shift(EXT_SHR, RDX, 4);
+      aluImm(EXT_AND, RDX, 1);
+    }
+    aluReg(sub ? OP_SUB : OP_ADD, RAX, RCX);
+    if (carry)
+      aluReg(sub ? OP_SUB : OP_ADD, RAX, RDX);
+
+    // H: carry/borrow into bit 4. C: bit 8 of the 32-bit result.
+    mov(RDX, REG_A);
+    aluReg(OP_XOR, RDX, RCX);
+    aluReg(OP_XOR, RDX, RAX);
+    aluImm(EXT_AND, RDX, 0x10);
+    shift(EXT_SHL, RDX, 1);
+    mov(REG_F, RDX);
+    mov(RDX, RAX);
+    aluImm(EXT_AND, RDX, 0x100);
+    shift(EXT_SHR, RDX, 4);
+    aluReg(OP_OR, REG_F, RDX);
+    if (sub)
+      aluImm(EXT_OR, REG_F, 0x40);
+    aluImm(EXT_AND, RAX, 0xFF);
+    zeroFlag();
+    if (y != 7)
+      mov(REG_A, RAX);
+  }
+
+  // Value in eax, keeps C
+  void incDec(bool dec) {
+    mov(RCX, RAX);
+    aluImm(dec ? EXT_SUB : EXT_ADD, RAX, 1);
+    mov(RDX, RCX);
+    aluReg(OP_XOR, RDX, RAX);
+    aluImm(EXT_AND, RDX, 0x10);
+    shift(EXT_SHL, RDX, 1);
+    aluImm(EXT_AND, REG_F, 0x10);
+    aluReg(OP_OR, REG_F, RDX);
+    if (dec)
+      aluImm(EXT_OR, REG_F, 0x40);
+    aluImm(EXT_AND, RAX, 0xFF);
+    zeroFlag();
+  }
+
+  // Keeps Z; H from bit 11, C from bit 15
+  void addHL(uint8_t src) {
+    mov(RAX, REG_HL);
+    aluReg(OP_ADD, RAX, src);
+    mov(RDX, REG_HL);
+    aluReg(OP_XOR, RDX, src);
+    aluReg(OP_XOR, RDX, RAX);
+    aluImm(EXT_AND, RDX, 0x1000);
+    shift(EXT_SHR, RDX, 7);
+    aluImm(EXT_AND, REG_F, 0x80);
+    aluReg(OP_OR, REG_F, RDX);
+    mov(RDX, RAX);
+    aluImm(EXT_AND, RDX, 0x10000);
+    shift(EXT_SHR, RDX, 12);
+    aluReg(OP_OR, REG_F, RDX);
+    aluImm(EXT_AND, RAX, 0xFFFF);
+    mov(REG_HL, RAX);
+  }
+
+  // LD (BC)/(DE)/(HL+)/(HL-), A and the matching loads into A
+  void indirect(int p, int q, int index) {
+    uint8_t address = p < 2 ? pair16(p) : REG_HL;
+    if (q == 0) {
+      mov(RDX, REG_A);
+      writeTo(address);
+    } else {
+      readFrom(address);
+      mov(REG_A, RAX);
+    }
+    if (p >= 2) { // Leaves eax alone for exitIfBanked
+      aluImm(p == 2 ? EXT_ADD : EXT_SUB, REG_HL, 1);
+      aluImm(EXT_AND, REG_HL, 0xFFFF);
+    }
+    if (q == 0)
+      exitIfBanked(index);
+  }
+};
+
+// Switches the pages spanning [begin, end) to `protection`
+bool protect(uint8_t *begin, uint8_t *end, int protection) {
+  static const uintptr_t page = static_cast<uintptr_t>(sysconf(_SC_PAGESIZE));
+  uintptr_t first = reinterpret_cast<uintptr_t>(begin) & ~(page - 1);
+  uintptr_t last = (reinterpret_cast<uintptr_t>(end) + page - 1) & ~(page - 1);
+  return mprotect(reinterpret_cast<void *>(first), last - first,
+                  protection) == 0;
+}
+
+} // namespace
+
+Jit::~Jit() {
+  if (code)
+    munmap(code, CODE_SIZE);
+}
+
+bool Jit::init() {
+  if (code)
+    return true;
+  void *memory = mmap(nullptr, CODE_SIZE, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (memory == MAP_FAILED)
+    return false;
+  code = static_cast<uint8_t *>(memory);
+  return true;
+}
+
+Jit::Entry Jit::compile(const Instruction *ops, size_t count,
+                        size_t &translated) {
+  translated = 0;
+  if (!code)
+    return nullptr;
+
+  size_t n = 0;
+  while (n < count && translatable(ops[n].opcode, ops[n].operand))
+    n++;
+  if (n == 0)
+    return nullptr;
+
+  Translator t;
+  t.prologue();
+  for (size_t i = 0; i < n; i++)
+    t.instruction(ops[i].opcode, ops[i].operand, static_cast<int>(i));
+  t.epilogue(static_cast<int>(n));
+
+  if (used + t.out.size() > CODE_SIZE) {
+    isFull = true;
+    return nullptr;
+  }
+  // Writable only while being appended to. The last page may hold earlier
+  // translations, so it goes back to executable before anything runs; if
+  // it can't, those are lost too and the caller has to start over.
+  uint8_t *entry = code + used;
+  uint8_t *end = entry + t.out.size();
+  if (!protect(entry, end, PROT_READ | PROT_WRITE))
+    return nullptr;
+  std::memcpy(entry, t.out.data(), t.out.size());
+  if (!protect(entry, end, PROT_READ | PROT_EXEC)) {
+    isFull = true;
+    return nullptr;
+  }
+  used = (used + t.out.size() + 15) & ~size_t{15};
+  translated = n;
+  return reinterpret_cast<Entry>(entry);
+}
+
+void Jit::reset() {
+  used = 0;
+  isFull = false;
+}
+
+#else
+
+Jit::~Jit() {}
+bool Jit::init() { return false; }
+Jit::Entry Jit::compile(const Instruction *, size_t, size_t &translated) {
+  translated = 0;
+  return nullptr;
+}
+void Jit::reset() {}
+
+#endif
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+class Bus;
+
+// Translates straight runs of LR35902 instructions into x86-64 machine
+// code. A, F, BC, DE, HL and SP live in host registers for the duration of
+// a translation; memory accesses call back into the Bus. Branches, stack
+// ops, CB-prefixed ops and explicit I/O accesses are left to the
+// interpreter, and translated code returns before any instruction but the
+// first whose BC, DE or HL pointer reaches I/O. The code buffer is never
+// writable and executable at once. Only built for x86-64 System V hosts,
+// available() is false everywhere else.
+class Jit {
+public:
+  // Guest registers handed to and returned from translated code. F must be
+  // materialised before the call.
+  struct Registers {
+    uint16_t af, bc, de, hl, sp;
+  };
+  // Returns how many instructions completed. Fewer than were translated
+  // means a write reached the MBC registers, or the next instruction would
+  // have reached I/O through a pointer; either way the block must stop there.
+  using Entry = int (*)(Registers *regs, Bus *bus);
+
+  struct Instruction {
+    uint8_t opcode;
+    uint16_t operand;
+  };
+
+  Jit() = default;
+  ~Jit();
+  Jit(const Jit &) = delete;
+  Jit &operator=(const Jit &) = delete;
+
+  // Allocates the code buffer on first use; false if the host can't run
+  // generated code.
+  bool init();
+  bool available() const { return code != nullptr; }
+
+  // Translate the longest supported prefix of `ops` (at most `count`
+  // instructions), reporting its length in `translated`. Returns nullptr if
+  // nothing could be translated or the code buffer is full (see full()),
+  // which is also how a failure to make new code executable is reported.
+  Entry compile(const Instruction *ops, size_t count, size_t &translated);
+  bool full() const { return isFull; }
+  // Bytes of the code buffer in use. The rest is reserved, never touched.
+  size_t codeBytes() const { return used; }
+
+  // Forget every translation. Previously returned entries become invalid.
+  void reset();
+
+  static bool translatable(uint8_t opcode, uint16_t operand);
+
+private:
+  static constexpr size_t CODE_SIZE = 1 << 20;
+
+  uint8_t *code = nullptr;
+  size_t used = 0;
+  bool isFull = false;
+};
@@ -1,5 +1,6 @@
 #include "Joypad.h"
 #include "Bus.h"
+#include "SaveState.h"
 
 Joypad::Joypad(Bus &b) : bus(b) {}
 
@@ -45,3 +46,14 @@ uint8_t Joypad::read() const {
 }
 
 void Joypad::write(uint8_t value) { select = value & 0x30; }
+
+void Joypad::saveState(StateWriter &out) const {
+  out.put(buttons);
+  out.put(select);
+}
+
+bool Joypad::loadState(StateReader &in) {
+  in.get(buttons);
+  in.get(select);
+  return in.ok();
+}
@@ -3,6 +3,8 @@
 #include <cstdint>
 
 class Bus;
+class StateWriter;
+class StateReader;
 
 class Joypad {
 public:
@@ -26,6 +28,10 @@ public:
   uint8_t read() const;
   void write(uint8_t value);
 
+  // Snapshot support, see SaveState.h
+  void saveState(StateWriter &out) const;
+  bool loadState(StateReader &in);
+
 private:
   Bus &bus;
   uint8_t buttons = 0xFF; // 1 = Released, 0 = Pressed
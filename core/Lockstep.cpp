@@ -0,0 +1,236 @@
+#include "Lockstep.h"
+#include "LockstepKernel.h"
+#include <bit>
+
+namespace {
+
+// Plain loops; the compiler vectorises what it can for the baseline target.
+struct PortableOps {
+  struct T {
+    uint16_t v[Lockstep::LANES];
+  };
+
+  template <typename F> static T map(T a, T b, F f) {
+    T out;
+    for (int i = 0; i < Lockstep::LANES; i++)
+      out.v[i] = static_cast<uint16_t>(f(a.v[i], b.v[i]));
+    return out;
+  }
+
+  static T load(const uint16_t *p) {
+    T out;
+    for (int i = 0; i < Lockstep::LANES; i++)
+      out.v[i] = p[i];
+    return out;
+  }
+  static void store(uint16_t *p, T a) {
+    for (int i = 0; i < Lockstep::LANES; i++)
+      p[i] = a.v[i];
+  }
+  static T splat(uint16_t x) {
+    T out;
+    for (int i = 0; i < Lockstep::LANES; i++)
+      out.v[i] = x;
+    return out;
+  }
+  static T add(T a, T b) {
+    return map(a, b, [](uint16_t x, uint16_t y) { return x + y; });
+  }
+  static T sub(T a, T b) {
+    return map(a, b, [](uint16_t x, uint16_t y) { return x - y; });
+  }
+  static T band(T a, T b) {
+    return map(a, b, [](uint16_t x, uint16_t y) { return x & y; });
+  }
+  static T bor(T a, T b) {
+    return map(a, b, [](uint16_t x, uint16_t y) { return x | y; });
+  }
+  static T bxor(T a, T b) {
+    return map(a, b, [](uint16_t x, uint16_t y) { return x ^ y; });
+  }
+  static T andnot(T a, T b) {
+    return map(a, b, [](uint16_t x, uint16_t y) { return ~x & y; });
+  }
+  static T shl(T a, int n) {
+    return map(a, a, [n](uint16_t x, uint16_t) { return x << n; });
+  }
+  static T shr(T a, int n) {
+    return map(a, a, [n](uint16_t x, uint16_t) { return x >> n; });
+  }
+  static T eq(T a, T b) {
+    return map(a, b,
+               [](uint16_t x, uint16_t y) { return x == y ? 0xFFFF : 0; });
+  }
+  static T select(T m, T a, T b) { return bor(band(m, a), andnot(m, b)); }
+  static uint16_t bits(T m) {
+    uint16_t out = 0;
+    for (int i = 0; i < Lockstep::LANES; i++)
+      out |= (m.v[i] & 1) << i;
+    return out;
+  }
+  static T mask(uint16_t bits) {
+    T out;
+    for (int i = 0; i < Lockstep::LANES; i++)
+      out.v[i] = (bits >> i) & 1 ? 0xFFFF : 0;
+    return out;
+  }
+  static int lowest(T a) {
+    int lane = 0;
+    for (int i = 1; i < Lockstep::LANES; i++)
+      if (a.v[i] < a.v[lane])
+        lane = i;
+    return lane;
+  }
+};
+
+} // namespace
+
+Lockstep::Lockstep(std::shared_ptr<const RomImage> rom) {
+  for (int i = 0; i < LANES; i++) {
+    lanes[i] = std::make_unique<Lane>();
+    lanes[i]->cartridge.loadRom(rom);
+    lanes[i]->bus.setCartridge(&lanes[i]->cartridge);
+    loadRegisters(i, lanes[i]->cpu);
+  }
+  kernels = &portableKernels();
+  setSimdEnabled(true);
+}
+
+bool Lockstep::setSimdEnabled(bool enabled) {
+  const Kernels *simd = avx2Kernels();
+  kernels = enabled && simd ? simd : &portableKernels();
+  return !enabled || simd;
+}
+
+const Lockstep::Kernels &Lockstep::portableKernels() {
+  static const Kernels portable{&lockstep::lowest<PortableOps>,
+                                &lockstep::lanesAt<PortableOps>,
+                                &lockstep::step<PortableOps>};
+  return portable;
+}
+
+const Lockstep::Kernels *Lockstep::avx2Kernels() {
+#ifdef SHELLBOY_LOCKSTEP_AVX2
+  if (__builtin_cpu_supports("avx2"))
+    return &lockstepAvx2Kernels;
+#endif
+  return nullptr;
+}
+
+void Lockstep::loadRegisters(int lane, CPU &from) {
+  from.syncFlags();
+  regs.r[A][lane] = from.AF.hi;
+  regs.r[F][lane] = from.AF.lo;
+  regs.r[B][lane] = from.BC.hi;
+  regs.r[C][lane] = from.BC.lo;
+  regs.r[D][lane] = from.DE.hi;
+  regs.r[E][lane] = from.DE.lo;
+  regs.r[H][lane] = from.HL.hi;
+  regs.r[L][lane] = from.HL.lo;
+  regs.r[SP][lane] = from.SP;
+  regs.r[PC][lane] = from.PC;
+}
+
+void Lockstep::storeRegisters(int lane, CPU &to) const {
+  to.syncFlags(); // Drops the pending flag op, AF.lo is replaced below
+  to.AF.hi = static_cast<uint8_t>(regs.r[A][lane]);
+  to.AF.lo = static_cast<uint8_t>(regs.r[F][lane]);
+  to.BC.hi = static_cast<uint8_t>(regs.r[B][lane]);
+  to.BC.lo = static_cast<uint8_t>(regs.r[C][lane]);
+  to.DE.hi = static_cast<uint8_t>(regs.r[D][lane]);
+  to.DE.lo = static_cast<uint8_t>(regs.r[E][lane]);
+  to.HL.hi = static_cast<uint8_t>(regs.r[H][lane]);
+  to.HL.lo = static_cast<uint8_t>(regs.r[L][lane]);
+  to.SP = regs.r[SP][lane];
+  to.PC = regs.r[PC][lane];
+}
+
+void Lockstep::read(uint16_t mask, const uint16_t *address, uint16_t *value) {
+  for (int i = 0; i < LANES; i++)
+    value[i] = (mask >> i) & 1 ? lanes[i]->bus.read(address[i]) : 0;
+}
+
+void Lockstep::write(uint16_t mask, const uint16_t *address,
+                     const uint16_t *value) {
+  for (; mask; mask &= mask - 1) {
+    int i = std::countr_zero(mask);
+    lanes[i]->bus.write(address[i], static_cast<uint8_t>(value[i]));
+  }
+}
+
+void Lockstep::stepScalar(int lane) {
+  CPU &cpu = lanes[lane]->cpu;
+  storeRegisters(lane, cpu);
+  uint64_t before = cpu.instructionsRetired();
+  cpu.tick();
+  loadRegisters(lane, cpu);
+  retired += cpu.instructionsRetired() - before;
+  scalar++;
+  if (cpu.isHalted() || cpu.IME)
+    watched |= 1u << lane;
+  else
+    watched &= ~(1u << lane);
+}
+
+bool Lockstep::needsCpu(int lane) const {
+  const CPU &cpu = lanes[lane]->cpu;
+  return cpu.isHalted() || (cpu.IME && cpu.interruptPending());
+}
+
+void Lockstep::run(uint32_t steps) {
+  std::array<uint32_t, LANES> left;
+  left.fill(steps);
+  uint16_t running = steps ? (1u << LANES) - 1 : 0;
+  auto spend = [&](uint16_t ran) {
+    for (; ran; ran &= ran - 1) {
+      int lane = std::countr_zero(ran);
+      if (--left[lane] == 0)
+        running &= ~(1u << lane);
+    }
+  };
+
+  while (running) {
+    // The group: every running lane at the lowest PC that sees the same
+    // code bytes there as the first of them
+    int leader = kernels->lowest(regs, running);
+    if (!((running >> leader) & 1))
+      leader = std::countr_zero(running);
+    uint16_t pc = regs.r[PC][leader];
+    const Bus &lead = lanes[leader]->bus;
+    uint8_t code[3] = {lead.read(pc), 0, 0};
+    int length = CPU::instructionLength(code[0]);
+    for (int i = 1; i < length; i++)
+      code[i] = lead.read(static_cast<uint16_t>(pc + i));
+
+    uint16_t group = kernels->lanesAt(regs, pc) & running;
+    for (uint16_t rest = group; rest; rest &= rest - 1) {
+      int lane = std::countr_zero(rest);
+      if (lane != leader) {
+        const Bus &bus = lanes[lane]->bus;
+        for (int i = 0; i < length; i++) {
+          if (bus.read(static_cast<uint16_t>(pc + i)) != code[i]) {
+            group &= ~(1u << lane);
+            break;
+          }
+        }
+      }
+      // Halted, or about to take an interrupt
+      if ((group & watched) >> lane & 1 && needsCpu(lane)) {
+        stepScalar(lane);
+        spend(1u << lane);
+        group &= ~(1u << lane);
+      }
+    }
+    if (!group)
+      continue;
+
+    groups++;
+    if (kernels->step(*this, regs, group, code, length)) {
+      retired += std::popcount(group);
+    } else {
+      for (uint16_t rest = group; rest; rest &= rest - 1)
+        stepScalar(std::countr_zero(rest));
+    }
+    spend(group);
+  }
+}
@@ -0,0 +1,106 @@
+#pragma once
+
+#include "Bus.h"
+#include "CPU.h"
+#include "mmu/Cartridge.h"
+#include <array>
+#include <cstdint>
+#include <memory>
+
+// Experimental: LANES copies of one ROM stepped an instruction at a time,
+// together. The register files live side by side (one array per register,
+// one element per lane) so an instruction runs in every lane at once with
+// vector ops, AVX2 when the host has it. Lanes are grouped by PC (and the
+// code bytes there, which differ only under different ROM banks or in RAM)
+// and a group runs as one, so lanes split when a branch goes different
+// ways. The group at the lowest PC always goes next: lanes that fell behind
+// (say, took the longer side of an if) run alone until they reach the
+// others, which wait, and from there on they are one group again.
+//
+// Each lane has its own Bus, Cartridge and RAM; the ROM image is shared.
+// There is no PPU, timer or joypad, and no cycle counting: this is the CPU
+// and memory only. Instructions the vector path does not cover (HALT, DAA,
+// DI/EI/RETI, illegal opcodes), halted lanes and lanes taking an interrupt
+// are stepped by the lane's own CPU.
+class Lockstep {
+public:
+  static constexpr int LANES = 16;
+
+  // 8-bit registers sit in the low byte of 16-bit elements, so every
+  // register is one 256-bit vector. The 8-bit ones are indexed like the
+  // opcode r field, with F in the (HL) slot.
+  enum Reg { B, C, D, E, H, L, F, A, SP, PC, REGS };
+  struct Registers {
+    alignas(32) uint16_t r[REGS][LANES];
+  };
+
+  explicit Lockstep(std::shared_ptr<const RomImage> rom);
+  Lockstep(const Lockstep &) = delete;
+  Lockstep &operator=(const Lockstep &) = delete;
+
+  // Executes `steps` instructions in every lane. A halted lane spends
+  // them idling.
+  void run(uint32_t steps);
+
+  // Runs groups through the AVX2 kernels. False if the host or build has
+  // none; the portable kernels are used then.
+  bool setSimdEnabled(bool enabled);
+  bool simdEnabled() const { return kernels != &portableKernels(); }
+
+  // Lane state. The registers are moved in and out of the register file;
+  // IME and HALT stay with the lane's CPU.
+  void loadRegisters(int lane, CPU &from);
+  void storeRegisters(int lane, CPU &to) const;
+  Bus &bus(int lane) { return lanes[lane]->bus; }
+
+  // Per-lane memory accesses for the lanes set in `mask`, through each
+  // lane's Bus. For the kernels.
+  void read(uint16_t mask, const uint16_t *address, uint16_t *value);
+  void write(uint16_t mask, const uint16_t *address, const uint16_t *value);
+
+  // Instructions executed, all lanes together
+  uint64_t instructionsRetired() const { return retired; }
+  // Groups stepped: instructionsRetired() / groupSteps() is how many lanes
+  // ran per dispatch on average.
+  uint64_t groupSteps() const { return groups; }
+  // Instructions the lanes' CPUs ran instead of the kernels
+  uint64_t scalarSteps() const { return scalar; }
+
+  // One build of the vector code (see LockstepKernel.h)
+  struct Kernels {
+    // A lane with the lowest PC of those in `mask`, which may be outside it
+    // when that PC is 0xFFFF
+    int (*lowest)(const Registers &regs, uint16_t mask);
+    // Lanes whose PC is `pc`
+    uint16_t (*lanesAt)(const Registers &regs, uint16_t pc);
+    // Runs the `length`-byte instruction in `code` in every lane of
+    // `mask`. False, with nothing changed, if it has no vector version.
+    bool (*step)(Lockstep &machine, Registers &regs, uint16_t mask,
+                 const uint8_t *code, int length);
+  };
+
+private:
+  struct Lane {
+    Bus bus;
+    Cartridge cartridge;
+    CPU cpu{bus};
+  };
+
+  Registers regs;
+  std::array<std::unique_ptr<Lane>, LANES> lanes;
+  const Kernels *kernels;
+
+  // Lanes whose CPU is halted or has IME set. Only the CPU changes
+  // either, so this is updated after stepScalar() alone.
+  uint16_t watched = 0;
+
+  uint64_t retired = 0;
+  uint64_t groups = 0;
+  uint64_t scalar = 0;
+
+  void stepScalar(int lane);
+  bool needsCpu(int lane) const;
+
+  static const Kernels &portableKernels();
+  static const Kernels *avx2Kernels(); // nullptr if unavailable
+};
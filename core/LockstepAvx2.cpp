@@ -0,0 +1,65 @@
+// Built with -mavx2 (see CMakeLists.txt); only reached through
+// Lockstep::avx2Kernels() after checking the host has AVX2.
+#include "LockstepKernel.h"
+#include <immintrin.h>
+
+namespace {
+
+// One register of every lane in one ymm register
+struct Avx2Ops {
+  using T = __m256i;
+
+  static T load(const uint16_t *p) {
+    return _mm256_load_si256(reinterpret_cast<const __m256i *>(p));
+  }
+  static void store(uint16_t *p, T a) {
+    _mm256_store_si256(reinterpret_cast<__m256i *>(p), a);
+  }
+  static T splat(uint16_t x) {
+    return _mm256_set1_epi16(static_cast<short>(x));
+  }
+  static T add(T a, T b) { return _mm256_add_epi16(a, b); }
+  static T sub(T a, T b) { return _mm256_sub_epi16(a, b); }
+  static T band(T a, T b) { return _mm256_and_si256(a, b); }
+  static T bor(T a, T b) { return _mm256_or_si256(a, b); }
+  static T bxor(T a, T b) { return _mm256_xor_si256(a, b); }
+  static T andnot(T a, T b) { return _mm256_andnot_si256(a, b); }
+  static T shl(T a, int n) {
+    return _mm256_sll_epi16(a, _mm_cvtsi32_si128(n));
+  }
+  static T shr(T a, int n) {
+    return _mm256_srl_epi16(a, _mm_cvtsi32_si128(n));
+  }
+  static T eq(T a, T b) { return _mm256_cmpeq_epi16(a, b); }
+  static T select(T m, T a, T b) { return _mm256_blendv_epi8(b, a, m); }
+  // Two mask bits per 16-bit element; keep the even ones
+  static uint16_t bits(T m) {
+    uint32_t bytes = static_cast<uint32_t>(_mm256_movemask_epi8(m));
+    uint16_t out = 0;
+    for (int i = 0; i < Lockstep::LANES; i++)
+      out |= ((bytes >> (2 * i)) & 1) << i;
+    return out;
+  }
+  static T mask(uint16_t bits) {
+    const T lane = _mm256_setr_epi16(1, 2, 4, 8, 16, 32, 64, 128, 256, 512,
+                                     1024, 2048, 4096, 8192, 16384,
+                                     static_cast<short>(0x8000));
+    return eq(band(splat(bits), lane), lane);
+  }
+  static int lowest(T a) {
+    __m128i lo = _mm_minpos_epu16(_mm256_castsi256_si128(a));
+    __m128i hi = _mm_minpos_epu16(_mm256_extracti128_si256(a, 1));
+    int low = _mm_cvtsi128_si32(lo);
+    int high = _mm_cvtsi128_si32(hi);
+    // Minimum in bits 0-15, its index in 16-18
+    if ((high & 0xFFFF) < (low & 0xFFFF))
+      return 8 + (high >> 16 & 0x07);
+    return low >> 16 & 0x07;
+  }
+};
+
+} // namespace
+
+const Lockstep::Kernels lockstepAvx2Kernels{&lockstep::lowest<Avx2Ops>,
+                                            &lockstep::lanesAt<Avx2Ops>,
+                                            &lockstep::step<Avx2Ops>};
@@ -0,0 +1,452 @@
+#pragma once
+
+#include "Lockstep.h"
+#include <cstdint>
+
+// The vector side of Lockstep, written once against an ops type V and built
+// twice: portably in Lockstep.cpp and with AVX2 in LockstepAvx2.cpp. V
+// provides a type T of LANES 16-bit elements and:
+//
+//   load(p) store(p, a) splat(x)
+//   add sub band bor bxor       element-wise
+//   andnot(a, b)                ~a & b
+//   shl(a, n) shr(a, n)         logical, by the same n in every element
+//   eq(a, b)                    0xFFFF where equal, else 0
+//   select(m, a, b)             a where m is 0xFFFF, else b
+//   bits(m)                     one bit per element of m that is 0xFFFF
+//   mask(bits)                  the reverse
+//   lowest(a)                   index of the smallest element (unsigned)
+//
+// Everything here is a template on V, and each V has internal linkage, so
+// the two builds never share an out-of-line copy of anything. Memory goes
+// through Lockstep::read()/write(), which are built without AVX2.
+
+namespace lockstep {
+
+template <class V> struct Kernel {
+  using T = typename V::T;
+
+  Lockstep &machine;
+  Lockstep::Registers &regs;
+  uint16_t lanes; // Lanes this instruction runs in...
+  T active;       // ...as a vector mask
+
+  static T k(uint16_t value) { return V::splat(value); }
+
+  T get(int reg) const { return V::load(regs.r[reg]); }
+  void put(int reg, T value) {
+    V::store(regs.r[reg], V::select(active, value, get(reg)));
+  }
+
+  T pair(int hi, int lo) const {
+    return V::bor(V::shl(get(hi), 8), get(lo));
+  }
+  void putPair(int hi, int lo, T value) {
+    put(hi, V::shr(value, 8));
+    put(lo, V::band(value, k(0xFF)));
+  }
+  // BC, DE, HL, SP
+  T rp(int p) const {
+    return p == 3 ? get(Lockstep::SP) : pair(2 * p, 2 * p + 1);
+  }
+  void putRp(int p, T value) {
+    if (p == 3)
+      put(Lockstep::SP, value);
+    else
+      putPair(2 * p, 2 * p + 1, value);
+  }
+
+  T read(T address) {
+    alignas(32) uint16_t at[Lockstep::LANES];
+    alignas(32) uint16_t value[Lockstep::LANES];
+    V::store(at, address);
+    machine.read(lanes, at, value);
+    return V::load(value);
+  }
+  void write(T address, T value) {
+    alignas(32) uint16_t at[Lockstep::LANES];
+    alignas(32) uint16_t bytes[Lockstep::LANES];
+    V::store(at, address);
+    V::store(bytes, value);
+    machine.write(lanes, at, bytes);
+  }
+
+  // B, C, D, E, H, L, (HL), A
+  T r8(int r) {
+    return r == 6 ? read(pair(Lockstep::H, Lockstep::L)) : get(r);
+  }
+  void putR8(int r, T value) {
+    if (r == 6)
+      write(pair(Lockstep::H, Lockstep::L), value);
+    else
+      put(r, value);
+  }
+
+  T zero(T value) const {
+    return V::band(V::eq(V::band(value, k(0xFF)), k(0)), k(CPU::FLAG_Z));
+  }
+  T carry() const { return V::band(V::shr(get(Lockstep::F), 4), k(1)); }
+  // NZ, Z, NC, C: 0xFFFF where the branch is taken
+  T condition(int cc) const {
+    uint16_t flag = cc < 2 ? CPU::FLAG_Z : CPU::FLAG_C;
+    T clear = V::eq(V::band(get(Lockstep::F), k(flag)), k(0));
+    return (cc & 1) ? V::bxor(clear, k(0xFFFF)) : clear;
+  }
+  // The same instruction, in the lanes of `taken` only
+  Kernel narrow(T taken) const {
+    T in = V::band(active, taken);
+    return Kernel{machine, regs, V::bits(in), in};
+  }
+
+  void push(T value) {
+    T sp = V::sub(get(Lockstep::SP), k(2));
+    put(Lockstep::SP, sp);
+    write(sp, V::band(value, k(0xFF)));
+    write(V::add(sp, k(1)), V::shr(value, 8));
+  }
+  T pop() {
+    T sp = get(Lockstep::SP);
+    T lo = read(sp);
+    T hi = read(V::add(sp, k(1)));
+    put(Lockstep::SP, V::add(sp, k(2)));
+    return V::bor(V::shl(hi, 8), lo);
+  }
+
+  // ADD ADC SUB SBC AND XOR OR CP
+  void alu(int y, T value) {
+    T a = get(Lockstep::A);
+    T result, flags;
+    if (y <= 1) {
+      T c = y == 1 ? carry() : k(0);
+      T sum = V::add(V::add(a, value), c);
+      T half = V::add(V::add(V::band(a, k(0x0F)), V::band(value, k(0x0F))), c);
+      result = V::band(sum, k(0xFF));
+      flags = V::bor(zero(result),
+                     V::bor(V::band(V::shl(half, 1), k(CPU::FLAG_H)),
+                            V::band(V::shr(sum, 4), k(CPU::FLAG_C))));
+    } else if (y <= 3 || y == 7) {
+      // Borrows show up in bit 15
+      T c = y == 3 ? carry() : k(0);
+      T diff = V::sub(V::sub(a, value), c);
+      T half = V::sub(V::sub(V::band(a, k(0x0F)), V::band(value, k(0x0F))), c);
+      result = V::band(diff, k(0xFF));
+      flags = V::bor(V::bor(zero(result), k(CPU::FLAG_N)),
+                     V::bor(V::band(V::shr(half, 10), k(CPU::FLAG_H)),
+                            V::band(V::shr(diff, 11), k(CPU::FLAG_C))));
+      if (y == 7)
+        result = a;
+    } else {
+      result = y == 4 ? V::band(a, value)
+                      : (y == 5 ? V::bxor(a, value) : V::bor(a, value));
+      flags = zero(result);
+      if (y == 4)
+        flags = V::bor(flags, k(CPU::FLAG_H));
+    }
+    put(Lockstep::A, result);
+    put(Lockstep::F, flags);
+  }
+
+  // RLC RRC RL RR SLA SRA SWAP SRL; sets F from the result
+  T rotate(int y, T value) {
+    T c, result;
+    switch (y) {
+    case 0:
+      c = V::shr(value, 7);
+      result = V::band(V::bor(V::shl(value, 1), c), k(0xFF));
+      break;
+    case 1:
+      c = V::band(value, k(1));
+      result = V::bor(V::shr(value, 1), V::shl(c, 7));
+      break;
+    case 2:
+      c = V::shr(value, 7);
+      result = V::band(V::bor(V::shl(value, 1), carry()), k(0xFF));
+      break;
+    case 3:
+      c = V::band(value, k(1));
+      result = V::bor(V::shr(value, 1), V::shl(carry(), 7));
+      break;
+    case 4:
+      c = V::shr(value, 7);
+      result = V::band(V::shl(value, 1), k(0xFF));
+      break;
+    case 5:
+      c = V::band(value, k(1));
+      result = V::bor(V::shr(value, 1), V::band(value, k(0x80)));
+      break;
+    case 6:
+      c = k(0);
+      result = V::band(V::bor(V::shl(value, 4), V::shr(value, 4)), k(0xFF));
+      break;
+    default:
+      c = V::band(value, k(1));
+      result = V::shr(value, 1);
+      break;
+    }
+    put(Lockstep::F, V::bor(zero(result), V::shl(c, 4)));
+    return result;
+  }
+
+  bool stepCB(uint8_t op) {
+    int x = op >> 6;
+    int y = (op >> 3) & 0x07;
+    int z = op & 0x07;
+    T value = r8(z);
+    if (x == 0) {
+      putR8(z, rotate(y, value));
+    } else if (x == 1) { // BIT: C is kept
+      T clear = V::eq(V::band(value, k(1 << y)), k(0));
+      put(Lockstep::F, V::bor(V::band(clear, k(CPU::FLAG_Z)),
+                              V::bor(k(CPU::FLAG_H),
+                                     V::band(get(Lockstep::F),
+                                             k(CPU::FLAG_C)))));
+    } else if (x == 2) {
+      putR8(z, V::band(value, k(~(1 << y) & 0xFF)));
+    } else {
+      putR8(z, V::bor(value, k(1 << y)));
+    }
+    return true;
+  }
+
+  // Mirrors CPU::op(). PC is advanced past the instruction (`length`
+  // bytes) up front, as the CPU has done by the time a handler runs.
+  bool step(const uint8_t *code, int length) {
+    uint8_t op = code[0];
+    int x = op >> 6;
+    int y = (op >> 3) & 0x07;
+    int z = op & 0x07;
+    int p = y >> 1;
+    int q = y & 0x01;
+    uint16_t n = code[1];
+    uint16_t nn = code[1] | code[2] << 8;
+    uint16_t e = static_cast<uint16_t>(static_cast<int8_t>(code[1]));
+
+    if (!supported(op))
+      return false;
+    T next = V::add(get(Lockstep::PC), k(length));
+    put(Lockstep::PC, next);
+
+    if (x == 1) { // LD r, r'
+      putR8(y, r8(z));
+    } else if (x == 2) { // ALU A, r
+      alu(y, r8(z));
+    } else if (x == 0) {
+      switch (z) {
+      case 0:
+        if (y == 1) { // LD (nn), SP
+          T sp = get(Lockstep::SP);
+          write(k(nn), V::band(sp, k(0xFF)));
+          write(k(nn + 1), V::shr(sp, 8));
+        } else if (y == 3) { // JR
+          put(Lockstep::PC, V::add(next, k(e)));
+        } else if (y >= 4) { // JR cc
+          put(Lockstep::PC,
+              V::select(condition(y - 4), V::add(next, k(e)), next));
+        } // NOP, STOP
+        break;
+      case 1:
+        if (q == 0) { // LD rp, n16
+          putRp(p, k(nn));
+        } else { // ADD HL, rp: carries out of bits 11 and 15
+          T hl = pair(Lockstep::H, Lockstep::L);
+          T value = rp(p);
+          T sum = V::add(hl, value);
+          T half = V::add(V::band(hl, k(0x0FFF)), V::band(value, k(0x0FFF)));
+          T c = V::shr(V::bor(V::band(hl, value),
+                              V::andnot(sum, V::bor(hl, value))),
+                       15);
+          put(Lockstep::F,
+              V::bor(V::band(get(Lockstep::F), k(CPU::FLAG_Z)),
+                     V::bor(V::band(V::shr(half, 7), k(CPU::FLAG_H)),
+                            V::shl(c, 4))));
+          putPair(Lockstep::H, Lockstep::L, sum);
+        }
+        break;
+      case 2: { // LD (BC)/(DE)/(HL+)/(HL-), A and back
+        T hl = pair(Lockstep::H, Lockstep::L);
+        T at = p == 0 ? rp(0) : (p == 1 ? rp(1) : hl);
+        if (q == 0)
+          write(at, get(Lockstep::A));
+        else
+          put(Lockstep::A, read(at));
+        if (p == 2)
+          putPair(Lockstep::H, Lockstep::L, V::add(hl, k(1)));
+        else if (p == 3)
+          putPair(Lockstep::H, Lockstep::L, V::sub(hl, k(1)));
+        break;
+      }
+      case 3: // INC rp / DEC rp
+        putRp(p, q == 0 ? V::add(rp(p), k(1)) : V::sub(rp(p), k(1)));
+        break;
+      case 4:
+      case 5: { // INC r / DEC r: C is kept
+        T value = r8(y);
+        T result, flags;
+        if (z == 4) {
+          result = V::band(V::add(value, k(1)), k(0xFF));
+          flags = V::band(V::eq(V::band(result, k(0x0F)), k(0)),
+                          k(CPU::FLAG_H));
+        } else {
+          result = V::band(V::sub(value, k(1)), k(0xFF));
+          flags = V::bor(V::band(V::eq(V::band(result, k(0x0F)), k(0x0F)),
+                                 k(CPU::FLAG_H)),
+                         k(CPU::FLAG_N));
+        }
+        flags = V::bor(V::bor(flags, zero(result)),
+                       V::band(get(Lockstep::F), k(CPU::FLAG_C)));
+        putR8(y, result);
+        put(Lockstep::F, flags);
+        break;
+      }
+      case 6: // LD r, n8
+        putR8(y, k(n));
+        break;
+      default:
+        if (y <= 3) { // RLCA, RRCA, RLA, RRA: Z is always clear
+          put(Lockstep::A, rotate(y, get(Lockstep::A)));
+          put(Lockstep::F,
+              V::band(get(Lockstep::F), k(~CPU::FLAG_Z & 0xFF)));
+        } else if (y == 5) { // CPL
+          put(Lockstep::A, V::bxor(get(Lockstep::A), k(0xFF)));
+          put(Lockstep::F,
+              V::bor(get(Lockstep::F), k(CPU::FLAG_N | CPU::FLAG_H)));
+        } else if (y == 6) { // SCF
+          T f = V::band(get(Lockstep::F),
+                        k(~(CPU::FLAG_N | CPU::FLAG_H) & 0xFF));
+          put(Lockstep::F, V::bor(f, k(CPU::FLAG_C)));
+        } else { // CCF
+          T f = V::band(get(Lockstep::F),
+                        k(~(CPU::FLAG_N | CPU::FLAG_H) & 0xFF));
+          put(Lockstep::F, V::bxor(f, k(CPU::FLAG_C)));
+        }
+        break;
+      }
+    } else {
+      switch (z) {
+      case 0:
+        if (y <= 3) { // RET cc
+          Kernel taken = narrow(condition(y));
+          if (taken.lanes)
+            taken.put(Lockstep::PC, taken.pop());
+        } else if (y == 4) { // LDH (n8), A
+          write(k(0xFF00 | n), get(Lockstep::A));
+        } else if (y == 6) { // LDH A, (n8)
+          put(Lockstep::A, read(k(0xFF00 | n)));
+        } else { // ADD SP, r8 / LD HL, SP+r8
+          T sp = get(Lockstep::SP);
+          T result = V::add(sp, k(e));
+          T half = V::add(V::band(sp, k(0x0F)), k(e & 0x0F));
+          T low = V::add(V::band(sp, k(0xFF)), k(e & 0xFF));
+          put(Lockstep::F, V::bor(V::band(V::shl(half, 1), k(CPU::FLAG_H)),
+                                  V::band(V::shr(low, 4), k(CPU::FLAG_C))));
+          if (y == 5)
+            put(Lockstep::SP, result);
+          else
+            putPair(Lockstep::H, Lockstep::L, result);
+        }
+        break;
+      case 1:
+        if (q == 0) { // POP rp2
+          T value = pop();
+          if (p == 3) {
+            put(Lockstep::A, V::shr(value, 8));
+            put(Lockstep::F, V::band(value, k(0xF0)));
+          } else {
+            putRp(p, value);
+          }
+        } else if (p == 0) { // RET
+          put(Lockstep::PC, pop());
+        } else if (p == 2) { // JP (HL)
+          put(Lockstep::PC, pair(Lockstep::H, Lockstep::L));
+        } else { // LD SP, HL
+          put(Lockstep::SP, pair(Lockstep::H, Lockstep::L));
+        }
+        break;
+      case 2:
+        if (y <= 3) { // JP cc, nn
+          put(Lockstep::PC, V::select(condition(y), k(nn), next));
+        } else if (y == 4) { // LD (C), A
+          write(V::bor(k(0xFF00), get(Lockstep::C)), get(Lockstep::A));
+        } else if (y == 5) { // LD (nn), A
+          write(k(nn), get(Lockstep::A));
+        } else if (y == 6) { // LD A, (C)
+          put(Lockstep::A, read(V::bor(k(0xFF00), get(Lockstep::C))));
+        } else { // LD A, (nn)
+          put(Lockstep::A, read(k(nn)));
+        }
+        break;
+      case 3:
+        if (y == 0) { // JP nn
+          put(Lockstep::PC, k(nn));
+        } else { // Prefix CB
+          return stepCB(code[1]);
+        }
+        break;
+      case 4: { // CALL cc, nn
+        Kernel taken = narrow(condition(y));
+        if (taken.lanes) {
+          taken.push(next);
+          taken.put(Lockstep::PC, k(nn));
+        }
+        break;
+      }
+      case 5:
+        if (q == 0) { // PUSH rp2
+          push(p == 3 ? pair(Lockstep::A, Lockstep::F) : rp(p));
+        } else { // CALL nn
+          push(next);
+          put(Lockstep::PC, k(nn));
+        }
+        break;
+      case 6: // ALU A, n8
+        alu(y, k(n));
+        break;
+      default: // RST
+        push(next);
+        put(Lockstep::PC, k(y * 0x08));
+        break;
+      }
+    }
+    return true;
+  }
+
+  // Everything but HALT, DAA, RETI, DI, EI and the illegal opcodes
+  static bool supported(uint8_t op) {
+    switch (op) {
+    case 0x76: // HALT
+    case 0x27: // DAA
+    case 0xD9: // RETI
+    case 0xF3: // DI
+    case 0xFB: // EI
+    case 0xD3: case 0xDB: case 0xDD: case 0xE3: case 0xE4: case 0xEB:
+    case 0xEC: case 0xED: case 0xF4: case 0xFC: case 0xFD:
+      return false;
+    default:
+      return true;
+    }
+  }
+};
+
+// Lanes outside `mask` read as 0xFFFF; if that is also the lowest PC in it,
+// the lane returned may be one of them.
+template <class V> int lowest(const Lockstep::Registers &regs, uint16_t mask) {
+  return V::lowest(V::bor(V::load(regs.r[Lockstep::PC]),
+                          V::bxor(V::mask(mask), V::splat(0xFFFF))));
+}
+
+template <class V>
+uint16_t lanesAt(const Lockstep::Registers &regs, uint16_t pc) {
+  return V::bits(V::eq(V::load(regs.r[Lockstep::PC]), V::splat(pc)));
+}
+
+template <class V>
+bool step(Lockstep &machine, Lockstep::Registers &regs, uint16_t mask,
+          const uint8_t *code, int length) {
+  Kernel<V> kernel{machine, regs, mask, V::mask(mask)};
+  return kernel.step(code, length);
+}
+
+} // namespace lockstep
+
+// Defined in LockstepAvx2.cpp when it is built
+extern const Lockstep::Kernels lockstepAvx2Kernels;
@@ -0,0 +1,86 @@
+#include "OpcodeStats.h"
+#include <algorithm>
+#include <vector>
+
+namespace {
+
+struct Row {
+  uint16_t opcode; // 0xCBxx for CB opcodes
+  OpcodeStats::Counter counter;
+};
+
+std::vector<Row> collect(const OpcodeStats &stats) {
+  std::vector<Row> rows;
+  for (int op = 0; op < 256; op++) {
+    if (stats.base(op).count)
+      rows.push_back({static_cast<uint16_t>(op), stats.base(op)});
+  }
+  for (int op = 0; op < 256; op++) {
+    if (stats.cb(op).count)
+      rows.push_back({static_cast<uint16_t>(0xCB00 | op), stats.cb(op)});
+  }
+  std::stable_sort(rows.begin(), rows.end(), [](const Row &a, const Row &b) {
+    return a.counter.cycles > b.counter.cycles;
+  });
+  return rows;
+}
+
+} // namespace
+
+void OpcodeStats::reset() {
+  baseCounters.fill({});
+  cbCounters.fill({});
+}
+
+void OpcodeStats::printTable(FILE *out, size_t limit) const {
+  std::vector<Row> rows = collect(*this);
+  uint64_t totalCount = 0;
+  uint64_t totalCycles = 0;
+  for (const Row &row : rows) {
+    totalCount += row.counter.count;
+    totalCycles += row.counter.cycles;
+  }
+  if (limit && rows.size() > limit)
+    rows.resize(limit);
+
+  fprintf(out, "%-7s %14s %7s %16s %7s %8s\n", "opcode", "count", "count%",
+          "cycles", "cycle%", "taken%");
+  for (const Row &row : rows) {
+    const Counter &c = row.counter;
+    char name[8];
+    if (row.opcode > 0xFF)
+      snprintf(name, sizeof(name), "CB %02X", row.opcode & 0xFF);
+    else
+      snprintf(name, sizeof(name), "%02X", row.opcode);
+    fprintf(out, "%-7s %14llu %6.2f%% %16llu %6.2f%%", name,
+            static_cast<unsigned long long>(c.count),
+            100.0 * c.count / totalCount,
+            static_cast<unsigned long long>(c.cycles),
+            100.0 * c.cycles / totalCycles);
+    if (row.opcode <= 0xFF && notTakenCycles(row.opcode))
+      fprintf(out, " %7.2f%%", 100.0 * c.taken / c.count);
+    fprintf(out, "\n");
+  }
+  fprintf(out, "%-7s %14llu %7s %16llu\n", "total",
+          static_cast<unsigned long long>(totalCount), "",
+          static_cast<unsigned long long>(totalCycles));
+}
+
+bool OpcodeStats::writeCsv(const std::string &path) const {
+  FILE *file = fopen(path.c_str(), "w");
+  if (!file)
+    return false;
+  fprintf(file, "opcode,cb,count,cycles,taken,not_taken\n");
+  for (const Row &row : collect(*this)) {
+    const Counter &c = row.counter;
+    bool conditional = row.opcode <= 0xFF && notTakenCycles(row.opcode);
+    fprintf(file, "0x%02X,%d,%llu,%llu,%llu,%llu\n", row.opcode & 0xFF,
+            row.opcode > 0xFF ? 1 : 0,
+            static_cast<unsigned long long>(c.count),
+            static_cast<unsigned long long>(c.cycles),
+            static_cast<unsigned long long>(c.taken),
+            static_cast<unsigned long long>(conditional ? c.count - c.taken
+                                                        : 0));
+  }
+  return fclose(file) == 0;
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+// Executions and T-cycles per base and CB opcode, with taken counts for
+// conditional branches. Only compiled into the CPU when SHELLBOY_OPCODE_STATS
+// is defined (CMake option of the same name); see CPU::opcodeStats().
+class OpcodeStats {
+public:
+  struct Counter {
+    uint64_t count = 0;
+    uint64_t cycles = 0;
+    uint64_t taken = 0; // Conditional JR/JP/CALL/RET only
+  };
+
+  // `operand` carries the second byte of 0xCB-prefixed opcodes.
+  void record(uint8_t opcode, uint16_t operand, int cycles) {
+    bool cb = opcode == 0xCB;
+    Counter &counter = cb ? cbCounters[operand & 0xFF] : baseCounters[opcode];
+    counter.count++;
+    counter.cycles += cycles;
+    int notTaken = cb ? 0 : notTakenCycles(opcode);
+    if (notTaken && cycles > notTaken)
+      counter.taken++;
+  }
+  void reset();
+
+  const Counter &base(uint8_t opcode) const { return baseCounters[opcode]; }
+  const Counter &cb(uint8_t opcode) const { return cbCounters[opcode]; }
+
+  // Opcodes that ran, heaviest total cycles first. `limit` 0 prints all.
+  void printTable(FILE *out, size_t limit = 0) const;
+  // One row per opcode that ran: opcode,cb,count,cycles,taken,not_taken
+  bool writeCsv(const std::string &path) const;
+
+  // Cycles of a conditional branch that falls through, 0 for other opcodes
+  static constexpr int notTakenCycles(uint8_t opcode) {
+    switch (opcode) {
+    case 0x20: // JR cc
+    case 0x28:
+    case 0x30:
+    case 0x38:
+    case 0xC0: // RET cc
+    case 0xC8:
+    case 0xD0:
+    case 0xD8:
+      return 8;
+    case 0xC2: // JP cc
+    case 0xCA:
+    case 0xD2:
+    case 0xDA:
+    case 0xC4: // CALL cc
+    case 0xCC:
+    case 0xD4:
+    case 0xDC:
+      return 12;
+    default:
+      return 0;
+    }
+  }
+
+private:
+  std::array<Counter, 256> baseCounters{};
+  std::array<Counter, 256> cbCounters{};
+};
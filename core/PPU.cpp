@@ -1,4 +1,28 @@
 #include "PPU.h"
+#include "SaveState.h"
+#include <iterator>
+
+namespace {
+
+// VRAM as the renderer reads it, in H-Blank when it is never locked. The
+// page table is copied locally: frameBuffer stores may alias anything, and
+// would otherwise force PagedRam's to be reloaded on every fetch.
+class VramView {
+public:
+  explicit VramView(const PagedRam &vram) {
+    for (size_t i = 0; i < std::size(pages); i++)
+      pages[i] = vram.readPage(i);
+  }
+  uint8_t operator[](uint16_t address) const {
+    address -= 0x8000;
+    return pages[address >> 8][address & 0xFF];
+  }
+
+private:
+  const uint8_t *pages[0x2000 / PagedRam::PAGE_SIZE];
+};
+
+} // namespace
 
 PPU::PPU(Bus &b) : bus(b) { frameBuffer.fill(0); }
 
@@ -9,7 +33,12 @@ void PPU::tick() {
     // LCD disabled: reset variables and stay in Mode 0 (or 2?)
     scanlineCounter = 456;
     currentScanline = 0;
-    stat &= ~0x03; // Clear mode
+    if (getMode() != Mode::HBlank) {
+      bool wasDrawing = getMode() == Mode::PixelTransfer;
+      stat &= ~0x03; // Clear mode
+      if (wasDrawing)
+        bus.remapVideo();
+    }
     return;
   }
 
@@ -51,8 +80,58 @@ void PPU::tick() {
   }
 }
 
+int PPU::cyclesUntilEvent() const {
+  if (!(lcdc & 0x80)) {
+    bool settled = getMode() == Mode::HBlank && currentScanline == 0 &&
+                   scanlineCounter == 456;
+    return settled ? 0 : 1;
+  }
+
+  int next = scanlineCounter - 1;
+  if (next <= 0) {
+    return 1; // New line
+  }
+  Mode expected = Mode::VBlank;
+  int boundary = 0; // Counter value at which the mode changes next
+  if (currentScanline < 144) {
+    if (next > 456 - 80) {
+      expected = Mode::OAMSearch;
+      boundary = 456 - 80;
+    } else if (next > 456 - 80 - 172) {
+      expected = Mode::PixelTransfer;
+      boundary = 456 - 80 - 172;
+    } else {
+      expected = Mode::HBlank;
+    }
+  }
+  if (getMode() != expected) {
+    return 1;
+  }
+  return scanlineCounter - boundary;
+}
+
+void PPU::advance(int cycles) {
+  while (cycles > 0) {
+    int next = cyclesUntilEvent();
+    if (next == 0) {
+      return; // LCD off and settled
+    }
+    if (cycles < next) {
+      scanlineCounter -= cycles;
+      return;
+    }
+    scanlineCounter -= next - 1;
+    tick();
+    cycles -= next;
+  }
+}
+
 void PPU::setMode(Mode mode) {
+  bool wasDrawing = getMode() == Mode::PixelTransfer;
   stat = (stat & 0xFC) | static_cast<uint8_t>(mode);
+  if (wasDrawing != (mode == Mode::PixelTransfer)) {
+    bus.remapVideo(); // VRAM locks/unlocks with pixel transfer
+  }
 
   bool interrupt = false;
   switch (mode) {
@@ -92,7 +171,15 @@ void PPU::renderScanline() {
   if ((lcdc & 0x80) == 0)
     return;
 
+  if (!rendering) {
+    // The window's line counter still advances on lines that show it
+    if ((lcdc & 0x21) == 0x21 && currentScanline >= wy && wx < 7 + 160)
+      windowLineCounter++;
+    return;
+  }
+
   // Background rendering
+  VramView vramAt(vram);
   if (lcdc & 0x01) {
     uint16_t tileMap = (lcdc & 0x08) ? 0x9C00 : 0x9800;
     uint16_t tileData = (lcdc & 0x10) ? 0x8000 : 0x8800;
@@ -125,9 +212,9 @@ void PPU::renderScanline() {
 
       int16_t tileNum;
       if (unsig) {
-        tileNum = read(tileAddr);
+        tileNum = vramAt[tileAddr];
       } else {
-        tileNum = static_cast<int8_t>(read(tileAddr));
+        tileNum = static_cast<int8_t>(vramAt[tileAddr]);
       }
 
       uint16_t tileLocation = tileData;
@@ -138,8 +225,8 @@ void PPU::renderScanline() {
       }
 
       uint8_t line = yPos % 8;
-      uint8_t data1 = read(tileLocation + (line * 2));
-      uint8_t data2 = read(tileLocation + (line * 2) + 1);
+      uint8_t data1 = vramAt[tileLocation + (line * 2)];
+      uint8_t data2 = vramAt[tileLocation + (line * 2) + 1];
 
       int colorBit = 7 - (xPos % 8);
 
@@ -168,6 +255,7 @@ void PPU::renderSprites() {
     return; // Sprites disabled
 
   bool use8x16 = (lcdc & 0x04) != 0;
+  VramView vramAt(vram);
 
   // Game Boy can render up to 40 sprites, but only 10 per scanline.
   // On DMG, priority is determined by X-coordinate (lower X = higher priority)
@@ -224,8 +312,8 @@ void PPU::renderSprites() {
       tileAddr = 0x8000 + (tileIndex * 16) + (line * 2);
     }
 
-    uint8_t data1 = read(tileAddr);
-    uint8_t data2 = read(tileAddr + 1);
+    uint8_t data1 = vramAt[tileAddr];
+    uint8_t data2 = vramAt[tileAddr + 1];
 
     for (int tilePixel = 0; tilePixel < 8; tilePixel++) {
       int colorBit = 7 - tilePixel;
@@ -275,14 +363,14 @@ uint8_t PPU::read(uint16_t address) const {
   if (getMode() == Mode::PixelTransfer) {
     return 0xFF;
   }
-  return vram[address - 0x8000];
+  return vram.read(address - 0x8000);
 }
 
 void PPU::write(uint16_t address, uint8_t value) {
   if (getMode() == Mode::PixelTransfer) {
     return;
   }
-  vram[address - 0x8000] = value;
+  vram.write(address - 0x8000, value);
 }
 
 uint8_t PPU::readReg(uint16_t address) const {
@@ -321,6 +409,7 @@ void PPU::writeReg(uint16_t address, uint8_t value) {
     break;
   case 0xFF41:
     stat = value;
+    bus.remapVideo();
     break;
   case 0xFF42:
     scy = value;
@@ -348,3 +437,39 @@ void PPU::writeReg(uint16_t address, uint8_t value) {
     break;
   }
 }
+
+void PPU::saveState(StateWriter &out) const {
+  out.put(scanlineCounter);
+  out.put(currentScanline);
+  out.put(windowLineCounter);
+  vram.saveState(out);
+  out.put(oam);
+  const uint8_t registers[] = {lcdc, stat, scy,  scx, lyc,
+                               bgp,  obp0, obp1, wy,  wx};
+  out.put(registers);
+  out.put(frameBuffer);
+  out.put(frameReady);
+}
+
+bool PPU::loadState(StateReader &in) {
+  in.get(scanlineCounter);
+  in.get(currentScanline);
+  in.get(windowLineCounter);
+  vram.loadState(in);
+  in.get(oam);
+  uint8_t registers[10];
+  in.get(registers);
+  lcdc = registers[0];
+  stat = registers[1];
+  scy = registers[2];
+  scx = registers[3];
+  lyc = registers[4];
+  bgp = registers[5];
+  obp0 = registers[6];
+  obp1 = registers[7];
+  wy = registers[8];
+  wx = registers[9];
+  in.get(frameBuffer);
+  in.get(frameReady);
+  return in.ok();
+}
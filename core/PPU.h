@@ -1,16 +1,27 @@
 #pragma once
 
 #include "Bus.h"
+#include "mmu/PagedRam.h"
 #include <array>
 #include <cstdint>
 #include <vector>
 
+class StateWriter;
+class StateReader;
+
 class PPU {
 public:
   explicit PPU(Bus &bus);
   ~PPU();
 
   void tick();
+  // Same as calling tick() `cycles` times, but jumps from one mode boundary
+  // to the next instead of stepping every dot.
+  void advance(int cycles);
+
+  // Number of tick() calls until the next one that changes the mode or LY,
+  // or 0 if nothing will happen until a register is written.
+  int cyclesUntilEvent() const;
 
   enum class Mode : uint8_t {
     HBlank = 0,
@@ -30,6 +41,19 @@ public:
   uint8_t readReg(uint16_t address) const;
   void writeReg(uint16_t address, uint8_t value);
 
+  // Backing store for the Bus page table; see Bus::remapVideo().
+  PagedRam &videoRam() { return vram; }
+  const PagedRam &videoRam() const { return vram; }
+
+  // With rendering off, scanlines leave frameBuffer untouched but the PPU
+  // otherwise behaves the same, e.g. for frames that will never be shown.
+  void setRendering(bool enabled) { rendering = enabled; }
+
+  // Snapshot support, see SaveState.h. The frame buffer is included so a
+  // restored machine shows the same picture.
+  void saveState(StateWriter &out) const;
+  bool loadState(StateReader &in);
+
   // The display is logically 160x144 pixels.
   // 0 = white, 1 = light gray, 2 = dark gray, 3 = black
   std::array<uint8_t, 160 * 144> frameBuffer{};
@@ -40,13 +64,14 @@ private:
   int scanlineCounter = 456; // T-cycles per scanline
   uint8_t currentScanline = 0;
   uint8_t windowLineCounter = 0;
+  bool rendering = true;
 
   void setMode(Mode mode);
   void updateStatus();
   void renderScanline();
   void renderSprites();
 
-  std::array<uint8_t, 0x2000> vram{};
+  PagedRam vram{0x2000};
   std::array<uint8_t, 0xA0> oam{};
 
   uint8_t lcdc = 0;
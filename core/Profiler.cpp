@@ -0,0 +1,65 @@
+#include "Profiler.h"
+#include "mmu/Symbols.h"
+#include <map>
+#include <string>
+
+Profiler::Profiler(uint32_t interval, size_t capacity)
+    : period(interval ? interval : 1) {
+  size_t size = 1;
+  while (size < capacity)
+    size <<= 1;
+  ring.resize(size);
+}
+
+size_t Profiler::drain() {
+  size_t tail = readIndex.load(std::memory_order_relaxed);
+  size_t head = writeIndex.load(std::memory_order_acquire);
+  for (size_t i = tail; i != head; i++) {
+    const Sample &sample = ring[i & (ring.size() - 1)];
+    counts[static_cast<uint32_t>(sample.bank) << 16 | sample.pc]++;
+  }
+  readIndex.store(head, std::memory_order_release);
+  total += head - tail;
+  return head - tail;
+}
+
+static const char *regionName(uint16_t pc) {
+  if (pc < 0x4000)
+    return "ROM0";
+  if (pc < 0x8000)
+    return "ROMX";
+  if (pc < 0xA000)
+    return "VRAM";
+  if (pc < 0xC000)
+    return "SRAM";
+  if (pc < 0xFE00)
+    return "WRAM";
+  if (pc < 0xFF80)
+    return "IO";
+  return "HRAM";
+}
+
+void Profiler::writeCollapsed(FILE *out, const SymbolTable &symbols) const {
+  // Merge per-PC counts into stacks, sorted for stable output
+  std::map<std::string, uint64_t> stacks;
+  for (const auto &[key, count] : counts) {
+    int bank = key >> 16;
+    uint16_t pc = key & 0xFFFF;
+    std::string stack = regionName(pc);
+    if (const std::string *label = symbols.lookup(bank, pc)) {
+      // "Func.loop" is a local label of "Func"
+      size_t dot = label->find('.');
+      stack += ";" + label->substr(0, dot);
+      if (dot != std::string::npos && dot > 0)
+        stack += ";" + *label;
+    } else {
+      char page[16];
+      snprintf(page, sizeof(page), ";%02X:%04X", bank, pc & 0xFF00);
+      stack += page;
+    }
+    stacks[stack] += count;
+  }
+  for (const auto &[stack, count] : stacks)
+    fprintf(out, "%s %llu\n", stack.c_str(),
+            static_cast<unsigned long long>(count));
+}
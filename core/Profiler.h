@@ -0,0 +1,60 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <unordered_map>
+#include <vector>
+
+class SymbolTable;
+
+// Sampling profiler for guest code. Once attached with
+// Scheduler::setProfiler(), the scheduler records the (ROM bank, PC) it is
+// at every interval() T-cycles. Samples go through a single-producer,
+// single-consumer ring so another thread can drain() while the emulator
+// runs; when the ring is full, samples are dropped and counted.
+class Profiler {
+public:
+  struct Sample {
+    uint16_t bank; // ROM bank for PCs in 0x4000-0x7FFF, else 0
+    uint16_t pc;
+  };
+
+  // `capacity` is rounded up to a power of two.
+  explicit Profiler(uint32_t interval = 1024, size_t capacity = 1 << 14);
+
+  uint32_t interval() const { return period; }
+
+  // Producer side
+  bool push(Sample sample) {
+    size_t head = writeIndex.load(std::memory_order_relaxed);
+    if (head - readIndex.load(std::memory_order_acquire) == ring.size()) {
+      lost.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+    ring[head & (ring.size() - 1)] = sample;
+    writeIndex.store(head + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Consumer side: folds buffered samples into the per-location counts and
+  // returns how many there were.
+  size_t drain();
+  uint64_t samples() const { return total; }
+  uint64_t dropped() const { return lost.load(std::memory_order_relaxed); }
+
+  // Collapsed stacks ("region;function;label count" per line) for
+  // flamegraph.pl, inferno or speedscope. Locations without a symbol are
+  // grouped by 256-byte page. Call drain() first.
+  void writeCollapsed(FILE *out, const SymbolTable &symbols) const;
+
+private:
+  uint32_t period;
+  std::vector<Sample> ring;
+  std::atomic<size_t> writeIndex{0};
+  std::atomic<size_t> readIndex{0};
+  std::atomic<uint64_t> lost{0};
+
+  std::unordered_map<uint32_t, uint64_t> counts; // bank << 16 | pc
+  uint64_t total = 0;
+};
@@ -0,0 +1,124 @@
+#include "Rewind.h"
+#include "DeltaCodec.h"
+#include <chrono>
+
+Rewind::Rewind(const SaveState::Machine &machine, int interval,
+               int keyframeInterval, size_t budget)
+    : machine(machine), interval(interval < 1 ? 1 : interval),
+      keyframeInterval(keyframeInterval < 1 ? 1 : keyframeInterval),
+      budget(budget) {}
+
+void Rewind::frameDone() {
+  frame++;
+  if (frame % interval == 0)
+    capture();
+}
+
+void Rewind::capture() {
+  auto start = std::chrono::steady_clock::now();
+  SaveState::save(machine, state);
+
+  bool keyframe = sinceKeyframe == 0 || !keyStateValid ||
+                  state.size() != keyState.size();
+  if (keyframe) {
+    DeltaCodec::compress(state.data(), state.size(), scratch);
+    keyState.swap(state);
+    keyStateValid = true;
+    keyFrame = frame;
+    sinceKeyframe = 0;
+  } else {
+    // `state` is free again once the XOR is taken
+    std::vector<uint8_t> &delta = state;
+    DeltaCodec::xorBytes(state.data(), keyState.data(), delta.data(),
+                         state.size());
+    DeltaCodec::compress(delta.data(), delta.size(), scratch);
+  }
+  sinceKeyframe = (sinceKeyframe + 1) % keyframeInterval;
+
+  entries.push_back(
+      {frame, keyframe, keyState.size(), {scratch.begin(), scratch.end()}});
+  held += entries.back().data.size();
+  evict();
+
+  captureTime += std::chrono::duration_cast<std::chrono::nanoseconds>(
+                     std::chrono::steady_clock::now() - start)
+                     .count();
+  captureCount++;
+}
+
+void Rewind::evict() {
+  // Drop whole keyframe groups, but never the newest one
+  while (held > budget) {
+    size_t next = 1;
+    while (next < entries.size() && !entries[next].keyframe)
+      next++;
+    if (next == entries.size())
+      break;
+    for (size_t i = 0; i < next; i++) {
+      held -= entries.front().data.size();
+      entries.pop_front();
+    }
+  }
+}
+
+bool Rewind::decodeKeyframe(const Entry &entry) {
+  keyState.resize(entry.size);
+  keyStateValid =
+      DeltaCodec::decompress(entry.data.data(), entry.data.size(),
+                             keyState.data(), keyState.size());
+  keyFrame = entry.frame;
+  return keyStateValid;
+}
+
+bool Rewind::stepBack() {
+  if (entries.empty())
+    return false;
+  const Entry &entry = entries.back();
+
+  state.resize(entry.size);
+  if (entry.keyframe) {
+    if (!DeltaCodec::decompress(entry.data.data(), entry.data.size(),
+                                state.data(), state.size()))
+      return false;
+  } else {
+    size_t key = entries.size() - 1;
+    while (!entries[key].keyframe)
+      key--;
+    if ((!keyStateValid || keyFrame != entries[key].frame) &&
+        !decodeKeyframe(entries[key]))
+      return false;
+    scratch.resize(state.size());
+    if (!DeltaCodec::decompress(entry.data.data(), entry.data.size(),
+                                scratch.data(), scratch.size()))
+      return false;
+    DeltaCodec::xorBytes(scratch.data(), keyState.data(), state.data(),
+                         state.size());
+  }
+  if (!SaveState::load(machine, state.data(), state.size()))
+    return false;
+
+  frame = entry.frame;
+  held -= entry.data.size();
+  if (entry.keyframe)
+    keyStateValid = false; // Its group is gone; start a new one
+  entries.pop_back();
+
+  // Continue the newest remaining group, if it's still cached
+  sinceKeyframe = 0;
+  if (keyStateValid) {
+    for (auto it = entries.rbegin(); it != entries.rend(); ++it) {
+      sinceKeyframe++;
+      if (it->keyframe)
+        break;
+    }
+    sinceKeyframe %= keyframeInterval;
+  }
+  return true;
+}
+
+void Rewind::clear() {
+  entries.clear();
+  held = 0;
+  sinceKeyframe = 0;
+  keyStateValid = false;
+}
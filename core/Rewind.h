@@ -0,0 +1,70 @@
+#pragma once
+
+#include "SaveState.h"
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+// History of save states to step backwards through. Every interval frames
+// the machine is snapshotted. Every keyframeInterval-th snapshot is kept
+// whole, the ones in between as an XOR against the keyframe before them;
+// both are run-length coded (see DeltaCodec). When the history outgrows its
+// byte budget, the oldest keyframe goes, along with its deltas.
+class Rewind {
+public:
+  explicit Rewind(const SaveState::Machine &machine, int interval = 2,
+                  int keyframeInterval = 60, size_t budget = 64 << 20);
+
+  // Call once after every emulated frame.
+  void frameDone();
+
+  // Load the newest snapshot and drop it from the history, so repeated
+  // calls walk backwards. Returns false once the history is empty.
+  bool stepBack();
+
+  void clear();
+
+  size_t snapshots() const { return entries.size(); }
+  // Emulated frames between the oldest snapshot and now
+  uint64_t framesHeld() const {
+    return entries.empty() ? 0 : frame - entries.front().frame;
+  }
+  // Compressed bytes held
+  size_t bytesHeld() const { return held; }
+  // Time spent in frameDone() capturing and compressing, in nanoseconds
+  uint64_t captureNanos() const { return captureTime; }
+  uint64_t captures() const { return captureCount; }
+
+private:
+  struct Entry {
+    uint64_t frame;
+    bool keyframe;
+    size_t size;               // Uncompressed
+    std::vector<uint8_t> data; // Compressed
+  };
+
+  SaveState::Machine machine;
+  int interval;
+  int keyframeInterval;
+  size_t budget;
+
+  std::deque<Entry> entries;
+  size_t held = 0;
+  uint64_t frame = 0;
+  int sinceKeyframe = 0;
+
+  // Uncompressed keyframe the newest deltas are against
+  std::vector<uint8_t> keyState;
+  bool keyStateValid = false;
+  uint64_t keyFrame = 0;
+  std::vector<uint8_t> state;   // Scratch
+  std::vector<uint8_t> scratch; // Scratch
+
+  uint64_t captureTime = 0;
+  uint64_t captureCount = 0;
+
+  void capture();
+  void evict();
+  bool decodeKeyframe(const Entry &entry);
+};
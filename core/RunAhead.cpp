@@ -0,0 +1,29 @@
+#include "RunAhead.h"
+#include "PPU.h"
+#include "Scheduler.h"
+
+RunAhead::RunAhead(const SaveState::Machine &machine, int frames)
+    : machine(machine) {
+  setFrames(frames);
+}
+
+void RunAhead::setFrames(int frames) { ahead = frames < 0 ? 0 : frames; }
+
+void RunAhead::runFrame() {
+  machine.scheduler.runFrame();
+  showPicture = false;
+  if (ahead == 0)
+    return;
+
+  SaveState::save(machine, snapshot);
+  for (int i = 1; i <= ahead; i++) {
+    machine.ppu.setRendering(i == ahead);
+    machine.scheduler.runFrame();
+  }
+  picture = machine.ppu.frameBuffer;
+  showPicture = SaveState::load(machine, snapshot.data(), snapshot.size());
+}
+
+const std::array<uint8_t, 160 * 144> &RunAhead::display() const {
+  return showPicture ? picture : machine.ppu.frameBuffer;
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include "SaveState.h"
+#include <array>
+#include <cstdint>
+#include <vector>
+
+// Hides `frames` frames of a game's input lag. Each frame is run for real,
+// then the machine is snapshotted, played `frames` further frames with the
+// same input, and restored; the picture shown is the last of those. Only
+// that one is rendered, the ones in between skip drawing entirely.
+//
+// Costs 1 + frames emulated frames plus a save and a load per displayed
+// frame, so it only pays off with headroom to spare.
+class RunAhead {
+public:
+  explicit RunAhead(const SaveState::Machine &machine, int frames = 0);
+
+  // 0 turns run-ahead off
+  void setFrames(int frames);
+  int frames() const { return ahead; }
+
+  // Run one real frame (and the frames ahead of it).
+  void runFrame();
+
+  // The picture to show for the last runFrame()
+  const std::array<uint8_t, 160 * 144> &display() const;
+  // Show the machine's own frame again, e.g. after it was loaded from a
+  // snapshot, until the next runFrame().
+  void discardPicture() { showPicture = false; }
+
+private:
+  SaveState::Machine machine;
+  int ahead = 0;
+  std::vector<uint8_t> snapshot;
+  std::array<uint8_t, 160 * 144> picture{};
+  bool showPicture = false;
+};
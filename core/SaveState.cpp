@@ -0,0 +1,99 @@
+#include "SaveState.h"
+#include "Bus.h"
+#include "CPU.h"
+#include "Joypad.h"
+#include "PPU.h"
+#include "Scheduler.h"
+#include "Timer.h"
+#include "mmu/Cartridge.h"
+
+namespace SaveState {
+
+namespace {
+
+constexpr size_t HEADER_SIZE = 3 * sizeof(uint32_t);
+
+void write(const Machine &machine, StateWriter &writer) {
+  writer.put(MAGIC);
+  writer.put(VERSION);
+  writer.put(uint32_t(0)); // Total size, patched by save()
+
+  // The cartridge goes first: it is the one section that can be rejected
+  // for something other than corruption, and loading checks it before
+  // touching anything else
+  writer.begin(tag("CART"));
+  machine.cartridge.saveState(writer);
+  writer.begin(tag("CPU "));
+  machine.cpu.saveState(writer);
+  writer.begin(tag("BUS "));
+  machine.bus.saveState(writer);
+  writer.begin(tag("PPU "));
+  machine.ppu.saveState(writer);
+  writer.begin(tag("TIMR"));
+  machine.timer.saveState(writer);
+  writer.begin(tag("JOYP"));
+  machine.joypad.saveState(writer);
+  writer.begin(tag("SCHD"));
+  machine.scheduler.saveState(writer);
+  writer.finish();
+}
+
+// Whether `data` holds exactly the sections this machine would write, in
+// the same order and of the same lengths, so applying it can't run short
+bool matchesLayout(const Machine &machine, const uint8_t *data, size_t size,
+                   bool withRam) {
+  Section expected[SECTIONS];
+  StateWriter measure(expected, withRam);
+  write(machine, measure);
+
+  size_t offset = HEADER_SIZE;
+  for (const Section &section : expected) {
+    Section found;
+    if (size - offset < sizeof(found))
+      return false;
+    std::memcpy(&found, data + offset, sizeof(found));
+    offset += sizeof(found);
+    if (found.tag != section.tag || found.length != section.length ||
+        found.length > size - offset)
+      return false;
+    offset += found.length;
+  }
+  return offset == size;
+}
+
+} // namespace
+
+void save(const Machine &machine, std::vector<uint8_t> &out, bool withRam) {
+  out.clear();
+  StateWriter writer(out, withRam);
+  write(machine, writer);
+
+  uint32_t size = uint32_t(out.size());
+  std::memcpy(out.data() + 2 * sizeof(uint32_t), &size, sizeof(size));
+}
+
+bool load(const Machine &machine, const uint8_t *data, size_t size,
+          bool withRam) {
+  StateReader reader(data, size, withRam);
+  if (reader.get<uint32_t>() != MAGIC || reader.get<uint32_t>() != VERSION ||
+      reader.get<uint32_t>() != size ||
+      !matchesLayout(machine, data, size, withRam))
+    return false;
+
+  // The cartridge's banking is back before Bus::loadState() remaps its
+  // pages; VRAM is remapped at the end, once the PPU mode is back too
+  bool ok = reader.begin(tag("CART")) && machine.cartridge.loadState(reader) &&
+            reader.begin(tag("CPU ")) && machine.cpu.loadState(reader) &&
+            reader.begin(tag("BUS ")) && machine.bus.loadState(reader) &&
+            reader.begin(tag("PPU ")) && machine.ppu.loadState(reader) &&
+            reader.begin(tag("TIMR")) && machine.timer.loadState(reader) &&
+            reader.begin(tag("JOYP")) && machine.joypad.loadState(reader) &&
+            reader.begin(tag("SCHD")) && machine.scheduler.loadState(reader) &&
+            reader.end();
+  if (!ok)
+    return false;
+  machine.bus.remapVideo();
+  return reader.atEnd();
+}
+
+} // namespace SaveState
@@ -0,0 +1,185 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+#include <vector>
+
+class Bus;
+class CPU;
+class PPU;
+class Timer;
+class Joypad;
+class Cartridge;
+class Scheduler;
+
+// Machine snapshots as one flat byte buffer:
+//
+//   "SBST" u32 version u32 size
+//   then per component: u32 tag u32 length <fields>
+//
+// Fields are raw host-endian copies, written and read back in the same order
+// by each component's saveState()/loadState(). Bump VERSION whenever any of
+// them changes; loading rejects other versions rather than guessing.
+namespace SaveState {
+
+constexpr uint32_t MAGIC = 0x54534253; // "SBST"
+constexpr uint32_t VERSION = 1;
+
+constexpr uint32_t tag(const char (&name)[5]) {
+  return uint32_t(uint8_t(name[0])) | uint32_t(uint8_t(name[1])) << 8 |
+         uint32_t(uint8_t(name[2])) << 16 | uint32_t(uint8_t(name[3])) << 24;
+}
+
+// One section's header, as found in a snapshot
+struct Section {
+  uint32_t tag;
+  uint32_t length;
+};
+constexpr size_t SECTIONS = 7;
+
+// Every component of one Game Boy. The Bus must already be wired to the
+// others.
+struct Machine {
+  Bus &bus;
+  CPU &cpu;
+  PPU &ppu;
+  Timer &timer;
+  Joypad &joypad;
+  Cartridge &cartridge;
+  Scheduler &scheduler;
+};
+
+// Replaces `out` with a snapshot. Reuses its capacity, so saving into the
+// same vector repeatedly does not allocate. Without RAM, the contents of
+// WRAM, VRAM and cartridge RAM are left out (see ForkPoint); such a
+// snapshot only loads with withRam false, which leaves them as they are.
+void save(const Machine &machine, std::vector<uint8_t> &out,
+          bool withRam = true);
+// Returns false, leaving the machine untouched, if `data` is not a snapshot
+// of this version or was taken with a different ROM. Every section is
+// checked against the one this machine would write before any is applied.
+bool load(const Machine &machine, const uint8_t *data, size_t size,
+          bool withRam = true);
+
+} // namespace SaveState
+
+class StateWriter {
+public:
+  explicit StateWriter(std::vector<uint8_t> &out, bool withRam = true)
+      : out(&out), ram(withRam) {}
+  // Measures instead of writing: each section's tag and length go to
+  // `sections`, which has room for SaveState::SECTIONS of them
+  StateWriter(SaveState::Section *sections, bool withRam)
+      : sections(sections), ram(withRam) {}
+
+  // Whether PagedRam contents are written
+  bool withRam() const { return ram; }
+
+  // Starts a section; the next begin() (or finish()) closes it.
+  void begin(uint32_t tag) {
+    close();
+    if (sections)
+      sections[count].tag = tag;
+    put(tag);
+    sectionStart = position();
+    put(uint32_t(0)); // Patched by close()
+  }
+  void finish() { close(); }
+
+  template <typename T> void put(const T &value) {
+    static_assert(std::is_trivially_copyable_v<T>);
+    bytes(&value, sizeof(T));
+  }
+  void bytes(const void *data, size_t size) {
+    if (!out) {
+      measured += size;
+      return;
+    }
+    size_t at = out->size();
+    out->resize(at + size);
+    std::memcpy(out->data() + at, data, size);
+  }
+
+private:
+  std::vector<uint8_t> *out = nullptr;
+  SaveState::Section *sections = nullptr;
+  bool ram;
+  size_t measured = 0;
+  size_t count = 0;
+  size_t sectionStart = 0;
+
+  size_t position() const { return out ? out->size() : measured; }
+
+  void close() {
+    if (!sectionStart)
+      return;
+    uint32_t length = uint32_t(position() - sectionStart - sizeof(uint32_t));
+    if (sections)
+      sections[count++].length = length;
+    else
+      std::memcpy(out->data() + sectionStart, &length, sizeof(length));
+    sectionStart = 0;
+  }
+};
+
+// Reads never run past the buffer: once anything is missing or malformed,
+// ok() turns false and every further read yields zeros.
+class StateReader {
+public:
+  StateReader(const uint8_t *data, size_t size, bool withRam = true)
+      : data(data), size(size), ram(withRam) {}
+
+  bool withRam() const { return ram; }
+
+  // Enters the next section, which must be `tag`.
+  bool begin(uint32_t tag) {
+    if (!end())
+      return false;
+    uint32_t found = 0, length = 0;
+    get(found);
+    get(length);
+    if (found != tag || length > size - offset)
+      failed = true;
+    sectionEnd = failed ? 0 : offset + length;
+    return !failed;
+  }
+  // Checks the current section was read exactly.
+  bool end() {
+    if (sectionEnd && offset != sectionEnd)
+      failed = true;
+    sectionEnd = 0;
+    return !failed;
+  }
+
+  template <typename T> void get(T &value) {
+    static_assert(std::is_trivially_copyable_v<T>);
+    bytes(&value, sizeof(T));
+  }
+  template <typename T> T get() {
+    T value{};
+    get(value);
+    return value;
+  }
+  void bytes(void *dest, size_t count) {
+    if (failed || count > size - offset) {
+      failed = true;
+      std::memset(dest, 0, count);
+      return;
+    }
+    std::memcpy(dest, data + offset, count);
+    offset += count;
+  }
+
+  bool ok() const { return !failed; }
+  bool atEnd() const { return offset == size; }
+
+private:
+  const uint8_t *data;
+  size_t size;
+  bool ram;
+  size_t offset = 0;
+  size_t sectionEnd = 0;
+  bool failed = false;
+};
@@ -0,0 +1,173 @@
+#include "Scheduler.h"
+#include "Bus.h"
+#include "CPU.h"
+#include "PPU.h"
+#include "Profiler.h"
+#include "SaveState.h"
+#include "Timer.h"
+#include <algorithm>
+
+Scheduler::Scheduler(Bus &b, CPU &c, PPU &p, Timer &t)
+    : bus(b), cpu(c), ppu(p), timer(t) {
+  deadlines.fill(NEVER);
+  timer.setClock(&clock);
+  schedule(Event::FrameEnd, CYCLES_PER_FRAME);
+  scheduleVideo();
+  scheduleTimer();
+}
+
+void Scheduler::schedule(Event event, uint64_t when) {
+  deadlines[static_cast<int>(event)] = when;
+  nextDeadline = *std::min_element(deadlines.begin(), deadlines.end());
+}
+
+uint64_t Scheduler::runFrame() {
+  uint64_t start = clock;
+  frameDone = false;
+  while (!frameDone) {
+    step(NEVER);
+  }
+  return clock - start;
+}
+
+uint64_t Scheduler::runCycles(uint64_t cycles) {
+  uint64_t start = clock;
+  uint64_t target = clock + cycles;
+  while (clock < target) {
+    step(target);
+  }
+  return clock - start;
+}
+
+// Run the CPU up to the next deadline (or `limit`), then handle every event
+// that has come due, oldest first. Register writes can bring a deadline
+// forward, so it is re-read after every block.
+void Scheduler::step(uint64_t limit) {
+  for (;;) {
+    uint64_t until = std::min(nextDeadline, limit);
+    if (clock >= until) {
+      break;
+    }
+    if (cpu.isHalted() && !cpu.interruptPending()) {
+      haltUntil(until);
+      continue;
+    }
+    int cycles = cpu.runBlock();
+    if (skipIdleLoops && cpu.inIdleLoop()) {
+      cycles = idleLoopCycles(until, cycles);
+    }
+    clock += cycles;
+  }
+
+  while (nextDeadline <= clock) {
+    auto due = std::min_element(deadlines.begin(), deadlines.end());
+    uint64_t when = *due;
+    Event event = static_cast<Event>(due - deadlines.begin());
+    cancel(event);
+    dispatch(event, when);
+  }
+}
+
+// A halted CPU burns 4 cycles per step until an interrupt is requested. PPU
+// and timer interrupts only come from events and joypad presses arrive
+// between runs, so skip straight to the deadline.
+void Scheduler::haltUntil(uint64_t until) {
+  uint64_t cycles = (until - clock + 3) & ~uint64_t{3};
+  clock += cycles;
+  cyclesHalted += cycles;
+}
+
+// The pass that just ran started at clock and saw the timer and video state
+// as of then; identical passes follow for as long as what it polls stays the
+// same: until the next event (which covers LY, STAT and IF) and, for DIV,
+// the next DIV step. Returns the cycles for this pass plus every identical
+// pass that would start before then.
+int Scheduler::idleLoopCycles(uint64_t until, int iteration) {
+  uint64_t wake = until - clock;
+  if (cpu.idleLoopPollsDiv()) {
+    wake = std::min<uint64_t>(wake, timer.cyclesUntilDivChange());
+  }
+  if (wake <= static_cast<uint64_t>(iteration)) {
+    return iteration;
+  }
+
+  uint64_t cycles = (wake + iteration - 1) / iteration * iteration;
+  cyclesIdle += cycles - iteration;
+  cpu.skipIdleIterations(cycles / iteration - 1);
+  return static_cast<int>(cycles);
+}
+
+void Scheduler::dispatch(Event event, uint64_t when) {
+  switch (event) {
+  case Event::Video:
+    ppu.advance(static_cast<int>(when - videoTime));
+    videoTime = when;
+    scheduleVideo();
+    break;
+  case Event::TimerOverflow:
+    timer.sync(); // Requests the interrupt
+    scheduleTimer();
+    break;
+  case Event::Dma:
+    bus.transferOam();
+    break;
+  case Event::Sample: {
+    bool romx = cpu.PC >= 0x4000 && cpu.PC < 0x8000;
+    profiler->push({static_cast<uint16_t>(romx ? bus.romBank() : 0), cpu.PC});
+    schedule(Event::Sample, when + profiler->interval());
+    break;
+  }
+  case Event::FrameEnd:
+    frameDone = true;
+    schedule(Event::FrameEnd, when + CYCLES_PER_FRAME);
+    break;
+  default:
+    break;
+  }
+}
+
+void Scheduler::setProfiler(Profiler *p) {
+  profiler = p;
+  schedule(Event::Sample, profiler ? clock + profiler->interval() : NEVER);
+}
+
+void Scheduler::syncVideo() {
+  if (clock > videoTime) {
+    ppu.advance(static_cast<int>(clock - videoTime));
+    videoTime = clock;
+  }
+  scheduleVideo();
+}
+
+void Scheduler::scheduleVideo() {
+  int cycles = ppu.cyclesUntilEvent();
+  schedule(Event::Video, cycles ? videoTime + cycles : NEVER);
+}
+
+void Scheduler::scheduleTimer() {
+  uint32_t cycles = timer.cyclesUntilOverflow();
+  schedule(Event::TimerOverflow, cycles ? clock + cycles : NEVER);
+}
+
+void Scheduler::saveState(StateWriter &out) const {
+  out.put(clock);
+  out.put(videoTime);
+  out.put(frameDone);
+  out.put(cyclesHalted);
+  out.put(cyclesIdle);
+  out.put(deadlines);
+}
+
+bool Scheduler::loadState(StateReader &in) {
+  in.get(clock);
+  in.get(videoTime);
+  in.get(frameDone);
+  in.get(cyclesHalted);
+  in.get(cyclesIdle);
+  in.get(deadlines);
+  if (!in.ok())
+    return false;
+  // Recomputes nextDeadline as well
+  schedule(Event::Sample, profiler ? clock + profiler->interval() : NEVER);
+  return true;
+}
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+
+class Bus;
+class CPU;
+class PPU;
+class Profiler;
+class Timer;
+class StateWriter;
+class StateReader;
+
+// Master clock for a Game Boy. Components put their next observable change
+// (PPU mode/LY change, DMA completion, frame end, ...) on the timeline as an
+// event and the CPU runs uninterrupted until the earliest deadline.
+//
+// The CPU is stepped a block at a time, so it may overshoot a deadline by
+// one block; events are still handled at their own timestamps.
+class Scheduler {
+public:
+  enum class Event : uint8_t {
+    Video,
+    TimerOverflow,
+    Dma,
+    FrameEnd,
+    Sample,
+    Count
+  };
+
+  static constexpr uint64_t NEVER = UINT64_MAX;
+  static constexpr uint64_t CYCLES_PER_FRAME = 70224;
+  static constexpr uint64_t DMA_CYCLES = 640;
+
+  Scheduler(Bus &bus, CPU &cpu, PPU &ppu, Timer &timer);
+
+  // T-cycles since power on
+  uint64_t now() const { return clock; }
+
+  void schedule(Event event, uint64_t when);
+  void cancel(Event event) { schedule(event, NEVER); }
+  uint64_t deadline(Event event) const {
+    return deadlines[static_cast<int>(event)];
+  }
+
+  // Run until the end of the current frame, return T-cycles elapsed.
+  uint64_t runFrame();
+  // Run for at least `cycles` T-cycles, return T-cycles elapsed.
+  uint64_t runCycles(uint64_t cycles);
+
+  // T-cycles skipped over while the CPU was halted
+  uint64_t haltedCycles() const { return cyclesHalted; }
+
+  // Fast-forward polling loops (see CPU::inIdleLoop()). On by default; some
+  // ROMs may need it off, see IdleLoopOverrides.
+  void setIdleLoopSkipping(bool enabled) { skipIdleLoops = enabled; }
+  // T-cycles skipped over in idle loops
+  uint64_t idleCycles() const { return cyclesIdle; }
+
+  // Sample the guest PC every profiler->interval() T-cycles, nullptr to
+  // stop. Without a profiler there is no sampling cost at all.
+  void setProfiler(Profiler *profiler);
+
+  // Bring the PPU up to now() and recompute its next event. The Bus calls
+  // this around writes to the LCD registers.
+  void syncVideo();
+  // Recompute the next TIMA overflow. The Bus calls this after writes to the
+  // timer registers.
+  void scheduleTimer();
+
+  // Snapshot support, see SaveState.h. The profiler is not part of the
+  // state; a loaded scheduler keeps sampling with its current one.
+  void saveState(StateWriter &out) const;
+  bool loadState(StateReader &in);
+
+private:
+  Bus &bus;
+  CPU &cpu;
+  PPU &ppu;
+  Timer &timer;
+
+  uint64_t clock = 0;
+  uint64_t videoTime = 0; // Cycle the PPU has been stepped up to
+  bool frameDone = false;
+  uint64_t cyclesHalted = 0;
+  bool skipIdleLoops = true;
+  uint64_t cyclesIdle = 0;
+  Profiler *profiler = nullptr;
+
+  std::array<uint64_t, static_cast<int>(Event::Count)> deadlines;
+  uint64_t nextDeadline = NEVER;
+
+  void step(uint64_t limit);
+  void haltUntil(uint64_t until);
+  int idleLoopCycles(uint64_t until, int iteration);
+  void dispatch(Event event, uint64_t when);
+  void scheduleVideo();
+};
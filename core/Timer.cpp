@@ -1,31 +1,61 @@
 #include "Timer.h"
 #include "Bus.h"
+#include "SaveState.h"
+
+static const int bit_map[] = {9, 3, 5, 7};
 
 Timer::Timer(Bus &b) : bus(b) {}
 
+void Timer::setClock(const uint64_t *source) {
+  sync();
+  clock = source;
+  synced = now();
+}
+
 void Timer::tick(int cycles) {
+  ownClock += cycles;
+  sync();
+}
+
+void Timer::sync() {
+  uint64_t elapsed = now() - synced;
+  if (elapsed == 0)
+    return;
   uint16_t prev_div = div_internal;
-  div_internal += cycles;
+  div_internal += elapsed;
+  synced += elapsed;
 
-  static const int bit_map[] = {9, 3, 5, 7};
-  int bit = bit_map[tac & 0x03];
   bool timer_enabled = (tac & 0x04) != 0;
+  if (!timer_enabled)
+    return;
 
-  if (timer_enabled) {
-    bool prev_bit = (prev_div >> bit) & 0x01;
-    bool current_bit = (div_internal >> bit) & 0x01;
-
-    if (prev_bit && !current_bit) {
-      tima++;
-      if (tima == 0) {
-        tima = tma;
-        bus.requestInterrupt(Bus::INTERRUPT_TIMER);
-      }
-    }
+  // One increment per falling edge of the selected DIV bit
+  int bit = bit_map[tac & 0x03];
+  uint64_t edges =
+      ((prev_div + elapsed) >> (bit + 1)) - (prev_div >> (bit + 1));
+  uint64_t count = tima + edges;
+  if (count <= 0xFF) {
+    tima = static_cast<uint8_t>(count);
+    return;
   }
+  // Overflowed at least once: reload from TMA and count on from there
+  uint64_t after = count - 0x100;
+  tima = static_cast<uint8_t>(tma + after % (0x100 - tma));
+  bus.requestInterrupt(Bus::INTERRUPT_TIMER);
 }
 
-uint8_t Timer::read(uint16_t address) const {
+uint32_t Timer::cyclesUntilOverflow() {
+  if (!(tac & 0x04))
+    return 0;
+
+  sync();
+  uint32_t period = 1u << (bit_map[tac & 0x03] + 1);
+  uint32_t firstEdge = period - (div_internal & (period - 1));
+  return firstEdge + (0xFF - tima) * period;
+}
+
+uint8_t Timer::read(uint16_t address) {
+  sync();
   switch (address) {
   case 0xFF04:
     return static_cast<uint8_t>(div_internal >> 8);
@@ -41,6 +71,7 @@ uint8_t Timer::read(uint16_t address) const {
 }
 
 void Timer::write(uint16_t address, uint8_t value) {
+  sync();
   switch (address) {
   case 0xFF04:
     div_internal = 0; // Writing any value to DIV resets it to 0
@@ -56,3 +87,22 @@ void Timer::write(uint16_t address, uint8_t value) {
     break;
   }
 }
+
+void Timer::saveState(StateWriter &out) const {
+  out.put(ownClock);
+  out.put(synced);
+  out.put(div_internal);
+  out.put(tima);
+  out.put(tma);
+  out.put(tac);
+}
+
+bool Timer::loadState(StateReader &in) {
+  in.get(ownClock);
+  in.get(synced);
+  in.get(div_internal);
+  in.get(tima);
+  in.get(tma);
+  in.get(tac);
+  return in.ok();
+}
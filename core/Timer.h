@@ -2,20 +2,47 @@
 #include <cstdint>
 
 class Bus;
+class StateWriter;
+class StateReader;
 
+// DIV and TIMA are derived on demand from a T-cycle timestamp rather than
+// stepped alongside the CPU. With a scheduler the timestamp is the master
+// clock and TIMA overflows are scheduled as events; standalone, tick()
+// advances the timer's own counter.
 class Timer {
 public:
   explicit Timer(Bus &bus);
+  // Use `clock` (e.g. the scheduler's) as the timestamp source.
+  void setClock(const uint64_t *clock);
   void tick(int cycles);
+  // Bring DIV/TIMA up to the current timestamp, requesting the timer
+  // interrupt if TIMA overflowed on the way.
+  void sync();
+  // T-cycles until TIMA next overflows, or 0 while the timer is stopped.
+  uint32_t cyclesUntilOverflow();
+  // T-cycles until DIV next reads differently.
+  uint32_t cyclesUntilDivChange() const {
+    return 0x100 - ((div_internal + (now() - synced)) & 0xFF);
+  }
 
-  uint8_t read(uint16_t address) const;
+  uint8_t read(uint16_t address);
   void write(uint16_t address, uint8_t value);
 
+  // Snapshot support, see SaveState.h
+  void saveState(StateWriter &out) const;
+  bool loadState(StateReader &in);
+
 private:
   Bus &bus;
 
+  const uint64_t *clock = nullptr;
+  uint64_t ownClock = 0;
+  uint64_t synced = 0; // Timestamp the registers below are current at
+
   uint16_t div_internal = 0; // Internal 16-bit counter for DIV
   uint8_t tima = 0;          // TIMA register (0xFF05)
   uint8_t tma = 0;           // TMA register (0xFF06)
   uint8_t tac = 0;           // TAC register (0xFF07)
+
+  uint64_t now() const { return clock ? *clock : ownClock; }
 };
@@ -1,52 +1,79 @@
-#include "core/Bus.h"
-#include "core/CPU.h"
-#include "core/Joypad.h"
-#include "core/PPU.h"
-#include "core/Timer.h"
+#include "core/GameBoy.h"
+#include "core/IdleLoops.h"
+#include "core/Rewind.h"
+#include "core/RunAhead.h"
 #include "frontend/BrailleRenderer.h"
 #include "ftxui/component/component.hpp"
 #include "ftxui/component/screen_interactive.hpp"
 #include "ftxui/dom/elements.hpp"
-#include "mmu/Cartridge.h"
 #include <atomic>
 #include <chrono>
 #include <iostream>
+#include <memory>
 #include <thread>
 
 using namespace ftxui;
 
+#ifdef SHELLBOY_OPCODE_STATS
+// Snapshot of the opcode counters, next to the working directory
+static void writeOpcodeStats(const OpcodeStats &stats) {
+  FILE *table = fopen("shellboy_opcodes.txt", "w");
+  if (table) {
+    stats.printTable(table);
+    fclose(table);
+  }
+  stats.writeCsv("shellboy_opcodes.csv");
+}
+#endif
+
 int main(int argc, char **argv) {
   if (argc < 2) {
-    std::cerr << "Usage: ShellBoy <rom_path>" << std::endl;
+    std::cerr << "Usage: ShellBoy <rom_path> [idle_loop_overrides]"
+              << std::endl;
     return 1;
   }
-  Bus bus;
-  Cartridge cart;
-  if (!cart.loadRom(argv[1])) {
-    std::cerr << "Failed to load ROM: " << argv[1] << std::endl;
+  auto gameBoy = std::make_unique<GameBoy>();
+  if (!gameBoy->loadRom(argv[1])) {
+    std::cerr << "Failed to load ROM: " << argv[1] << ": "
+              << gameBoy->loadError() << std::endl;
     return 1;
   }
-
-  bus.setCartridge(&cart);
-
-  CPU cpu(bus);
-  PPU ppu(bus);
-  Timer timer(bus);
-  Joypad joypad(bus);
-  bus.setPPU(&ppu);
-  bus.setTimer(&timer);
-  bus.setJoypad(&joypad);
+  CPU &cpu = gameBoy->cpu;
+  PPU &ppu = gameBoy->ppu;
+  Joypad &joypad = gameBoy->joypad;
+  Cartridge &cart = gameBoy->cartridge;
+  Scheduler &scheduler = gameBoy->scheduler;
+
+  IdleLoopOverrides overrides;
+  if (argc > 2 && !overrides.load(argv[2])) {
+    std::cerr << "Failed to load idle loop overrides: " << argv[2]
+              << std::endl;
+    return 1;
+  }
+  scheduler.setIdleLoopSkipping(
+      overrides.allowsSkipping(cart.title(), cart.headerChecksum()));
   BrailleRenderer renderer;
 
+  // A snapshot every other frame; 64MB holds several minutes for most games
+  Rewind rewind(gameBoy->machine());
+  RunAhead runAhead(gameBoy->machine());
+
   auto screen = ScreenInteractive::TerminalOutput();
 
   std::atomic<int> frames = 0;
+  std::atomic<bool> jit = false;
+  std::atomic<bool> dumpStats = false;
+  std::atomic<int> rewindSteps = 0;
+  std::atomic<int> runAheadFrames = 0;
   auto renderer_component = Renderer([&] {
-    std::string frameText = renderer.render(ppu.frameBuffer);
+    std::string frameText = renderer.render(runAhead.display());
     return window(text("ShellBoy - DMG-01 Emulator"),
-                  vbox({text("Frames: " + std::to_string(frames.load())),
+                  vbox({text("Frames: " + std::to_string(frames.load()) +
+                             "  Run-ahead: " +
+                             std::to_string(runAheadFrames.load())),
                         text("Controls: Arrows=D-Pad, Z=A, X=B, Enter=Start, "
-                             "Backspace=Select"),
+                             "Backspace=Select, J=Toggle JIT, R=Rewind, "
+                             "L=Run-ahead 0/1/2"),
                         separator(), text(frameText)}));
   });
 
@@ -83,6 +110,25 @@ int main(int argc, char **argv) {
       joypad.pressButton(Joypad::SELECT);
       return true;
     }
+    if (event == Event::Character("j") || event == Event::Character("J")) {
+      jit = !jit;
+      return true;
+    }
+    if (event == Event::Character("l") || event == Event::Character("L")) {
+      runAheadFrames = (runAheadFrames + 1) % 3;
+      return true;
+    }
+    // Terminals only report key repeats, so holding R keeps rewinding
+    if (event == Event::Character("r") || event == Event::Character("R")) {
+      rewindSteps++;
+      return true;
+    }
+#ifdef SHELLBOY_OPCODE_STATS
+    if (event == Event::Character("p") || event == Event::Character("P")) {
+      dumpStats = true;
+      return true;
+    }
+#endif
     if (event == Event::Character("q") || event == Event::Character("Q")) {
       screen.Exit();
       return true;
@@ -109,20 +155,29 @@ int main(int argc, char **argv) {
       joypad.releaseButton(Joypad::SELECT);
       joypad.releaseButton(Joypad::START);
 
-      // Run CPU and PPU until a frame is ready
-      // A full frame is 70224 T-cycles
-      int cyclesThisFrame = 0;
-      while (cyclesThisFrame < 70224) {
-        int cycles = cpu.tick(); // CPU is currently a stub NOP taking 4 cycles
-        timer.tick(cycles);
-        for (int i = 0; i < cycles; ++i) {
-          ppu.tick();
-        }
-        cyclesThisFrame += cycles;
+      if (jit != cpu.jitEnabled()) {
+        jit = cpu.setJitEnabled(jit);
+      }
+      runAhead.setFrames(runAheadFrames);
+#ifdef SHELLBOY_OPCODE_STATS
+      if (dumpStats.exchange(false)) {
+        writeOpcodeStats(cpu.opcodeStats());
+      }
+#endif
+
+      if (rewindSteps.load() > 0) {
+        // Show the restored frame instead of running a new one
+        rewindSteps--;
+        rewind.stepBack();
+        runAhead.discardPicture();
+      } else {
+        // Run CPU and PPU until a frame is ready
+        // A full frame is 70224 T-cycles
+        runAhead.runFrame();
+        rewind.frameDone();
+        frames++;
       }
-
       ppu.frameReady = false;
-      frames++;
 
       // Trigger a UI re-render on the main thread safely
       screen.PostEvent(Event::Custom);
@@ -143,5 +198,10 @@ int main(int argc, char **argv) {
   running = false;
   emulatorThread.join();
 
+#ifdef SHELLBOY_OPCODE_STATS
+  cpu.opcodeStats().printTable(stdout, 40);
+  writeOpcodeStats(cpu.opcodeStats());
+#endif
+
   return 0;
 }
@@ -1,106 +1,186 @@
 #include "Cartridge.h"
-#include <fstream>
+#include "core/SaveState.h"
+#include <cstring>
+#include <filesystem>
 
 Cartridge::Cartridge() {}
 Cartridge::~Cartridge() {}
 
 bool Cartridge::loadRom(const std::string &filepath) {
-  std::ifstream file(filepath, std::ios::binary | std::ios::ate);
-  if (!file.is_open())
+  // Let go of the previous image first, so a file rewritten in place since
+  // is opened afresh rather than found in the cache
+  image.reset();
+  rom = nullptr;
+  romx = nullptr;
+  std::shared_ptr<const RomImage> loaded = RomImage::open(filepath, error);
+  if (!loaded)
     return false;
+  loadRom(std::move(loaded));
 
-  std::streamsize size = file.tellg();
-  file.seekg(0, std::ios::beg);
-
-  rom.resize(size);
-  if (file.read(reinterpret_cast<char *>(rom.data()), size)) {
-    uint8_t type = rom[0x147];
-    if (type >= 0x01 && type <= 0x03)
-      mbcType = 1; // MBC1
-    else if (type >= 0x0F && type <= 0x13)
-      mbcType = 3; // MBC3
-    else if (type >= 0x19 && type <= 0x1E)
-      mbcType = 5; // MBC5
-    else
-      mbcType = 0; // ROM ONLY or unimplemented
-
-    switch (rom[0x149]) {
-    case 1:
-      ram.resize(2048);
-      break;
-    case 2:
-      ram.resize(8192);
-      break;
-    case 3:
-      ram.resize(32768);
-      break;
-    case 4:
-      ram.resize(131072);
-      break;
-    case 5:
-      ram.resize(65536);
-      break;
-    default:
-      ram.resize(0);
-      break;
-    }
-  }
+  std::filesystem::path symPath(filepath);
+  if (!symbolTable.load(symPath.replace_extension(".sym").string()))
+    symbolTable.clear();
   return true;
 }
 
-return false;
+void Cartridge::loadRom(std::shared_ptr<const RomImage> loaded) {
+  image = std::move(loaded);
+  rom = image->data();
+  symbolTable.clear();
+  error.clear();
+
+  romBanks = image->banks();
+  romBankMask = 1;
+  while (romBankMask + 1 < romBanks)
+    romBankMask = (romBankMask << 1) | 1;
+
+  uint8_t type = image->cartridgeType();
+  if (type >= 0x01 && type <= 0x03)
+    mbc = Mbc::Mbc1;
+  else if (type == 0x05 || type == 0x06)
+    mbc = Mbc::Mbc2;
+  else if (type >= 0x0F && type <= 0x13)
+    mbc = Mbc::Mbc3;
+  else if (type >= 0x19 && type <= 0x1E)
+    mbc = Mbc::Mbc5;
+  else
+    mbc = Mbc::None; // ROM only or ROM+RAM; RomImage rejects the rest
+
+  switch (mbc) {
+  case Mbc::None:
+    readHandler = &Cartridge::readAs<Mbc::None>;
+    writeHandler = &Cartridge::writeAs<Mbc::None>;
+    break;
+  case Mbc::Mbc1:
+    readHandler = &Cartridge::readAs<Mbc::Mbc1>;
+    writeHandler = &Cartridge::writeAs<Mbc::Mbc1>;
+    break;
+  case Mbc::Mbc2:
+    readHandler = &Cartridge::readAs<Mbc::Mbc2>;
+    writeHandler = &Cartridge::writeAs<Mbc::Mbc2>;
+    break;
+  case Mbc::Mbc3:
+    readHandler = &Cartridge::readAs<Mbc::Mbc3>;
+    writeHandler = &Cartridge::writeAs<Mbc::Mbc3>;
+    break;
+  case Mbc::Mbc5:
+    readHandler = &Cartridge::readAs<Mbc::Mbc5>;
+    writeHandler = &Cartridge::writeAs<Mbc::Mbc5>;
+    break;
+  }
+
+  // 2KB RAM is rounded up to a full bank
+  int ramBanks = 0;
+  switch (image->ramSizeCode()) {
+  case 1:
+  case 2:
+    ramBanks = 1;
+    break;
+  case 3:
+    ramBanks = 4;
+    break;
+  case 4:
+    ramBanks = 16;
+    break;
+  case 5:
+    ramBanks = 8;
+    break;
+  }
+  if (mbc == Mbc::Mbc2) {
+    ram.resize(512); // Built in, 4 bits per byte
+  } else {
+    ram.resize(ramBanks * 0x2000);
+  }
+  ramBankMask = ramBanks ? ramBanks - 1 : 0;
+
+  romBank = 1;
+  ramBank = 0;
+  ramEnabled = mbc == Mbc::None; // No MBC: RAM, if any, is always there
+  bankingMode = 0;
+  romBankHigh = 0;
+  updateBanks();
 }
 
-uint8_t Cartridge::read(uint16_t address) const {
-  if (address < 0x4000) {
+template <Cartridge::Mbc M>
+uint8_t Cartridge::readAs(uint16_t address) const {
+  if (address < 0x4000)
     return rom[address];
-  } else if (address < 0x8000) {
-    uint32_t bank = romBank;
-    if (mbcType == 5) {
-      bank |= (romBankHigh << 8);
-    }
-    uint32_t mapped = (bank * 0x4000) + (address - 0x4000);
-    return rom[mapped % rom.size()];
-  } else if (address >= 0xA000 && address <= 0xBFFF) {
-    if (ramEnabled) {
-      if (mbcType == 3 && ramBank >= 0x08 && ramBank <= 0x0C) {
-        return rtcRegisters[ramBank - 0x08];
-      }
-      uint32_t mapped = (ramBank * 0x2000) + (address - 0xA000);
-      if (mapped < ram.size())
-        return ram[mapped];
-    }
+  if (address < 0x8000)
+    return romx[address - 0x4000];
+  if (address < 0xA000 || address > 0xBFFF)
+    return 0xFF;
+
+  if (sramMapped)
+    return ram.read(sramBase + (address - 0xA000));
+  if constexpr (M == Mbc::Mbc2) {
+    if (ramEnabled)
+      return 0xF0 | ram.read(address & 0x1FF);
+  }
+  if constexpr (M == Mbc::Mbc3) {
+    if (ramEnabled && ramBank >= 0x08 && ramBank <= 0x0C)
+      return rtcRegisters[ramBank - 0x08];
   }
   return 0xFF;
 }
 
-void Cartridge::write(uint16_t address, uint8_t value) {
-  if (mbcType == 1) { // MBC1
+template <Cartridge::Mbc M>
+void Cartridge::writeAs(uint16_t address, uint8_t value) {
+  if (address < 0x8000) {
+    writeControl<M>(address, value);
+    updateBanks();
+    return;
+  }
+  if (address < 0xA000 || address > 0xBFFF)
+    return;
+
+  if (sramMapped) {
+    ram.write(sramBase + (address - 0xA000), value);
+    return;
+  }
+  if constexpr (M == Mbc::Mbc2) {
+    if (ramEnabled)
+      ram.write(address & 0x1FF, value & 0x0F);
+  }
+  if constexpr (M == Mbc::Mbc3) {
+    if (ramEnabled && ramBank >= 0x08 && ramBank <= 0x0C)
+      rtcRegisters[ramBank - 0x08] = value;
+  }
+}
+
+template <Cartridge::Mbc M>
+void Cartridge::writeControl(uint16_t address, uint8_t value) {
+  if constexpr (M == Mbc::Mbc1) {
     if (address < 0x2000) {
       ramEnabled = ((value & 0x0F) == 0x0A);
     } else if (address < 0x4000) {
       romBank = (romBank & 0xE0) | (value & 0x1F);
-      if (romBank == 0 || romBank == 0x20 || romBank == 0x40 ||
-          (romBank == 0x60)) {
+      if ((romBank & 0x1F) == 0)
         romBank++;
-      }
     } else if (address < 0x6000) {
       if (bankingMode == 0) {
         romBank = (romBank & 0x1F) | ((value & 0x03) << 5);
-        if (romBank == 0 || romBank == 0x20 || romBank == 0x40 ||
-            (romBank == 0x60)) {
+        if ((romBank & 0x1F) == 0)
           romBank++;
-        }
       } else {
         ramBank = value & 0x03;
       }
-    } else if (address < 0x8000) {
+    } else {
       bankingMode = value & 0x01;
-      if (bankingMode == 0) {
+      if (bankingMode == 0)
         ramBank = 0;
+    }
+  } else if constexpr (M == Mbc::Mbc2) {
+    // Address bit 8 selects between RAM enable and ROM bank
+    if (address < 0x4000) {
+      if (address & 0x0100) {
+        romBank = value & 0x0F;
+        if (romBank == 0)
+          romBank = 1;
+      } else {
+        ramEnabled = ((value & 0x0F) == 0x0A);
       }
     }
-  } else if (mbcType == 3) { // MBC3
+  } else if constexpr (M == Mbc::Mbc3) {
     if (address < 0x2000) {
       ramEnabled = ((value & 0x0F) == 0x0A);
     } else if (address < 0x4000) {
@@ -109,45 +189,127 @@ void Cartridge::write(uint16_t address, uint8_t value) {
         romBank = 1;
     } else if (address < 0x6000) {
       ramBank = value;
-    } else if (address < 0x8000) {
+    } else {
       if (rtcLatch == 0 && value == 1) {
         // In a real implementation, we would capture the current time here.
         // For now, we just acknowledge the latch signal.
       }
       rtcLatch = value;
     }
-  } else if (mbcType == 5) { // MBC5
+  } else if constexpr (M == Mbc::Mbc5) {
     if (address < 0x2000) {
       ramEnabled = ((value & 0x0F) == 0x0A);
+    } else if (address < 0x3000) {
+      romBank = value;
     } else if (address < 0x4000) {
-      if (address < 0x3000) {
-        romBank = value;
-      } else {
-        romBankHigh = value & 0x01;
-      }
+      romBankHigh = value & 0x01;
     } else if (address < 0x6000) {
       ramBank = value & 0x0F;
     }
   }
+}
 
-  // Common RAM write logic
-  if (address >= 0xA000 && address <= 0xBFFF) {
-    if (ramEnabled) {
-      if (mbcType == 3 && ramBank >= 0x08 && ramBank <= 0x0C) {
-        rtcRegisters[ramBank - 0x08] = value;
-        return;
-      }
-      uint32_t mapped = (ramBank * 0x2000) + (address - 0xA000);
-      if (mapped < ram.size()) {
-        ram[mapped] = value;
-      }
-    } else if (mbcType == 0) {
-      // ROM ONLY, ram might be written to if 0xA000 - 0xBFFF is accessed (e.g.,
-      // Tetris)
-      uint32_t offset = address - 0xA000;
-      if (offset < ram.size()) {
-        ram[offset] = value;
-      }
-    }
+void Cartridge::updateBanks() {
+  int bank = romBank;
+  if (mbc == Mbc::Mbc5)
+    bank |= romBankHigh << 8;
+  bank &= romBankMask;
+  if (bank >= romBanks)
+    bank %= romBanks; // Only for images that aren't a power of two
+  mappedRomBank = bank;
+  romx = rom + bank * 0x4000;
+
+  bool rtc = mbc == Mbc::Mbc3 && ramBank >= 0x08;
+  sramMapped = ramEnabled && ram.size() && mbc != Mbc::Mbc2 && !rtc;
+  sramBase = sramMapped ? (ramBank & ramBankMask) * 0x2000 : 0;
+}
+
+std::string Cartridge::title() const {
+  std::string name;
+  if (!rom)
+    return name;
+  for (uint16_t address = 0x134; address <= 0x143; address++) {
+    if (rom[address] == 0)
+      break;
+    name += static_cast<char>(rom[address]);
   }
+  return name;
+}
+
+uint8_t Cartridge::headerChecksum() const {
+  return rom ? rom[0x14D] : 0;
+}
+
+const uint8_t *Cartridge::romPage(uint16_t address) const {
+  if (!rom)
+    return nullptr;
+  if (address < 0x4000)
+    return &rom[address & 0xFF00];
+  return romx + ((address - 0x4000) & 0xFF00);
+}
+
+const uint8_t *Cartridge::ramReadPage(uint16_t address) const {
+  if (!sramMapped)
+    return nullptr;
+  return ram.readPage((sramBase + (address - 0xA000)) / PagedRam::PAGE_SIZE);
+}
+
+uint8_t *Cartridge::ramWritePage(uint16_t address) {
+  if (!sramMapped)
+    return nullptr;
+  return ram.ownedPage((sramBase + (address - 0xA000)) / PagedRam::PAGE_SIZE);
+}
+
+void Cartridge::saveState(StateWriter &out) const {
+  out.put(static_cast<uint32_t>(romBanks));
+  out.put(headerChecksum());
+  out.put(mbc);
+  out.put(romBank);
+  out.put(ramBank);
+  out.put(ramEnabled);
+  out.put(bankingMode);
+  out.put(romBankHigh);
+  out.put(rtcRegisters);
+  out.put(rtcLatch);
+  out.put(static_cast<uint32_t>(ram.size()));
+  ram.saveState(out);
+}
+
+bool Cartridge::loadState(StateReader &in) {
+  uint32_t banks = in.get<uint32_t>();
+  uint8_t checksum = in.get<uint8_t>();
+  Mbc type = in.get<Mbc>();
+  if (!in.ok() || banks != uint32_t(romBanks) ||
+      checksum != headerChecksum() || type != mbc)
+    return false;
+
+  // Read in full and checked before anything changes: the cartridge is the
+  // first section, so rejecting it leaves the whole machine as it was
+  struct {
+    int romBank, ramBank;
+    bool ramEnabled;
+    int bankingMode, romBankHigh;
+    uint8_t rtcRegisters[5];
+    bool rtcLatch;
+  } saved;
+  in.get(saved.romBank);
+  in.get(saved.ramBank);
+  in.get(saved.ramEnabled);
+  in.get(saved.bankingMode);
+  in.get(saved.romBankHigh);
+  in.get(saved.rtcRegisters);
+  in.get(saved.rtcLatch);
+  if (in.get<uint32_t>() != ram.size() || !in.ok())
+    return false;
+
+  romBank = saved.romBank;
+  ramBank = saved.ramBank;
+  ramEnabled = saved.ramEnabled;
+  bankingMode = saved.bankingMode;
+  romBankHigh = saved.romBankHigh;
+  std::memcpy(rtcRegisters, saved.rtcRegisters, sizeof(rtcRegisters));
+  rtcLatch = saved.rtcLatch;
+  ram.loadState(in);
+  updateBanks();
+  return in.ok();
 }
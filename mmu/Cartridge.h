@@ -1,25 +1,83 @@
 #pragma once
+#include "PagedRam.h"
+#include "RomImage.h"
+#include "Symbols.h"
+#include <memory>
 #include <cstdint>
 #include <string>
 #include <vector>
 
+class StateWriter;
+class StateReader;
+
 class Cartridge {
 public:
   Cartridge();
   ~Cartridge();
 
+  // Also picks up an RGBDS .sym file next to the ROM (same name, .sym
+  // extension) if there is one. The ROM itself is shared with any other
+  // Cartridge that has the same file loaded (see RomImage). On failure,
+  // loadError() says why.
   bool loadRom(const std::string &filepath);
+  // Same, from an image already open (no symbols)
+  void loadRom(std::shared_ptr<const RomImage> rom);
+  const std::shared_ptr<const RomImage> &romImage() const { return image; }
+  const std::string &loadError() const { return error; }
+  const SymbolTable &symbols() const { return symbolTable; }
+
+  // Memory Bank Controller logic. Each MBC has its own read/write handlers,
+  // picked once by loadRom(), so accesses never branch on the MBC type.
+  uint8_t read(uint16_t address) const { return (this->*readHandler)(address); }
+  void write(uint16_t address, uint8_t value) {
+    (this->*writeHandler)(address, value);
+  }
+
+  // Host memory backing the 256-byte page at `address` under the current
+  // banking state, for the Bus page table. nullptr means the page has to go
+  // through read()/write() (unmapped, RAM disabled, RTC registers, ...).
+  // Cartridge RAM pages still shared with another machine (see
+  // PagedRam::borrow()) have no write page until their first write.
+  const uint8_t *romPage(uint16_t address) const;
+  const uint8_t *ramReadPage(uint16_t address) const;
+  uint8_t *ramWritePage(uint16_t address);
+
+  // Battery-backed RAM, sized by the header
+  PagedRam &ramPages() { return ram; }
+  const PagedRam &ramPages() const { return ram; }
+
+  // Bank currently mapped at 0x4000-0x7FFF.
+  int currentRomBank() const { return mappedRomBank; }
+
+  // Header fields identifying the game
+  std::string title() const;
+  uint8_t headerChecksum() const;
 
-  // Abstracted away Memory Bank Controller logic
-  uint8_t read(uint16_t address) const;
-  void write(uint16_t address, uint8_t value);
+  // Snapshot support, see SaveState.h: banking, RAM and RTC. Loading fails
+  // for a snapshot taken with a different ROM.
+  void saveState(StateWriter &out) const;
+  bool loadState(StateReader &in);
 
 private:
-  std::vector<uint8_t> rom;
-  std::vector<uint8_t> ram;
-  int mbcType = 0; // 0: None, 1: MBC1, 2: MBC2, 3: MBC3, etc.
+  enum class Mbc : uint8_t { None, Mbc1, Mbc2, Mbc3, Mbc5 };
 
-  // Banking state
+  std::shared_ptr<const RomImage> image;
+  const uint8_t *rom = nullptr; // image->data(): whole 16KB banks, at least two
+  PagedRam ram; // Whole 8KB banks (MBC2: 512 nibbles)
+  SymbolTable symbolTable;
+  std::string error;
+  Mbc mbc = Mbc::None;
+
+  using ReadHandler = uint8_t (Cartridge::*)(uint16_t address) const;
+  using WriteHandler = void (Cartridge::*)(uint16_t address, uint8_t value);
+  ReadHandler readHandler = &Cartridge::readAs<Mbc::None>;
+  WriteHandler writeHandler = &Cartridge::writeAs<Mbc::None>;
+
+  template <Mbc M> uint8_t readAs(uint16_t address) const;
+  template <Mbc M> void writeAs(uint16_t address, uint8_t value);
+  template <Mbc M> void writeControl(uint16_t address, uint8_t value);
+
+  // Banking state, as written by the game
   int romBank = 1;
   int ramBank = 0;
   bool ramEnabled = false;
@@ -27,9 +85,21 @@ private:
 
   // MBC3 RTC
   uint8_t rtcRegisters[5] = {0}; // S, M, H, DL, DH
-  int rtcMappedBank = 0;
   bool rtcLatch = false;
 
   // MBC5
   int romBankHigh = 0;
+
+  // Where that state points, recomputed by updateBanks() after every
+  // control register write. Bank numbers are wrapped with a power-of-two
+  // mask here rather than per access.
+  int romBanks = 2;
+  int romBankMask = 1;
+  int ramBankMask = 0;
+  int mappedRomBank = 1;
+  const uint8_t *romx = nullptr; // 0x4000-0x7FFF
+  bool sramMapped = false;       // 0xA000-0xBFFF is plain RAM...
+  size_t sramBase = 0;           // ...at this offset into ram
+
+  void updateBanks();
 };
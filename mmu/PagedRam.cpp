@@ -0,0 +1,79 @@
+#include "PagedRam.h"
+#include "core/SaveState.h"
+#include <algorithm>
+#include <cstring>
+
+void PagedRam::resize(size_t size) {
+  size_t count = (size + PAGE_SIZE - 1) / PAGE_SIZE;
+  // Zeroed; nothing at all for RAM the cartridge doesn't have
+  home = count ? std::make_unique<uint8_t[]>(count * PAGE_SIZE) : nullptr;
+  copies.clear();
+  image.reset();
+  pages.resize(count);
+  owned.resize(count);
+  for (size_t i = 0; i < count; i++)
+    pages[i] = owned[i] = home.get() + i * PAGE_SIZE;
+}
+
+std::shared_ptr<const PagedRam::Image> PagedRam::freeze() const {
+  auto frozen = std::make_shared<Image>();
+  frozen->bytes.resize(size());
+  for (size_t i = 0; i < pages.size(); i++)
+    std::memcpy(frozen->bytes.data() + i * PAGE_SIZE, pages[i], PAGE_SIZE);
+  return frozen;
+}
+
+void PagedRam::borrow(std::shared_ptr<const Image> source) {
+  home.reset();
+  copies.clear();
+  image = std::move(source);
+  owned.assign(pages.size(), nullptr);
+  for (size_t i = 0; i < pages.size(); i++)
+    pages[i] = image->bytes.data() + i * PAGE_SIZE;
+}
+
+const uint8_t *PagedRam::data() const {
+  // Borrowed pages belong to the frozen image, not to this RAM
+  return image ? nullptr : home.get();
+}
+
+size_t PagedRam::ownedPages() const {
+  return pages.size() - std::count(owned.begin(), owned.end(), nullptr);
+}
+
+void PagedRam::copyPage(size_t page) {
+  auto copy = std::make_unique<uint8_t[]>(PAGE_SIZE);
+  std::memcpy(copy.get(), pages[page], PAGE_SIZE);
+  pages[page] = owned[page] = copy.get();
+  copies.push_back(std::move(copy));
+}
+
+size_t PagedRam::contiguousPages(size_t first) const {
+  size_t count = 1;
+  while (first + count < pages.size() &&
+         pages[first + count] == pages[first] + count * PAGE_SIZE)
+    count++;
+  return count;
+}
+
+void PagedRam::saveState(StateWriter &out) const {
+  if (!out.withRam())
+    return;
+  for (size_t i = 0; i < pages.size();) {
+    size_t count = contiguousPages(i);
+    out.bytes(pages[i], count * PAGE_SIZE);
+    i += count;
+  }
+}
+
+void PagedRam::loadState(StateReader &in) {
+  if (!in.withRam())
+    return;
+  for (size_t i = 0; i < pages.size(); i++)
+    writablePage(i);
+  for (size_t i = 0; i < pages.size();) {
+    size_t count = contiguousPages(i);
+    in.bytes(owned[i], count * PAGE_SIZE);
+    i += count;
+  }
+}
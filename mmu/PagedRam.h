@@ -0,0 +1,72 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+class StateWriter;
+class StateReader;
+
+// Guest RAM held as 256-byte pages, the granularity of the Bus page table,
+// so forked machines (see core/Fork.h) can share the pages neither has written.
+// A page is either owned, and written in place, or borrowed from a frozen
+// Image and copied on its first write.
+class PagedRam {
+public:
+  static constexpr size_t PAGE_SIZE = 0x100;
+
+  // Frozen contents, shareable between any number of PagedRams
+  struct Image {
+    std::vector<uint8_t> bytes;
+  };
+
+  explicit PagedRam(size_t size = 0) { resize(size); }
+
+  // Zeroed and owned, rounded up to whole pages.
+  void resize(size_t size);
+  size_t size() const { return pages.size() * PAGE_SIZE; }
+
+  uint8_t read(size_t offset) const {
+    return pages[offset / PAGE_SIZE][offset % PAGE_SIZE];
+  }
+  void write(size_t offset, uint8_t value) {
+    writablePage(offset / PAGE_SIZE)[offset % PAGE_SIZE] = value;
+  }
+
+  const uint8_t *readPage(size_t page) const { return pages[page]; }
+  // All of it as one block while every page is still where resize() put
+  // it; nullptr from the first borrow() until the next resize(), even once
+  // every page has been copied on write.
+  const uint8_t *data() const;
+  // nullptr while the page is borrowed
+  uint8_t *ownedPage(size_t page) { return owned[page]; }
+  uint8_t *writablePage(size_t page) {
+    if (!owned[page])
+      copyPage(page);
+    return owned[page];
+  }
+
+  std::shared_ptr<const Image> freeze() const;
+  // Borrow every page from `image`, which must be the same size. Memory
+  // use then grows a page at a time as pages are written.
+  void borrow(std::shared_ptr<const Image> image);
+  // Pages written since the last borrow(), or all of them
+  size_t ownedPages() const;
+
+  // Raw contents for save states, unless they are taken without RAM;
+  // loading takes ownership of every page.
+  void saveState(StateWriter &out) const;
+  void loadState(StateReader &in);
+
+private:
+  std::vector<const uint8_t *> pages;
+  std::vector<uint8_t *> owned; // Same as pages, or nullptr while borrowed
+  std::unique_ptr<uint8_t[]> home; // Contiguous owned pages after resize()
+  std::vector<std::unique_ptr<uint8_t[]>> copies; // Pages copied on write
+  std::shared_ptr<const Image> image;
+
+  void copyPage(size_t page);
+  // Pages from `first` on that follow each other in memory
+  size_t contiguousPages(size_t first) const;
+};
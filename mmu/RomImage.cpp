@@ -0,0 +1,198 @@
+#include "RomImage.h"
+#include <algorithm>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <tuple>
+
+#if !defined(_WIN32)
+#define SHELLBOY_MMAP 1
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+constexpr size_t BANK = 0x4000;
+constexpr size_t HEADER_END = 0x150;
+constexpr size_t MAX_SIZE = 512 * BANK; // MBC5's 9-bit bank number
+
+// Canonical path, size, modification time, device and inode
+using Key = std::tuple<std::string, uintmax_t, int64_t, uint64_t, uint64_t>;
+
+std::mutex cacheMutex;
+std::map<Key, std::weak_ptr<const RomImage>> cache;
+
+// ROM only and ROM+RAM, then MBC1, MBC2, MBC3 and MBC5 with their RAM,
+// battery and timer variants: the types Cartridge emulates
+bool supportedType(uint8_t type) {
+  return type <= 0x03 || type == 0x05 || type == 0x06 || type == 0x08 ||
+         type == 0x09 || (type >= 0x0F && type <= 0x13) ||
+         (type >= 0x19 && type <= 0x1E);
+}
+
+// Banks declared by header byte 0x148, or 0 for a code no cartridge uses
+size_t declaredBanks(uint8_t code) {
+  if (code <= 0x08)
+    return size_t(2) << code;
+  switch (code) {
+  case 0x52:
+    return 72;
+  case 0x53:
+    return 80;
+  case 0x54:
+    return 96;
+  }
+  return 0;
+}
+
+#ifdef SHELLBOY_MMAP
+// Closes the descriptor on every way out of open()
+struct File {
+  int fd;
+  ~File() {
+    if (fd >= 0)
+      ::close(fd);
+  }
+};
+#endif
+
+} // namespace
+
+RomImage::~RomImage() {
+#ifdef SHELLBOY_MMAP
+  if (mapping)
+    munmap(mapping, length);
+#endif
+}
+
+bool RomImage::validate(size_t fileSize, std::string &error) {
+  if (fileSize < HEADER_END) {
+    error = "file too small for a cartridge header (" +
+            std::to_string(fileSize) + " bytes)";
+    return false;
+  }
+  if (fileSize > MAX_SIZE) {
+    error = "file larger than any cartridge can address (" +
+            std::to_string(fileSize) + " bytes)";
+    return false;
+  }
+  return true;
+}
+
+bool RomImage::checkHeader(std::string &error) const {
+  char message[80];
+  if (!supportedType(cartridgeType())) {
+    std::snprintf(message, sizeof(message),
+                  "unsupported cartridge type 0x%02X", cartridgeType());
+    error = message;
+    return false;
+  }
+  if (declaredBanks(romSizeCode()) != static_cast<size_t>(banks())) {
+    std::snprintf(message, sizeof(message),
+                  "header ROM size code 0x%02X does not match %d banks",
+                  romSizeCode(), banks());
+    error = message;
+    return false;
+  }
+  return true;
+}
+
+void RomImage::pad(std::vector<uint8_t> &&contents) {
+  // Whole banks only, and at least ROM0 plus one switchable bank, so every
+  // mapped address is backed
+  size_t banks = std::max<size_t>(2, (contents.size() + BANK - 1) / BANK);
+  buffer = std::move(contents);
+  buffer.resize(banks * BANK, 0xFF);
+  bytes = buffer.data();
+  length = buffer.size();
+}
+
+std::shared_ptr<const RomImage> RomImage::open(const std::string &path,
+                                               std::string &error) {
+  std::error_code ec;
+  std::filesystem::path canonical = std::filesystem::canonical(path, ec);
+  uintmax_t fileSize = ec ? 0 : std::filesystem::file_size(canonical, ec);
+  auto modified = ec ? std::filesystem::file_time_type()
+                     : std::filesystem::last_write_time(canonical, ec);
+  if (ec) {
+    error = ec.message();
+    return nullptr;
+  }
+  uint64_t device = 0, inode = 0;
+
+#ifdef SHELLBOY_MMAP
+  // Size and identity come from the descriptor that gets mapped, so a file
+  // replaced under the same name and timestamp is not mistaken for the one
+  // already loaded
+  File file{::open(canonical.c_str(), O_RDONLY)};
+  struct stat info;
+  if (file.fd < 0 || fstat(file.fd, &info) != 0) {
+    error = "cannot open " + canonical.string();
+    return nullptr;
+  }
+  fileSize = static_cast<uintmax_t>(info.st_size);
+  device = static_cast<uint64_t>(info.st_dev);
+  inode = static_cast<uint64_t>(info.st_ino);
+#endif
+
+  Key key{canonical.string(), fileSize, modified.time_since_epoch().count(),
+          device, inode};
+
+  std::lock_guard<std::mutex> lock(cacheMutex);
+  if (auto it = cache.find(key); it != cache.end()) {
+    if (auto shared = it->second.lock())
+      return shared;
+  }
+
+  std::shared_ptr<RomImage> image(new RomImage());
+  if (!image->validate(fileSize, error))
+    return nullptr;
+
+#ifdef SHELLBOY_MMAP
+  // Bank-sized files map as they are; others need padding the file can't
+  // provide
+  if (fileSize % BANK == 0 && fileSize >= 2 * BANK) {
+    void *memory =
+        mmap(nullptr, fileSize, PROT_READ, MAP_PRIVATE, file.fd, 0);
+    if (memory != MAP_FAILED) {
+      image->mapping = memory;
+      image->bytes = static_cast<const uint8_t *>(memory);
+      image->length = fileSize;
+    }
+  }
+#endif
+
+  if (!image->mapping) {
+    std::ifstream stream(canonical, std::ios::binary);
+    std::vector<uint8_t> contents(fileSize);
+    if (!stream.read(reinterpret_cast<char *>(contents.data()), fileSize)) {
+      error = "read failed";
+      return nullptr;
+    }
+    image->pad(std::move(contents));
+  }
+  if (!image->checkHeader(error))
+    return nullptr;
+
+  // Drop entries whose images have been released
+  for (auto it = cache.begin(); it != cache.end();)
+    it = it->second.expired() ? cache.erase(it) : std::next(it);
+  cache[key] = image;
+  return image;
+}
+
+std::shared_ptr<const RomImage>
+RomImage::fromMemory(const uint8_t *data, size_t size, std::string &error) {
+  std::shared_ptr<RomImage> image(new RomImage());
+  if (!image->validate(size, error))
+    return nullptr;
+  image->pad(std::vector<uint8_t>(data, data + size));
+  if (!image->checkHeader(error))
+    return nullptr;
+  return image;
+}
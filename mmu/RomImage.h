@@ -0,0 +1,54 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Read-only ROM contents, shared by every Cartridge in the process that
+// loads the same file. Images are mapped straight from the file where the
+// platform allows it and the file is already a whole number of 16KB banks;
+// anything else is read into memory and padded with 0xFF.
+//
+// A mapped file must not be truncated or rewritten while it is loaded.
+class RomImage {
+public:
+  // Returns the already-open image if the file (same canonical path, size,
+  // modification time, device and inode) is still loaded somewhere, else
+  // opens it.
+  // nullptr, with a message in `error`, if it can't be read, is too small
+  // to hold a cartridge header, names a cartridge type Cartridge can't
+  // emulate or is not the size its header declares.
+  static std::shared_ptr<const RomImage> open(const std::string &path,
+                                              std::string &error);
+  // Copies `size` bytes, with the same checks; never shared.
+  static std::shared_ptr<const RomImage> fromMemory(const uint8_t *data,
+                                                    size_t size,
+                                                    std::string &error);
+
+  RomImage(const RomImage &) = delete;
+  RomImage &operator=(const RomImage &) = delete;
+  ~RomImage();
+
+  // At least two 16KB banks
+  const uint8_t *data() const { return bytes; }
+  size_t size() const { return length; }
+  int banks() const { return static_cast<int>(length / 0x4000); }
+  bool mapped() const { return mapping != nullptr; }
+
+  // Header bytes 0x147-0x149
+  uint8_t cartridgeType() const { return bytes[0x147]; }
+  uint8_t romSizeCode() const { return bytes[0x148]; }
+  uint8_t ramSizeCode() const { return bytes[0x149]; }
+
+private:
+  RomImage() = default;
+  bool validate(size_t fileSize, std::string &error);
+  bool checkHeader(std::string &error) const;
+  void pad(std::vector<uint8_t> &&contents);
+
+  const uint8_t *bytes = nullptr;
+  size_t length = 0;
+  void *mapping = nullptr; // Owned when mapped, else `buffer` holds the data
+  std::vector<uint8_t> buffer;
+};
@@ -0,0 +1,72 @@
+#include "Symbols.h"
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+
+// Labels only cover addresses in their own region
+static int region(uint16_t address) {
+  if (address < 0x4000)
+    return 0; // ROM0
+  if (address < 0x8000)
+    return 1; // ROMX
+  if (address < 0xA000)
+    return 2; // VRAM
+  if (address < 0xC000)
+    return 3; // SRAM
+  if (address < 0xD000)
+    return 4; // WRAM0
+  if (address < 0xE000)
+    return 5; // WRAMX
+  if (address < 0xFF80)
+    return 6; // Echo, OAM, I/O
+  return 7;   // HRAM
+}
+
+bool SymbolTable::load(const std::string &path) {
+  std::ifstream file(path);
+  if (!file.is_open())
+    return false;
+
+  symbols.clear();
+  std::string line;
+  while (std::getline(file, line)) {
+    line = line.substr(0, line.find(';'));
+    size_t colon = line.find(':');
+    size_t space = line.find_first_of(" \t", colon);
+    if (colon == std::string::npos || space == std::string::npos)
+      continue;
+
+    char *end = nullptr;
+    unsigned long bank = std::strtoul(line.c_str(), &end, 16);
+    if (end != line.c_str() + colon || bank > 0xFFFF)
+      continue;
+    unsigned long address = std::strtoul(line.c_str() + colon + 1, &end, 16);
+    if (end != line.c_str() + space || address > 0xFFFF)
+      continue;
+
+    size_t first = line.find_first_not_of(" \t", space);
+    size_t last = line.find_last_not_of(" \t\r");
+    if (first == std::string::npos)
+      continue;
+    symbols.push_back({static_cast<uint32_t>(bank << 16 | address),
+                       line.substr(first, last - first + 1)});
+  }
+  std::stable_sort(
+      symbols.begin(), symbols.end(),
+      [](const Symbol &a, const Symbol &b) { return a.key < b.key; });
+  return true;
+}
+
+const std::string *SymbolTable::lookup(int bank, uint16_t address) const {
+  uint32_t key = static_cast<uint32_t>(bank) << 16 | address;
+  auto it = std::upper_bound(
+      symbols.begin(), symbols.end(), key,
+      [](uint32_t k, const Symbol &symbol) { return k < symbol.key; });
+  if (it == symbols.begin())
+    return nullptr;
+  --it;
+  if (it->key >> 16 != static_cast<uint32_t>(bank) ||
+      region(it->key & 0xFFFF) != region(address))
+    return nullptr;
+  return &it->name;
+}
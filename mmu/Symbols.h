@@ -0,0 +1,27 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Labels from an RGBDS .sym file: one "BB:AAAA Name" per line, ';' starts a
+// comment. Banks are per memory region (ROMX bank, WRAMX bank, ...).
+class SymbolTable {
+public:
+  // Replaces the current labels. Returns false if the file can't be opened;
+  // malformed lines are skipped.
+  bool load(const std::string &path);
+  void clear() { symbols.clear(); }
+  bool empty() const { return symbols.empty(); }
+  size_t size() const { return symbols.size(); }
+
+  // The closest label at or below `address` in the same bank and memory
+  // region, or nullptr.
+  const std::string *lookup(int bank, uint16_t address) const;
+
+private:
+  struct Symbol {
+    uint32_t key; // bank << 16 | address
+    std::string name;
+  };
+  std::vector<Symbol> symbols; // Sorted by key
+};
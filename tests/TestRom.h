@@ -0,0 +1,48 @@
+#pragma once
+
+#include "mmu/RomImage.h"
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+
+// The small cartridges tests and benchmarks run: `banks` 16KB banks of
+// zeros, ROM only unless the header is changed, with `main` at MAIN, a JP
+// MAIN at the entry point and the ROM size code to match `banks`. Interrupt
+// handlers and other routines go in with place().
+struct TestRom {
+  static constexpr uint16_t MAIN = 0x0150;
+
+  std::vector<uint8_t> bytes;
+
+  explicit TestRom(const std::vector<uint8_t> &main, size_t banks = 2)
+      : bytes(banks * 0x4000) {
+    while ((size_t(2) << bytes[0x148]) < banks)
+      bytes[0x148]++;
+    place(0x0100, {0xC3, MAIN & 0xFF, MAIN >> 8});
+    place(MAIN, main);
+  }
+
+  TestRom &place(uint16_t address, const std::vector<uint8_t> &code) {
+    std::copy(code.begin(), code.end(), bytes.begin() + address);
+    return *this;
+  }
+
+  std::shared_ptr<const RomImage> image() const {
+    std::string error;
+    return RomImage::fromMemory(bytes.data(), bytes.size(), error);
+  }
+
+  // Saved as `name` in the temporary directory; returns the path
+  std::string write(const std::string &name) const {
+    std::string path =
+        (std::filesystem::temp_directory_path() / name).string();
+    std::ofstream(path, std::ios::binary)
+        .write(reinterpret_cast<const char *>(bytes.data()), bytes.size());
+    return path;
+  }
+};
@@ -0,0 +1,44 @@
+#include "core/Bus.h"
+#include "core/PPU.h"
+#include <gtest/gtest.h>
+
+class BusTest : public ::testing::Test {
+protected:
+  Bus bus;
+  PPU ppu{bus};
+
+  void SetUp() override { bus.setPPU(&ppu); }
+};
+
+TEST_F(BusTest, EchoRamMirrorsWram) {
+  bus.write(0xC123, 0x42);
+  EXPECT_EQ(bus.read(0xE123), 0x42);
+  bus.write(0xFDFF, 0x99);
+  EXPECT_EQ(bus.read(0xDDFF), 0x99);
+}
+
+TEST_F(BusTest, HramAndIoRoundTrip) {
+  bus.write(0xFF80, 0x12);
+  EXPECT_EQ(bus.read(0xFF80), 0x12);
+  bus.write(0xFFFF, 0x1F); // IE
+  EXPECT_EQ(bus.read(0xFFFF), 0x1F);
+  bus.write(0xFF42, 0x34); // SCY lives in the PPU
+  EXPECT_EQ(bus.read(0xFF42), 0x34);
+}
+
+TEST_F(BusTest, VramLockedDuringPixelTransfer) {
+  bus.write(0x8000, 0x55);
+  EXPECT_EQ(bus.read(0x8000), 0x55);
+
+  bus.write(0xFF41, 0x03); // Force mode 3
+  EXPECT_EQ(bus.read(0x8000), 0xFF);
+  bus.write(0x8000, 0xAA);
+
+  bus.write(0xFF41, 0x00); // Back to H-Blank
+  EXPECT_EQ(bus.read(0x8000), 0x55);
+}
+
+TEST_F(BusTest, RomWritesWithoutCartridgeAreDropped) {
+  bus.write(0x0100, 0x12);
+  EXPECT_EQ(bus.read(0x0100), 0x00);
+}
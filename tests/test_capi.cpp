@@ -0,0 +1,125 @@
+#include "capi/shellboy.h"
+#include "tests/TestRom.h"
+#include <cstring>
+#include <gtest/gtest.h>
+#include <string>
+#include <vector>
+
+namespace {
+
+// ROM-only cartridge that selects the action buttons, then keeps counting
+// in C000 and copying the joypad register to C001, with the LCD on.
+std::vector<uint8_t> makeRom() {
+  return TestRom({
+      0x31, 0xFE, 0xFF, // LD SP, FFFE
+      0x3E, 0x91,       // LD A, 91
+      0xE0, 0x40,       // LDH (LCDC), A
+      0x3E, 0x10,       // LD A, 10
+      0xE0, 0x00,       // LDH (P1), A
+      0xFA, 0x00, 0xC0, // loop: LD A, (C000)
+      0x3C,             // INC A
+      0xEA, 0x00, 0xC0, // LD (C000), A
+      0xF0, 0x00,       // LDH A, (P1)
+      0xEA, 0x01, 0xC0, // LD (C001), A
+      0x18, 0xF2,       // JR loop
+  }).bytes;
+}
+
+struct Handle {
+  shellboy *gb = shellboy_create();
+  ~Handle() { shellboy_destroy(gb); }
+};
+
+} // namespace
+
+TEST(CApiTest, RunsARomWithWramReadInPlace) {
+  ASSERT_EQ(shellboy_abi_version(), uint32_t(SHELLBOY_ABI_VERSION));
+  Handle handle;
+  shellboy *gb = handle.gb;
+  ASSERT_NE(gb, nullptr);
+  EXPECT_EQ(shellboy_run_frames(gb, 1), -1);
+  EXPECT_STREQ(shellboy_error(gb), "no ROM loaded");
+  EXPECT_EQ(shellboy_wram(gb), nullptr);
+  EXPECT_EQ(shellboy_frame_buffer(gb), nullptr);
+
+  std::vector<uint8_t> rom = makeRom();
+  ASSERT_EQ(shellboy_load_rom_memory(gb, rom.data(), rom.size()), 0);
+  EXPECT_STREQ(shellboy_error(gb), "");
+  const uint8_t *wram = shellboy_wram(gb);
+  ASSERT_NE(wram, nullptr);
+  ASSERT_NE(shellboy_frame_buffer(gb), nullptr);
+
+  ASSERT_EQ(shellboy_run_frames(gb, 2), 0);
+  uint8_t count = wram[0];
+  ASSERT_EQ(shellboy_run_frames(gb, 1), 0);
+  EXPECT_EQ(shellboy_wram(gb), wram); // Same memory, updated in place
+  EXPECT_NE(wram[0], count);
+}
+
+TEST(CApiTest, ButtonsReachTheJoypadRegister) {
+  Handle handle;
+  std::vector<uint8_t> rom = makeRom();
+  ASSERT_EQ(shellboy_load_rom_memory(handle.gb, rom.data(), rom.size()), 0);
+  const uint8_t *wram = shellboy_wram(handle.gb);
+
+  shellboy_set_buttons(handle.gb, SHELLBOY_BUTTON_START | SHELLBOY_BUTTON_UP);
+  ASSERT_EQ(shellboy_run_frames(handle.gb, 1), 0);
+  EXPECT_EQ(wram[1] & 0x0F, 0x07); // Start only: directions not selected
+
+  shellboy_set_buttons(handle.gb, SHELLBOY_BUTTON_A);
+  ASSERT_EQ(shellboy_run_frames(handle.gb, 1), 0);
+  EXPECT_EQ(wram[1] & 0x0F, 0x0E);
+}
+
+TEST(CApiTest, StatesRoundTripThroughCallerBuffers) {
+  Handle handle;
+  shellboy *gb = handle.gb;
+  EXPECT_EQ(shellboy_save_state(gb, nullptr, 0), 0u);
+  std::vector<uint8_t> rom = makeRom();
+  ASSERT_EQ(shellboy_load_rom_memory(gb, rom.data(), rom.size()), 0);
+  ASSERT_EQ(shellboy_run_frames(gb, 3), 0);
+
+  size_t size = shellboy_save_state(gb, nullptr, 0);
+  ASSERT_GT(size, 0u);
+  std::vector<uint8_t> state(size);
+  EXPECT_EQ(shellboy_save_state(gb, state.data(), size - 1), size);
+  EXPECT_EQ(state[0], 0); // Too small: nothing written
+  ASSERT_EQ(shellboy_save_state(gb, state.data(), state.size()), size);
+
+  ASSERT_EQ(shellboy_run_frames(gb, 5), 0);
+  const uint8_t *wram = shellboy_wram(gb);
+  std::vector<uint8_t> expected(wram, wram + SHELLBOY_WRAM_SIZE);
+  const uint8_t *frame = shellboy_frame_buffer(gb);
+  std::vector<uint8_t> expectedFrame(
+      frame, frame + SHELLBOY_SCREEN_WIDTH * SHELLBOY_SCREEN_HEIGHT);
+
+  ASSERT_EQ(shellboy_load_state(gb, state.data(), state.size()), 0);
+  ASSERT_EQ(shellboy_run_frames(gb, 5), 0);
+  EXPECT_EQ(std::memcmp(wram, expected.data(), expected.size()), 0);
+  EXPECT_EQ(std::memcmp(frame, expectedFrame.data(), expectedFrame.size()),
+            0);
+
+  state[4] ^= 0xFF; // Version
+  EXPECT_EQ(shellboy_load_state(gb, state.data(), state.size()), -1);
+  EXPECT_STRNE(shellboy_error(gb), "");
+}
+
+TEST(CApiTest, FailedLoadsKeepTheRunningMachine) {
+  Handle handle;
+  shellboy *gb = handle.gb;
+  std::vector<uint8_t> rom = makeRom();
+  ASSERT_EQ(shellboy_load_rom_memory(gb, rom.data(), rom.size()), 0);
+  ASSERT_EQ(shellboy_run_frames(gb, 1), 0);
+  const uint8_t *wram = shellboy_wram(gb);
+  uint8_t count = wram[0];
+
+  EXPECT_EQ(shellboy_load_rom_memory(gb, rom.data(), 0x100), -1);
+  EXPECT_STRNE(shellboy_error(gb), "");
+  std::string missing = ::testing::TempDir() + "shellboy_missing.gb";
+  EXPECT_EQ(shellboy_load_rom_file(gb, missing.c_str()), -1);
+  EXPECT_NE(std::string(shellboy_error(gb)).find(missing), std::string::npos);
+
+  EXPECT_EQ(shellboy_wram(gb), wram);
+  EXPECT_EQ(wram[0], count);
+  EXPECT_EQ(shellboy_run_frames(gb, 1), 0);
+}
@@ -0,0 +1,181 @@
+#include "mmu/Cartridge.h"
+#include "tests/TestRom.h"
+#include <filesystem>
+#include <gtest/gtest.h>
+#include <vector>
+
+// ROM images where every byte of bank N reads N, apart from the header.
+class CartridgeTest : public ::testing::Test {
+protected:
+  Cartridge cart;
+
+  static TestRom rom(uint8_t type, int banks, uint8_t ramSize = 0) {
+    TestRom rom({}, banks);
+    for (size_t i = 0x4000; i < rom.bytes.size(); i++)
+      rom.bytes[i] = static_cast<uint8_t>(i / 0x4000);
+    rom.bytes[0x147] = type;
+    rom.bytes[0x149] = ramSize;
+    return rom;
+  }
+
+  void load(const TestRom &rom) {
+    auto image = rom.image();
+    ASSERT_NE(image, nullptr);
+    cart.loadRom(image);
+  }
+  void load(uint8_t type, int banks, uint8_t ramSize = 0) {
+    load(rom(type, banks, ramSize));
+  }
+};
+
+TEST_F(CartridgeTest, Mbc5BanksAcrossTwoMegabytes) {
+  load(0x19, 128);
+  for (int bank = 0; bank < 128; bank++) {
+    cart.write(0x2000, bank);
+    EXPECT_EQ(cart.read(0x4000), bank);
+    EXPECT_EQ(cart.read(0x7FFF), bank);
+    EXPECT_EQ(cart.romPage(0x7F00)[0xFF], bank);
+    EXPECT_EQ(cart.currentRomBank(), bank);
+  }
+  cart.write(0x3000, 0x01); // Bank 0x105 wraps to 5
+  cart.write(0x2000, 0x05);
+  EXPECT_EQ(cart.read(0x4000), 5);
+  EXPECT_EQ(cart.read(0x0000), 0);
+}
+
+TEST_F(CartridgeTest, Mbc1SkipsBankZeroAndUsesUpperBits) {
+  load(0x01, 64);
+  EXPECT_EQ(cart.read(0x4000), 1);
+  cart.write(0x2000, 0x00);
+  EXPECT_EQ(cart.read(0x4000), 1);
+  cart.write(0x4000, 0x01);
+  cart.write(0x2000, 0x02);
+  EXPECT_EQ(cart.read(0x4000), 34);
+}
+
+TEST_F(CartridgeTest, ImageThatIsNotAPowerOfTwoWraps) {
+  TestRom banks72 = rom(0x19, 72);
+  banks72.bytes[0x148] = 0x52; // 72 banks
+  load(banks72);
+  cart.write(0x2000, 71);
+  EXPECT_EQ(cart.read(0x4000), 71);
+  cart.write(0x2000, 72);
+  EXPECT_EQ(cart.read(0x4000), 0);
+  cart.write(0x2000, 0x85); // Masked to 5
+  EXPECT_EQ(cart.read(0x4000), 5);
+}
+
+TEST_F(CartridgeTest, RamNeedsEnablingAndBanks) {
+  load(0x1B, 4, 0x03); // MBC5, 32KB RAM
+  cart.write(0xA000, 0x12);
+  EXPECT_EQ(cart.read(0xA000), 0xFF);
+  EXPECT_EQ(cart.ramReadPage(0xA000), nullptr);
+
+  cart.write(0x0000, 0x0A);
+  cart.write(0x4000, 0x02);
+  cart.write(0xA000, 0x12);
+  EXPECT_EQ(cart.read(0xA000), 0x12);
+  EXPECT_EQ(cart.ramReadPage(0xA000)[0], 0x12);
+  cart.write(0x4000, 0x01);
+  EXPECT_EQ(cart.read(0xA000), 0x00);
+  cart.write(0x4000, 0x06); // Masked to bank 2
+  EXPECT_EQ(cart.read(0xA000), 0x12);
+}
+
+TEST_F(CartridgeTest, Mbc2HasNibbleRamAndAddressSelectedRegisters) {
+  load(0x06, 16);
+  cart.write(0x2100, 0x07); // Bit 8 set: ROM bank
+  EXPECT_EQ(cart.read(0x4000), 7);
+  cart.write(0x0000, 0x0A); // Bit 8 clear: RAM enable
+  cart.write(0xA123, 0xAB);
+  EXPECT_EQ(cart.read(0xA123), 0xFB);
+  EXPECT_EQ(cart.read(0xA323), 0xFB); // 512 bytes, mirrored
+  EXPECT_EQ(cart.ramReadPage(0xA100), nullptr);
+}
+
+TEST_F(CartridgeTest, Mbc3MapsRtcRegistersOverRam) {
+  load(0x10, 8, 0x03);
+  cart.write(0x0000, 0x0A);
+  cart.write(0xA000, 0x34);
+  cart.write(0x4000, 0x08); // RTC seconds
+  EXPECT_EQ(cart.ramReadPage(0xA000), nullptr);
+  cart.write(0xA000, 42);
+  EXPECT_EQ(cart.read(0xA000), 42);
+  cart.write(0x4000, 0x00);
+  EXPECT_EQ(cart.read(0xA000), 0x34);
+}
+
+TEST_F(CartridgeTest, CartridgesLoadingTheSameFileShareTheImage) {
+  std::string path = rom(0x19, 64).write("shellboy_cartridge_shared.gb");
+  Cartridge other;
+  ASSERT_TRUE(cart.loadRom(path));
+  ASSERT_TRUE(other.loadRom(path));
+  EXPECT_EQ(cart.romPage(0x0000), other.romPage(0x0000));
+
+  // Banking state stays per cartridge
+  cart.write(0x2000, 9);
+  other.write(0x2000, 40);
+  EXPECT_EQ(cart.read(0x4000), 9);
+  EXPECT_EQ(other.read(0x4000), 40);
+}
+
+TEST_F(CartridgeTest, FileReplacedUnderTheSameNameAndTimeIsReloaded) {
+  TestRom original = rom(0x19, 4), replacement = rom(0x19, 4);
+  replacement.bytes[0x0000] = 0x77;
+  std::string path = original.write("shellboy_cartridge_original.gb");
+  std::string other = replacement.write("shellboy_cartridge_replacement.gb");
+  std::filesystem::last_write_time(other,
+                                   std::filesystem::last_write_time(path));
+  ASSERT_TRUE(cart.loadRom(path));
+
+  // Renamed over the loaded file, which stays mapped under its old inode
+  std::filesystem::rename(other, path);
+  Cartridge replaced;
+  ASSERT_TRUE(replaced.loadRom(path));
+  EXPECT_EQ(cart.read(0x0000), 0);
+  EXPECT_EQ(replaced.read(0x0000), 0x77);
+}
+
+TEST_F(CartridgeTest, RejectsHeadersItCannotHonour) {
+  for (uint8_t type : {0x0B, 0x20, 0x22, 0xFE, 0xFF}) { // MMM01 to HuC1
+    std::string path = rom(type, 2).write("shellboy_cartridge_type.gb");
+    EXPECT_FALSE(cart.loadRom(path));
+    EXPECT_NE(cart.loadError().find("cartridge type"), std::string::npos);
+  }
+
+  TestRom oversized = rom(0x00, 4);
+  oversized.bytes[0x148] = 0x02; // 128KB
+  std::string error;
+  EXPECT_EQ(RomImage::fromMemory(oversized.bytes.data(),
+                                 oversized.bytes.size(), error),
+            nullptr);
+  EXPECT_NE(error.find("ROM size"), std::string::npos);
+  EXPECT_FALSE(cart.loadRom(oversized.write("shellboy_cartridge_size.gb")));
+  EXPECT_FALSE(cart.loadError().empty());
+}
+
+TEST_F(CartridgeTest, PadsPartialBanksWithFF) {
+  TestRom partial = rom(0x00, 2);
+  partial.bytes.resize(0x5000);
+  load(partial);
+  EXPECT_EQ(cart.read(0x4FFF), 1);
+  EXPECT_EQ(cart.read(0x5000), 0xFF);
+  EXPECT_EQ(cart.read(0x7FFF), 0xFF);
+}
+
+TEST_F(CartridgeTest, RejectsImagesWithoutAHeader) {
+  TestRom headerless = rom(0x00, 2);
+  headerless.bytes.resize(0x14F);
+  EXPECT_FALSE(cart.loadRom(headerless.write("shellboy_cartridge_short.gb")));
+  EXPECT_FALSE(cart.loadError().empty());
+  EXPECT_FALSE(cart.loadRom(::testing::TempDir() + "shellboy_missing.gb"));
+  EXPECT_FALSE(cart.loadError().empty());
+
+  std::string error;
+  uint8_t header[0x150] = {};
+  EXPECT_EQ(RomImage::fromMemory(header, 0x14F, error), nullptr);
+  auto image = RomImage::fromMemory(header, sizeof(header), error);
+  ASSERT_NE(image, nullptr);
+  EXPECT_EQ(image->size(), 0x8000u);
+  EXPECT_FALSE(image->mapped());
+}
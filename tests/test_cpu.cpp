@@ -26,3 +26,145 @@ TEST_F(CPUTest, NopInstruction) {
   EXPECT_EQ(cycles, 4);
   EXPECT_EQ(cpu.PC, 0x0101);
 }
+
+TEST_F(CPUTest, ImmediateOperandsAndAlu) {
+  // Code runs from WRAM: without a cartridge ROM writes are dropped.
+  const uint8_t program[] = {
+      0x3E, 0x0F, // LD A, 0x0F
+      0x06, 0x01, // LD B, 0x01
+      0x80,       // ADD A, B
+      0xCB, 0x37, // SWAP A
+  };
+  for (size_t i = 0; i < sizeof(program); i++)
+    bus.write(0xC000 + i, program[i]);
+  cpu.PC = 0xC000;
+
+  EXPECT_EQ(cpu.tick(), 8);
+  EXPECT_EQ(cpu.tick(), 8);
+  EXPECT_EQ(cpu.tick(), 4);
+  EXPECT_EQ(cpu.AF.hi, 0x10);
+  EXPECT_TRUE(cpu.getFlag(CPU::FLAG_H));
+  EXPECT_FALSE(cpu.getFlag(CPU::FLAG_C));
+  EXPECT_EQ(cpu.tick(), 8);
+  EXPECT_EQ(cpu.AF.hi, 0x01);
+  EXPECT_EQ(cpu.PC, 0xC000 + sizeof(program));
+}
+
+TEST_F(CPUTest, StoreStackPointerToImmediateAddress) {
+  bus.write(0xC000, 0x08); // LD (0xD000), SP
+  bus.write(0xC001, 0x00);
+  bus.write(0xC002, 0xD0);
+  cpu.PC = 0xC000;
+
+  EXPECT_EQ(cpu.tick(), 20);
+  EXPECT_EQ(cpu.PC, 0xC003);
+  EXPECT_EQ(bus.read16(0xD000), 0xFFFE);
+}
+
+TEST_F(CPUTest, LazyFlagsMaterialiseOnPushAF) {
+  const uint8_t program[] = {
+      0x3E, 0x10, // LD A, 0x10
+      0xFE, 0x20, // CP 0x20    -> N, C
+      0x3C,       // INC A      -> H from INC, C kept from CP
+      0xF5,       // PUSH AF
+  };
+  for (size_t i = 0; i < sizeof(program); i++)
+    bus.write(0xC000 + i, program[i]);
+  cpu.PC = 0xC000;
+  cpu.SP = 0xD000;
+
+  for (int i = 0; i < 4; i++)
+    cpu.tick();
+  EXPECT_EQ(bus.read16(0xCFFE), 0x1100 | CPU::FLAG_C);
+
+  cpu.syncFlags();
+  EXPECT_EQ(cpu.AF.lo, CPU::FLAG_C);
+}
+
+TEST_F(CPUTest, RunBlockExecutesStraightLineCode) {
+  const uint8_t program[] = {
+      0x06, 0x01,       // LD B, 0x01
+      0x04,             // INC B
+      0x0C,             // INC C
+      0xC3, 0x00, 0xC0, // JP 0xC000
+  };
+  for (size_t i = 0; i < sizeof(program); i++)
+    bus.write(0xC000 + i, program[i]);
+  cpu.PC = 0xC000;
+  cpu.BC.reg16 = 0;
+
+  EXPECT_EQ(cpu.runBlock(), 8 + 4 + 4 + 16);
+  EXPECT_EQ(cpu.PC, 0xC000);
+  EXPECT_EQ(cpu.BC.hi, 0x02);
+  EXPECT_EQ(cpu.BC.lo, 0x01);
+}
+
+TEST_F(CPUTest, RunBlockSeesSelfModifiedCode) {
+  const uint8_t program[] = {
+      0x04,             // INC B
+      0xC3, 0x00, 0xC0, // JP 0xC000
+  };
+  for (size_t i = 0; i < sizeof(program); i++)
+    bus.write(0xC000 + i, program[i]);
+  cpu.PC = 0xC000;
+  cpu.BC.reg16 = 0;
+
+  cpu.runBlock();
+  EXPECT_EQ(cpu.BC.hi, 0x01);
+
+  bus.write(0xC000, 0x0C); // INC C
+  cpu.runBlock();
+  EXPECT_EQ(cpu.BC.hi, 0x01);
+  EXPECT_EQ(cpu.BC.lo, 0x01);
+
+  bus.write(0xE000, 0x04); // INC B through the echo mirror
+  cpu.runBlock();
+  EXPECT_EQ(cpu.BC.hi, 0x02);
+}
+
+TEST_F(CPUTest, RunBlockSeesSelfModifiedHram) {
+  const uint8_t program[] = {
+      0x04,       // INC B
+      0x18, 0xFD, // JR 0xFF80
+  };
+  for (size_t i = 0; i < sizeof(program); i++)
+    bus.write(0xFF80 + i, program[i]);
+  cpu.PC = 0xFF80;
+  cpu.BC.reg16 = 0;
+
+  cpu.runBlock();
+  EXPECT_EQ(cpu.BC.hi, 0x01);
+
+  bus.write(0xFF80, 0x0C); // INC C
+  cpu.runBlock();
+  EXPECT_EQ(cpu.BC.hi, 0x01);
+  EXPECT_EQ(cpu.BC.lo, 0x01);
+}
+
+#ifdef SHELLBOY_OPCODE_STATS
+TEST_F(CPUTest, OpcodeStatsCountBlocksAndBranches) {
+  const uint8_t program[] = {
+      0x06, 0x03, // LD B, 3
+      0xCB, 0x37, // SWAP A
+      0x05,       // DEC B
+      0x20, 0xFB, // JR NZ, -5
+      0x76,       // HALT
+  };
+  for (size_t i = 0; i < sizeof(program); i++)
+    bus.write(0xC000 + i, program[i]);
+  cpu.PC = 0xC000;
+  cpu.tick(); // LD B, 3 through execute()
+  while (cpu.PC != 0xC008)
+    cpu.runBlock();
+
+  const OpcodeStats &stats = cpu.opcodeStats();
+  EXPECT_EQ(stats.base(0x06).count, 1u);
+  EXPECT_EQ(stats.cb(0x37).count, 3u);
+  EXPECT_EQ(stats.cb(0x37).cycles, 24u);
+  EXPECT_EQ(stats.base(0x05).count, 3u);
+  EXPECT_EQ(stats.base(0x20).count, 3u);
+  EXPECT_EQ(stats.base(0x20).taken, 2u);
+  EXPECT_EQ(stats.base(0x20).cycles, 12u + 12u + 8u);
+  EXPECT_EQ(stats.base(0x76).count, 1u);
+}
+#endif
@@ -0,0 +1,89 @@
+#include "core/GameBoy.h"
+#include "tests/TestRom.h"
+#include <gtest/gtest.h>
+#include <memory>
+#include <vector>
+
+namespace {
+
+// ROM-only cartridge whose main loop counts in WRAM and copies the count
+// into tile data and the scroll register, with the LCD on.
+std::shared_ptr<const RomImage> romImage() {
+  const TestRom rom({
+      0x31, 0xFE, 0xFF, // LD SP, FFFE
+      0x3E, 0x91,       // LD A, 91
+      0xE0, 0x40,       // LDH (LCDC), A
+      0xFA, 0x00, 0xC0, // loop: LD A, (C000)
+      0x3C,             // INC A
+      0xEA, 0x00, 0xC0, // LD (C000), A
+      0xEA, 0x10, 0x80, // LD (8010), A
+      0xE0, 0x42,       // LDH (SCY), A
+      0x18, 0xF3,       // JR loop
+  });
+  return rom.image();
+}
+
+} // namespace
+
+TEST(GameBoyTest, RunsLikeHandWiredComponents) {
+  auto rom = romImage();
+  ASSERT_NE(rom, nullptr);
+  auto gameBoy = std::make_unique<GameBoy>();
+  gameBoy->loadRom(rom);
+
+  Cartridge cart;
+  cart.loadRom(rom);
+  Bus bus;
+  CPU cpu(bus);
+  PPU ppu(bus);
+  Timer timer(bus);
+  Joypad joypad(bus);
+  Scheduler scheduler(bus, cpu, ppu, timer);
+  bus.setCartridge(&cart);
+  bus.setPPU(&ppu);
+  bus.setTimer(&timer);
+  bus.setJoypad(&joypad);
+  bus.setScheduler(&scheduler);
+
+  for (int frame = 0; frame < 5; frame++) {
+    EXPECT_EQ(gameBoy->runFrame(), scheduler.runFrame());
+  }
+  std::vector<uint8_t> expected, actual;
+  SaveState::save({bus, cpu, ppu, timer, joypad, cart, scheduler}, expected);
+  SaveState::save(gameBoy->machine(), actual);
+  EXPECT_EQ(actual, expected);
+  EXPECT_GT(gameBoy->bus.read(0xC000), 0);
+}
+
+TEST(GameBoyTest, RunCyclesRunsAtLeastThatLong) {
+  auto gameBoy = std::make_unique<GameBoy>();
+  gameBoy->loadRom(romImage());
+  uint64_t elapsed = gameBoy->runCycles(1000);
+  EXPECT_GE(elapsed, 1000u);
+  EXPECT_EQ(gameBoy->scheduler.now(), elapsed);
+}
+
+TEST(GameBoyTest, ReportsWhyARomDidNotLoad) {
+  auto gameBoy = std::make_unique<GameBoy>();
+  EXPECT_FALSE(gameBoy->loadRom(::testing::TempDir() + "missing.gb"));
+  EXPECT_FALSE(gameBoy->loadError().empty());
+}
+
+TEST(GameBoyTest, FootprintIsTheInstanceAloneNotItsRom) {
+  auto rom = romImage();
+  auto first = std::make_unique<GameBoy>();
+  auto second = std::make_unique<GameBoy>();
+  first->loadRom(rom);
+  second->loadRom(rom);
+  EXPECT_EQ(first->cartridge.romImage(), second->cartridge.romImage());
+
+  // WRAM, HRAM and I/O, next to page tables; no 64KB address space copy
+  EXPECT_LT(sizeof(Bus), 8u * 1024);
+  // No cartridge RAM in the header, so none allocated
+  EXPECT_EQ(first->cartridge.ramPages().size(), 0u);
+  size_t fresh = first->footprint();
+  EXPECT_EQ(fresh, sizeof(GameBoy) + 0x4000 + // WRAM + VRAM
+                       first->cpu.blockCacheBytes());
+  first->runFrame();
+  EXPECT_GT(first->footprint(), fresh); // Decoded blocks
+}
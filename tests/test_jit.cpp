@@ -0,0 +1,195 @@
+#include "core/Bus.h"
+#include "core/CPU.h"
+#include "mmu/Cartridge.h"
+#include "tests/TestRom.h"
+#include <cstdio>
+#include <fstream>
+#include <gtest/gtest.h>
+#include <random>
+#include <string>
+#include <vector>
+
+// Runs the same ROM on a JIT and an interpreter CPU and compares them after
+// every block.
+class JitTest : public ::testing::Test {
+protected:
+  static constexpr uint16_t ORIGIN = 0x0200;
+
+  Bus jitBus, refBus;
+  Cartridge jitCart, refCart;
+  CPU jitCpu{jitBus}, refCpu{refBus};
+
+  void load(const std::vector<uint8_t> &code, uint8_t type = 0x00) {
+    TestRom rom({}, 4);
+    rom.place(ORIGIN, code);
+    rom.bytes[0x147] = type;
+    auto image = rom.image();
+    ASSERT_NE(image, nullptr);
+    jitCart.loadRom(image);
+    refCart.loadRom(image);
+    jitBus.setCartridge(&jitCart);
+    refBus.setCartridge(&refCart);
+
+    for (CPU *cpu : {&jitCpu, &refCpu}) {
+      cpu->reset();
+      cpu->PC = ORIGIN;
+      cpu->flushBlockCache();
+    }
+  }
+
+  void setRegisters(uint16_t af, uint16_t bc, uint16_t de, uint16_t hl,
+                    uint16_t sp) {
+    for (CPU *cpu : {&jitCpu, &refCpu}) {
+      cpu->AF.reg16 = af & 0xFFF0;
+      cpu->BC.reg16 = bc;
+      cpu->DE.reg16 = de;
+      cpu->HL.reg16 = hl;
+      cpu->SP = sp;
+    }
+  }
+
+  void compareBlocks(int count) {
+    for (int i = 0; i < count; i++) {
+      ASSERT_EQ(jitCpu.runBlock(), refCpu.runBlock()) << "block " << i;
+      jitCpu.syncFlags();
+      refCpu.syncFlags();
+      ASSERT_EQ(jitCpu.PC, refCpu.PC) << "block " << i;
+      ASSERT_EQ(jitCpu.AF.reg16, refCpu.AF.reg16) << "block " << i;
+      ASSERT_EQ(jitCpu.BC.reg16, refCpu.BC.reg16) << "block " << i;
+      ASSERT_EQ(jitCpu.DE.reg16, refCpu.DE.reg16) << "block " << i;
+      ASSERT_EQ(jitCpu.HL.reg16, refCpu.HL.reg16) << "block " << i;
+      ASSERT_EQ(jitCpu.SP, refCpu.SP) << "block " << i;
+    }
+    for (uint32_t address = 0xC000; address < 0xE000; address++) {
+      ASSERT_EQ(jitBus.read(address), refBus.read(address)) << address;
+    }
+  }
+
+  void SetUp() override {
+    if (!jitCpu.setJitEnabled(true)) {
+      GTEST_SKIP() << "No JIT backend on this host";
+    }
+  }
+};
+
+TEST_F(JitTest, RandomBlocksMatchInterpreter) {
+  std::mt19937 rng(1234);
+  for (int program = 0; program < 200; program++) {
+    std::vector<uint8_t> code;
+    for (int n = 0; n < 16; n++) {
+      uint8_t opcode = rng();
+      uint8_t lo = rng(), hi = 0xC0 | (rng() & 0x1F);
+      if (!Jit::translatable(opcode, hi << 8 | lo))
+        continue;
+      int y = (opcode >> 3) & 0x07;
+      int z = opcode & 0x07;
+      // Keep memory accesses inside WRAM
+      if (opcode == 0x02 || opcode == 0x0A)
+        code.insert(code.end(), {0x06, hi}); // LD B, hi
+      if (opcode == 0x12 || opcode == 0x1A)
+        code.insert(code.end(), {0x16, hi}); // LD D, hi
+      code.push_back(opcode);
+      if (CPU::instructionLength(opcode) >= 2)
+        code.push_back(lo);
+      if (CPU::instructionLength(opcode) == 3)
+        code.push_back(hi);
+      int x = opcode >> 6;
+      int p = y >> 1;
+      bool writesH = (x == 1 && y == 4) ||
+                     (x == 0 && z == 1 && (p == 2 || (y & 1))) ||
+                     (x == 0 && z == 2 && p >= 2) ||
+                     (x == 0 && z == 3 && p == 2) ||
+                     (x == 0 && z >= 4 && z <= 6 && y == 4);
+      if (writesH)
+        code.insert(code.end(), {0x26, hi}); // LD H, hi
+    }
+    code.insert(code.end(), {0xC3, ORIGIN & 0xFF, ORIGIN >> 8}); // JP ORIGIN
+    load(code);
+    setRegisters(rng(), rng(), rng(), 0xD000 | (rng() & 0x0FFF), rng());
+    compareBlocks(40);
+  }
+}
+
+TEST_F(JitTest, MbcWriteEndsNativeBlock) {
+  load(
+      {
+          0x3E, 0x02,       // LD A, 0x02
+          0xEA, 0x00, 0x20, // LD (0x2000), A  -> select ROM bank 2
+          0x47,             // LD B, A
+          0x04,             // INC B
+          0xC3, ORIGIN & 0xFF, ORIGIN >> 8,
+      },
+      0x01); // MBC1
+  compareBlocks(40);
+}
+
+// I/O reached through a pointer must be accessed at the start of a block,
+// as the interpreter does (see CPU::reachesIO())
+TEST_F(JitTest, IoThroughPointerEndsNativeBlock) {
+  load({
+      0x01, 0x01, 0xFF, // LD BC, SB
+      0x11, 0x00, 0xD0, // LD DE, 0xD000
+      0x21, 0x02, 0xFF, // LD HL, SC
+      0x3C,             // INC A
+      0x02,             // LD (BC), A
+      0x1A,             // LD A, (DE)
+      0x3C,             // INC A
+      0x12,             // LD (DE), A
+      0x34,             // INC (HL)
+      0x2A,             // LD A, (HL+)
+      0x0A,             // LD A, (BC)
+      0xC3, ORIGIN & 0xFF, ORIGIN >> 8,
+  });
+  compareBlocks(100);
+  EXPECT_EQ(jitBus.read(0xFF01), refBus.read(0xFF01));
+  EXPECT_EQ(jitBus.read(0xFF02), refBus.read(0xFF02));
+}
+
+TEST_F(JitTest, ToggleBetweenBlocks) {
+  load({
+      0x04,             // INC B
+      0x80,             // ADD A, B
+      0x21, 0x00, 0xD0, // LD HL, 0xD000
+      0x77,             // LD (HL), A
+      0x18, 0xF8,       // JR -8
+  });
+  compareBlocks(20);
+  jitCpu.setJitEnabled(false);
+  compareBlocks(20);
+  jitCpu.setJitEnabled(true);
+  compareBlocks(20);
+}
+
+// Translated code runs from pages that are executable but not writable
+TEST_F(JitTest, CodeIsNeverWritableAndExecutable) {
+  Jit jit;
+  ASSERT_TRUE(jit.init());
+  std::vector<Jit::Instruction> ops(8, {0x04, 0}); // INC B
+  size_t translated = 0;
+  Jit::Entry first = jit.compile(ops.data(), ops.size(), translated);
+  Jit::Entry second = jit.compile(ops.data(), ops.size(), translated);
+  ASSERT_NE(first, nullptr);
+  ASSERT_NE(second, nullptr);
+
+  std::ifstream maps("/proc/self/maps");
+  if (!maps)
+    GTEST_SKIP() << "No /proc/self/maps on this host";
+  for (Jit::Entry entry : {first, second}) {
+    uintptr_t address = reinterpret_cast<uintptr_t>(entry);
+    std::string perms;
+    maps.clear();
+    maps.seekg(0);
+    for (std::string line; std::getline(maps, line);) {
+      uintptr_t start = 0, end = 0;
+      char mode[5] = {};
+      if (std::sscanf(line.c_str(), "%lx-%lx %4s", &start, &end, mode) == 3 &&
+          address >= start && address < end)
+        perms = mode;
+    }
+    EXPECT_EQ(perms.substr(0, 3), "r-x");
+  }
+
+  Jit::Registers regs{0, 0, 0, 0, 0};
+  EXPECT_EQ(second(&regs, &jitBus), 8);
+  EXPECT_EQ(regs.bc, 0x0800);
+}
@@ -0,0 +1,376 @@
+#include "core/Lockstep.h"
+#include "tests/TestRom.h"
+#include <array>
+#include <gtest/gtest.h>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace {
+
+constexpr uint16_t MAIN = TestRom::MAIN;
+constexpr uint16_t SUBROUTINES = 0x1000;
+constexpr uint16_t DATA = 0xC000;      // 256 bytes, the only RAM written
+constexpr uint16_t STACK_TOP = 0xDFF0; // SP only moves in balanced pairs
+
+// Random programs that stay in ROM and keep their stack intact: writes only
+// reach DATA, HRAM and I/O, SP is only moved by PUSH/POP pairs and
+// CALL/RET, and there is no HALT or EI. Branches test flags, so lanes
+// started from different registers and data keep splitting and rejoining.
+class ProgramWriter {
+public:
+  ProgramWriter(std::vector<uint8_t> &rom, std::mt19937 &rng)
+      : rom(rom), rng(rng) {}
+
+  size_t at = 0;
+
+  void emit(std::initializer_list<int> bytes) {
+    for (int byte : bytes)
+      rom[at++] = static_cast<uint8_t>(byte);
+  }
+  int pick(int n) { return static_cast<int>(rng() % n); }
+  int byte() { return pick(0x100); }
+
+  // One instruction without control flow
+  void straight() {
+    int y = pick(8);
+    int z = pick(8);
+    int p = pick(4);
+    int reg = pick(7); // B, C, D, E, H, L or A, never (HL)
+    if (reg == 6)
+      reg = 7;
+    switch (pick(14)) {
+    case 0: // LD r, r'
+      emit({0x40 | reg << 3 | z});
+      break;
+    case 1: // ALU A, r
+      emit({0x80 | y << 3 | z});
+      break;
+    case 2: // ALU A, n8
+      emit({0xC6 | y << 3, byte()});
+      break;
+    case 3: // LD r, n8
+      emit({0x06 | reg << 3, byte()});
+      break;
+    case 4: // INC r / DEC r
+      emit({0x04 | reg << 3 | pick(2)});
+      break;
+    case 5: // INC rp / DEC rp, not SP
+      emit({0x03 | pick(3) << 4 | pick(2) << 3});
+      break;
+    case 6: // ADD HL, rp
+      emit({0x09 | p << 4});
+      break;
+    case 7: // LD A, (BC)/(DE)/(HL+)/(HL-)
+      emit({0x0A | p << 4});
+      break;
+    case 8: // RLCA RRCA RLA RRA DAA CPL SCF CCF
+      emit({0x07 | y << 3});
+      break;
+    case 9: // CB on a register, or BIT b, (HL)
+      emit({0xCB, pick(2) ? (byte() & 0xF8) | (reg == 7 ? 7 : reg)
+                          : 0x46 | y << 3});
+      break;
+    case 10: // LDH A, (n8) / LD A, (C) / LD A, (nn)
+      if (y < 3)
+        emit({0xF0, byte()});
+      else if (y < 5)
+        emit({0xF2});
+      else
+        emit({0xFA, byte(), byte()});
+      break;
+    case 11: // LD HL, SP+r8
+      emit({0xF8, byte()});
+      break;
+    case 12:
+      store();
+      break;
+    default: // LD rp, n16, not SP
+      emit({0x01 | pick(3) << 4, byte(), byte()});
+      break;
+    }
+  }
+
+  // A write into DATA or HRAM
+  void store() {
+    int low = byte();
+    switch (pick(6)) {
+    case 0: { // Through HL
+      emit({0x21, low, DATA >> 8});
+      int y = pick(8);
+      switch (pick(5)) {
+      case 0:
+        emit({0x70 | (y == 6 ? 7 : y)});
+        break;
+      case 1:
+        emit({0x34 | pick(2)});
+        break;
+      case 2:
+        emit({0x36, byte()});
+        break;
+      case 3:
+        emit({pick(2) ? 0x22 : 0x32});
+        break;
+      default: // Rotate, RES or SET (HL)
+        emit({0xCB, (pick(3) ? 0x80 + pick(2) * 0x40 : 0x00) | y << 3 | 6});
+        break;
+      }
+      break;
+    }
+    case 1: // Through BC or DE
+      if (pick(2))
+        emit({0x01, low, DATA >> 8, 0x02});
+      else
+        emit({0x11, low, DATA >> 8, 0x12});
+      break;
+    case 2: // LD (nn), A
+      emit({0xEA, low, DATA >> 8});
+      break;
+    case 3: // LDH (n8), A into HRAM
+      emit({0xE0, 0x80 + pick(0x70)});
+      break;
+    case 4: // LD (C), A
+      emit({0xE2});
+      break;
+    default: // LD (nn), SP
+      emit({0x08, low & 0xFE, DATA >> 8});
+      break;
+    }
+  }
+
+  void straights(int count) {
+    for (int i = 0; i < count; i++)
+      straight();
+  }
+
+  // A run of instructions between branches
+  void chunk(int subroutines) {
+    straights(1 + pick(4));
+    int cc = pick(4);
+    switch (pick(6)) {
+    case 0: { // JR cc over a few instructions
+      emit({0x20 | cc << 3, 0});
+      size_t from = at;
+      straights(1 + pick(3));
+      rom[from - 1] = static_cast<uint8_t>(at - from);
+      break;
+    }
+    case 1: { // JP cc over a few instructions
+      emit({0xC2 | cc << 3, 0, 0});
+      size_t from = at;
+      straights(1 + pick(3));
+      rom[from - 2] = static_cast<uint8_t>(at);
+      rom[from - 1] = static_cast<uint8_t>(at >> 8);
+      break;
+    }
+    case 2: { // CALL or CALL cc
+      int target = SUBROUTINES + 0x100 * pick(subroutines);
+      emit({pick(2) ? 0xCD : 0xC4 | cc << 3, target & 0xFF, target >> 8});
+      break;
+    }
+    case 3: // RST 08
+      emit({0xCF});
+      break;
+    case 4: { // PUSH ... POP into another pair
+      emit({0xC5 | pick(4) << 4});
+      straights(pick(3));
+      emit({0xC1 | pick(4) << 4});
+      break;
+    }
+    default:
+      break;
+    }
+  }
+
+  void subroutine() {
+    straights(1 + pick(5));
+    emit({0xC0 | pick(4) << 3}); // RET cc
+    straights(1 + pick(3));
+    emit({0xC9});
+  }
+
+private:
+  std::vector<uint8_t> &rom;
+  std::mt19937 &rng;
+};
+
+std::shared_ptr<const RomImage> writeProgram(std::mt19937 &rng) {
+  TestRom rom({});
+  rom.place(0x0008, {0x07, 0x80, 0xC9}); // RST 08: RLCA; ADD A, B; RET
+  ProgramWriter writer(rom.bytes, rng);
+
+  constexpr int SUBROUTINE_COUNT = 4;
+  writer.at = MAIN;
+  for (int i = 0; i < 60; i++)
+    writer.chunk(SUBROUTINE_COUNT);
+  writer.emit({0xC3, MAIN & 0xFF, MAIN >> 8});
+  EXPECT_LT(writer.at, SUBROUTINES);
+  for (int i = 0; i < SUBROUTINE_COUNT; i++) {
+    writer.at = SUBROUTINES + 0x100 * i;
+    writer.subroutine();
+  }
+  return rom.image();
+}
+
+struct Reference {
+  Bus bus;
+  Cartridge cartridge;
+  CPU cpu{bus};
+};
+
+void expectSameRegisters(CPU &expected, CPU &actual, int lane, int round) {
+  expected.syncFlags();
+  actual.syncFlags();
+  SCOPED_TRACE("lane " + std::to_string(lane) + ", round " +
+               std::to_string(round));
+  ASSERT_EQ(expected.PC, actual.PC);
+  ASSERT_EQ(expected.AF.reg16, actual.AF.reg16);
+  ASSERT_EQ(expected.BC.reg16, actual.BC.reg16);
+  ASSERT_EQ(expected.DE.reg16, actual.DE.reg16);
+  ASSERT_EQ(expected.HL.reg16, actual.HL.reg16);
+  ASSERT_EQ(expected.SP, actual.SP);
+}
+
+// Every lane against its own CPU::tick() on the same program, registers
+// after every run() and the RAM written at the end.
+void matchesCpu(Lockstep &lockstep, std::shared_ptr<const RomImage> rom,
+                std::mt19937 &rng) {
+  std::array<std::unique_ptr<Reference>, Lockstep::LANES> refs;
+  for (int lane = 0; lane < Lockstep::LANES; lane++) {
+    refs[lane] = std::make_unique<Reference>();
+    Reference &ref = *refs[lane];
+    ref.cartridge.loadRom(rom);
+    ref.bus.setCartridge(&ref.cartridge);
+    ref.cpu.AF.reg16 = rng() & 0xFFF0;
+    ref.cpu.BC.reg16 = rng();
+    ref.cpu.DE.reg16 = rng();
+    ref.cpu.HL.reg16 = rng();
+    ref.cpu.SP = STACK_TOP;
+    for (int i = 0; i < 0x100; i++) {
+      uint8_t value = rng();
+      ref.bus.write(DATA + i, value);
+      lockstep.bus(lane).write(DATA + i, value);
+    }
+    lockstep.loadRegisters(lane, ref.cpu);
+  }
+
+  Bus scratchBus;
+  CPU actual(scratchBus);
+  uint64_t steps = 0;
+  for (int round = 0; round < 3000; round++) {
+    uint32_t count = round % 4 == 3 ? 1 + rng() % 64 : 1;
+    lockstep.run(count);
+    steps += count;
+    for (int lane = 0; lane < Lockstep::LANES; lane++) {
+      for (uint32_t i = 0; i < count; i++)
+        refs[lane]->cpu.tick();
+      lockstep.storeRegisters(lane, actual);
+      expectSameRegisters(refs[lane]->cpu, actual, lane, round);
+      if (testing::Test::HasFatalFailure())
+        return;
+    }
+  }
+
+  for (int lane = 0; lane < Lockstep::LANES; lane++) {
+    for (uint16_t address : {DATA, uint16_t(0xDF00), uint16_t(0xFF80)}) {
+      for (int i = 0; i < 0x80; i++) {
+        ASSERT_EQ(refs[lane]->bus.read(address + i),
+                  lockstep.bus(lane).read(address + i))
+            << "lane " << lane << " at " << address + i;
+      }
+    }
+  }
+  EXPECT_EQ(lockstep.instructionsRetired(), steps * Lockstep::LANES);
+  EXPECT_GT(lockstep.scalarSteps(), 0u); // DAA
+  EXPECT_LT(lockstep.groupSteps(), lockstep.instructionsRetired());
+}
+
+} // namespace
+
+TEST(LockstepTest, PortableKernelsMatchCpuLaneByLane) {
+  for (int seed = 1; seed <= 4; seed++) {
+    std::mt19937 rng(seed);
+    auto rom = writeProgram(rng);
+    ASSERT_NE(rom, nullptr);
+    Lockstep lockstep(rom);
+    ASSERT_TRUE(lockstep.setSimdEnabled(false));
+    matchesCpu(lockstep, rom, rng);
+  }
+}
+
+TEST(LockstepTest, Avx2KernelsMatchCpuLaneByLane) {
+  for (int seed = 1; seed <= 4; seed++) {
+    std::mt19937 rng(seed);
+    auto rom = writeProgram(rng);
+    ASSERT_NE(rom, nullptr);
+    Lockstep lockstep(rom);
+    if (!lockstep.setSimdEnabled(true))
+      GTEST_SKIP() << "No AVX2 on this host or build";
+    matchesCpu(lockstep, rom, rng);
+  }
+}
+
+TEST(LockstepTest, LanesRejoinAfterAnIf) {
+  // loop: BIT 0, B; JR Z, +1; INC C; INC B; JR loop
+  auto image =
+      TestRom({0xCB, 0x40, 0x28, 0x01, 0x0C, 0x04, 0x18, 0xF8}).image();
+  ASSERT_NE(image, nullptr);
+
+  Lockstep lockstep(image);
+  Bus bus;
+  CPU cpu(bus);
+  for (int lane = 0; lane < Lockstep::LANES; lane++) {
+    cpu.BC.hi = static_cast<uint8_t>(lane); // Half the lanes skip INC C
+    lockstep.loadRegisters(lane, cpu);
+  }
+  lockstep.run(1000);
+
+  EXPECT_EQ(lockstep.instructionsRetired(), 1000u * Lockstep::LANES);
+  EXPECT_EQ(lockstep.scalarSteps(), 0u);
+  // Five groups an iteration, one of them half full, whichever lanes
+  // skipped this time
+  EXPECT_GT(lockstep.instructionsRetired(), 12 * lockstep.groupSteps());
+}
+
+TEST(LockstepTest, HaltedLanesWakeForInterruptsLikeTheCpu) {
+  // Lanes with C = 4 request the timer interrupt before halting
+  TestRom rom({
+      0x3E, 0x04, // LD A, 04
+      0xE0, 0xFF, // LDH (IE), A
+      0x79,       // LD A, C
+      0xE0, 0x0F, // LDH (IF), A
+      0xFB,       // EI
+      0x76,       // HALT
+      0x04,       // INC B
+      0x18, 0xF4, // JR back to LD A, C
+  });
+  rom.place(0x50, {0x14, 0xD9}); // INC D; RETI
+  auto image = rom.image();
+  ASSERT_NE(image, nullptr);
+
+  Lockstep lockstep(image);
+  std::array<std::unique_ptr<Reference>, Lockstep::LANES> refs;
+  for (int lane = 0; lane < Lockstep::LANES; lane++) {
+    refs[lane] = std::make_unique<Reference>();
+    Reference &ref = *refs[lane];
+    ref.cartridge.loadRom(image);
+    ref.bus.setCartridge(&ref.cartridge);
+    ref.cpu.BC.lo = lane % 2 ? 0x04 : 0x00;
+    lockstep.loadRegisters(lane, ref.cpu);
+  }
+  Bus scratchBus;
+  CPU actual(scratchBus);
+  for (int round = 0; round < 200; round++) {
+    lockstep.run(1);
+    for (int lane = 0; lane < Lockstep::LANES; lane++) {
+      refs[lane]->cpu.tick();
+      lockstep.storeRegisters(lane, actual);
+      expectSameRegisters(refs[lane]->cpu, actual, lane, round);
+      ASSERT_FALSE(HasFatalFailure());
+    }
+  }
+  EXPECT_GT(refs[1]->cpu.DE.hi, 0); // Took interrupts
+  EXPECT_EQ(refs[0]->cpu.DE.hi, 0);
+  EXPECT_TRUE(refs[0]->cpu.isHalted());
+}
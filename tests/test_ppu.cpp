@@ -0,0 +1,85 @@
+#include "core/Bus.h"
+#include "core/PPU.h"
+#include <gtest/gtest.h>
+#include <random>
+
+// PPU::advance() against the same number of PPU::tick() calls, on scenes
+// built from random VRAM/OAM contents and register settings.
+class PPUAdvanceTest : public ::testing::TestWithParam<int> {
+protected:
+  Bus tickBus, advanceBus;
+  PPU tickPpu{tickBus}, advancePpu{advanceBus};
+
+  void SetUp() override {
+    tickBus.setPPU(&tickPpu);
+    advanceBus.setPPU(&advancePpu);
+  }
+
+  void both(uint16_t address, uint8_t value) {
+    tickBus.write(address, value);
+    advanceBus.write(address, value);
+  }
+
+  void buildScene(std::mt19937 &rng) {
+    both(0xFF40, 0x00); // VRAM/OAM are only writable with the LCD off
+    for (uint16_t address = 0x8000; address < 0xA000; address++)
+      both(address, rng());
+    for (uint16_t address = 0xFE00; address < 0xFEA0; address++)
+      both(address, rng() % 176);
+    for (uint16_t address : {0xFF42, 0xFF43, 0xFF47, 0xFF48, 0xFF49})
+      both(address, rng());
+    both(0xFF4A, rng() % 144); // WY
+    both(0xFF4B, rng() % 167); // WX
+    both(0xFF45, rng() % 154); // LYC
+    both(0xFF41, rng() & 0x78);
+    both(0xFF40, 0x80 | (rng() & 0x7F));
+  }
+
+  void expectSame(int step) {
+    ASSERT_EQ(advanceBus.read(0xFF44), tickBus.read(0xFF44)) << step;
+    ASSERT_EQ(advanceBus.read(0xFF41), tickBus.read(0xFF41)) << step;
+    ASSERT_EQ(advanceBus.read(0xFF0F), tickBus.read(0xFF0F)) << step;
+  }
+};
+
+TEST_P(PPUAdvanceTest, MatchesTick) {
+  std::mt19937 rng(GetParam());
+  buildScene(rng);
+
+  for (int step = 0; step < 4000; step++) {
+    int cycles = rng() % 600;
+    for (int i = 0; i < cycles; i++)
+      tickPpu.tick();
+    advancePpu.advance(cycles);
+    expectSame(step);
+
+    if (rng() % 200 == 0) { // Toggle the LCD or change a register mid-frame
+      uint8_t lcdc = tickBus.read(0xFF40) ^ (rng() % 3 ? 0x22 : 0x80);
+      both(0xFF40, lcdc);
+    }
+  }
+  EXPECT_EQ(advancePpu.frameBuffer, tickPpu.frameBuffer);
+  EXPECT_EQ(advancePpu.frameReady, tickPpu.frameReady);
+}
+
+INSTANTIATE_TEST_SUITE_P(Scenes, PPUAdvanceTest, ::testing::Range(1, 7));
+
+TEST_P(PPUAdvanceTest, SkippedScanlinesKeepTheWindowInStep) {
+  std::mt19937 rng(GetParam());
+  buildScene(rng);
+  both(0xFF4A, rng() % 60);            // WY above the switch-over line
+  both(0xFF4B, 7 + rng() % 100);       // WX on screen
+  both(0xFF40, 0x00);                  // Restart at line 0...
+  both(0xFF40, 0xA1 | (rng() & 0x5E)); // ...with LCD, BG and window on
+
+  advancePpu.setRendering(false);
+  advancePpu.advance(72 * 456);
+  advancePpu.setRendering(true);
+  advancePpu.advance(72 * 456);
+  for (int i = 0; i < 144 * 456; i++)
+    tickPpu.tick();
+
+  EXPECT_TRUE(std::equal(advancePpu.frameBuffer.begin() + 72 * 160,
+                         advancePpu.frameBuffer.end(),
+                         tickPpu.frameBuffer.begin() + 72 * 160));
+}
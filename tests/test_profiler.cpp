@@ -0,0 +1,93 @@
+#include "core/Bus.h"
+#include "core/CPU.h"
+#include "core/PPU.h"
+#include "core/Profiler.h"
+#include "core/Scheduler.h"
+#include "core/Timer.h"
+#include "mmu/Symbols.h"
+#include <fstream>
+#include <gtest/gtest.h>
+#include <sstream>
+
+namespace {
+
+std::string writeTempFile(const std::string &name, const std::string &text) {
+  std::string path = ::testing::TempDir() + name;
+  std::ofstream(path) << text;
+  return path;
+}
+
+} // namespace
+
+TEST(SymbolTableTest, LooksUpClosestLabelInBankAndRegion) {
+  SymbolTable symbols;
+  ASSERT_TRUE(symbols.load(writeTempFile("shellboy_test.sym",
+                                         "; File generated by rgblink\n"
+                                         "00:0150 Start\n"
+                                         "00:0180 Start.loop\n"
+                                         "02:4000 Bank2Code\n"
+                                         "garbage\n"
+                                         "00:c000 wBuffer ; comment\n")));
+  EXPECT_EQ(symbols.size(), 4u);
+
+  ASSERT_NE(symbols.lookup(0, 0x0150), nullptr);
+  EXPECT_EQ(*symbols.lookup(0, 0x0150), "Start");
+  EXPECT_EQ(*symbols.lookup(0, 0x017F), "Start");
+  EXPECT_EQ(*symbols.lookup(0, 0x3FFF), "Start.loop");
+  EXPECT_EQ(*symbols.lookup(2, 0x4567), "Bank2Code");
+  EXPECT_EQ(*symbols.lookup(0, 0xC010), "wBuffer");
+  EXPECT_EQ(symbols.lookup(0, 0x0100), nullptr); // Before the first label
+  EXPECT_EQ(symbols.lookup(3, 0x4567), nullptr); // Other bank
+  EXPECT_EQ(symbols.lookup(0, 0xFF80), nullptr); // Other region
+}
+
+TEST(ProfilerTest, DropsSamplesWhenFull) {
+  Profiler profiler(1024, 4);
+  for (int i = 0; i < 5; i++)
+    profiler.push({0, static_cast<uint16_t>(i)});
+  EXPECT_EQ(profiler.dropped(), 1u);
+  EXPECT_EQ(profiler.drain(), 4u);
+  EXPECT_TRUE(profiler.push({0, 0}));
+  EXPECT_EQ(profiler.drain(), 1u);
+  EXPECT_EQ(profiler.samples(), 5u);
+}
+
+TEST(ProfilerTest, SchedulerSamplesGuestCode) {
+  Bus bus;
+  CPU cpu(bus);
+  PPU ppu(bus);
+  Timer timer(bus);
+  bus.setPPU(&ppu);
+  bus.setTimer(&timer);
+  Scheduler scheduler(bus, cpu, ppu, timer);
+  bus.setScheduler(&scheduler);
+
+  const uint8_t program[] = {
+      0x04,       // C000: INC B
+      0x18, 0xFD, //       JR -3
+  };
+  for (size_t i = 0; i < sizeof(program); i++)
+    bus.write(0xC000 + i, program[i]);
+  cpu.PC = 0xC000;
+
+  Profiler profiler(100);
+  scheduler.setProfiler(&profiler);
+  scheduler.runFrame();
+  scheduler.setProfiler(nullptr);
+  scheduler.runFrame();
+  profiler.drain();
+  EXPECT_EQ(profiler.samples(), Scheduler::CYCLES_PER_FRAME / 100);
+
+  SymbolTable symbols;
+  symbols.load(writeTempFile("shellboy_loop.sym", "00:C000 Loop\n"));
+  std::string path = ::testing::TempDir() + "shellboy_profile.folded";
+  FILE *out = fopen(path.c_str(), "w");
+  ASSERT_NE(out, nullptr);
+  profiler.writeCollapsed(out, symbols);
+  fclose(out);
+
+  std::stringstream folded;
+  folded << std::ifstream(path).rdbuf();
+  EXPECT_EQ(folded.str(),
+            "WRAM;Loop " + std::to_string(profiler.samples()) + "\n");
+}
@@ -0,0 +1,360 @@
+#include "core/Bus.h"
+#include "core/CPU.h"
+#include "core/DeltaCodec.h"
+#include "core/Fork.h"
+#include "core/Joypad.h"
+#include "core/PPU.h"
+#include "core/Rewind.h"
+#include "core/RunAhead.h"
+#include "core/SaveState.h"
+#include "core/Scheduler.h"
+#include "core/Timer.h"
+#include "mmu/Cartridge.h"
+#include "tests/TestRom.h"
+#include <cstdio>
+#include <cstring>
+#include <gtest/gtest.h>
+#include <random>
+#include <vector>
+
+namespace {
+
+// MBC5 cartridge with RAM. The main loop halts, then copies a byte from the
+// ROM bank picked by a VBlank counter into cartridge RAM; the VBlank handler
+// writes to tile data and the timer handler scrolls, so the picture keeps
+// changing.
+std::string writeRom(uint8_t checksum = 0) {
+  const std::vector<uint8_t> vblank = {
+      0xF5,             // PUSH AF
+      0xFA, 0x00, 0xC0, // LD A, (C000)
+      0x3C,             // INC A
+      0xEA, 0x00, 0xC0, // LD (C000), A
+      0xEA, 0x00, 0x80, // LD (8000), A
+      0xF1,             // POP AF
+      0xD9,             // RETI
+  };
+  const std::vector<uint8_t> timer = {
+      0xF5,             // PUSH AF
+      0xFA, 0x01, 0xC0, // LD A, (C001)
+      0xC6, 0x03,       // ADD A, 3
+      0xEA, 0x01, 0xC0, // LD (C001), A
+      0xE0, 0x43,       // LDH (SCX), A
+      0xF1,             // POP AF
+      0xD9,             // RETI
+  };
+  const std::vector<uint8_t> main = {
+      0x31, 0xFE, 0xFF, // LD SP, FFFE
+      0x3E, 0x0A,       // LD A, 0A
+      0xEA, 0x00, 0x00, // LD (0000), A: RAM on
+      0x3E, 0x05,       // LD A, 05
+      0xE0, 0x07,       // LDH (TAC), A
+      0xE0, 0xFF,       // LDH (IE), A: VBlank and timer
+      0x3E, 0xE4,       // LD A, E4
+      0xE0, 0x47,       // LDH (BGP), A
+      0x3E, 0x91,       // LD A, 91
+      0xE0, 0x40,       // LDH (LCDC), A
+      0xFB,             // EI
+      0x76,             // loop: HALT
+      0xFA, 0x00, 0xC0, // LD A, (C000)
+      0xE6, 0x0F,       // AND 0F
+      0xEA, 0x00, 0x20, // LD (2000), A
+      0xFA, 0x34, 0x42, // LD A, (4234)
+      0xEA, 0x10, 0xA0, // LD (A010), A
+      0x18, 0xEF,       // JR loop
+  };
+  TestRom rom(main, 16);
+  rom.place(0x40, vblank).place(0x50, timer);
+  for (size_t i = 0x4000; i < rom.bytes.size(); i++)
+    rom.bytes[i] = static_cast<uint8_t>(i * 13 + (i >> 14));
+  rom.bytes[0x147] = 0x1B;
+  rom.bytes[0x149] = 0x03;
+  rom.bytes[0x14D] = checksum;
+
+  char name[48];
+  std::snprintf(name, sizeof(name), "shellboy_state_%02X.gb", checksum);
+  return rom.write(name);
+}
+
+struct Machine {
+  Cartridge cart;
+  Bus bus;
+  CPU cpu{bus};
+  PPU ppu{bus};
+  Timer timer{bus};
+  Joypad joypad{bus};
+  Scheduler scheduler{bus, cpu, ppu, timer};
+
+  explicit Machine(const std::string &rom) {
+    EXPECT_TRUE(cart.loadRom(rom));
+    bus.setCartridge(&cart);
+    bus.setPPU(&ppu);
+    bus.setTimer(&timer);
+    bus.setJoypad(&joypad);
+    bus.setScheduler(&scheduler);
+  }
+
+  SaveState::Machine parts() {
+    return {bus, cpu, ppu, timer, joypad, cart, scheduler};
+  }
+  std::vector<uint8_t> save() {
+    std::vector<uint8_t> state;
+    SaveState::save(parts(), state);
+    return state;
+  }
+  bool load(const std::vector<uint8_t> &state) {
+    return SaveState::load(parts(), state.data(), state.size());
+  }
+  void run(int frames) {
+    for (int i = 0; i < frames; i++)
+      scheduler.runFrame();
+  }
+};
+
+} // namespace
+
+TEST(SaveStateTest, RestoredMachineContinuesBitIdentically) {
+  std::string rom = writeRom();
+  Machine original(rom);
+  original.joypad.pressButton(Joypad::START);
+  original.run(30);
+  std::vector<uint8_t> snapshot = original.save();
+  original.run(30);
+  ASSERT_GT(original.bus.read(0xC000), 50); // The program is running
+
+  Machine restored(rom);
+  restored.run(7); // Diverge first; loading must overwrite all of it
+  ASSERT_TRUE(restored.load(snapshot));
+  EXPECT_EQ(restored.save(), snapshot);
+  restored.run(30);
+
+  EXPECT_EQ(restored.save(), original.save());
+  EXPECT_EQ(restored.ppu.frameBuffer, original.ppu.frameBuffer);
+  EXPECT_EQ(restored.cpu.instructionsRetired(),
+            original.cpu.instructionsRetired());
+  EXPECT_EQ(restored.bus.read(0xA010), original.bus.read(0xA010));
+}
+
+TEST(SaveStateTest, RejectsMalformedSnapshots) {
+  std::string rom = writeRom();
+  Machine machine(rom);
+  machine.run(3);
+  std::vector<uint8_t> snapshot = machine.save();
+
+  std::vector<uint8_t> truncated(snapshot.begin(), snapshot.end() - 1);
+  EXPECT_FALSE(machine.load(truncated));
+
+  std::vector<uint8_t> version = snapshot;
+  version[4]++;
+  EXPECT_FALSE(machine.load(version));
+
+  std::vector<uint8_t> section = snapshot;
+  section[12]++; // First section tag
+  EXPECT_FALSE(machine.load(section));
+
+  EXPECT_TRUE(machine.load(snapshot));
+}
+
+TEST(SaveStateTest, FailedLoadLeavesTheMachineUntouched) {
+  std::string rom = writeRom();
+  Machine source(rom), machine(rom), twin(rom);
+  source.joypad.pressButton(Joypad::START);
+  source.run(20);
+  machine.run(5);
+  twin.run(5);
+
+  // Cut short in the middle and inside the last section, with the size
+  // field patched to match so only the sections give them away
+  std::vector<std::vector<uint8_t>> broken;
+  for (size_t keep : {source.save().size() / 2, source.save().size() - 1}) {
+    std::vector<uint8_t> truncated = source.save();
+    truncated.resize(keep);
+    uint32_t size = uint32_t(keep);
+    std::memcpy(truncated.data() + 8, &size, sizeof(size));
+    broken.push_back(truncated);
+  }
+  std::vector<uint8_t> withoutRam;
+  SaveState::save(source.parts(), withoutRam, false);
+  broken.push_back(withoutRam);
+
+  for (const std::vector<uint8_t> &state : broken) {
+    EXPECT_FALSE(machine.load(state));
+    EXPECT_EQ(machine.save(), twin.save());
+  }
+  machine.run(30);
+  twin.run(30);
+  EXPECT_EQ(machine.save(), twin.save());
+  EXPECT_EQ(machine.ppu.frameBuffer, twin.ppu.frameBuffer);
+}
+
+TEST(SaveStateTest, RejectsSnapshotsOfAnotherRom) {
+  Machine machine(writeRom(0x00));
+  machine.run(3);
+  std::vector<uint8_t> snapshot = machine.save();
+
+  Machine other(writeRom(0x42));
+  other.run(1);
+  std::vector<uint8_t> before = other.save();
+  EXPECT_FALSE(other.load(snapshot));
+  EXPECT_EQ(other.save(), before); // Rejected before anything was touched
+}
+
+TEST(DeltaCodecTest, RoundTripsRunsAndLiterals) {
+  std::mt19937 rng(7);
+  std::vector<uint8_t> data(70000, 0);
+  for (int i = 0; i < 500; i++)
+    data[rng() % data.size()] = rng();
+  std::fill(data.begin() + 1000, data.begin() + 3000, 0xFF);
+  for (size_t i = 40000; i < 41000; i++)
+    data[i] = rng();
+
+  for (size_t size :
+       {size_t(0), size_t(1), size_t(3), size_t(5), size_t(70000)}) {
+    std::vector<uint8_t> packed, unpacked(size);
+    DeltaCodec::compress(data.data(), size, packed);
+    ASSERT_TRUE(DeltaCodec::decompress(packed.data(), packed.size(),
+                                       unpacked.data(), size));
+    EXPECT_TRUE(std::equal(unpacked.begin(), unpacked.end(), data.begin()));
+    if (size == data.size()) {
+      EXPECT_LT(packed.size(), 5000u);
+    }
+  }
+}
+
+TEST(DeltaCodecTest, RejectsTruncatedStreams) {
+  std::vector<uint8_t> data(1000, 0x00), packed;
+  data[500] = 0x12;
+  DeltaCodec::compress(data.data(), data.size(), packed);
+  std::vector<uint8_t> out(data.size());
+  EXPECT_FALSE(DeltaCodec::decompress(packed.data(), packed.size() - 1,
+                                      out.data(), out.size()));
+  EXPECT_FALSE(DeltaCodec::decompress(packed.data(), packed.size(), out.data(),
+                                      out.size() - 1));
+  EXPECT_FALSE(DeltaCodec::decompress(packed.data(), packed.size(), out.data(),
+                                      out.size() + 1));
+}
+
+TEST(RewindTest, StepsBackThroughEverySnapshot) {
+  Machine machine(writeRom());
+  Rewind rewind(machine.parts(), 1, 4);
+  std::vector<std::vector<uint8_t>> history;
+  for (int i = 0; i < 20; i++) {
+    machine.run(1);
+    rewind.frameDone();
+    history.push_back(machine.save());
+  }
+  EXPECT_EQ(rewind.snapshots(), 20u);
+
+  for (int i = 19; i >= 10; i--) {
+    ASSERT_TRUE(rewind.stepBack());
+    EXPECT_EQ(machine.save(), history[i]) << "snapshot " << i;
+  }
+
+  // Branch off from frame 10 (the last one restored), then walk all the
+  // way back
+  history.resize(10);
+  for (int i = 0; i < 7; i++) {
+    machine.joypad.pressButton(Joypad::A);
+    machine.run(1);
+    rewind.frameDone();
+    history.push_back(machine.save());
+  }
+  for (int i = static_cast<int>(history.size()) - 1; i >= 0; i--) {
+    ASSERT_TRUE(rewind.stepBack());
+    EXPECT_EQ(machine.save(), history[i]) << "snapshot " << i;
+  }
+  EXPECT_FALSE(rewind.stepBack());
+  EXPECT_EQ(rewind.bytesHeld(), 0u);
+}
+
+TEST(RewindTest, EvictsOldestKeyframeGroupsOverBudget) {
+  Machine machine(writeRom());
+  Rewind rewind(machine.parts(), 2, 5, 1);
+  for (int i = 0; i < 40; i++) {
+    machine.run(1);
+    rewind.frameDone();
+  }
+  // Only the newest group survives a one-byte budget
+  EXPECT_EQ(rewind.snapshots(), 5u);
+  EXPECT_EQ(rewind.framesHeld(), 8u);
+  EXPECT_GT(rewind.bytesHeld(), 0u);
+  EXPECT_EQ(rewind.captures(), 20u);
+}
+
+TEST(RunAheadTest, ShowsFramesAheadWithoutDisturbingTheRealMachine) {
+  std::string rom = writeRom();
+  Machine machine(rom), reference(rom);
+  RunAhead runAhead(machine.parts(), 2);
+  for (int frame = 0; frame < 12; frame++) {
+    if (frame == 5) {
+      machine.joypad.pressButton(Joypad::A);
+      reference.joypad.pressButton(Joypad::A);
+    }
+    runAhead.runFrame();
+    reference.run(1);
+    ASSERT_EQ(machine.save(), reference.save()) << "frame " << frame;
+
+    Machine future(rom);
+    ASSERT_TRUE(future.load(reference.save()));
+    future.run(2);
+    ASSERT_EQ(runAhead.display(), future.ppu.frameBuffer) << "frame " << frame;
+  }
+
+  runAhead.setFrames(0);
+  runAhead.runFrame();
+  EXPECT_EQ(&runAhead.display(), &machine.ppu.frameBuffer);
+}
+
+TEST(ForkTest, ChildrenContinueLikeAFullCopyWithoutSharingWrites) {
+  std::string rom = writeRom();
+  Machine parent(rom);
+  parent.run(30);
+  std::vector<uint8_t> snapshot = parent.save();
+  ForkPoint fork(parent.parts());
+
+  Machine first(rom), second(rom), reference(rom);
+  second.run(3); // Whatever a child held before is replaced
+  ASSERT_TRUE(fork.spawn(first.parts()));
+  ASSERT_TRUE(fork.spawn(second.parts()));
+  ASSERT_TRUE(reference.load(snapshot));
+  EXPECT_EQ(first.save(), snapshot);
+
+  second.bus.write(0xC100, 0x55);
+  second.bus.write(0xA100, 0x66);
+  first.run(30);
+  reference.run(30);
+  EXPECT_EQ(first.save(), reference.save());
+  EXPECT_EQ(first.ppu.frameBuffer, reference.ppu.frameBuffer);
+  EXPECT_EQ(first.bus.read(0xC100), 0);
+  EXPECT_EQ(first.bus.read(0xA100), 0);
+
+  parent.bus.write(0xC200, 0x77);
+  EXPECT_EQ(second.bus.read(0xC200), 0);
+  EXPECT_EQ(second.bus.read(0xC100), 0x55);
+  EXPECT_EQ(parent.bus.read(0xC100), 0);
+}
+
+TEST(ForkTest, ChildCopiesOnlyThePagesItWrites) {
+  std::string rom = writeRom();
+  Machine parent(rom), child(rom);
+  parent.run(10);
+  ForkPoint fork(parent.parts());
+  ASSERT_TRUE(fork.spawn(child.parts()));
+  EXPECT_EQ(ForkPoint::privateBytes(child.parts()), 0u);
+  // Borrowed, so not a block of the child's own even before any writes
+  EXPECT_NE(parent.bus.workRam().data(), nullptr);
+  EXPECT_EQ(child.bus.workRam().data(), nullptr);
+
+  uint8_t before = parent.bus.read(0xC101);
+  child.bus.write(0xC101, before + 1);
+  EXPECT_EQ(ForkPoint::privateBytes(child.parts()), 0x100u);
+  child.bus.write(0xE102, 0x42); // Echo of the same page
+  EXPECT_EQ(child.bus.read(0xC102), 0x42);
+  EXPECT_EQ(ForkPoint::privateBytes(child.parts()), 0x100u);
+  child.bus.write(0xA300, 0x24);
+  EXPECT_EQ(ForkPoint::privateBytes(child.parts()), 0x200u);
+
+  EXPECT_EQ(child.bus.read(0xC101), uint8_t(before + 1));
+  EXPECT_EQ(parent.bus.read(0xC101), before);
+  EXPECT_EQ(parent.bus.read(0xA300), 0);
+  EXPECT_EQ(child.bus.read(0xA300), 0x24);
+}
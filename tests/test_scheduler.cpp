@@ -0,0 +1,288 @@
+#include "core/Bus.h"
+#include "core/CPU.h"
+#include "core/IdleLoops.h"
+#include "core/PPU.h"
+#include "core/Scheduler.h"
+#include "core/Timer.h"
+#include <fstream>
+#include <gtest/gtest.h>
+
+// Two identical machines: one stepped the old way (PPU ticked every
+// T-cycle), one driven by the scheduler.
+class SchedulerTest : public ::testing::Test {
+protected:
+  struct Machine {
+    Bus bus;
+    CPU cpu{bus};
+    PPU ppu{bus};
+    Timer timer{bus};
+
+    Machine() {
+      bus.setPPU(&ppu);
+      bus.setTimer(&timer);
+    }
+  };
+  Machine ref, sched;
+  Scheduler scheduler{sched.bus, sched.cpu, sched.ppu, sched.timer};
+
+  void SetUp() override { sched.bus.setScheduler(&scheduler); }
+
+  void load(Machine &m, const std::vector<uint8_t> &program) {
+    for (size_t i = 0; i < program.size(); i++)
+      m.bus.write(0xC000 + i, program[i]);
+    m.cpu.PC = 0xC000;
+    m.cpu.HL.reg16 = 0xD000;
+  }
+
+  uint64_t runReference(uint64_t cycles) {
+    uint64_t elapsed = 0;
+    while (elapsed < cycles) {
+      int step = ref.cpu.runBlock();
+      ref.timer.tick(step);
+      for (int i = 0; i < step; i++)
+        ref.ppu.tick();
+      elapsed += step;
+    }
+    return elapsed;
+  }
+};
+
+TEST_F(SchedulerTest, MatchesPerCycleStepping) {
+  const std::vector<uint8_t> program = {
+      0xF0, 0x44, // LDH A, (LY)
+      0x77,       // LD (HL), A
+      0x2C,       // INC L
+      0xF0, 0x41, // LDH A, (STAT)
+      0x77,       // LD (HL), A
+      0x2C,       // INC L
+      0xF0, 0x05, // LDH A, (TIMA)
+      0x77,       // LD (HL), A
+      0x2C,       // INC L
+      0x18, 0xF2, // JR -14
+  };
+  for (Machine *m : {&ref, &sched}) {
+    load(*m, program);
+    m->bus.write(0xFF07, 0x05); // Timer on, 16 cycles per tick
+    m->bus.write(0xFF41, 0x78); // Every STAT interrupt source
+    m->bus.write(0xFF45, 0x40); // LYC
+    m->bus.write(0xFF40, 0x91); // LCD on
+  }
+
+  for (int frame = 0; frame < 3; frame++) {
+    uint64_t elapsed = scheduler.runFrame();
+    EXPECT_EQ(runReference(Scheduler::CYCLES_PER_FRAME), elapsed);
+    scheduler.syncVideo();
+
+    EXPECT_EQ(sched.cpu.PC, ref.cpu.PC);
+    EXPECT_EQ(sched.bus.read(0xFF44), ref.bus.read(0xFF44));
+    EXPECT_EQ(sched.bus.read(0xFF41), ref.bus.read(0xFF41));
+    EXPECT_EQ(sched.bus.read(0xFF0F), ref.bus.read(0xFF0F));
+    EXPECT_EQ(sched.ppu.frameBuffer, ref.ppu.frameBuffer);
+    for (uint16_t address = 0xD000; address < 0xD100; address++)
+      ASSERT_EQ(sched.bus.read(address), ref.bus.read(address)) << address;
+  }
+}
+
+TEST_F(SchedulerTest, FrameEndRecurs) {
+  load(sched, {0x18, 0xFE}); // JR -2
+  EXPECT_EQ(scheduler.deadline(Scheduler::Event::FrameEnd),
+            Scheduler::CYCLES_PER_FRAME);
+  scheduler.runFrame();
+  EXPECT_GE(scheduler.now(), Scheduler::CYCLES_PER_FRAME);
+  EXPECT_EQ(scheduler.deadline(Scheduler::Event::FrameEnd),
+            2 * Scheduler::CYCLES_PER_FRAME);
+}
+
+TEST_F(SchedulerTest, OamDmaCompletesAsEvent) {
+  for (int i = 0; i < 0xA0; i++)
+    sched.bus.write(0xC100 + i, i);
+  load(sched, {
+                  0x3E, 0xC1, // LD A, 0xC1
+                  0xE0, 0x46, // LDH (DMA), A
+                  0x18, 0xFE, // JR -2
+              });
+
+  scheduler.runCycles(100);
+  EXPECT_NE(scheduler.deadline(Scheduler::Event::Dma), Scheduler::NEVER);
+  EXPECT_EQ(sched.ppu.readOAM(0xFE9F), 0x00);
+
+  scheduler.runCycles(Scheduler::DMA_CYCLES);
+  EXPECT_EQ(scheduler.deadline(Scheduler::Event::Dma), Scheduler::NEVER);
+  EXPECT_EQ(sched.ppu.readOAM(0xFE9F), 0x9F);
+}
+
+TEST_F(SchedulerTest, HaltSkipMatchesPerCycleStepping) {
+  const std::vector<uint8_t> program = {
+      0xAF,       // XOR A
+      0xE0, 0x0F, // LDH (IF), A
+      0x76,       // HALT
+      0x04,       // INC B
+      0xF0, 0x05, // LDH A, (TIMA)
+      0x77,       // LD (HL), A
+      0x2C,       // INC L
+      0x18, 0xF5, // JR -11
+  };
+  for (Machine *m : {&ref, &sched}) {
+    load(*m, program);
+    m->bus.write(0xFFFF, Bus::INTERRUPT_VBLANK | Bus::INTERRUPT_TIMER);
+    m->bus.write(0xFF06, 0xC0); // TMA
+    m->bus.write(0xFF07, 0x06); // Timer on, 64 cycles per tick
+    m->bus.write(0xFF40, 0x91); // LCD on
+  }
+
+  for (int frame = 0; frame < 3; frame++) {
+    uint64_t elapsed = scheduler.runFrame();
+    EXPECT_EQ(runReference(Scheduler::CYCLES_PER_FRAME), elapsed);
+
+    EXPECT_EQ(sched.cpu.PC, ref.cpu.PC);
+    EXPECT_EQ(sched.cpu.BC.hi, ref.cpu.BC.hi);
+    EXPECT_EQ(sched.bus.read(0xFF04), ref.bus.read(0xFF04));
+    EXPECT_EQ(sched.bus.read(0xFF05), ref.bus.read(0xFF05));
+    EXPECT_EQ(sched.bus.read(0xFF0F), ref.bus.read(0xFF0F));
+    for (uint16_t address = 0xD000; address < 0xD100; address++)
+      ASSERT_EQ(sched.bus.read(address), ref.bus.read(address)) << address;
+  }
+  EXPECT_GT(sched.cpu.BC.hi, 3); // Woken by both sources
+  EXPECT_GT(scheduler.haltedCycles(), 2 * Scheduler::CYCLES_PER_FRAME);
+}
+
+TEST_F(SchedulerTest, TimerWritesRescheduleOverflow) {
+  const std::vector<uint8_t> program = {
+      0xF0, 0x05, // LDH A, (TIMA)
+      0x77,       // LD (HL), A
+      0x2C,       // INC L
+      0xF0, 0x0F, // LDH A, (IF)
+      0x77,       // LD (HL), A
+      0x2C,       // INC L
+      0x7D,       // LD A, L
+      0xE6, 0x3F, // AND 0x3F
+      0x20, 0xF3, // JR NZ, -13
+      0x3E, 0xF8, // LD A, 0xF8
+      0xE0, 0x05, // LDH (TIMA), A
+      0xAF,       // XOR A
+      0xE0, 0x0F, // LDH (IF), A
+      0x04,       // INC B
+      0x78,       // LD A, B
+      0xE6, 0x03, // AND 3
+      0xF6, 0x04, // OR 4
+      0xE0, 0x07, // LDH (TAC), A: cycle through every rate
+      0xE0, 0x04, // LDH (DIV), A
+      0x18, 0xE0, // JR -32
+  };
+  for (Machine *m : {&ref, &sched}) {
+    load(*m, program);
+    m->bus.write(0xFF06, 0xC0); // TMA
+    m->bus.write(0xFF07, 0x05);
+  }
+
+  uint64_t refClock = 0;
+  for (int frame = 0; frame < 3; frame++) {
+    scheduler.runFrame();
+    refClock += runReference(scheduler.now() - refClock);
+    ASSERT_EQ(refClock, scheduler.now());
+
+    EXPECT_EQ(sched.cpu.PC, ref.cpu.PC);
+    for (uint16_t address = 0xD000; address < 0xD100; address++)
+      EXPECT_EQ(sched.bus.read(address), ref.bus.read(address)) << address;
+    for (uint16_t address = 0xFF04; address <= 0xFF07; address++)
+      EXPECT_EQ(sched.bus.read(address), ref.bus.read(address)) << address;
+    EXPECT_EQ(sched.bus.read(0xFF0F), ref.bus.read(0xFF0F));
+  }
+}
+
+// Blocks run as a whole before the clock moves, so an I/O read through a
+// register pointer mustn't happen part way through one.
+TEST_F(SchedulerTest, IoThroughRegistersSeesCurrentTime) {
+  std::vector<uint8_t> program = {
+      0x21, 0x04, 0xFF, // LD HL, DIV
+      0xE0, 0x04,       // LDH (DIV), A
+  };
+  program.insert(program.end(), 62, 0x00); // NOP: 248 cycles
+  program.insert(program.end(), {
+                                    0x7E,       // LD A, (HL)
+                                    0x47,       // LD B, A
+                                    0xF0, 0x04, // LDH A, (DIV)
+                                    0x4F,       // LD C, A
+                                    0x18, 0xFE, // JR -2
+                                });
+  load(sched, program);
+  sched.cpu.BC.reg16 = 0xFFFF;
+
+  scheduler.runCycles(400);
+  EXPECT_EQ(sched.cpu.BC.lo, 1);
+  EXPECT_EQ(sched.cpu.BC.hi, 1);
+}
+
+TEST_F(SchedulerTest, IdleLoopSkipMatchesPerCycleStepping) {
+  const std::vector<uint8_t> program = {
+      0xF0, 0x44, // LDH A, (LY)
+      0xFE, 0x90, // CP 144
+      0x20, 0xFA, // JR NZ, -6
+      0x04,       // INC B
+      0xF0, 0x41, // LDH A, (STAT)
+      0xE6, 0x03, // AND 3
+      0xFE, 0x01, // CP 1 (VBlank)
+      0x28, 0xF8, // JR Z, -8
+      0x0C,       // INC C
+      0xF0, 0x04, // LDH A, (DIV)
+      0x57,       // LD D, A
+      0xF0, 0x04, // LDH A, (DIV)
+      0xBA,       // CP D
+      0x28, 0xFB, // JR Z, -5
+      0x1C,       // INC E
+      0x18, 0xE5, // JR -27
+  };
+  for (Machine *m : {&ref, &sched}) {
+    load(*m, program);
+    m->cpu.BC.reg16 = 0;
+    m->cpu.DE.reg16 = 0;
+    m->bus.write(0xFF07, 0x05); // Timer on, 16 cycles per tick
+    m->bus.write(0xFF40, 0x91); // LCD on
+  }
+
+  // Frame ends land on block boundaries, so step the reference to the
+  // scheduler's absolute clock rather than frame by frame.
+  uint64_t refClock = 0;
+  for (int frame = 0; frame < 3; frame++) {
+    scheduler.runFrame();
+    refClock += runReference(scheduler.now() - refClock);
+    EXPECT_EQ(refClock, scheduler.now());
+
+    sched.cpu.syncFlags();
+    ref.cpu.syncFlags();
+    EXPECT_EQ(sched.cpu.PC, ref.cpu.PC);
+    EXPECT_EQ(sched.cpu.AF.reg16, ref.cpu.AF.reg16);
+    EXPECT_EQ(sched.cpu.BC.reg16, ref.cpu.BC.reg16);
+    EXPECT_EQ(sched.cpu.DE.reg16, ref.cpu.DE.reg16);
+    EXPECT_EQ(sched.bus.read(0xFF04), ref.bus.read(0xFF04));
+    EXPECT_EQ(sched.bus.read(0xFF05), ref.bus.read(0xFF05));
+  }
+  EXPECT_GE(sched.cpu.BC.hi, 2);
+  EXPECT_GT(scheduler.idleCycles(), Scheduler::CYCLES_PER_FRAME);
+}
+
+TEST_F(SchedulerTest, IdleLoopSkippingCanBeDisabled) {
+  load(sched, {0x18, 0xFE}); // JR -2
+  scheduler.setIdleLoopSkipping(false);
+  scheduler.runFrame();
+  EXPECT_EQ(scheduler.idleCycles(), 0u);
+  scheduler.setIdleLoopSkipping(true);
+  scheduler.runFrame();
+  EXPECT_GT(scheduler.idleCycles(), 0u);
+}
+
+TEST(IdleLoopOverridesTest, LoadsEntriesByTitleAndChecksum) {
+  std::string path = ::testing::TempDir() + "shellboy_idle_overrides.txt";
+  std::ofstream(path) << "# title,checksum,mode\n"
+                      << "SLOWGAME,3C,off\n"
+                      << "broken line\n"
+                      << "FASTGAME,c1,on # trailing comment\n";
+
+  IdleLoopOverrides overrides;
+  ASSERT_TRUE(overrides.load(path));
+  EXPECT_FALSE(overrides.allowsSkipping("SLOWGAME", 0x3C));
+  EXPECT_TRUE(overrides.allowsSkipping("SLOWGAME", 0x3D));
+  EXPECT_TRUE(overrides.allowsSkipping("FASTGAME", 0xC1, false));
+  EXPECT_FALSE(overrides.allowsSkipping("OTHER", 0x00, false));
+  EXPECT_FALSE(overrides.load(path + ".missing"));
+}